@@ -10,6 +10,7 @@
 #include "mcp_server.h"
 
 #include <cstring>
+#include <algorithm>
 #include <esp_log.h>
 #include <cJSON.h>
 #include <driver/gpio.h>
@@ -118,12 +119,12 @@ void Application::CheckNewVersion(Ota& ota) {
             vTaskDelay(pdMS_TO_TICKS(1000));
 
             bool upgrade_success = ota.StartUpgrade([display](int progress, size_t speed) {
-                std::thread([display, progress, speed]() {
-                    char buffer[32];
-                    snprintf(buffer, sizeof(buffer), "%d%% %uKB/s", progress, speed / 1024);
-                    display->SetChatMessage("system", buffer);
-                }).detach();
+                // Called from the download loop, posting does not wait for the display
+                char buffer[32];
+                snprintf(buffer, sizeof(buffer), "%d%% %uKB/s", progress, speed / 1024);
+                display->Post(kDisplayMailboxSystemMessage, buffer);
             });
+            display->ClearPosted(kDisplayMailboxSystemMessage);
 
             if (!upgrade_success) {
                 // Upgrade failed, restart audio service and continue running
@@ -176,6 +177,56 @@ void Application::CheckNewVersion(Ota& ota) {
     }
 }
 
+void Application::StartBackgroundVersionCheck() {
+    auto ret = xTaskCreate([](void* arg) {
+        Application* app = (Application*)arg;
+        app->RevalidateServerConfig();
+        vTaskDelete(NULL);
+    }, "check_version", 4096 * 2, this, 2, nullptr);
+    if (ret != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create the version check task");
+    }
+}
+
+// The device runs on the cached server config, check it without touching the state or the display
+void Application::RevalidateServerConfig() {
+    const int MAX_RETRY_DELAY = 600;
+    int retry_delay = 10;
+    Ota ota;
+    // Retry for as long as the cached server config is within its TTL
+    bool expired = false;
+    for (int retry_count = 1; !ota.CheckVersion(); retry_count++) {
+        if (!ota.IsConfigCacheFresh()) {
+            ESP_LOGW(TAG, "Check version failed %d times and the cached server config expired", retry_count);
+            expired = true;
+            break;
+        }
+        ESP_LOGW(TAG, "Check version failed, retry in %d seconds (%d)", retry_delay, retry_count);
+        vTaskDelay(pdMS_TO_TICKS(retry_delay * 1000));
+        retry_delay = std::min(retry_delay * 2, MAX_RETRY_DELAY);
+    }
+
+    bool has_server_time = ota.HasServerTime();
+    bool restart = expired || ota.HasNewVersion() || ota.HasActivationCode() || ota.HasActivationChallenge() ||
+        ota.HasConfigChanged();
+    Schedule([this, has_server_time, restart]() {
+        // A 304 carries no server time, the clock stays as it is
+        if (has_server_time) {
+            has_server_time_ = true;
+        }
+        if (!restart) {
+            ESP_LOGI(TAG, "Cached server config is up to date");
+            return;
+        }
+        // The upgrade, the activation, a moved server and an expired cache are handled by the check at boot
+        ESP_LOGI(TAG, "Upgrade, activation, new server config or expired cache pending, restarting when idle");
+        reboot_when_idle_ = true;
+        if (device_state_ == kDeviceStateIdle) {
+            Reboot();
+        }
+    });
+}
+
 void Application::ShowActivationCode(const std::string& code, const std::string& message) {
     struct digit_sound {
         char digit;
@@ -213,7 +264,7 @@ void Application::Alert(const char* status, const char* message, const char* emo
     display->SetEmotion(emotion);
     display->SetChatMessage("system", message);
     if (!sound.empty()) {
-        audio_service_.PlaySound(sound);
+        PlaySound(sound);
     }
 }
 
@@ -247,11 +298,8 @@ void Application::ToggleChatState() {
 
     if (device_state_ == kDeviceStateIdle) {
         Schedule([this]() {
-            if (!protocol_->IsAudioChannelOpened()) {
-                SetDeviceState(kDeviceStateConnecting);
-                if (!protocol_->OpenAudioChannel()) {
-                    return;
-                }
+            if (!EnsureAudioChannel()) {
+                return;
             }
 
             SetListeningMode(aec_mode_ == kAecOff ? kListeningModeAutoStop : kListeningModeRealtime);
@@ -284,11 +332,8 @@ void Application::StartListening() {
     
     if (device_state_ == kDeviceStateIdle) {
         Schedule([this]() {
-            if (!protocol_->IsAudioChannelOpened()) {
-                SetDeviceState(kDeviceStateConnecting);
-                if (!protocol_->OpenAudioChannel()) {
-                    return;
-                }
+            if (!EnsureAudioChannel()) {
+                return;
             }
 
             SetListeningMode(kListeningModeManualStop);
@@ -332,180 +377,233 @@ void Application::Start() {
 
     /* Setup the display */
     auto display = board.GetDisplay();
-
-    /* Setup the audio service */
     auto codec = board.GetAudioCodec();
-    audio_service_.Initialize(codec);
-    audio_service_.Start();
-
-    AudioServiceCallbacks callbacks;
-    callbacks.on_send_queue_available = [this]() {
-        xEventGroupSetBits(event_group_, MAIN_EVENT_SEND_AUDIO);
-    };
-    callbacks.on_wake_word_detected = [this](const std::string& wake_word) {
-        xEventGroupSetBits(event_group_, MAIN_EVENT_WAKE_WORD_DETECTED);
-    };
-    callbacks.on_vad_change = [this](bool speaking) {
-        xEventGroupSetBits(event_group_, MAIN_EVENT_VAD_CHANGE);
-    };
-    audio_service_.SetCallbacks(callbacks);
 
     /* Start the clock timer to update the status bar */
     esp_timer_start_periodic(clock_timer_handle_, 1000000);
 
-    /* Wait for the network to be ready */
-    board.StartNetwork();
-
-    // Update the status bar immediately to show the network state
-    display->UpdateStatusBar(true);
-
-    // Check for new firmware version or get the MQTT broker address
+    // The phases without dependencies run in parallel, the network takes the longest so it
+    // goes first and stays on this task. Sounds played while the network starts (WiFi
+    // config mode, modem errors) wait for the audio phase in PlaySound
     Ota ota;
-    CheckNewVersion(ota);
-
-    // Initialize the protocol
-    display->SetStatus(Lang::Strings::LOADING_PROTOCOL);
-
-    // Add MCP common tools before initializing the protocol
-    McpServer::GetInstance().AddCommonTools();
+    bool protocol_started = false;
+    boot_sequence_.AddPhase("network", {}, [&board, display]() {
+        /* Wait for the network to be ready */
+        board.StartNetwork();
+        // Update the status bar immediately to show the network state
+        display->UpdateStatusBar(true);
+    });
 
-    if (ota.HasMqttConfig()) {
-        protocol_ = std::make_unique<MqttProtocol>();
-    } else if (ota.HasWebsocketConfig()) {
-        protocol_ = std::make_unique<WebsocketProtocol>();
-    } else {
-        ESP_LOGW(TAG, "No protocol specified in the OTA config, using MQTT");
-        protocol_ = std::make_unique<MqttProtocol>();
-    }
+    boot_sequence_.AddPhase("audio", {}, [this, codec]() {
+        /* Setup the audio service */
+        audio_service_.Initialize(codec);
+        audio_service_.Start();
+        audio_service_.PreloadModels();
+
+        AudioServiceCallbacks callbacks;
+        callbacks.on_send_queue_available = [this]() {
+            xEventGroupSetBits(event_group_, MAIN_EVENT_SEND_AUDIO);
+        };
+        callbacks.on_wake_word_detected = [this](const std::string& wake_word) {
+            xEventGroupSetBits(event_group_, MAIN_EVENT_WAKE_WORD_DETECTED);
+        };
+        callbacks.on_vad_change = [this](bool speaking) {
+            xEventGroupSetBits(event_group_, MAIN_EVENT_VAD_CHANGE);
+        };
+        audio_service_.SetCallbacks(callbacks);
+    });
 
-    protocol_->OnNetworkError([this](const std::string& message) {
-        last_error_message_ = message;
-        xEventGroupSetBits(event_group_, MAIN_EVENT_ERROR);
+    boot_sequence_.AddPhase("mcp", {}, []() {
+        // Add MCP common tools before initializing the protocol
+        McpServer::GetInstance().AddCommonTools();
     });
-    protocol_->OnIncomingAudio([this](std::unique_ptr<AudioStreamPacket> packet) {
-        if (device_state_ == kDeviceStateSpeaking) {
-            audio_service_.PushPacketToDecodeQueue(std::move(packet));
+
+    boot_sequence_.AddPhase("ota", {"network", "audio"}, [this, &ota]() {
+        // A cached server config starts the protocol right away, the check runs once the device is ready
+        if (ota.LoadCachedConfig()) {
+            boot_sequence_.SetPhaseNote("ota", "cached config");
+            // The cache belongs to this firmware, it already passed a check
+            ota.MarkCurrentVersionValid();
+            return;
         }
+        // Check for new firmware version or get the MQTT broker address
+        CheckNewVersion(ota);
     });
-    protocol_->OnAudioChannelOpened([this, codec, &board]() {
-        board.SetPowerSaveMode(false);
-        if (protocol_->server_sample_rate() != codec->output_sample_rate()) {
-            ESP_LOGW(TAG, "Server sample rate %d does not match device output sample rate %d, resampling may cause distortion",
-                protocol_->server_sample_rate(), codec->output_sample_rate());
+
+    boot_sequence_.AddPhase("protocol", {"ota", "mcp"}, [this, &ota, &board, display, codec, &protocol_started]() {
+        // Initialize the protocol
+        display->SetStatus(Lang::Strings::LOADING_PROTOCOL);
+        if (ota.HasMqttConfig()) {
+            protocol_ = std::make_unique<MqttProtocol>();
+        } else if (ota.HasWebsocketConfig()) {
+            protocol_ = std::make_unique<WebsocketProtocol>();
+        } else {
+            ESP_LOGW(TAG, "No protocol specified in the OTA config, using MQTT");
+            protocol_ = std::make_unique<MqttProtocol>();
         }
+
+        protocol_->OnNetworkError([this](const std::string& message) {
+            if (channel_prewarming_) {
+                // Nobody is waiting for a prewarmed channel, the next session will retry
+                ESP_LOGW(TAG, "Failed to prewarm the audio channel: %s", message.c_str());
+                return;
+            }
+            last_error_message_ = message;
+            xEventGroupSetBits(event_group_, MAIN_EVENT_ERROR);
+        });
+        protocol_->OnIncomingAudio([this](std::unique_ptr<AudioStreamPacket> packet) {
+            if (device_state_ == kDeviceStateSpeaking) {
+                audio_service_.PushPacketToDecodeQueue(std::move(packet));
+            }
+        });
+        protocol_->OnUplinkLoss([this](int loss_percent) {
+            audio_service_.SetUplinkPacketLoss(loss_percent);
+        });
+        protocol_->OnAudioChannelOpened([this, codec, &board]() {
+            board.SetPowerSaveMode(false);
+            if (protocol_->server_sample_rate() != codec->output_sample_rate()) {
+                ESP_LOGI(TAG, "Server sample rate %d does not match device output sample rate %d, resampling the downlink audio",
+                    protocol_->server_sample_rate(), codec->output_sample_rate());
+            }
+        });
+        protocol_->OnAudioChannelClosed([this, &board]() {
+            board.SetPowerSaveMode(true);
+            Schedule([this]() {
+                auto display = Board::GetInstance().GetDisplay();
+                display->SetChatMessage("system", "");
+                SetDeviceState(kDeviceStateIdle);
+                if (channel_policy_.OnChannelClosed() && channel_policy_.ShouldPrewarm(true)) {
+                    PrewarmAudioChannel();
+                }
+            });
+        });
+        protocol_->OnIncomingJson([this](const cJSON* root) {
+            HandleIncomingJson(root);
+        });
+        protocol_started = protocol_->Start();
+        StartAudioUplinkTask();
     });
-    protocol_->OnAudioChannelClosed([this, &board]() {
-        board.SetPowerSaveMode(true);
-        Schedule([this]() {
-            auto display = Board::GetInstance().GetDisplay();
+
+    boot_sequence_.AddPhase("ready", {"protocol"}, [this, &ota, display, &protocol_started]() {
+        SetDeviceState(kDeviceStateIdle);
+
+        has_server_time_ = ota.HasServerTime();
+        if (protocol_started) {
+            std::string message = std::string(Lang::Strings::VERSION) + ota.GetCurrentVersion();
+            display->ShowNotification(message.c_str());
             display->SetChatMessage("system", "");
-            SetDeviceState(kDeviceStateIdle);
-        });
+            // Play the success sound to indicate the device is ready
+            audio_service_.PlaySound(Lang::Sounds::OGG_SUCCESS);
+        }
     });
-    protocol_->OnIncomingJson([this, display](const cJSON* root) {
-        // Parse JSON data
-        auto type = cJSON_GetObjectItem(root, "type");
-        if (strcmp(type->valuestring, "tts") == 0) {
-            auto state = cJSON_GetObjectItem(root, "state");
-            if (strcmp(state->valuestring, "start") == 0) {
-                Schedule([this]() {
-                    aborted_ = false;
-                    if (device_state_ == kDeviceStateIdle || device_state_ == kDeviceStateListening) {
-                        SetDeviceState(kDeviceStateSpeaking);
-                    }
-                });
-            } else if (strcmp(state->valuestring, "stop") == 0) {
-                Schedule([this]() {
-                    if (device_state_ == kDeviceStateSpeaking) {
-                        if (listening_mode_ == kListeningModeManualStop) {
-                            SetDeviceState(kDeviceStateIdle);
-                        } else {
-                            SetDeviceState(kDeviceStateListening);
-                        }
+
+    boot_sequence_.Run();
+
+    if (ota.IsConfigFromCache()) {
+        StartBackgroundVersionCheck();
+    }
+
+    // Print heap stats
+    SystemInfo::PrintHeapStats();
+}
+
+// A plain strcmp chain with the most frequent type (tts) first. scripts/fleet_simulator/dispatch_benchmark
+// shows the lookup at about 1% of parsing the message, a hash table is slower and a switch saves nothing
+void Application::HandleIncomingJson(const cJSON* root) {
+    // The protocols have checked that the type is a string
+    auto type = cJSON_GetObjectItem(root, "type");
+    if (strcmp(type->valuestring, "tts") == 0) {
+        auto state = cJSON_GetObjectItem(root, "state");
+        if (!cJSON_IsString(state)) {
+            return;
+        }
+        if (strcmp(state->valuestring, "start") == 0) {
+            Schedule([this]() {
+                aborted_ = false;
+                if (device_state_ == kDeviceStateIdle || device_state_ == kDeviceStateListening) {
+                    SetDeviceState(kDeviceStateSpeaking);
+                }
+            });
+        } else if (strcmp(state->valuestring, "stop") == 0) {
+            Schedule([this]() {
+                if (device_state_ == kDeviceStateSpeaking) {
+                    if (listening_mode_ == kListeningModeManualStop) {
+                        SetDeviceState(kDeviceStateIdle);
+                    } else {
+                        SetDeviceState(kDeviceStateListening);
                     }
-                });
-            } else if (strcmp(state->valuestring, "sentence_start") == 0) {
-                auto text = cJSON_GetObjectItem(root, "text");
-                if (cJSON_IsString(text)) {
-                    ESP_LOGI(TAG, "<< %s", text->valuestring);
-                    Schedule([this, display, message = std::string(text->valuestring)]() {
-                        display->SetChatMessage("assistant", message.c_str());
-                    });
                 }
-            }
-        } else if (strcmp(type->valuestring, "stt") == 0) {
+            });
+        } else if (strcmp(state->valuestring, "sentence_start") == 0) {
+            audio_service_.MarkSentenceStart();
             auto text = cJSON_GetObjectItem(root, "text");
             if (cJSON_IsString(text)) {
-                ESP_LOGI(TAG, ">> %s", text->valuestring);
-                Schedule([this, display, message = std::string(text->valuestring)]() {
-                    display->SetChatMessage("user", message.c_str());
+                ESP_LOGI(TAG, "<< %s", text->valuestring);
+                Schedule([message = std::string(text->valuestring)]() {
+                    Board::GetInstance().GetDisplay()->SetChatMessage("assistant", message.c_str());
                 });
             }
-        } else if (strcmp(type->valuestring, "llm") == 0) {
-            auto emotion = cJSON_GetObjectItem(root, "emotion");
-            if (cJSON_IsString(emotion)) {
-                Schedule([this, display, emotion_str = std::string(emotion->valuestring)]() {
-                    display->SetEmotion(emotion_str.c_str());
+        }
+    } else if (strcmp(type->valuestring, "stt") == 0) {
+        auto text = cJSON_GetObjectItem(root, "text");
+        if (cJSON_IsString(text)) {
+            ESP_LOGI(TAG, ">> %s", text->valuestring);
+            Schedule([message = std::string(text->valuestring)]() {
+                Board::GetInstance().GetDisplay()->SetChatMessage("user", message.c_str());
+            });
+        }
+    } else if (strcmp(type->valuestring, "llm") == 0) {
+        auto emotion = cJSON_GetObjectItem(root, "emotion");
+        if (cJSON_IsString(emotion)) {
+            Schedule([emotion_str = std::string(emotion->valuestring)]() {
+                Board::GetInstance().GetDisplay()->SetEmotion(emotion_str.c_str());
+            });
+        }
+    } else if (strcmp(type->valuestring, "mcp") == 0) {
+        // The payload sub-tree is handed over as is, it is never serialized and parsed again
+        auto payload = cJSON_GetObjectItem(root, "payload");
+        if (cJSON_IsObject(payload)) {
+            McpServer::GetInstance().ParseMessage(payload);
+        }
+    } else if (strcmp(type->valuestring, "system") == 0) {
+        auto command = cJSON_GetObjectItem(root, "command");
+        if (cJSON_IsString(command)) {
+            ESP_LOGI(TAG, "System command: %s", command->valuestring);
+            if (strcmp(command->valuestring, "reboot") == 0) {
+                // Do a reboot if user requests a OTA update
+                Schedule([this]() {
+                    Reboot();
                 });
-            }
-        } else if (strcmp(type->valuestring, "mcp") == 0) {
-            auto payload = cJSON_GetObjectItem(root, "payload");
-            if (cJSON_IsObject(payload)) {
-                McpServer::GetInstance().ParseMessage(payload);
-            }
-        } else if (strcmp(type->valuestring, "system") == 0) {
-            auto command = cJSON_GetObjectItem(root, "command");
-            if (cJSON_IsString(command)) {
-                ESP_LOGI(TAG, "System command: %s", command->valuestring);
-                if (strcmp(command->valuestring, "reboot") == 0) {
-                    // Do a reboot if user requests a OTA update
-                    Schedule([this]() {
-                        Reboot();
-                    });
-                } else {
-                    ESP_LOGW(TAG, "Unknown system command: %s", command->valuestring);
-                }
-            }
-        } else if (strcmp(type->valuestring, "alert") == 0) {
-            auto status = cJSON_GetObjectItem(root, "status");
-            auto message = cJSON_GetObjectItem(root, "message");
-            auto emotion = cJSON_GetObjectItem(root, "emotion");
-            if (cJSON_IsString(status) && cJSON_IsString(message) && cJSON_IsString(emotion)) {
-                Alert(status->valuestring, message->valuestring, emotion->valuestring, Lang::Sounds::OGG_VIBRATION);
             } else {
-                ESP_LOGW(TAG, "Alert command requires status, message and emotion");
+                ESP_LOGW(TAG, "Unknown system command: %s", command->valuestring);
             }
+        }
+    } else if (strcmp(type->valuestring, "alert") == 0) {
+        auto status = cJSON_GetObjectItem(root, "status");
+        auto message = cJSON_GetObjectItem(root, "message");
+        auto emotion = cJSON_GetObjectItem(root, "emotion");
+        if (cJSON_IsString(status) && cJSON_IsString(message) && cJSON_IsString(emotion)) {
+            Alert(status->valuestring, message->valuestring, emotion->valuestring, Lang::Sounds::OGG_VIBRATION);
+        } else {
+            ESP_LOGW(TAG, "Alert command requires status, message and emotion");
+        }
 #if CONFIG_RECEIVE_CUSTOM_MESSAGE
-        } else if (strcmp(type->valuestring, "custom") == 0) {
-            auto payload = cJSON_GetObjectItem(root, "payload");
-            ESP_LOGI(TAG, "Received custom message: %s", cJSON_PrintUnformatted(root));
-            if (cJSON_IsObject(payload)) {
-                Schedule([this, display, payload_str = std::string(cJSON_PrintUnformatted(payload))]() {
-                    display->SetChatMessage("system", payload_str.c_str());
-                });
-            } else {
-                ESP_LOGW(TAG, "Invalid custom message format: missing payload");
-            }
-#endif
+    } else if (strcmp(type->valuestring, "custom") == 0) {
+        auto payload = cJSON_GetObjectItem(root, "payload");
+        if (cJSON_IsObject(payload)) {
+            auto payload_str = cJSON_PrintUnformatted(payload);
+            ESP_LOGI(TAG, "Received custom message: %s", payload_str);
+            Schedule([message = std::string(payload_str)]() {
+                Board::GetInstance().GetDisplay()->SetChatMessage("system", message.c_str());
+            });
+            cJSON_free(payload_str);
         } else {
-            ESP_LOGW(TAG, "Unknown message type: %s", type->valuestring);
+            ESP_LOGW(TAG, "Invalid custom message format: missing payload");
         }
-    });
-    bool protocol_started = protocol_->Start();
-
-    SetDeviceState(kDeviceStateIdle);
-
-    has_server_time_ = ota.HasServerTime();
-    if (protocol_started) {
-        std::string message = std::string(Lang::Strings::VERSION) + ota.GetCurrentVersion();
-        display->ShowNotification(message.c_str());
-        display->SetChatMessage("system", "");
-        // Play the success sound to indicate the device is ready
-        audio_service_.PlaySound(Lang::Sounds::OGG_SUCCESS);
+#endif
+    } else {
+        ESP_LOGW(TAG, "Unknown message type: %s", type->valuestring);
     }
-
-    // Print heap stats
-    SystemInfo::PrintHeapStats();
 }
 
 void Application::OnClockTimer() {
@@ -519,16 +617,28 @@ void Application::OnClockTimer() {
         // SystemInfo::PrintTaskCpuUsage(pdMS_TO_TICKS(1000));
         // SystemInfo::PrintTaskList();
         SystemInfo::PrintHeapStats();
+        auto stats = main_tasks_.GetStats();
+        ESP_LOGI(TAG, "Main tasks: %lu run, %lu overflowed, max depth %d, max run time %d ms",
+            (unsigned long)stats.executed, (unsigned long)stats.overflowed, stats.max_depth, stats.max_run_time_us / 1000);
     }
-}
 
-// Add a async task to MainLoop
-void Application::Schedule(std::function<void()> callback) {
-    {
-        std::lock_guard<std::mutex> lock(mutex_);
-        main_tasks_.push_back(std::move(callback));
+    if (clock_ticks_ % PROTOCOL_PING_INTERVAL_SECONDS == 0 && protocol_) {
+        Schedule([this]() {
+            if (protocol_->IsAudioChannelOpened()) {
+                protocol_->SendPing();
+            }
+        });
+    }
+
+    if (channel_policy_.mode() != kChannelPolicyOnDemand && protocol_) {
+        Schedule([this]() {
+            if (device_state_ == kDeviceStateIdle && channel_policy_.IsIdleExpired()) {
+                ESP_LOGI(TAG, "Closing the prewarmed audio channel, idle for %d ms", channel_policy_.GetIdleTimeoutMs());
+                protocol_->CloseAudioChannel();
+                channel_policy_.OnChannelClosed();
+            }
+        });
     }
-    xEventGroupSetBits(event_group_, MAIN_EVENT_SCHEDULE);
 }
 
 // The Main Event Loop controls the chat state and websocket connection
@@ -540,7 +650,6 @@ void Application::MainEventLoop() {
 
     while (true) {
         auto bits = xEventGroupWaitBits(event_group_, MAIN_EVENT_SCHEDULE |
-            MAIN_EVENT_SEND_AUDIO |
             MAIN_EVENT_WAKE_WORD_DETECTED |
             MAIN_EVENT_VAD_CHANGE |
             MAIN_EVENT_ERROR, pdTRUE, pdFALSE, portMAX_DELAY);
@@ -549,14 +658,6 @@ void Application::MainEventLoop() {
             Alert(Lang::Strings::ERROR, last_error_message_.c_str(), "sad", Lang::Sounds::OGG_EXCLAMATION);
         }
 
-        if (bits & MAIN_EVENT_SEND_AUDIO) {
-            while (auto packet = audio_service_.PopPacketFromSendQueue()) {
-                if (!protocol_->SendAudio(std::move(packet))) {
-                    break;
-                }
-            }
-        }
-
         if (bits & MAIN_EVENT_WAKE_WORD_DETECTED) {
             OnWakeWordDetected();
         }
@@ -569,38 +670,75 @@ void Application::MainEventLoop() {
         }
 
         if (bits & MAIN_EVENT_SCHEDULE) {
-            std::unique_lock<std::mutex> lock(mutex_);
-            auto tasks = std::move(main_tasks_);
-            lock.unlock();
-            for (auto& task : tasks) {
-                task();
-            }
+            main_tasks_.RunPending();
+        }
+    }
+}
+
+void Application::StartAudioUplinkTask() {
+    auto ret = xTaskCreate([](void* arg) {
+        Application* app = (Application*)arg;
+        app->AudioUplinkTask();
+        vTaskDelete(NULL);
+    }, "audio_uplink", 4096 * 2, this, 4, nullptr);
+    if (ret != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create the audio uplink task");
+    }
+}
+
+// The encoded audio is sent here and not on the main loop, so a main loop task that blocks
+// (connecting, a slow display update, a control message on a congested link) does not hold
+// back the uplink. The protocols lock their transport for SendAudio
+void Application::AudioUplinkTask() {
+    while (true) {
+        xEventGroupWaitBits(event_group_, MAIN_EVENT_SEND_AUDIO, pdTRUE, pdFALSE, portMAX_DELAY);
+        SendPendingAudio();
+    }
+}
+
+void Application::SendPendingAudio() {
+    while (auto packet = audio_service_.PopPacketFromSendQueue()) {
+        if (!SendAudioPacket(std::move(packet))) {
+            break;
         }
     }
 }
 
+bool Application::SendAudioPacket(std::unique_ptr<AudioStreamPacket> packet) {
+    if (!protocol_->SendAudio(std::move(packet))) {
+        return false;
+    }
+    // The wake word packets are sent by the main loop, the rest by the uplink task
+    int64_t wake_word_time = wake_word_time_.exchange(0);
+    if (wake_word_time != 0) {
+        ESP_LOGI(TAG, "First uplink packet sent %d ms after the wake word", (int)((esp_timer_get_time() - wake_word_time) / 1000));
+    }
+    return true;
+}
+
 void Application::OnWakeWordDetected() {
     if (!protocol_) {
         return;
     }
 
     if (device_state_ == kDeviceStateIdle) {
+        auto wake_word_time = esp_timer_get_time();
+        wake_word_time_ = wake_word_time;
         audio_service_.EncodeWakeWord();
 
-        if (!protocol_->IsAudioChannelOpened()) {
-            SetDeviceState(kDeviceStateConnecting);
-            if (!protocol_->OpenAudioChannel()) {
-                audio_service_.EnableWakeWordDetection(true);
-                return;
-            }
+        if (!EnsureAudioChannel()) {
+            wake_word_time_ = 0;
+            audio_service_.EnableWakeWordDetection(true);
+            return;
         }
 
         auto wake_word = audio_service_.GetLastWakeWord();
-        ESP_LOGI(TAG, "Wake word detected: %s", wake_word.c_str());
+        ESP_LOGI(TAG, "Wake word detected: %s, audio channel ready after %d ms", wake_word.c_str(),
+            (int)((esp_timer_get_time() - wake_word_time) / 1000));
 #if CONFIG_USE_AFE_WAKE_WORD || CONFIG_USE_CUSTOM_WAKE_WORD
         // Encode and send the wake word data to the server
         while (auto packet = audio_service_.PopWakeWordPacket()) {
-            protocol_->SendAudio(std::move(packet));
+            SendAudioPacket(std::move(packet));
         }
         // Set the chat state to wake word detected
         protocol_->SendWakeWordDetected(wake_word);
@@ -640,6 +778,9 @@ void Application::SetDeviceState(DeviceState state) {
 
     // Send the state change event
     DeviceStateEventManager::GetInstance().PostStateChangeEvent(previous_state, state);
+    if (previous_state == kDeviceStateSpeaking) {
+        audio_service_.EndOutputStream();
+    }
 
     auto& board = Board::GetInstance();
     auto display = board.GetDisplay();
@@ -648,6 +789,13 @@ void Application::SetDeviceState(DeviceState state) {
     switch (state) {
         case kDeviceStateUnknown:
         case kDeviceStateIdle:
+            if (reboot_when_idle_) {
+                Schedule([this]() {
+                    if (device_state_ == kDeviceStateIdle) {
+                        Reboot();
+                    }
+                });
+            }
             display->SetStatus(Lang::Strings::STANDBY);
             display->SetEmotion("neutral");
             audio_service_.EnableVoiceProcessing(false);
@@ -716,6 +864,46 @@ void Application::WakeWordInvoke(const std::string& wake_word) {
     }
 }
 
+bool Application::OpenAudioChannel(bool prewarm) {
+    auto start_time = esp_timer_get_time();
+    channel_prewarming_ = prewarm;
+    // A session that is starting sends its audio right behind the hello, a prewarm has nothing to send
+    bool success = prewarm ? protocol_->OpenAudioChannel() : protocol_->OpenAudioChannelEarly();
+    channel_prewarming_ = false;
+    channel_policy_.OnConnected(esp_timer_get_time() - start_time, success, prewarm);
+    return success;
+}
+
+bool Application::EnsureAudioChannel() {
+    bool opened = protocol_->IsAudioChannelOpened();
+    channel_policy_.OnSessionStart(opened);
+    if (opened) {
+        return true;
+    }
+    SetDeviceState(kDeviceStateConnecting);
+    return OpenAudioChannel(false);
+}
+
+void Application::PrewarmAudioChannel() {
+    if (channel_policy_.mode() == kChannelPolicyOnDemand) {
+        return;
+    }
+    Schedule([this]() {
+        if (device_state_ != kDeviceStateIdle || !protocol_ || protocol_->IsAudioChannelOpened()) {
+            return;
+        }
+        if (channel_policy_.ShouldPrewarm(false)) {
+            OpenAudioChannel(true);
+        }
+    });
+}
+
+void Application::MigrateNetwork() {
+    if (protocol_) {
+        protocol_->MigrateNetwork();
+    }
+}
+
 bool Application::CanEnterSleepMode() {
     if (device_state_ != kDeviceStateIdle) {
         return false;
@@ -733,8 +921,8 @@ bool Application::CanEnterSleepMode() {
     return true;
 }
 
-void Application::SendMcpMessage(const std::string& payload) {
-    Schedule([this, payload]() {
+void Application::SendMcpMessage(std::string payload) {
+    Schedule([this, payload = std::move(payload)]() {
         if (protocol_) {
             protocol_->SendMcpMessage(payload);
         }
@@ -769,5 +957,10 @@ void Application::SetAecMode(AecMode mode) {
 }
 
 void Application::PlaySound(const std::string_view& sound) {
+    // The network phase may alert before the audio service is up
+    if (!boot_sequence_.WaitFor("audio", BOOT_AUDIO_WAIT_TIMEOUT_MS)) {
+        ESP_LOGW(TAG, "Audio service not ready after %d ms, skipping the sound", BOOT_AUDIO_WAIT_TIMEOUT_MS);
+        return;
+    }
     audio_service_.PlaySound(sound);
 }
\ No newline at end of file
@@ -11,19 +11,27 @@
 #include <deque>
 #include <vector>
 #include <memory>
+#include <atomic>
 
 #include "protocol.h"
+#include "audio_channel_policy.h"
 #include "ota.h"
 #include "audio_service.h"
 #include "device_state_event.h"
+#include "main_task_queue.h"
+#include "boot_sequence.h"
 
 #define MAIN_EVENT_SCHEDULE (1 << 0)
+// Waited for by the audio uplink task rather than the main loop
 #define MAIN_EVENT_SEND_AUDIO (1 << 1)
 #define MAIN_EVENT_WAKE_WORD_DETECTED (1 << 2)
 #define MAIN_EVENT_VAD_CHANGE (1 << 3)
 #define MAIN_EVENT_ERROR (1 << 4)
 #define MAIN_EVENT_CHECK_NEW_VERSION_DONE (1 << 5)
 
+// How long PlaySound waits for the audio boot phase, it only starts the codec and the audio tasks
+#define BOOT_AUDIO_WAIT_TIMEOUT_MS 3000
+
 enum AecMode {
     kAecOff,
     kAecOnDeviceSide,
@@ -44,7 +52,12 @@ public:
     void MainEventLoop();
     DeviceState GetDeviceState() const { return device_state_; }
     bool IsVoiceDetected() const { return audio_service_.IsVoiceDetected(); }
-    void Schedule(std::function<void()> callback);
+    // Run the callback in the main loop, its captures must fit MAIN_TASK_INLINE_SIZE
+    template <typename F>
+    void Schedule(F&& callback) {
+        main_tasks_.Push(std::forward<F>(callback));
+        xEventGroupSetBits(event_group_, MAIN_EVENT_SCHEDULE);
+    }
     void SetDeviceState(DeviceState state);
     void Alert(const char* status, const char* message, const char* emotion = "", const std::string_view& sound = "");
     void DismissAlert();
@@ -55,18 +68,27 @@ public:
     void Reboot();
     void WakeWordInvoke(const std::string& wake_word);
     bool CanEnterSleepMode();
-    void SendMcpMessage(const std::string& payload);
+    void SendMcpMessage(std::string payload);
     void SetAecMode(AecMode mode);
     AecMode GetAecMode() const { return aec_mode_; }
     void PlaySound(const std::string_view& sound);
     AudioService& GetAudioService() { return audio_service_; }
+    // Called by the boards when the talk button goes down, opens the audio channel ahead of
+    // the click depending on the audio channel policy. Safe to call from any task
+    void PrewarmAudioChannel();
+    const AudioChannelPolicy& GetAudioChannelPolicy() const { return channel_policy_; }
+    // Traffic of the current or last audio session, nullptr before the protocol is started
+    const ProtocolStats* GetProtocolStats() const { return protocol_ ? &protocol_->stats() : nullptr; }
+    const BootSequence& GetBootSequence() const { return boot_sequence_; }
+    // Must be called in the main loop after the board switched to another network
+    void MigrateNetwork();
 
 private:
     Application();
     ~Application();
 
-    std::mutex mutex_;
-    std::deque<std::function<void()>> main_tasks_;
+    MainTaskQueue main_tasks_;
+    BootSequence boot_sequence_;
     std::unique_ptr<Protocol> protocol_;
     EventGroupHandle_t event_group_ = nullptr;
     esp_timer_handle_t clock_timer_handle_ = nullptr;
@@ -75,17 +97,32 @@ private:
     AecMode aec_mode_ = kAecOff;
     std::string last_error_message_;
     AudioService audio_service_;
+    AudioChannelPolicy channel_policy_;
+    bool channel_prewarming_ = false;
 
     bool has_server_time_ = false;
+    // Set when the background version check needs the boot path again
+    bool reboot_when_idle_ = false;
     bool aborted_ = false;
     int clock_ticks_ = 0;
+    // Set by the wake word, cleared when the first audio packet after it is sent
+    std::atomic<int64_t> wake_word_time_ = 0;
     TaskHandle_t check_new_version_task_handle_ = nullptr;
 
     void OnWakeWordDetected();
+    void StartAudioUplinkTask();
+    void AudioUplinkTask();
+    void SendPendingAudio();
+    bool SendAudioPacket(std::unique_ptr<AudioStreamPacket> packet);
     void CheckNewVersion(Ota& ota);
+    void StartBackgroundVersionCheck();
+    void RevalidateServerConfig();
     void ShowActivationCode(const std::string& code, const std::string& message);
     void OnClockTimer();
     void SetListeningMode(ListeningMode mode);
+    bool OpenAudioChannel(bool prewarm);
+    bool EnsureAudioChannel();
+    void HandleIncomingJson(const cJSON* root);
 };
 
 #endif // _APPLICATION_H_
@@ -3,6 +3,7 @@
 #include "settings.h"
 
 #include <esp_log.h>
+#include <esp_timer.h>
 #include <cstring>
 #include <driver/i2s_common.h>
 
@@ -16,16 +17,77 @@ AudioCodec::~AudioCodec() {
 
 void AudioCodec::OutputData(std::vector<int16_t>& data) {
     Write(data.data(), data.size());
+    if (!render_clock_from_dma_) {
+        portENTER_CRITICAL(&clock_lock_);
+        render_clock_.frames += data.size() / output_channels_;
+        render_clock_.time_us = esp_timer_get_time();
+        portEXIT_CRITICAL(&clock_lock_);
+    }
 }
 
 bool AudioCodec::InputData(std::vector<int16_t>& data) {
     int samples = Read(data.data(), data.size());
     if (samples > 0) {
+        if (!capture_clock_from_dma_) {
+            portENTER_CRITICAL(&clock_lock_);
+            capture_clock_.frames += samples / input_channels_;
+            capture_clock_.time_us = esp_timer_get_time();
+            portEXIT_CRITICAL(&clock_lock_);
+        }
         return true;
     }
     return false;
 }
 
+AudioClock AudioCodec::GetRenderClock() {
+    portENTER_CRITICAL(&clock_lock_);
+    AudioClock clock = render_clock_;
+    portEXIT_CRITICAL(&clock_lock_);
+    return clock;
+}
+
+AudioClock AudioCodec::GetCaptureClock() {
+    portENTER_CRITICAL(&clock_lock_);
+    AudioClock clock = capture_clock_;
+    portEXIT_CRITICAL(&clock_lock_);
+    return clock;
+}
+
+// Every DMA buffer holds AUDIO_CODEC_DMA_FRAME_NUM frames, count them when the DMA is done with it
+bool IRAM_ATTR AudioCodec::OnDmaSent(i2s_chan_handle_t handle, i2s_event_data_t* event, void* user_ctx) {
+    auto codec = (AudioCodec*)user_ctx;
+    portENTER_CRITICAL_ISR(&codec->clock_lock_);
+    codec->render_clock_.frames += AUDIO_CODEC_DMA_FRAME_NUM;
+    codec->render_clock_.time_us = esp_timer_get_time();
+    portEXIT_CRITICAL_ISR(&codec->clock_lock_);
+    return false;
+}
+
+bool IRAM_ATTR AudioCodec::OnDmaReceived(i2s_chan_handle_t handle, i2s_event_data_t* event, void* user_ctx) {
+    auto codec = (AudioCodec*)user_ctx;
+    portENTER_CRITICAL_ISR(&codec->clock_lock_);
+    codec->capture_clock_.frames += AUDIO_CODEC_DMA_FRAME_NUM;
+    codec->capture_clock_.time_us = esp_timer_get_time();
+    portEXIT_CRITICAL_ISR(&codec->clock_lock_);
+    return false;
+}
+
+void AudioCodec::RegisterClockCallbacks() {
+    // Callbacks can only be registered before the channel is enabled
+    if (tx_handle_ != nullptr) {
+        i2s_event_callbacks_t callbacks = {};
+        callbacks.on_sent = OnDmaSent;
+        render_clock_from_dma_ = i2s_channel_register_event_callback(tx_handle_, &callbacks, this) == ESP_OK;
+    }
+    if (rx_handle_ != nullptr) {
+        i2s_event_callbacks_t callbacks = {};
+        callbacks.on_recv = OnDmaReceived;
+        capture_clock_from_dma_ = i2s_channel_register_event_callback(rx_handle_, &callbacks, this) == ESP_OK;
+    }
+    ESP_LOGI(TAG, "Render clock: %s, capture clock: %s", render_clock_from_dma_ ? "DMA" : "software",
+        capture_clock_from_dma_ ? "DMA" : "software");
+}
+
 void AudioCodec::Start() {
     Settings settings("audio", false);
     output_volume_ = settings.GetInt("output_volume", output_volume_);
@@ -34,6 +96,8 @@ void AudioCodec::Start() {
         output_volume_ = 10;
     }
 
+    RegisterClockCallbacks();
+
     if (tx_handle_ != nullptr) {
         ESP_ERROR_CHECK(i2s_channel_enable(tx_handle_));
     }
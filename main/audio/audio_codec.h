@@ -4,6 +4,7 @@
 #include <freertos/FreeRTOS.h>
 #include <freertos/event_groups.h>
 #include <driver/i2s_std.h>
+#include <sdkconfig.h>
 
 #include <vector>
 #include <string>
@@ -11,10 +12,20 @@
 
 #include "board.h"
 
-#define AUDIO_CODEC_DMA_DESC_NUM 6
-#define AUDIO_CODEC_DMA_FRAME_NUM 240
+#define AUDIO_CODEC_DMA_DESC_NUM CONFIG_AUDIO_CODEC_DMA_DESC_NUM
+#define AUDIO_CODEC_DMA_FRAME_NUM CONFIG_AUDIO_CODEC_DMA_FRAME_NUM
 #define AUDIO_CODEC_DEFAULT_MIC_GAIN 30.0
 
+/*
+ * A sample clock of the I2S stream: the number of frames the DMA has finished
+ * sending (render) or receiving (capture), and the esp_timer time it happened.
+ * Codecs without a DMA callback fall back to counting frames in OutputData / InputData.
+ */
+struct AudioClock {
+    uint32_t frames = 0;
+    int64_t time_us = 0;
+};
+
 class AudioCodec {
 public:
     AudioCodec();
@@ -28,6 +39,9 @@ public:
     virtual bool InputData(std::vector<int16_t>& data);
     virtual void Start();
 
+    AudioClock GetRenderClock();
+    AudioClock GetCaptureClock();
+
     inline bool duplex() const { return duplex_; }
     inline bool input_reference() const { return input_reference_; }
     inline int input_sample_rate() const { return input_sample_rate_; }
@@ -52,6 +66,15 @@ protected:
     int output_channels_ = 1;
     int output_volume_ = 70;
 
+    portMUX_TYPE clock_lock_ = portMUX_INITIALIZER_UNLOCKED;
+    AudioClock render_clock_;
+    AudioClock capture_clock_;
+    bool render_clock_from_dma_ = false;
+    bool capture_clock_from_dma_ = false;
+
+    void RegisterClockCallbacks();
+    static bool OnDmaSent(i2s_chan_handle_t handle, i2s_event_data_t* event, void* user_ctx);
+    static bool OnDmaReceived(i2s_chan_handle_t handle, i2s_event_data_t* event, void* user_ctx);
     virtual int Read(int16_t* dest, int samples) = 0;
     virtual int Write(const int16_t* data, int samples) = 0;
 };
@@ -12,11 +12,13 @@ public:
     virtual ~AudioProcessor() = default;
     
     virtual void Initialize(AudioCodec* codec, int frame_duration_ms) = 0;
-    virtual void Feed(std::vector<int16_t>&& data) = 0;
+    // capture_time_us is when the first frame of data was captured, 0 if unknown
+    virtual void Feed(std::vector<int16_t>&& data, int64_t capture_time_us) = 0;
     virtual void Start() = 0;
     virtual void Stop() = 0;
     virtual bool IsRunning() = 0;
-    virtual void OnOutput(std::function<void(std::vector<int16_t>&& data)> callback) = 0;
+    // The output keeps the capture time of its first frame, so the processing latency is not lost
+    virtual void OnOutput(std::function<void(std::vector<int16_t>&& data, int64_t capture_time_us)> callback) = 0;
     virtual void OnVadStateChange(std::function<void(bool speaking)> callback) = 0;
     virtual size_t GetFeedSize() = 0;
     virtual void EnableDeviceAec(bool enable) = 0;
@@ -1,6 +1,8 @@
 #include "audio_service.h"
 #include <esp_log.h>
 #include <cstring>
+#include <cstdlib>
+#include <algorithm>
 
 #if CONFIG_USE_AUDIO_PROCESSOR
 #include "processors/afe_audio_processor.h"
@@ -36,7 +38,7 @@ void AudioService::Initialize(AudioCodec* codec) {
 
     /* Setup the audio codec */
     opus_decoder_ = std::make_unique<OpusDecoderWrapper>(codec->output_sample_rate(), 1, OPUS_FRAME_DURATION_MS);
-    opus_encoder_ = std::make_unique<OpusEncoderWrapper>(16000, 1, OPUS_FRAME_DURATION_MS);
+    opus_encoder_ = std::make_unique<UplinkOpusEncoder>(16000, 1, OPUS_FRAME_DURATION_MS);
     opus_encoder_->SetComplexity(0);
 
     if (codec->input_sample_rate() != 16000) {
@@ -44,14 +46,20 @@ void AudioService::Initialize(AudioCodec* codec) {
         reference_resampler_.Configure(codec->input_sample_rate(), 16000);
     }
 
+#if CONFIG_USE_AUDIO_PROCESSOR && CONFIG_USE_AFE_WAKE_WORD && !CONFIG_USE_DEVICE_AEC
+    /* The wake word and the audio processor share one AFE pipeline, the device AEC keeps its own
+       VC pipeline because the shared one can only use the SR AEC mode */
+    afe_session_ = std::make_shared<AfeSession>();
+#endif
+
 #if CONFIG_USE_AUDIO_PROCESSOR
-    audio_processor_ = std::make_unique<AfeAudioProcessor>();
+    audio_processor_ = std::make_unique<AfeAudioProcessor>(afe_session_);
 #else
     audio_processor_ = std::make_unique<NoAudioProcessor>();
 #endif
 
 #if CONFIG_USE_AFE_WAKE_WORD
-    wake_word_ = std::make_unique<AfeWakeWord>();
+    wake_word_ = std::make_unique<AfeWakeWord>(afe_session_);
 #elif CONFIG_USE_ESP_WAKE_WORD
     wake_word_ = std::make_unique<EspWakeWord>();
 #elif CONFIG_USE_CUSTOM_WAKE_WORD
@@ -60,8 +68,15 @@ void AudioService::Initialize(AudioCodec* codec) {
     wake_word_ = nullptr;
 #endif
 
-    audio_processor_->OnOutput([this](std::vector<int16_t>&& data) {
-        PushTaskToEncodeQueue(kAudioTaskTypeEncodeToSendQueue, std::move(data));
+#if CONFIG_USE_AUDIO_DEBUGGER
+    audio_debugger_ = std::make_unique<AudioDebugger>();
+#endif
+
+    audio_processor_->OnOutput([this](std::vector<int16_t>&& data, int64_t capture_time_us) {
+#if CONFIG_USE_AUDIO_DEBUGGER
+        audio_debugger_->Feed(kAudioDebugTapAfeOutput, data, 16000);
+#endif
+        PushTaskToEncodeQueue(kAudioTaskTypeEncodeToSendQueue, std::move(data), capture_time_us);
     });
 
     audio_processor_->OnVadStateChange([this](bool speaking) {
@@ -83,6 +98,9 @@ void AudioService::Initialize(AudioCodec* codec) {
         .callback = [](void* arg) {
             AudioService* audio_service = (AudioService*)arg;
             audio_service->CheckAndUpdateAudioPowerState();
+#if CONFIG_USE_SERVER_AEC
+            audio_service->CheckClockDrift();
+#endif
         },
         .arg = this,
         .dispatch_method = ESP_TIMER_TASK,
@@ -92,6 +110,72 @@ void AudioService::Initialize(AudioCodec* codec) {
     esp_timer_create(&audio_power_timer_args, &audio_power_timer_);
 }
 
+void AudioService::PreloadModels() {
+    if (wake_word_ready_.valid() || audio_processor_ready_.valid()) {
+        return;
+    }
+
+    struct PreloadContext {
+        AudioService* service;
+        std::promise<bool> wake_word;
+        std::promise<bool> audio_processor;
+    };
+    auto context = new PreloadContext{this};
+    if (wake_word_) {
+        wake_word_ready_ = context->wake_word.get_future().share();
+    }
+    audio_processor_ready_ = context->audio_processor.get_future().share();
+
+    /* Load the models while the network is starting, instead of on the first wake word / listen */
+    auto ret = xTaskCreate([](void* arg) {
+        auto context = (PreloadContext*)arg;
+        auto service = context->service;
+        auto start_time = esp_timer_get_time();
+        if (service->wake_word_) {
+            context->wake_word.set_value(service->InitializeWakeWord());
+        }
+        context->audio_processor.set_value(service->InitializeAudioProcessor());
+        ESP_LOGI(TAG, "Models preloaded in %d ms, ready at %d ms since boot",
+            (int)((esp_timer_get_time() - start_time) / 1000), (int)(esp_timer_get_time() / 1000));
+        delete context;
+        vTaskDelete(NULL);
+    }, "model_preload", MODEL_PRELOAD_TASK_STACK_SIZE, context, 2, nullptr);
+    if (ret != pdPASS) {
+        ESP_LOGW(TAG, "Failed to create model preload task, models will be loaded on first use");
+        wake_word_ready_ = std::shared_future<bool>();
+        audio_processor_ready_ = std::shared_future<bool>();
+        delete context;
+    }
+}
+
+bool AudioService::InitializeWakeWord() {
+    if (!wake_word_->Initialize(codec_)) {
+        ESP_LOGE(TAG, "Failed to initialize wake word");
+        return false;
+    }
+    return true;
+}
+
+bool AudioService::InitializeAudioProcessor() {
+    audio_processor_->Initialize(codec_, OPUS_FRAME_DURATION_MS);
+    return true;
+}
+
+bool AudioService::WaitForModelReady(std::shared_future<bool>& ready, const char* name, std::function<bool()> initialize) {
+    if (!ready.valid()) {
+        // Not preloaded, initialize it on first use
+        std::promise<bool> promise;
+        promise.set_value(initialize());
+        ready = promise.get_future().share();
+    }
+    if (ready.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+        auto start_time = esp_timer_get_time();
+        ready.wait();
+        ESP_LOGI(TAG, "Waited %d ms for the %s model", (int)((esp_timer_get_time() - start_time) / 1000), name);
+    }
+    return ready.get();
+}
+
 void AudioService::Start() {
     service_stopped_ = false;
     xEventGroupClearBits(event_group_, AS_EVENT_AUDIO_TESTING_RUNNING | AS_EVENT_WAKE_WORD_RUNNING | AS_EVENT_AUDIO_PROCESSOR_RUNNING);
@@ -163,6 +247,7 @@ bool AudioService::ReadAudioData(std::vector<int16_t>& data, int sample_rate, in
         if (!codec_->InputData(data)) {
             return false;
         }
+        UpdateCaptureTime(data.size() / codec_->input_channels());
         if (codec_->input_channels() == 2) {
             auto mic_channel = std::vector<int16_t>(data.size() / 2);
             auto reference_channel = std::vector<int16_t>(data.size() / 2);
@@ -189,6 +274,7 @@ bool AudioService::ReadAudioData(std::vector<int16_t>& data, int sample_rate, in
         if (!codec_->InputData(data)) {
             return false;
         }
+        UpdateCaptureTime(samples);
     }
 
     /* Update the last input time */
@@ -196,11 +282,28 @@ bool AudioService::ReadAudioData(std::vector<int16_t>& data, int sample_rate, in
     debug_statistics_.input_count++;
 
 #if CONFIG_USE_AUDIO_DEBUGGER
-    // 音频调试：发送原始音频数据
-    if (audio_debugger_ == nullptr) {
-        audio_debugger_ = std::make_unique<AudioDebugger>();
+    // 音频调试：发送麦克风原始数据与 AEC 参考信号
+    int channels = codec_->input_channels();
+    if (codec_->input_reference() && channels > 1) {
+        bool mic_enabled = audio_debugger_->IsTapEnabled(kAudioDebugTapMicRaw);
+        bool reference_enabled = audio_debugger_->IsTapEnabled(kAudioDebugTapReference);
+        if (mic_enabled || reference_enabled) {
+            // Split into buffers kept across frames, so an enabled tap does not add allocations
+            size_t frames = data.size() / channels;
+            debug_mic_buffer_.resize(frames * (channels - 1));
+            debug_reference_buffer_.resize(frames);
+            for (size_t i = 0; i < frames; ++i) {
+                for (int c = 0; c < channels - 1; ++c) {
+                    debug_mic_buffer_[i * (channels - 1) + c] = data[i * channels + c];
+                }
+                debug_reference_buffer_[i] = data[i * channels + channels - 1];
+            }
+            audio_debugger_->Feed(kAudioDebugTapMicRaw, debug_mic_buffer_, sample_rate, channels - 1);
+            audio_debugger_->Feed(kAudioDebugTapReference, debug_reference_buffer_, sample_rate);
+        }
+    } else {
+        audio_debugger_->Feed(kAudioDebugTapMicRaw, data, sample_rate, channels);
     }
-    audio_debugger_->Feed(data);
 #endif
 
     return true;
@@ -215,11 +318,6 @@ void AudioService::AudioInputTask() {
         if (service_stopped_) {
             break;
         }
-        if (audio_input_need_warmup_) {
-            audio_input_need_warmup_ = false;
-            vTaskDelay(pdMS_TO_TICKS(120));
-            continue;
-        }
 
         /* Used for audio testing in NetworkConfiguring mode by clicking the BOOT button */
         if (bits & AS_EVENT_AUDIO_TESTING_RUNNING) {
@@ -239,7 +337,7 @@ void AudioService::AudioInputTask() {
                     }
                     data = std::move(mono_data);
                 }
-                PushTaskToEncodeQueue(kAudioTaskTypeEncodeToTestingQueue, std::move(data));
+                PushTaskToEncodeQueue(kAudioTaskTypeEncodeToTestingQueue, std::move(data), 0);
                 continue;
             }
         }
@@ -262,7 +360,19 @@ void AudioService::AudioInputTask() {
             int samples = audio_processor_->GetFeedSize();
             if (samples > 0) {
                 if (ReadAudioData(data, 16000, samples)) {
-                    audio_processor_->Feed(std::move(data));
+                    int64_t capture_end_us = last_capture_time_us_.load();
+                    if (capture_end_us < input_discard_until_us_.load()) {
+                        // Captured while the speaker was still playing the dropped audio
+                        continue;
+                    }
+                    int64_t capture_start_us = capture_end_us - (int64_t)samples * 1000000 / 16000;
+                    int64_t listen_start_us = listen_start_time_us_.exchange(0);
+                    if (listen_start_us > 0) {
+                        ESP_LOGI(TAG, "Voice processing started in %d ms, %d ms pre-roll",
+                            (int)((esp_timer_get_time() - listen_start_us) / 1000),
+                            (int)(std::max<int64_t>(0, listen_start_us - capture_start_us) / 1000));
+                    }
+                    audio_processor_->Feed(std::move(data), capture_start_us);
                     continue;
                 }
             }
@@ -293,19 +403,50 @@ void AudioService::AudioOutputTask() {
             esp_timer_start_periodic(audio_power_timer_, AUDIO_POWER_CHECK_INTERVAL_MS * 1000);
             codec_->EnableOutput(true);
         }
-        codec_->OutputData(task->pcm);
-
-        /* Update the last output time */
-        last_output_time_ = std::chrono::steady_clock::now();
-        debug_statistics_.playback_count++;
 
+        /* Place the packet on the render clock, the DMA plays it right after the data already written */
+        auto render_clock = codec_->GetRenderClock();
+        int32_t queued_frames = render_write_frames_ - render_clock.frames;
+        lock.lock();
+        if (queued_frames < 0) {
+            // The DMA has been playing silence and picks up the new data after the buffer in flight
+            render_write_frames_ = render_clock.frames + AUDIO_CODEC_DMA_FRAME_NUM;
+            // Only a stream that ran dry in the middle of a sentence is an underrun, the pause
+            // before a new sentence and the sounds played outside a stream are not
+            if (output_stream_active_ && !output_sentence_start_ && output_stats_.played_frames > 0) {
+                output_stats_.underruns++;
+                output_stats_.silence_frames += AUDIO_CODEC_DMA_FRAME_NUM - queued_frames;
+            }
+            output_sentence_start_ = false;
+            queued_frames = AUDIO_CODEC_DMA_FRAME_NUM;
+        }
+        if (output_stream_active_) {
+            int latency_ms = queued_frames * 1000 / codec_->output_sample_rate();
+            output_stats_.latency_ms = latency_ms;
+            if (output_stats_.played_frames == 0 || latency_ms < output_stats_.min_latency_ms) {
+                output_stats_.min_latency_ms = latency_ms;
+            }
+            if (latency_ms > output_stats_.max_latency_ms) {
+                output_stats_.max_latency_ms = latency_ms;
+            }
+            output_stats_.played_frames += task->pcm.size();
+        }
 #if CONFIG_USE_SERVER_AEC
-        /* Record the timestamp for server AEC */
         if (task->timestamp > 0) {
-            lock.lock();
-            timestamp_queue_.push_back(task->timestamp);
+            render_segments_.push_back({render_write_frames_, (uint32_t)task->pcm.size(), task->timestamp});
+            if (render_segments_.size() > MAX_RENDER_SEGMENTS) {
+                render_segments_.pop_front();
+            }
         }
 #endif
+        render_write_frames_ += task->pcm.size();
+        lock.unlock();
+
+        codec_->OutputData(task->pcm);
+
+        /* Update the last output time */
+        last_output_time_ = std::chrono::steady_clock::now();
+        debug_statistics_.playback_count++;
     }
 
     ESP_LOGW(TAG, "Audio output task stopped");
@@ -327,6 +468,9 @@ void AudioService::OpusCodecTask() {
         if (!audio_decode_queue_.empty() && audio_playback_queue_.size() < MAX_PLAYBACK_TASKS_IN_QUEUE) {
             auto packet = std::move(audio_decode_queue_.front());
             audio_decode_queue_.pop_front();
+            // The resampler is only touched by this task, ResetDecoder asks for the reset
+            bool reset_resampler = reset_output_resampler_;
+            reset_output_resampler_ = false;
             audio_queue_cv_.notify_all();
             lock.unlock();
 
@@ -335,14 +479,22 @@ void AudioService::OpusCodecTask() {
             task->timestamp = packet->timestamp;
 
             SetDecodeSampleRate(packet->sample_rate, packet->frame_duration);
+            if (reset_resampler) {
+                output_resampler_.Reset();
+            }
+            if (opus_decoder_->sample_rate() != codec_->output_sample_rate()) {
+                // Room for the resampled frame, so the resampler does not grow the vector again
+                int frame_samples = opus_decoder_->sample_rate() * opus_decoder_->duration_ms() / 1000;
+                task->pcm.reserve(output_resampler_.GetOutputSamples(frame_samples));
+            }
             if (opus_decoder_->Decode(std::move(packet->payload), task->pcm)) {
                 // Resample if the sample rate is different
                 if (opus_decoder_->sample_rate() != codec_->output_sample_rate()) {
-                    int target_size = output_resampler_.GetOutputSamples(task->pcm.size());
-                    std::vector<int16_t> resampled(target_size);
-                    output_resampler_.Process(task->pcm.data(), task->pcm.size(), resampled.data());
-                    task->pcm = std::move(resampled);
+                    output_resampler_.Process(task->pcm);
                 }
+#if CONFIG_USE_AUDIO_DEBUGGER
+                audio_debugger_->Feed(kAudioDebugTapDecoderOutput, task->pcm, codec_->output_sample_rate());
+#endif
 
                 lock.lock();
                 audio_playback_queue_.push_back(std::move(task));
@@ -365,12 +517,18 @@ void AudioService::OpusCodecTask() {
             packet->frame_duration = OPUS_FRAME_DURATION_MS;
             packet->sample_rate = 16000;
             packet->timestamp = task->timestamp;
+#if CONFIG_USE_AUDIO_DEBUGGER
+            if (task->type == kAudioTaskTypeEncodeToSendQueue) {
+                audio_debugger_->Feed(kAudioDebugTapEncoderInput, task->pcm, 16000);
+            }
+#endif
             if (!opus_encoder_->Encode(std::move(task->pcm), packet->payload)) {
                 ESP_LOGE(TAG, "Failed to encode audio");
                 continue;
             }
 
             if (task->type == kAudioTaskTypeEncodeToSendQueue) {
+                packet->enqueue_time_us = esp_timer_get_time();
                 {
                     std::lock_guard<std::mutex> lock(audio_queue_mutex_);
                     audio_send_queue_.push_back(std::move(packet));
@@ -401,11 +559,11 @@ void AudioService::SetDecodeSampleRate(int sample_rate, int frame_duration) {
     auto codec = Board::GetInstance().GetAudioCodec();
     if (opus_decoder_->sample_rate() != codec->output_sample_rate()) {
         ESP_LOGI(TAG, "Resampling audio from %d to %d", opus_decoder_->sample_rate(), codec->output_sample_rate());
-        output_resampler_.Configure(opus_decoder_->sample_rate(), codec->output_sample_rate());
+        output_resampler_.Configure(opus_decoder_->sample_rate(), codec->output_sample_rate(), DOWNLINK_RESAMPLER_QUALITY);
     }
 }
 
-void AudioService::PushTaskToEncodeQueue(AudioTaskType type, std::vector<int16_t>&& pcm) {
+void AudioService::PushTaskToEncodeQueue(AudioTaskType type, std::vector<int16_t>&& pcm, int64_t capture_time_us) {
     auto task = std::make_unique<AudioTask>();
     task->type = type;
     task->pcm = std::move(pcm);
@@ -413,15 +571,12 @@ void AudioService::PushTaskToEncodeQueue(AudioTaskType type, std::vector<int16_t
     /* Push the task to the encode queue */
     std::unique_lock<std::mutex> lock(audio_queue_mutex_);
 
-    /* If the task is to send queue, we need to set the timestamp */
-    if (type == kAudioTaskTypeEncodeToSendQueue && !timestamp_queue_.empty()) {
-        if (timestamp_queue_.size() <= MAX_TIMESTAMPS_IN_QUEUE) {
-            task->timestamp = timestamp_queue_.front();
-        } else {
-            ESP_LOGW(TAG, "Timestamp queue (%u) is full, dropping timestamp", timestamp_queue_.size());
-        }
-        timestamp_queue_.pop_front();
+#if CONFIG_USE_SERVER_AEC
+    /* If the task is to send queue, tag it with the playback position heard when its first sample was captured */
+    if (type == kAudioTaskTypeEncodeToSendQueue) {
+        task->timestamp = GetRenderTimestamp(capture_time_us);
     }
+#endif
 
     audio_queue_cv_.wait(lock, [this]() { return audio_encode_queue_.size() < MAX_ENCODE_TASKS_IN_QUEUE; });
     audio_encode_queue_.push_back(std::move(task));
@@ -478,12 +633,8 @@ void AudioService::EnableWakeWordDetection(bool enable) {
 
     ESP_LOGD(TAG, "%s wake word detection", enable ? "Enabling" : "Disabling");
     if (enable) {
-        if (!wake_word_initialized_) {
-            if (!wake_word_->Initialize(codec_)) {
-                ESP_LOGE(TAG, "Failed to initialize wake word");
-                return;
-            }
-            wake_word_initialized_ = true;
+        if (!WaitForModelReady(wake_word_ready_, "wake word", [this]() { return InitializeWakeWord(); })) {
+            return;
         }
         wake_word_->Start();
         xEventGroupSetBits(event_group_, AS_EVENT_WAKE_WORD_RUNNING);
@@ -496,14 +647,13 @@ void AudioService::EnableWakeWordDetection(bool enable) {
 void AudioService::EnableVoiceProcessing(bool enable) {
     ESP_LOGD(TAG, "%s voice processing", enable ? "Enabling" : "Disabling");
     if (enable) {
-        if (!audio_processor_initialized_) {
-            audio_processor_->Initialize(codec_, OPUS_FRAME_DURATION_MS);
-            audio_processor_initialized_ = true;
+        if (!WaitForModelReady(audio_processor_ready_, "audio processor", [this]() { return InitializeAudioProcessor(); })) {
+            return;
         }
 
         /* We should make sure no audio is playing */
-        ResetDecoder();
-        audio_input_need_warmup_ = true;
+        DrainPlayback();
+        listen_start_time_us_ = esp_timer_get_time();
         audio_processor_->Start();
         xEventGroupSetBits(event_group_, AS_EVENT_AUDIO_PROCESSOR_RUNNING);
     } else {
@@ -527,14 +677,23 @@ void AudioService::EnableAudioTesting(bool enable) {
 
 void AudioService::EnableDeviceAec(bool enable) {
     ESP_LOGI(TAG, "%s device AEC", enable ? "Enabling" : "Disabling");
-    if (!audio_processor_initialized_) {
-        audio_processor_->Initialize(codec_, OPUS_FRAME_DURATION_MS);
-        audio_processor_initialized_ = true;
+    if (!WaitForModelReady(audio_processor_ready_, "audio processor", [this]() { return InitializeAudioProcessor(); })) {
+        return;
     }
 
     audio_processor_->EnableDeviceAec(enable);
 }
 
+void AudioService::SetAudioDebugTaps(uint32_t mask) {
+    if (audio_debugger_) {
+        audio_debugger_->SetTapMask(mask);
+    }
+}
+
+void AudioService::SetUplinkPacketLoss(int percent) {
+    opus_encoder_->SetPacketLoss(percent);
+}
+
 void AudioService::SetCallbacks(AudioServiceCallbacks& callbacks) {
     callbacks_ = callbacks;
 }
@@ -638,6 +797,36 @@ void AudioService::PlaySound(const std::string_view& ogg) {
     }
 }
 
+AudioOutputStats AudioService::GetOutputStats() {
+    std::lock_guard<std::mutex> lock(audio_queue_mutex_);
+    return output_stream_active_ ? output_stats_ : last_output_stats_;
+}
+
+void AudioService::EndOutputStream() {
+    std::lock_guard<std::mutex> lock(audio_queue_mutex_);
+    FinishOutputStream();
+}
+
+void AudioService::MarkSentenceStart() {
+    std::lock_guard<std::mutex> lock(audio_queue_mutex_);
+    output_sentence_start_ = true;
+}
+
+// Must be called with audio_queue_mutex_ held
+void AudioService::FinishOutputStream() {
+    if (output_stats_.played_frames > 0) {
+        ESP_LOGI(TAG, "Playback session: %lu ms, %lu underruns, %lu ms silence inserted, latency %d-%d ms",
+            (unsigned long)(output_stats_.played_frames * 1000ULL / codec_->output_sample_rate()),
+            (unsigned long)output_stats_.underruns,
+            (unsigned long)(output_stats_.silence_frames * 1000ULL / codec_->output_sample_rate()),
+            output_stats_.min_latency_ms, output_stats_.max_latency_ms);
+        last_output_stats_ = output_stats_;
+    }
+    output_stats_ = AudioOutputStats();
+    output_stream_active_ = false;
+    output_sentence_start_ = false;
+}
+
 bool AudioService::IsIdle() {
     std::lock_guard<std::mutex> lock(audio_queue_mutex_);
     return audio_encode_queue_.empty() && audio_decode_queue_.empty() && audio_playback_queue_.empty() && audio_testing_queue_.empty();
@@ -645,14 +834,33 @@ bool AudioService::IsIdle() {
 
 void AudioService::ResetDecoder() {
     std::lock_guard<std::mutex> lock(audio_queue_mutex_);
+    /* A new playback session starts, report the last one */
+    FinishOutputStream();
+    output_stream_active_ = true;
     opus_decoder_->ResetState();
-    timestamp_queue_.clear();
+    reset_output_resampler_ = true;
+    render_segments_.clear();
     audio_decode_queue_.clear();
     audio_playback_queue_.clear();
     audio_testing_queue_.clear();
     audio_queue_cv_.notify_all();
 }
 
+// Drop the audio that has not reached the speaker yet, but keep the decoder and the AFE warm
+void AudioService::DrainPlayback() {
+    std::lock_guard<std::mutex> lock(audio_queue_mutex_);
+    audio_decode_queue_.clear();
+    audio_playback_queue_.clear();
+    audio_queue_cv_.notify_all();
+
+    // The DMA still holds the tail of the dropped audio, skip the mic frames captured until it is played
+    auto render_clock = codec_->GetRenderClock();
+    int32_t queued_frames = render_write_frames_ - render_clock.frames;
+    if (queued_frames > 0) {
+        input_discard_until_us_ = esp_timer_get_time() + (int64_t)queued_frames * 1000000 / codec_->output_sample_rate();
+    }
+}
+
 void AudioService::CheckAndUpdateAudioPowerState() {
     auto now = std::chrono::steady_clock::now();
     auto input_elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(now - last_input_time_).count();
@@ -662,8 +870,76 @@ void AudioService::CheckAndUpdateAudioPowerState() {
     }
     if (output_elapsed > AUDIO_POWER_TIMEOUT_MS && codec_->output_enabled()) {
         codec_->EnableOutput(false);
+        std::lock_guard<std::mutex> lock(audio_queue_mutex_);
+        FinishOutputStream();
     }
     if (!codec_->input_enabled() && !codec_->output_enabled()) {
         esp_timer_stop(audio_power_timer_);
     }
-}
\ No newline at end of file
+}
+
+void AudioService::UpdateCaptureTime(int frames) {
+    auto clock = codec_->GetCaptureClock();
+    capture_read_frames_ += frames;
+    int32_t pending = clock.frames - capture_read_frames_;
+    if (pending < 0 || pending > AUDIO_CODEC_DMA_DESC_NUM * AUDIO_CODEC_DMA_FRAME_NUM) {
+        // Input was paused and the DMA has overwritten the unread buffers
+        capture_read_frames_ = clock.frames;
+        pending = 0;
+    }
+    // The last frame we read was captured `pending` frames before the last DMA interrupt
+    last_capture_time_us_ = clock.time_us - (int64_t)pending * 1000000 / codec_->input_sample_rate();
+}
+
+#if CONFIG_USE_SERVER_AEC
+
+// Must be called with audio_queue_mutex_ held
+uint32_t AudioService::GetRenderTimestamp(int64_t capture_time_us) {
+    auto render_clock = codec_->GetRenderClock();
+    if (capture_time_us <= 0 || render_clock.time_us == 0) {
+        return 0;
+    }
+
+    // The render frame that was playing when the microphone captured this frame
+    int64_t delta_frames = (capture_time_us - render_clock.time_us) * codec_->output_sample_rate() / 1000000;
+    uint32_t render_frame = render_clock.frames + (int32_t)delta_frames;
+    while (!render_segments_.empty()) {
+        auto& segment = render_segments_.front();
+        int32_t offset = render_frame - segment.start_frame;
+        if (offset < 0) {
+            // Silence before the next packet
+            return 0;
+        }
+        if ((uint32_t)offset < segment.frames) {
+            return segment.timestamp + offset * 1000 / codec_->output_sample_rate();
+        }
+        // Captures only move forward, this packet will never be heard again
+        render_segments_.pop_front();
+    }
+    return 0;
+}
+
+void AudioService::CheckClockDrift() {
+    auto render_clock = codec_->GetRenderClock();
+    auto capture_clock = codec_->GetCaptureClock();
+    int64_t render_elapsed_us = render_clock.time_us - drift_render_base_.time_us;
+    int64_t capture_elapsed_us = capture_clock.time_us - drift_capture_base_.time_us;
+    if (drift_render_base_.time_us != 0 && drift_capture_base_.time_us != 0) {
+        if (render_elapsed_us < AUDIO_CLOCK_DRIFT_INTERVAL_MS * 1000 || capture_elapsed_us < AUDIO_CLOCK_DRIFT_INTERVAL_MS * 1000) {
+            return;
+        }
+        int64_t render_media_us = (int64_t)(uint32_t)(render_clock.frames - drift_render_base_.frames) * 1000000 / codec_->output_sample_rate();
+        int64_t capture_media_us = (int64_t)(uint32_t)(capture_clock.frames - drift_capture_base_.frames) * 1000000 / codec_->input_sample_rate();
+        // Skip the window if one of the streams was stopped in between
+        if (std::abs(render_media_us - render_elapsed_us) < render_elapsed_us / 100 &&
+            std::abs(capture_media_us - capture_elapsed_us) < capture_elapsed_us / 100) {
+            int render_ppm = (render_media_us - render_elapsed_us) * 1000000 / render_elapsed_us;
+            int capture_ppm = (capture_media_us - capture_elapsed_us) * 1000000 / capture_elapsed_us;
+            ESP_LOGI(TAG, "Clock drift: render %d ppm, capture %d ppm, render - capture %d ppm",
+                render_ppm, capture_ppm, render_ppm - capture_ppm);
+        }
+    }
+    drift_render_base_ = render_clock;
+    drift_capture_base_ = capture_clock;
+}
+#endif
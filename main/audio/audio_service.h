@@ -6,6 +6,8 @@
 #include <condition_variable>
 #include <chrono>
 #include <mutex>
+#include <future>
+#include <atomic>
 
 #include <freertos/FreeRTOS.h>
 #include <freertos/task.h>
@@ -17,11 +19,14 @@
 #include <opus_resampler.h>
 
 #include "audio_codec.h"
+#include "polyphase_resampler.h"
+#include "uplink_opus_encoder.h"
 #include "audio_processor.h"
 #include "processors/audio_debugger.h"
 #include "wake_word.h"
 #include "protocol.h"
 
+class AfeSession;
 
 /*
  * There are two types of audio data flow:
@@ -40,10 +45,20 @@
 #define MAX_DECODE_PACKETS_IN_QUEUE (2400 / OPUS_FRAME_DURATION_MS)
 #define MAX_SEND_PACKETS_IN_QUEUE (2400 / OPUS_FRAME_DURATION_MS)
 #define AUDIO_TESTING_MAX_DURATION_MS 10000
-#define MAX_TIMESTAMPS_IN_QUEUE 3
+#define MAX_RENDER_SEGMENTS 8
+#define AUDIO_CLOCK_DRIFT_INTERVAL_MS 30000
 
 #define AUDIO_POWER_TIMEOUT_MS 15000
 #define AUDIO_POWER_CHECK_INTERVAL_MS 1000
+#define MODEL_PRELOAD_TASK_STACK_SIZE (4096 * 2)
+
+#if CONFIG_DOWNLINK_RESAMPLER_QUALITY_LOW
+#define DOWNLINK_RESAMPLER_QUALITY kResamplerQualityLow
+#elif CONFIG_DOWNLINK_RESAMPLER_QUALITY_HIGH
+#define DOWNLINK_RESAMPLER_QUALITY kResamplerQualityHigh
+#else
+#define DOWNLINK_RESAMPLER_QUALITY kResamplerQualityMedium
+#endif
 
 
 #define AS_EVENT_AUDIO_TESTING_RUNNING      (1 << 0)
@@ -71,6 +86,23 @@ struct AudioTask {
     uint32_t timestamp;
 };
 
+// For server AEC: the place of a played packet on the render clock
+struct RenderSegment {
+    uint32_t start_frame;
+    uint32_t frames;
+    uint32_t timestamp;
+};
+
+// Output statistics of a speaking session, from ResetDecoder to EndOutputStream or the output power down
+struct AudioOutputStats {
+    uint32_t played_frames = 0;
+    uint32_t underruns = 0;
+    uint32_t silence_frames = 0;
+    int latency_ms = 0;
+    int min_latency_ms = 0;
+    int max_latency_ms = 0;
+};
+
 struct DebugStatistics {
     uint32_t input_count = 0;
     uint32_t decode_count = 0;
@@ -85,6 +117,8 @@ public:
 
     void Initialize(AudioCodec* codec);
     void Start();
+    // Load the wake word and audio processor models in a background task
+    void PreloadModels();
     void Stop();
     void EncodeWakeWord();
     std::unique_ptr<AudioStreamPacket> PopWakeWordPacket();
@@ -98,6 +132,9 @@ public:
     void EnableVoiceProcessing(bool enable);
     void EnableAudioTesting(bool enable);
     void EnableDeviceAec(bool enable);
+    void SetAudioDebugTaps(uint32_t mask);
+    // Uplink loss reported by the server, drives the in-band FEC of the encoder
+    void SetUplinkPacketLoss(int percent);
 
     void SetCallbacks(AudioServiceCallbacks& callbacks);
 
@@ -105,19 +142,32 @@ public:
     std::unique_ptr<AudioStreamPacket> PopPacketFromSendQueue();
     void PlaySound(const std::string_view& sound);
     bool ReadAudioData(std::vector<int16_t>& data, int sample_rate, int samples);
+    // Also starts a new output stream for the playback statistics
     void ResetDecoder();
+    void EndOutputStream();
+    // The server starts a new sentence, the next pause in the output is not an underrun
+    void MarkSentenceStart();
+    // The current stream, or the last one when no stream is active
+    AudioOutputStats GetOutputStats();
 
 private:
     AudioCodec* codec_ = nullptr;
     AudioServiceCallbacks callbacks_;
+    std::shared_ptr<AfeSession> afe_session_;
     std::unique_ptr<AudioProcessor> audio_processor_;
     std::unique_ptr<WakeWord> wake_word_;
     std::unique_ptr<AudioDebugger> audio_debugger_;
-    std::unique_ptr<OpusEncoderWrapper> opus_encoder_;
+    // Only used by the audio input task
+    std::vector<int16_t> debug_mic_buffer_;
+    std::vector<int16_t> debug_reference_buffer_;
+    std::unique_ptr<UplinkOpusEncoder> opus_encoder_;
     std::unique_ptr<OpusDecoderWrapper> opus_decoder_;
     OpusResampler input_resampler_;
     OpusResampler reference_resampler_;
-    OpusResampler output_resampler_;
+    // Only used by the opus codec task, which resets it before the next packet when
+    // reset_output_resampler_ is set (guarded by audio_queue_mutex_)
+    PolyphaseResampler output_resampler_;
+    bool reset_output_resampler_ = false;
     DebugStatistics debug_statistics_;
 
     EventGroupHandle_t event_group_;
@@ -133,14 +183,31 @@ private:
     std::deque<std::unique_ptr<AudioStreamPacket>> audio_testing_queue_;
     std::deque<std::unique_ptr<AudioTask>> audio_encode_queue_;
     std::deque<std::unique_ptr<AudioTask>> audio_playback_queue_;
+    // Position of the next written frame on the render clock, written by the output task
+    // under audio_queue_mutex_
+    uint32_t render_write_frames_ = 0;
+    AudioOutputStats output_stats_;
+    AudioOutputStats last_output_stats_;
+    bool output_stream_active_ = false;
+    bool output_sentence_start_ = false;
+
+    // Capture time of the last frame read from the codec
+    uint32_t capture_read_frames_ = 0;
+    std::atomic<int64_t> last_capture_time_us_{0};
+    // Mic frames captured before this time are stale, set when entering listening
+    std::atomic<int64_t> input_discard_until_us_{0};
+    std::atomic<int64_t> listen_start_time_us_{0};
+
     // For server AEC
-    std::deque<uint32_t> timestamp_queue_;
+    std::deque<RenderSegment> render_segments_;
+    AudioClock drift_render_base_;
+    AudioClock drift_capture_base_;
 
-    bool wake_word_initialized_ = false;
-    bool audio_processor_initialized_ = false;
+    // Readiness of the models, set by PreloadModels() or on first use
+    std::shared_future<bool> wake_word_ready_;
+    std::shared_future<bool> audio_processor_ready_;
     bool voice_detected_ = false;
     bool service_stopped_ = true;
-    bool audio_input_need_warmup_ = false;
 
     esp_timer_handle_t audio_power_timer_ = nullptr;
     std::chrono::steady_clock::time_point last_input_time_;
@@ -149,9 +216,17 @@ private:
     void AudioInputTask();
     void AudioOutputTask();
     void OpusCodecTask();
-    void PushTaskToEncodeQueue(AudioTaskType type, std::vector<int16_t>&& pcm);
+    void FinishOutputStream();
+    void PushTaskToEncodeQueue(AudioTaskType type, std::vector<int16_t>&& pcm, int64_t capture_time_us);
     void SetDecodeSampleRate(int sample_rate, int frame_duration);
     void CheckAndUpdateAudioPowerState();
+    void UpdateCaptureTime(int frames);
+    void DrainPlayback();
+    uint32_t GetRenderTimestamp(int64_t capture_time_us);
+    void CheckClockDrift();
+    bool WaitForModelReady(std::shared_future<bool>& ready, const char* name, std::function<bool()> initialize);
+    bool InitializeWakeWord();
+    bool InitializeAudioProcessor();
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,231 @@
+#include "polyphase_resampler.h"
+
+#include <esp_log.h>
+#include <esp_heap_caps.h>
+#include <sdkconfig.h>
+#include <cmath>
+#include <cstring>
+#include <numeric>
+#include <algorithm>
+
+#if CONFIG_IDF_TARGET_ESP32S3
+#include <dsps_dotprod.h>
+#endif
+
+#define TAG "PolyphaseResampler"
+
+#if CONFIG_IDF_TARGET_ESP32S3
+// dsps_dotprod_s16 falls back to plain C unless both operands are 16 byte aligned
+#define HISTORY_COPIES 8
+#else
+#define HISTORY_COPIES 1
+#endif
+
+// Coefficients are stored at half gain so a full scale overshoot still fits in int16
+#define COEFFICIENT_SCALE 16384.0
+
+struct ResamplerDesign {
+    int taps;
+    double rolloff;
+    double beta;
+};
+
+// Indexed by ResamplerQuality
+static const ResamplerDesign kResamplerDesigns[] = {
+    { 16, 0.85, 6.0 },
+    { 24, 0.90, 8.0 },
+    { 32, 0.94, 9.5 },
+};
+
+// Zeroth order modified Bessel function of the first kind, for the Kaiser window
+static double BesselI0(double x) {
+    double sum = 1.0;
+    double term = 1.0;
+    for (int k = 1; k < 32; k++) {
+        term *= (x / (2.0 * k)) * (x / (2.0 * k));
+        sum += term;
+        if (term < sum * 1e-12) {
+            break;
+        }
+    }
+    return sum;
+}
+
+static inline int16_t DotProduct(const int16_t* window, const int16_t* coefficients, int taps) {
+#if CONFIG_IDF_TARGET_ESP32S3
+    int16_t half;
+    dsps_dotprod_s16(window, coefficients, &half, taps, 0);
+    int32_t sample = (int32_t)half * 2;
+#else
+    int32_t acc = 0;
+    for (int i = 0; i < taps; i += 4) {
+        acc += window[i] * coefficients[i];
+        acc += window[i + 1] * coefficients[i + 1];
+        acc += window[i + 2] * coefficients[i + 2];
+        acc += window[i + 3] * coefficients[i + 3];
+    }
+    int32_t sample = (acc + (1 << 13)) >> 14;
+#endif
+    return (int16_t)std::clamp<int32_t>(sample, INT16_MIN, INT16_MAX);
+}
+
+PolyphaseResampler::PolyphaseResampler() {
+}
+
+PolyphaseResampler::~PolyphaseResampler() {
+    Release();
+}
+
+void PolyphaseResampler::Release() {
+    if (coefficients_ != nullptr) {
+        heap_caps_free(coefficients_);
+        coefficients_ = nullptr;
+    }
+    if (buffer_ != nullptr) {
+        heap_caps_free(buffer_);
+        buffer_ = nullptr;
+    }
+    buffer_stride_ = 0;
+}
+
+bool PolyphaseResampler::Configure(int input_rate, int output_rate, ResamplerQuality quality) {
+    Release();
+    input_rate_ = input_rate;
+    output_rate_ = output_rate;
+
+    int divisor = std::gcd(input_rate, output_rate);
+    up_ = output_rate / divisor;
+    down_ = input_rate / divisor;
+    auto& design = kResamplerDesigns[quality];
+    taps_ = (design.taps + 7) & ~7;
+
+    coefficients_ = (int16_t*)heap_caps_aligned_alloc(16, up_ * taps_ * sizeof(int16_t), MALLOC_CAP_8BIT);
+    if (coefficients_ == nullptr) {
+        ESP_LOGE(TAG, "Failed to allocate %d coefficients", up_ * taps_);
+        return false;
+    }
+    memset(coefficients_, 0, up_ * taps_ * sizeof(int16_t));
+
+    // Kaiser windowed sinc prototype at the upsampled rate, cut off below the lower Nyquist frequency
+    int length = up_ * design.taps;
+    double center = (length - 1) / 2.0;
+    double cutoff = design.rolloff * 0.5 / std::max(up_, down_);
+    double window_norm = BesselI0(design.beta);
+    std::vector<double> prototype(length);
+    for (int n = 0; n < length; n++) {
+        double t = n - center;
+        double x = 2.0 * cutoff * t;
+        double sinc = (t == 0) ? 1.0 : std::sin(M_PI * x) / (M_PI * x);
+        double r = t / (center + 1.0);
+        double window = BesselI0(design.beta * std::sqrt(std::max(0.0, 1.0 - r * r))) / window_norm;
+        prototype[n] = 2.0 * cutoff * sinc * window;
+    }
+
+    // Split into phases, normalize every phase to unity DC gain, and reverse it for the dot product.
+    // The padding stays zero at the start of the phase, the oldest end of the window
+    for (int p = 0; p < up_; p++) {
+        double sum = 0;
+        for (int k = 0; k < design.taps; k++) {
+            sum += prototype[p + k * up_];
+        }
+        int16_t* phase = coefficients_ + p * taps_;
+        for (int k = 0; k < design.taps; k++) {
+            double value = prototype[p + k * up_] / sum * COEFFICIENT_SCALE;
+            phase[taps_ - 1 - k] = (int16_t)std::clamp(std::lround(value), (long)INT16_MIN, (long)INT16_MAX);
+        }
+    }
+
+    Reset();
+    ESP_LOGI(TAG, "Resampling %d -> %d (%d/%d), %d taps per phase, %u bytes of coefficients",
+        input_rate, output_rate, up_, down_, taps_, (unsigned)(up_ * taps_ * sizeof(int16_t)));
+    return true;
+}
+
+void PolyphaseResampler::Reset() {
+    if (buffer_ != nullptr) {
+        for (int k = 0; k < HISTORY_COPIES; k++) {
+            memset(buffer_ + k * buffer_stride_ + k, 0, (taps_ - 1) * sizeof(int16_t));
+        }
+    }
+    index_ = taps_ - 1;
+    phase_ = 0;
+}
+
+int PolyphaseResampler::GetOutputSamples(int input_samples) const {
+    return ((int64_t)input_samples * up_ + down_ - 1) / down_ + 1;
+}
+
+bool PolyphaseResampler::Feed(const int16_t* input, int input_samples) {
+    if (coefficients_ == nullptr) {
+        return false;
+    }
+
+    // The buffer only grows, so a steady stream of equal blocks never allocates. The stride
+    // is a multiple of 8 samples, so every copy starts aligned
+    int stride = (HISTORY_COPIES - 1 + taps_ - 1 + input_samples + 7) & ~7;
+    if (stride > buffer_stride_) {
+        auto buffer = (int16_t*)heap_caps_aligned_alloc(16, HISTORY_COPIES * stride * sizeof(int16_t), MALLOC_CAP_8BIT);
+        if (buffer == nullptr) {
+            ESP_LOGE(TAG, "Failed to allocate %d samples", HISTORY_COPIES * stride);
+            return false;
+        }
+        for (int k = 0; k < HISTORY_COPIES; k++) {
+            if (buffer_ != nullptr) {
+                memcpy(buffer + k * stride + k, buffer_ + k * buffer_stride_ + k, (taps_ - 1) * sizeof(int16_t));
+            } else {
+                memset(buffer + k * stride + k, 0, (taps_ - 1) * sizeof(int16_t));
+            }
+        }
+        if (buffer_ != nullptr) {
+            heap_caps_free(buffer_);
+        }
+        buffer_ = buffer;
+        buffer_stride_ = stride;
+    }
+    for (int k = 0; k < HISTORY_COPIES; k++) {
+        memcpy(buffer_ + k * buffer_stride_ + k + taps_ - 1, input, input_samples * sizeof(int16_t));
+    }
+    return true;
+}
+
+// The window of taps_ samples starting at history position start, aligned when there are 8 copies
+const int16_t* PolyphaseResampler::GetWindow(int start) const {
+    int k = (HISTORY_COPIES - start % HISTORY_COPIES) % HISTORY_COPIES;
+    return buffer_ + k * buffer_stride_ + k + start;
+}
+
+int PolyphaseResampler::Run(int input_samples, int16_t* output) {
+    int end = taps_ - 1 + input_samples;
+    int count = 0;
+    while (index_ < end) {
+        output[count++] = DotProduct(GetWindow(index_ - (taps_ - 1)), coefficients_ + phase_ * taps_, taps_);
+        phase_ += down_;
+        index_ += phase_ / up_;
+        phase_ %= up_;
+    }
+
+    // Keep the tail of this block as the history of the next one
+    index_ -= input_samples;
+    for (int k = 0; k < HISTORY_COPIES; k++) {
+        int16_t* copy = buffer_ + k * buffer_stride_ + k;
+        memmove(copy, copy + input_samples, (taps_ - 1) * sizeof(int16_t));
+    }
+    return count;
+}
+
+int PolyphaseResampler::Process(const int16_t* input, int input_samples, int16_t* output) {
+    if (!Feed(input, input_samples)) {
+        return 0;
+    }
+    return Run(input_samples, output);
+}
+
+void PolyphaseResampler::Process(std::vector<int16_t>& pcm) {
+    int input_samples = pcm.size();
+    if (!Feed(pcm.data(), input_samples)) {
+        pcm.clear();
+        return;
+    }
+    pcm.resize(GetOutputSamples(input_samples));
+    pcm.resize(Run(input_samples, pcm.data()));
+}
@@ -0,0 +1,64 @@
+#ifndef POLYPHASE_RESAMPLER_H
+#define POLYPHASE_RESAMPLER_H
+
+#include <cstdint>
+#include <vector>
+
+enum ResamplerQuality {
+    kResamplerQualityLow,       // 16 taps per phase
+    kResamplerQualityMedium,    // 24 taps per phase
+    kResamplerQualityHigh,      // 32 taps per phase
+};
+
+/*
+ * Rational polyphase FIR resampler for mono int16 PCM.
+ *
+ * output_rate / input_rate is reduced to L / M (24k->16k is 2/3, 24k->48k is 2/1,
+ * 16k->44.1k is 441/160). The L phases of a Kaiser windowed sinc are designed once
+ * in Configure, so every output sample is a single dot product over a contiguous
+ * window of the history buffer. On ESP32-S3 the dot product runs on the esp-dsp
+ * PIE kernel, which needs 16 byte aligned operands and a multiple of 8 taps: the
+ * phases are zero padded to a multiple of 8, and the history is kept in 8 copies
+ * shifted by one sample each, so every window starts aligned in one of them.
+ */
+class PolyphaseResampler {
+public:
+    PolyphaseResampler();
+    ~PolyphaseResampler();
+
+    bool Configure(int input_rate, int output_rate, ResamplerQuality quality = kResamplerQualityMedium);
+    // Clear the filter history, call it when a new stream starts
+    void Reset();
+    // Upper bound of the output samples for the given input samples
+    int GetOutputSamples(int input_samples) const;
+    // Resample the block in place, the vector is resized to the output length. Reserve
+    // GetOutputSamples(input samples) before filling it and this never reallocates
+    void Process(std::vector<int16_t>& pcm);
+    // Returns the number of samples written to output, which must hold GetOutputSamples(input_samples)
+    int Process(const int16_t* input, int input_samples, int16_t* output);
+
+    inline int input_rate() const { return input_rate_; }
+    inline int output_rate() const { return output_rate_; }
+
+private:
+    int input_rate_ = 0;
+    int output_rate_ = 0;
+    int up_ = 1;
+    int down_ = 1;
+    // Padded to a multiple of 8
+    int taps_ = 0;
+    // up_ phases of taps_ coefficients, each phase stored in reverse order
+    int16_t* coefficients_ = nullptr;
+    // Copy k holds k samples of padding, taps_ - 1 samples of history and the current input block
+    int16_t* buffer_ = nullptr;
+    int buffer_stride_ = 0;
+    int index_ = 0;
+    int phase_ = 0;
+
+    bool Feed(const int16_t* input, int input_samples);
+    const int16_t* GetWindow(int start) const;
+    int Run(int input_samples, int16_t* output);
+    void Release();
+};
+
+#endif // POLYPHASE_RESAMPLER_H
@@ -8,38 +8,42 @@
 
 #include <string>
 #include <vector>
+#include <memory>
 #include <functional>
 
 #include "audio_processor.h"
 #include "audio_codec.h"
+#include "afe_session.h"
 
 class AfeAudioProcessor : public AudioProcessor {
 public:
-    AfeAudioProcessor();
+    // Pass a shared session to run on the same AFE as the wake word
+    AfeAudioProcessor(std::shared_ptr<AfeSession> session = nullptr);
     ~AfeAudioProcessor();
 
     void Initialize(AudioCodec* codec, int frame_duration_ms) override;
-    void Feed(std::vector<int16_t>&& data) override;
+    void Feed(std::vector<int16_t>&& data, int64_t capture_time_us) override;
     void Start() override;
     void Stop() override;
     bool IsRunning() override;
-    void OnOutput(std::function<void(std::vector<int16_t>&& data)> callback) override;
+    void OnOutput(std::function<void(std::vector<int16_t>&& data, int64_t capture_time_us)> callback) override;
     void OnVadStateChange(std::function<void(bool speaking)> callback) override;
     size_t GetFeedSize() override;
     void EnableDeviceAec(bool enable) override;
 
 private:
-    EventGroupHandle_t event_group_ = nullptr;
-    esp_afe_sr_iface_t* afe_iface_ = nullptr;
-    esp_afe_sr_data_t* afe_data_ = nullptr;
-    std::function<void(std::vector<int16_t>&& data)> output_callback_;
+    std::shared_ptr<AfeSession> session_;
+    std::function<void(std::vector<int16_t>&& data, int64_t capture_time_us)> output_callback_;
     std::function<void(bool speaking)> vad_state_change_callback_;
     AudioCodec* codec_ = nullptr;
     int frame_samples_ = 0;
     bool is_speaking_ = false;
+    bool device_aec_enabled_ = false;
     std::vector<int16_t> output_buffer_;
+    int64_t output_buffer_time_us_ = 0;
 
-    void AudioProcessorTask();
+    uint32_t GetStages() const;
+    void OnFetch(const afe_fetch_result_t* res, int64_t capture_time_us);
 };
 
 #endif 
\ No newline at end of file
@@ -0,0 +1,296 @@
+#include "afe_session.h"
+
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <esp_heap_caps.h>
+#include <string>
+#include <cstring>
+#include <algorithm>
+
+#define TAG "AfeSession"
+
+#define CONSUMER_BIT(consumer) (1 << (consumer))
+#define ALL_CONSUMER_BITS ((1 << kAfeConsumerCount) - 1)
+
+AfeSession::AfeSession() {
+    event_group_ = xEventGroupCreate();
+}
+
+AfeSession::~AfeSession() {
+    if (afe_data_ != nullptr) {
+        afe_iface_->destroy(afe_data_);
+    }
+    if (models_ != nullptr) {
+        esp_srmodel_deinit(models_);
+    }
+    vEventGroupDelete(event_group_);
+}
+
+void AfeSession::Require(uint32_t stages) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (afe_data_ != nullptr && (stages & ~required_stages_) != 0) {
+        ESP_LOGW(TAG, "AFE already created, stages 0x%lx are not available", (unsigned long)(stages & ~required_stages_));
+    }
+    required_stages_ |= stages;
+}
+
+bool AfeSession::Initialize(AudioCodec* codec) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (afe_data_ != nullptr) {
+        return true;
+    }
+    codec_ = codec;
+    auto start_time = esp_timer_get_time();
+    auto free_psram = heap_caps_get_free_size(MALLOC_CAP_SPIRAM);
+    auto free_internal = heap_caps_get_free_size(MALLOC_CAP_INTERNAL);
+
+    models_ = esp_srmodel_init("model");
+    if (models_ == nullptr || models_->num == -1) {
+        ESP_LOGE(TAG, "Failed to initialize models");
+        return false;
+    }
+
+    bool use_wakenet = (required_stages_ & AFE_STAGE_WAKENET) != 0;
+    if (use_wakenet) {
+        wakenet_model_ = esp_srmodel_filter(models_, ESP_WN_PREFIX, NULL);
+        if (wakenet_model_ == nullptr) {
+            ESP_LOGE(TAG, "No wakenet model found");
+            return false;
+        }
+    }
+    char* ns_model_name = esp_srmodel_filter(models_, ESP_NSNET_PREFIX, NULL);
+    char* vad_model_name = esp_srmodel_filter(models_, ESP_VADN_PREFIX, NULL);
+
+    int ref_num = codec_->input_reference() ? 1 : 0;
+    if (ref_num == 0) {
+        required_stages_ &= ~AFE_STAGE_AEC;
+    }
+    std::string input_format;
+    for (int i = 0; i < codec_->input_channels() - ref_num; i++) {
+        input_format.push_back('M');
+    }
+    for (int i = 0; i < ref_num; i++) {
+        input_format.push_back('R');
+    }
+
+    // The wakenet is only available in the SR pipeline, the VC pipeline is used for voice processing only.
+    // A shared session therefore hands the audio processor the SR front end: the same NS and VAD models,
+    // plus the SR beamforming on boards with more than one mic. The uplink only feeds the server ASR,
+    // so recognition tuning suits it. The VOIP AEC is kept, AudioService does not share the session
+    // when the device AEC is enabled
+    afe_config_t* afe_config = afe_config_init(input_format.c_str(), use_wakenet ? models_ : NULL,
+        use_wakenet ? AFE_TYPE_SR : AFE_TYPE_VC, AFE_MODE_HIGH_PERF);
+    afe_config->aec_mode = use_wakenet ? AEC_MODE_SR_HIGH_PERF : AEC_MODE_VOIP_HIGH_PERF;
+    afe_config->aec_init = (required_stages_ & AFE_STAGE_AEC) != 0;
+    afe_config->wakenet_init = use_wakenet;
+    afe_config->vad_init = (required_stages_ & AFE_STAGE_VAD) != 0;
+    afe_config->vad_mode = VAD_MODE_0;
+    afe_config->vad_min_noise_ms = 100;
+    if (vad_model_name != nullptr) {
+        afe_config->vad_model_name = vad_model_name;
+    }
+    if ((required_stages_ & AFE_STAGE_NS) && ns_model_name != nullptr) {
+        afe_config->ns_init = true;
+        afe_config->ns_model_name = ns_model_name;
+        afe_config->afe_ns_mode = AFE_NS_MODE_NET;
+    } else {
+        afe_config->ns_init = false;
+        required_stages_ &= ~AFE_STAGE_NS;
+    }
+    afe_config->afe_perferred_core = 1;
+    afe_config->afe_perferred_priority = 1;
+    afe_config->agc_init = false;
+    afe_config->memory_alloc_mode = AFE_MEMORY_ALLOC_MORE_PSRAM;
+
+    afe_iface_ = esp_afe_handle_from_config(afe_config);
+    afe_data_ = afe_iface_->create_from_config(afe_config);
+    afe_config_free(afe_config);
+    if (afe_data_ == nullptr) {
+        ESP_LOGE(TAG, "Failed to create AFE");
+        return false;
+    }
+
+    // Every stage starts enabled and stays so until the first consumer becomes active, ApplyStages
+    // keeps the stages while nobody is active. Nothing is fetched before that, so they cost nothing
+    enabled_stages_ = required_stages_;
+
+    ESP_LOGI(TAG, "AFE created with stages 0x%lx in %ld ms, used %u bytes PSRAM, %u bytes internal RAM",
+        (unsigned long)required_stages_, (long)((esp_timer_get_time() - start_time) / 1000),
+        free_psram - heap_caps_get_free_size(MALLOC_CAP_SPIRAM),
+        free_internal - heap_caps_get_free_size(MALLOC_CAP_INTERNAL));
+
+    xTaskCreate([](void* arg) {
+        auto this_ = (AfeSession*)arg;
+        this_->FetchTask();
+        vTaskDelete(NULL);
+    }, "afe_fetch", 4096, this, 3, nullptr);
+    return true;
+}
+
+void AfeSession::Subscribe(AfeConsumer consumer, std::function<void(const afe_fetch_result_t* result, int64_t capture_time_us)> callback) {
+    std::lock_guard<std::mutex> lock(callback_mutex_);
+    callbacks_[consumer] = std::move(callback);
+}
+
+void AfeSession::SetConsumerStages(AfeConsumer consumer, uint32_t stages) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    consumer_stages_[consumer] = stages;
+    if (afe_data_ != nullptr) {
+        ApplyStages();
+    }
+}
+
+void AfeSession::SetActive(AfeConsumer consumer, bool active) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto start_time = esp_timer_get_time();
+    auto bits = xEventGroupGetBits(event_group_) & ALL_CONSUMER_BITS;
+    if (active) {
+        // Stale audio only matters if nobody consumed the stream for a while
+        if (bits == 0 && afe_data_ != nullptr && idle_since_us_ > 0 &&
+            start_time - idle_since_us_ > AFE_SESSION_RESET_IDLE_MS * 1000) {
+            afe_iface_->reset_buffer(afe_data_);
+            // The buffered frames are gone, the next fetch starts with the next feed
+            portENTER_CRITICAL(&timeline_lock_);
+            fetched_frames_ = fed_frames_;
+            portEXIT_CRITICAL(&timeline_lock_);
+        }
+        xEventGroupSetBits(event_group_, CONSUMER_BIT(consumer));
+    } else {
+        xEventGroupClearBits(event_group_, CONSUMER_BIT(consumer));
+        if ((bits & ~CONSUMER_BIT(consumer)) == 0) {
+            idle_since_us_ = start_time;
+        }
+    }
+
+    if (afe_data_ != nullptr) {
+        ApplyStages();
+        ESP_LOGD(TAG, "Consumer %d %s, stages 0x%lx, switched in %ld us", consumer, active ? "active" : "inactive",
+            (unsigned long)enabled_stages_, (long)(esp_timer_get_time() - start_time));
+    }
+}
+
+bool AfeSession::IsActive(AfeConsumer consumer) const {
+    return xEventGroupGetBits(event_group_) & CONSUMER_BIT(consumer);
+}
+
+void AfeSession::ApplyStages() {
+    auto bits = xEventGroupGetBits(event_group_);
+    uint32_t wanted = 0;
+    for (int i = 0; i < kAfeConsumerCount; i++) {
+        if (bits & CONSUMER_BIT(i)) {
+            wanted |= consumer_stages_[i];
+        }
+    }
+    wanted &= required_stages_;
+    // Keep the previous stages while nobody is active, so the next consumer starts warm
+    if ((bits & ALL_CONSUMER_BITS) == 0) {
+        return;
+    }
+
+    uint32_t changed = wanted ^ enabled_stages_;
+    if (changed & AFE_STAGE_WAKENET) {
+        if (wanted & AFE_STAGE_WAKENET) {
+            afe_iface_->enable_wakenet(afe_data_);
+        } else {
+            afe_iface_->disable_wakenet(afe_data_);
+        }
+    }
+    if (changed & AFE_STAGE_VAD) {
+        if (wanted & AFE_STAGE_VAD) {
+            afe_iface_->enable_vad(afe_data_);
+        } else {
+            afe_iface_->disable_vad(afe_data_);
+        }
+    }
+    if (changed & AFE_STAGE_NS) {
+        if (wanted & AFE_STAGE_NS) {
+            afe_iface_->enable_ns(afe_data_);
+        } else {
+            afe_iface_->disable_ns(afe_data_);
+        }
+    }
+    if (changed & AFE_STAGE_AEC) {
+        if (wanted & AFE_STAGE_AEC) {
+            afe_iface_->enable_aec(afe_data_);
+        } else {
+            afe_iface_->disable_aec(afe_data_);
+        }
+    }
+    enabled_stages_ = wanted;
+}
+
+size_t AfeSession::GetFeedSize() {
+    if (afe_data_ == nullptr) {
+        return 0;
+    }
+    return afe_iface_->get_feed_chunksize(afe_data_);
+}
+
+size_t AfeSession::GetFetchSize() {
+    if (afe_data_ == nullptr) {
+        return 0;
+    }
+    return afe_iface_->get_fetch_chunksize(afe_data_);
+}
+
+void AfeSession::Feed(const int16_t* data, int64_t capture_time_us) {
+    if (afe_data_ == nullptr) {
+        return;
+    }
+    uint32_t frames = afe_iface_->get_feed_chunksize(afe_data_);
+    portENTER_CRITICAL(&timeline_lock_);
+    feed_history_[feed_history_count_++ % AFE_SESSION_FEED_HISTORY] = {fed_frames_, frames, capture_time_us};
+    fed_frames_ += frames;
+    portEXIT_CRITICAL(&timeline_lock_);
+    afe_iface_->feed(afe_data_, data);
+}
+
+int64_t AfeSession::GetCaptureTime(uint32_t frame) {
+    int64_t capture_time_us = 0;
+    portENTER_CRITICAL(&timeline_lock_);
+    uint32_t count = std::min<uint32_t>(feed_history_count_, AFE_SESSION_FEED_HISTORY);
+    for (uint32_t i = 1; i <= count; i++) {
+        auto& chunk = feed_history_[(feed_history_count_ - i) % AFE_SESSION_FEED_HISTORY];
+        uint32_t offset = frame - chunk.start_frame;
+        if (offset < chunk.frames) {
+            if (chunk.capture_time_us > 0) {
+                capture_time_us = chunk.capture_time_us + (int64_t)offset * 1000000 / 16000;
+            }
+            break;
+        }
+    }
+    portEXIT_CRITICAL(&timeline_lock_);
+    return capture_time_us;
+}
+
+void AfeSession::FetchTask() {
+    ESP_LOGI(TAG, "AFE fetch task started, feed size: %d fetch size: %d",
+        afe_iface_->get_feed_chunksize(afe_data_), afe_iface_->get_fetch_chunksize(afe_data_));
+
+    while (true) {
+        xEventGroupWaitBits(event_group_, ALL_CONSUMER_BITS, pdFALSE, pdFALSE, portMAX_DELAY);
+
+        auto res = afe_iface_->fetch_with_delay(afe_data_, portMAX_DELAY);
+        if (res == nullptr || res->ret_value == ESP_FAIL) {
+            if (res != nullptr) {
+                ESP_LOGI(TAG, "Error code: %d", res->ret_value);
+            }
+            continue;
+        }
+
+        portENTER_CRITICAL(&timeline_lock_);
+        uint32_t first_frame = fetched_frames_;
+        fetched_frames_ += res->data_size / sizeof(int16_t);
+        portEXIT_CRITICAL(&timeline_lock_);
+        int64_t capture_time_us = GetCaptureTime(first_frame);
+
+        // Not mutex_, the callbacks may switch the consumers
+        std::lock_guard<std::mutex> lock(callback_mutex_);
+        for (int i = 0; i < kAfeConsumerCount; i++) {
+            // Check again, the previous consumer may have stopped this one
+            if ((xEventGroupGetBits(event_group_) & CONSUMER_BIT(i)) && callbacks_[i]) {
+                callbacks_[i](res, capture_time_us);
+            }
+        }
+    }
+}
@@ -0,0 +1,97 @@
+#ifndef AFE_SESSION_H
+#define AFE_SESSION_H
+
+#include <esp_afe_sr_models.h>
+#include <model_path.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/event_groups.h>
+
+#include <mutex>
+#include <functional>
+
+#include "audio_codec.h"
+
+#define AFE_STAGE_WAKENET   (1 << 0)
+#define AFE_STAGE_VAD       (1 << 1)
+#define AFE_STAGE_NS        (1 << 2)
+#define AFE_STAGE_AEC       (1 << 3)
+
+// Keep the AFE buffers when switching consumers faster than this
+#define AFE_SESSION_RESET_IDLE_MS 200
+// Feed chunks remembered to find the capture time of a fetch, more than the AFE buffers
+#define AFE_SESSION_FEED_HISTORY 16
+
+enum AfeConsumer {
+    kAfeConsumerWakeWord,
+    kAfeConsumerProcessor,
+    kAfeConsumerCount
+};
+
+/*
+ * AfeSession owns one AFE pipeline and its fetch task.
+ *
+ * The wake word and the audio processor subscribe to the same fetch stream,
+ * and the wakenet / VAD / NS / AEC stages are switched on and off according to
+ * which consumers are active, so idle <-> listening never rebuilds the AFE.
+ */
+class AfeSession {
+public:
+    AfeSession();
+    ~AfeSession();
+
+    // Declare the stages a consumer may need, must be called before Initialize
+    void Require(uint32_t stages);
+    bool Initialize(AudioCodec* codec);
+    bool IsInitialized() const { return afe_data_ != nullptr; }
+
+    // Passing nullptr returns only after a callback that is running has finished. capture_time_us
+    // is when the first frame of the fetched data was captured, 0 if unknown
+    void Subscribe(AfeConsumer consumer, std::function<void(const afe_fetch_result_t* result, int64_t capture_time_us)> callback);
+    void SetConsumerStages(AfeConsumer consumer, uint32_t stages);
+    void SetActive(AfeConsumer consumer, bool active);
+    bool IsActive(AfeConsumer consumer) const;
+
+    size_t GetFeedSize();
+    size_t GetFetchSize();
+    // capture_time_us is when the first frame of data was captured, 0 if unknown
+    void Feed(const int16_t* data, int64_t capture_time_us = 0);
+
+    srmodel_list_t* models() const { return models_; }
+    const char* wakenet_model() const { return wakenet_model_; }
+
+private:
+    EventGroupHandle_t event_group_ = nullptr;
+    srmodel_list_t* models_ = nullptr;
+    char* wakenet_model_ = nullptr;
+    esp_afe_sr_iface_t* afe_iface_ = nullptr;
+    esp_afe_sr_data_t* afe_data_ = nullptr;
+    AudioCodec* codec_ = nullptr;
+    std::mutex mutex_;
+    uint32_t required_stages_ = 0;
+    uint32_t enabled_stages_ = 0;
+    uint32_t consumer_stages_[kAfeConsumerCount] = {};
+    // Held by the fetch task while it calls the consumers, so unsubscribing waits for a running callback
+    std::mutex callback_mutex_;
+    std::function<void(const afe_fetch_result_t* result, int64_t capture_time_us)> callbacks_[kAfeConsumerCount];
+    int64_t idle_since_us_ = 0;
+
+    // The AFE outputs one frame per fed frame, so counting both maps a fetch back to its feed chunk
+    struct FeedChunk {
+        uint32_t start_frame;
+        uint32_t frames;
+        int64_t capture_time_us;
+    };
+    portMUX_TYPE timeline_lock_ = portMUX_INITIALIZER_UNLOCKED;
+    FeedChunk feed_history_[AFE_SESSION_FEED_HISTORY] = {};
+    uint32_t feed_history_count_ = 0;
+    uint32_t fed_frames_ = 0;
+    uint32_t fetched_frames_ = 0;
+
+    int64_t GetCaptureTime(uint32_t frame);
+
+    void ApplyStages();
+    void FetchTask();
+};
+
+#endif
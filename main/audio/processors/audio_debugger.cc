@@ -3,15 +3,32 @@
 
 #if CONFIG_USE_AUDIO_DEBUGGER
 #include <esp_log.h>
+#include <esp_timer.h>
 #include <arpa/inet.h>
 #include <unistd.h>
 #include <errno.h>
 #include <cstring>
 #include <string>
+#include <algorithm>
 #endif
 
 #define TAG "AudioDebugger"
 
+#if CONFIG_USE_AUDIO_DEBUGGER
+static const int16_t kImaStepTable[89] = {
+    7, 8, 9, 10, 11, 12, 13, 14, 16, 17, 19, 21, 23, 25, 28, 31, 34, 37, 41, 45,
+    50, 55, 60, 66, 73, 80, 88, 97, 107, 118, 130, 143, 157, 173, 190, 209, 230, 253, 279, 307,
+    337, 371, 408, 449, 494, 544, 598, 658, 724, 796, 876, 963, 1060, 1166, 1282, 1411, 1552, 1707, 1878, 2066,
+    2272, 2499, 2749, 3024, 3327, 3660, 4026, 4428, 4871, 5358, 5894, 6484, 7132, 7845, 8630, 9493, 10442, 11487, 12635, 13899,
+    15289, 16818, 18500, 20350, 22385, 24623, 27086, 29794, 32767
+};
+
+static const int8_t kImaIndexTable[16] = {
+    -1, -1, -1, -1, 2, 4, 6, 8,
+    -1, -1, -1, -1, 2, 4, 6, 8
+};
+#endif
+
 
 AudioDebugger::AudioDebugger() {
 #if CONFIG_USE_AUDIO_DEBUGGER
@@ -20,16 +37,16 @@ AudioDebugger::AudioDebugger() {
         // 解析配置的服务器地址 "IP:PORT"
         std::string server_addr = CONFIG_AUDIO_DEBUG_UDP_SERVER;
         size_t colon_pos = server_addr.find(':');
-        
+
         if (colon_pos != std::string::npos) {
             std::string ip = server_addr.substr(0, colon_pos);
             int port = std::stoi(server_addr.substr(colon_pos + 1));
-            
+
             memset(&udp_server_addr_, 0, sizeof(udp_server_addr_));
             udp_server_addr_.sin_family = AF_INET;
             udp_server_addr_.sin_port = htons(port);
             inet_pton(AF_INET, ip.c_str(), &udp_server_addr_.sin_addr);
-            
+
             ESP_LOGI(TAG, "Initialized server address: %s", CONFIG_AUDIO_DEBUG_UDP_SERVER);
         } else {
             ESP_LOGW(TAG, "Invalid server address: %s, should be IP:PORT", CONFIG_AUDIO_DEBUG_UDP_SERVER);
@@ -39,11 +56,36 @@ AudioDebugger::AudioDebugger() {
     } else {
         ESP_LOGW(TAG, "Failed to create UDP socket: %d", errno);
     }
+
+    if (udp_sockfd_ < 0) {
+        return;
+    }
+
+    ring_buffer_ = xRingbufferCreate(AUDIO_DEBUGGER_RING_SIZE, RINGBUF_TYPE_NOSPLIT);
+    if (ring_buffer_ == nullptr) {
+        ESP_LOGE(TAG, "Failed to create ring buffer");
+        return;
+    }
+    send_buffer_.resize(sizeof(AudioDebugPacketHeader) + AUDIO_DEBUGGER_MAX_FRAMES_PER_PACKET * sizeof(int16_t));
+    tap_mask_ = CONFIG_AUDIO_DEBUG_TAPS;
+
+    // The sender runs below every audio task, so a slow network never stalls audio capture
+    xTaskCreate([](void* arg) {
+        auto debugger = (AudioDebugger*)arg;
+        debugger->SenderTask();
+        vTaskDelete(NULL);
+    }, "audio_debugger", 3072, this, 1, &sender_task_handle_);
 #endif
 }
 
 AudioDebugger::~AudioDebugger() {
 #if CONFIG_USE_AUDIO_DEBUGGER
+    if (sender_task_handle_ != nullptr) {
+        vTaskDelete(sender_task_handle_);
+    }
+    if (ring_buffer_ != nullptr) {
+        vRingbufferDelete(ring_buffer_);
+    }
     if (udp_sockfd_ >= 0) {
         close(udp_sockfd_);
         ESP_LOGI(TAG, "Closed UDP socket");
@@ -51,18 +93,130 @@ AudioDebugger::~AudioDebugger() {
 #endif
 }
 
-void AudioDebugger::Feed(const std::vector<int16_t>& data) {
+void AudioDebugger::SetTapMask(uint32_t mask) {
 #if CONFIG_USE_AUDIO_DEBUGGER
-    if (udp_sockfd_ >= 0) {
-        ssize_t sent = sendto(udp_sockfd_, data.data(), data.size() * sizeof(int16_t), 0,
+    tap_mask_ = mask & ((1u << kAudioDebugTapCount) - 1);
+    ESP_LOGI(TAG, "Tap mask set to 0x%02lx", (unsigned long)tap_mask_.load());
+#endif
+}
+
+void AudioDebugger::Feed(AudioDebugTap tap, const int16_t* data, size_t samples, int sample_rate, int channels) {
+#if CONFIG_USE_AUDIO_DEBUGGER
+    if (ring_buffer_ == nullptr || !IsTapEnabled(tap) || channels <= 0) {
+        return;
+    }
+
+    auto timestamp_us = esp_timer_get_time();
+    size_t total_frames = samples / channels;
+    size_t max_frames = AUDIO_DEBUGGER_MAX_FRAMES_PER_PACKET / channels;
+    size_t offset = 0;
+    while (offset < total_frames) {
+        size_t frames = std::min(max_frames, total_frames - offset);
+        size_t payload_size = frames * channels * sizeof(int16_t);
+        uint32_t sample_index = sample_index_[tap].fetch_add(frames, std::memory_order_relaxed);
+
+        void* item = nullptr;
+        if (xRingbufferSendAcquire(ring_buffer_, &item, sizeof(AudioDebugPacketHeader) + payload_size, 0) != pdTRUE) {
+            // Backpressure: drop the frames, the receiver zero-fills them by sample_index
+            dropped_frames_[tap].fetch_add(frames, std::memory_order_relaxed);
+            offset += frames;
+            continue;
+        }
+
+        auto header = (AudioDebugPacketHeader*)item;
+        header->magic = AUDIO_DEBUGGER_MAGIC;
+        header->version = AUDIO_DEBUGGER_VERSION;
+        header->tap = tap;
+        header->channels = channels;
+        header->encoding = kAudioDebugEncodingPcm16;
+        header->sample_rate = sample_rate;
+        header->sequence = 0;
+        header->sample_index = sample_index;
+        header->timestamp_us = timestamp_us + (uint64_t)offset * 1000000 / sample_rate;
+        header->frames = frames;
+        header->payload_size = payload_size;
+        header->adpcm_predictor = 0;
+        header->adpcm_index = 0;
+        header->reserved = 0;
+        memcpy((uint8_t*)item + sizeof(AudioDebugPacketHeader), data + offset * channels, payload_size);
+        xRingbufferSendComplete(ring_buffer_, item);
+        offset += frames;
+    }
+#endif
+}
+
+void AudioDebugger::SenderTask() {
+#if CONFIG_USE_AUDIO_DEBUGGER
+    while (true) {
+        size_t item_size = 0;
+        auto item = (uint8_t*)xRingbufferReceive(ring_buffer_, &item_size, portMAX_DELAY);
+        if (item == nullptr) {
+            continue;
+        }
+
+        auto header = (AudioDebugPacketHeader*)item;
+        header->sequence = sequence_++;
+        const uint8_t* packet = item;
+        size_t packet_size = item_size;
+
+#if CONFIG_AUDIO_DEBUG_COMPRESSION
+        if (header->channels == 1) {
+            auto output = (AudioDebugPacketHeader*)send_buffer_.data();
+            *output = *header;
+            output->encoding = kAudioDebugEncodingImaAdpcm;
+            output->adpcm_predictor = adpcm_predictor_[header->tap];
+            output->adpcm_index = adpcm_index_[header->tap];
+            output->payload_size = EncodeAdpcm((AudioDebugTap)header->tap, (const int16_t*)(item + sizeof(AudioDebugPacketHeader)),
+                header->frames, send_buffer_.data() + sizeof(AudioDebugPacketHeader));
+            packet = send_buffer_.data();
+            packet_size = sizeof(AudioDebugPacketHeader) + output->payload_size;
+        }
+#endif
+
+        ssize_t sent = sendto(udp_sockfd_, packet, packet_size, 0,
                              (struct sockaddr*)&udp_server_addr_, sizeof(udp_server_addr_));
         if (sent < 0) {
             ESP_LOGW(TAG, "Failed to send audio data to %s: %d", CONFIG_AUDIO_DEBUG_UDP_SERVER, errno);
-        } else {
-            ESP_LOGD(TAG, "Sent %d bytes audio data to %s", sent, CONFIG_AUDIO_DEBUG_UDP_SERVER);
         }
+        vRingbufferReturnItem(ring_buffer_, item);
     }
 #endif
 }
 
- 
\ No newline at end of file
+size_t AudioDebugger::EncodeAdpcm(AudioDebugTap tap, const int16_t* pcm, size_t samples, uint8_t* output) {
+#if CONFIG_USE_AUDIO_DEBUGGER
+    int predictor = adpcm_predictor_[tap];
+    int index = adpcm_index_[tap];
+    for (size_t i = 0; i < samples; i++) {
+        int step = kImaStepTable[index];
+        int diff = pcm[i] - predictor;
+        uint8_t nibble = 0;
+        if (diff < 0) {
+            nibble = 8;
+            diff = -diff;
+        }
+        int delta = step >> 3;
+        if (diff >= step) { nibble |= 4; diff -= step; delta += step; }
+        step >>= 1;
+        if (diff >= step) { nibble |= 2; diff -= step; delta += step; }
+        step >>= 1;
+        if (diff >= step) { nibble |= 1; delta += step; }
+
+        predictor += (nibble & 8) ? -delta : delta;
+        predictor = std::clamp(predictor, -32768, 32767);
+        index = std::clamp(index + kImaIndexTable[nibble], 0, 88);
+
+        // Low nibble first
+        if (i & 1) {
+            output[i / 2] |= nibble << 4;
+        } else {
+            output[i / 2] = nibble;
+        }
+    }
+    adpcm_predictor_[tap] = predictor;
+    adpcm_index_[tap] = index;
+    return (samples + 1) / 2;
+#else
+    return 0;
+#endif
+}
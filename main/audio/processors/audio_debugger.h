@@ -2,21 +2,93 @@
 #define AUDIO_DEBUGGER_H
 
 #include <vector>
+#include <atomic>
 #include <cstdint>
 
 #include <sys/socket.h>
 #include <netinet/in.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/ringbuf.h>
+
+#define AUDIO_DEBUGGER_MAGIC 0x44415a58 // "XZAD"
+#define AUDIO_DEBUGGER_VERSION 1
+#define AUDIO_DEBUGGER_RING_SIZE (32 * 1024)
+#define AUDIO_DEBUGGER_MAX_FRAMES_PER_PACKET 480
+
+enum AudioDebugTap {
+    kAudioDebugTapMicRaw = 0,
+    kAudioDebugTapReference,
+    kAudioDebugTapAfeOutput,
+    kAudioDebugTapEncoderInput,
+    kAudioDebugTapDecoderOutput,
+    kAudioDebugTapCount
+};
+
+enum AudioDebugEncoding {
+    kAudioDebugEncodingPcm16 = 0,
+    kAudioDebugEncodingImaAdpcm = 1,
+};
+
+/*
+ * UDP Audio Debug Packet Format (little-endian):
+ * |magic 4u|version 1u|tap 1u|channels 1u|encoding 1u|sample_rate 4u|sequence 4u|
+ * |sample_index 4u|timestamp_us 8u|frames 2u|payload_size 2u|adpcm_predictor 2s|adpcm_index 1u|reserved 1u|
+ * |payload payload_size|
+ *
+ * sample_index counts frames per tap since the debugger started, including dropped frames,
+ * so the receiver can zero-fill gaps and keep all taps time-aligned.
+ */
+struct AudioDebugPacketHeader {
+    uint32_t magic;
+    uint8_t version;
+    uint8_t tap;
+    uint8_t channels;
+    uint8_t encoding;
+    uint32_t sample_rate;
+    uint32_t sequence;
+    uint32_t sample_index;
+    uint64_t timestamp_us;
+    uint16_t frames;
+    uint16_t payload_size;
+    int16_t adpcm_predictor;
+    uint8_t adpcm_index;
+    uint8_t reserved;
+} __attribute__((packed));
 
 class AudioDebugger {
 public:
     AudioDebugger();
     ~AudioDebugger();
 
-    void Feed(const std::vector<int16_t>& data);
+    // Non-blocking, safe to call from the audio tasks. Frames are dropped when the ring is full.
+    void Feed(AudioDebugTap tap, const int16_t* data, size_t samples, int sample_rate, int channels = 1);
+    void Feed(AudioDebugTap tap, const std::vector<int16_t>& data, int sample_rate, int channels = 1) {
+        Feed(tap, data.data(), data.size(), sample_rate, channels);
+    }
+
+    inline bool IsTapEnabled(AudioDebugTap tap) const {
+        return (tap_mask_.load(std::memory_order_relaxed) & (1u << tap)) != 0;
+    }
+    void SetTapMask(uint32_t mask);
+    uint32_t GetTapMask() const { return tap_mask_.load(std::memory_order_relaxed); }
+    uint32_t GetDroppedFrames(AudioDebugTap tap) const { return dropped_frames_[tap].load(std::memory_order_relaxed); }
 
 private:
     int udp_sockfd_ = -1;
     struct sockaddr_in udp_server_addr_;
+    RingbufHandle_t ring_buffer_ = nullptr;
+    TaskHandle_t sender_task_handle_ = nullptr;
+    std::atomic<uint32_t> tap_mask_{0};
+    std::atomic<uint32_t> sequence_{0};
+    std::atomic<uint32_t> sample_index_[kAudioDebugTapCount] = {};
+    std::atomic<uint32_t> dropped_frames_[kAudioDebugTapCount] = {};
+    int16_t adpcm_predictor_[kAudioDebugTapCount] = {};
+    uint8_t adpcm_index_[kAudioDebugTapCount] = {};
+    std::vector<uint8_t> send_buffer_;
+
+    void SenderTask();
+    size_t EncodeAdpcm(AudioDebugTap tap, const int16_t* pcm, size_t samples, uint8_t* output);
 };
 
-#endif 
\ No newline at end of file
+#endif
@@ -8,7 +8,7 @@ void NoAudioProcessor::Initialize(AudioCodec* codec, int frame_duration_ms) {
     frame_samples_ = frame_duration_ms * 16000 / 1000;
 }
 
-void NoAudioProcessor::Feed(std::vector<int16_t>&& data) {
+void NoAudioProcessor::Feed(std::vector<int16_t>&& data, int64_t capture_time_us) {
     if (!is_running_ || !output_callback_) {
         return;
     }
@@ -19,9 +19,9 @@ void NoAudioProcessor::Feed(std::vector<int16_t>&& data) {
         for (size_t i = 0, j = 0; i < mono_data.size(); ++i, j += 2) {
             mono_data[i] = data[j];
         }
-        output_callback_(std::move(mono_data));
+        output_callback_(std::move(mono_data), capture_time_us);
     } else {
-        output_callback_(std::move(data));
+        output_callback_(std::move(data), capture_time_us);
     }
 }
 
@@ -37,7 +37,7 @@ bool NoAudioProcessor::IsRunning() {
     return is_running_;
 }
 
-void NoAudioProcessor::OnOutput(std::function<void(std::vector<int16_t>&& data)> callback) {
+void NoAudioProcessor::OnOutput(std::function<void(std::vector<int16_t>&& data, int64_t capture_time_us)> callback) {
     output_callback_ = callback;
 }
 
@@ -13,11 +13,11 @@ public:
     ~NoAudioProcessor() = default;
 
     void Initialize(AudioCodec* codec, int frame_duration_ms) override;
-    void Feed(std::vector<int16_t>&& data) override;
+    void Feed(std::vector<int16_t>&& data, int64_t capture_time_us) override;
     void Start() override;
     void Stop() override;
     bool IsRunning() override;
-    void OnOutput(std::function<void(std::vector<int16_t>&& data)> callback) override;
+    void OnOutput(std::function<void(std::vector<int16_t>&& data, int64_t capture_time_us)> callback) override;
     void OnVadStateChange(std::function<void(bool speaking)> callback) override;
     size_t GetFeedSize() override;
     void EnableDeviceAec(bool enable) override;
@@ -25,7 +25,7 @@ public:
 private:
     AudioCodec* codec_ = nullptr;
     int frame_samples_ = 0;
-    std::function<void(std::vector<int16_t>&& data)> output_callback_;
+    std::function<void(std::vector<int16_t>&& data, int64_t capture_time_us)> output_callback_;
     std::function<void(bool speaking)> vad_state_change_callback_;
     bool is_running_ = false;
 };
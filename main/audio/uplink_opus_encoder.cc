@@ -0,0 +1,87 @@
+#include "uplink_opus_encoder.h"
+
+#include <opus.h>
+#include <esp_log.h>
+#include <algorithm>
+
+#define TAG "UplinkOpusEncoder"
+
+// Also the size of the MQTT UDP send buffer
+#define MAX_OPUS_PACKET_SIZE 1500
+
+UplinkOpusEncoder::UplinkOpusEncoder(int sample_rate, int channels, int duration_ms)
+    : sample_rate_(sample_rate), channels_(channels), duration_ms_(duration_ms),
+      frame_size_(sample_rate / 1000 * channels * duration_ms) {
+    int error;
+    encoder_ = opus_encoder_create(sample_rate, channels, OPUS_APPLICATION_VOIP, &error);
+    if (encoder_ == nullptr) {
+        ESP_LOGE(TAG, "Failed to create audio encoder, error code: %d", error);
+        return;
+    }
+
+    // Default DTX enabled
+    opus_encoder_ctl(encoder_, OPUS_SET_DTX(1));
+    opus_encoder_ctl(encoder_, OPUS_SET_INBAND_FEC(0));
+}
+
+UplinkOpusEncoder::~UplinkOpusEncoder() {
+    if (encoder_ != nullptr) {
+        opus_encoder_destroy(encoder_);
+    }
+}
+
+void UplinkOpusEncoder::SetComplexity(int complexity) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (encoder_ != nullptr) {
+        opus_encoder_ctl(encoder_, OPUS_SET_COMPLEXITY(complexity));
+    }
+}
+
+void UplinkOpusEncoder::SetPacketLoss(int percent) {
+    percent = std::clamp(percent, 0, 100);
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (encoder_ == nullptr || percent == packet_loss_) {
+        return;
+    }
+    if ((percent > 0) != (packet_loss_ > 0)) {
+        ESP_LOGI(TAG, "%s in-band FEC, packet loss %d%%", percent > 0 ? "Enabling" : "Disabling", percent);
+    }
+    packet_loss_ = percent;
+    opus_encoder_ctl(encoder_, OPUS_SET_INBAND_FEC(percent > 0 ? 1 : 0));
+    opus_encoder_ctl(encoder_, OPUS_SET_PACKET_LOSS_PERC(percent));
+}
+
+bool UplinkOpusEncoder::Encode(std::vector<int16_t>&& pcm, std::vector<uint8_t>& opus) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (encoder_ == nullptr) {
+        return false;
+    }
+
+    if (in_buffer_.empty() && (int)pcm.size() == frame_size_) {
+        in_buffer_ = std::move(pcm);
+    } else {
+        in_buffer_.insert(in_buffer_.end(), pcm.begin(), pcm.end());
+    }
+    if ((int)in_buffer_.size() < frame_size_) {
+        return false;
+    }
+
+    opus.resize(MAX_OPUS_PACKET_SIZE);
+    auto ret = opus_encode(encoder_, in_buffer_.data(), frame_size_ / channels_, opus.data(), opus.size());
+    in_buffer_.erase(in_buffer_.begin(), in_buffer_.begin() + frame_size_);
+    if (ret < 0) {
+        ESP_LOGE(TAG, "Failed to encode audio, error code: %d", ret);
+        opus.clear();
+        return false;
+    }
+    opus.resize(ret);
+    return true;
+}
+
+void UplinkOpusEncoder::ResetState() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (encoder_ != nullptr) {
+        opus_encoder_ctl(encoder_, OPUS_RESET_STATE);
+    }
+    in_buffer_.clear();
+}
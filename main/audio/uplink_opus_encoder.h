@@ -0,0 +1,45 @@
+#ifndef UPLINK_OPUS_ENCODER_H
+#define UPLINK_OPUS_ENCODER_H
+
+#include <cstdint>
+#include <vector>
+#include <mutex>
+
+struct OpusEncoder;
+
+/*
+ * Opus encoder for the uplink with in-band FEC.
+ *
+ * With FEC each packet also carries a low bitrate copy of the previous frame, so
+ * the server can rebuild a single lost packet from the one after it. FEC costs
+ * bitrate, so it is only turned on while the server reports loss on the path;
+ * the expected loss is passed to libopus, which scales the redundancy with it.
+ * OpusEncoderWrapper does not expose these controls, so this talks to libopus.
+ */
+class UplinkOpusEncoder {
+public:
+    UplinkOpusEncoder(int sample_rate, int channels, int duration_ms);
+    ~UplinkOpusEncoder();
+
+    inline int sample_rate() const { return sample_rate_; }
+    inline int duration_ms() const { return duration_ms_; }
+
+    void SetComplexity(int complexity);
+    // Loss reported by the server in percent, in-band FEC is on while it is above zero
+    void SetPacketLoss(int percent);
+    // Encodes one frame once enough samples are buffered, returns false while waiting for more
+    bool Encode(std::vector<int16_t>&& pcm, std::vector<uint8_t>& opus);
+    void ResetState();
+
+private:
+    std::mutex mutex_;
+    OpusEncoder* encoder_ = nullptr;
+    int sample_rate_;
+    int channels_;
+    int duration_ms_;
+    int frame_size_;
+    int packet_loss_ = 0;
+    std::vector<int16_t> in_buffer_;
+};
+
+#endif // UPLINK_OPUS_ENCODER_H
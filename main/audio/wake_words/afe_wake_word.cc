@@ -4,22 +4,21 @@
 #include <esp_log.h>
 #include <sstream>
 
-#define DETECTION_RUNNING_EVENT 1
-
 #define TAG "AfeWakeWord"
 
-AfeWakeWord::AfeWakeWord()
-    : afe_data_(nullptr),
+AfeWakeWord::AfeWakeWord(std::shared_ptr<AfeSession> session)
+    : session_(session),
       wake_word_pcm_(),
       wake_word_opus_() {
-
-    event_group_ = xEventGroupCreate();
+    if (session_ == nullptr) {
+        session_ = std::make_shared<AfeSession>();
+    }
+    session_->Require(AFE_STAGE_WAKENET | AFE_STAGE_AEC);
 }
 
 AfeWakeWord::~AfeWakeWord() {
-    if (afe_data_ != nullptr) {
-        afe_iface_->destroy(afe_data_);
-    }
+    session_->SetActive(kAfeConsumerWakeWord, false);
+    session_->Subscribe(kAfeConsumerWakeWord, nullptr);
 
     if (wake_word_encode_task_stack_ != nullptr) {
         heap_caps_free(wake_word_encode_task_stack_);
@@ -28,60 +27,42 @@ AfeWakeWord::~AfeWakeWord() {
     if (wake_word_encode_task_buffer_ != nullptr) {
         heap_caps_free(wake_word_encode_task_buffer_);
     }
-
-    if (models_ != nullptr) {
-        esp_srmodel_deinit(models_);
-    }
-
-    vEventGroupDelete(event_group_);
 }
 
 bool AfeWakeWord::Initialize(AudioCodec* codec) {
     codec_ = codec;
-    int ref_num = codec_->input_reference() ? 1 : 0;
 
-    models_ = esp_srmodel_init("model");
-    if (models_ == nullptr || models_->num == -1) {
+    uint32_t stages = AFE_STAGE_WAKENET;
+    if (codec_->input_reference()) {
+        stages |= AFE_STAGE_AEC;
+    }
+    if (!session_->Initialize(codec_)) {
         ESP_LOGE(TAG, "Failed to initialize wakenet model");
         return false;
     }
-    for (int i = 0; i < models_->num; i++) {
-        ESP_LOGI(TAG, "Model %d: %s", i, models_->model_name[i]);
-        if (strstr(models_->model_name[i], ESP_WN_PREFIX) != NULL) {
-            wakenet_model_ = models_->model_name[i];
-            auto words = esp_srmodel_get_wake_words(models_, wakenet_model_);
-            // split by ";" to get all wake words
-            std::stringstream ss(words);
-            std::string word;
-            while (std::getline(ss, word, ';')) {
-                wake_words_.push_back(word);
-            }
-        }
-    }
 
-    std::string input_format;
-    for (int i = 0; i < codec_->input_channels() - ref_num; i++) {
-        input_format.push_back('M');
+    auto models = session_->models();
+    for (int i = 0; i < models->num; i++) {
+        ESP_LOGI(TAG, "Model %d: %s", i, models->model_name[i]);
     }
-    for (int i = 0; i < ref_num; i++) {
-        input_format.push_back('R');
+    auto wakenet_model = session_->wakenet_model();
+    if (wakenet_model == nullptr) {
+        ESP_LOGE(TAG, "Failed to initialize wakenet model");
+        return false;
+    }
+    auto words = esp_srmodel_get_wake_words(models, (char*)wakenet_model);
+    // split by ";" to get all wake words
+    std::stringstream ss(words);
+    std::string word;
+    wake_words_.clear();
+    while (std::getline(ss, word, ';')) {
+        wake_words_.push_back(word);
     }
-    afe_config_t* afe_config = afe_config_init(input_format.c_str(), models_, AFE_TYPE_SR, AFE_MODE_HIGH_PERF);
-    afe_config->aec_init = codec_->input_reference();
-    afe_config->aec_mode = AEC_MODE_SR_HIGH_PERF;
-    afe_config->afe_perferred_core = 1;
-    afe_config->afe_perferred_priority = 1;
-    afe_config->memory_alloc_mode = AFE_MEMORY_ALLOC_MORE_PSRAM;
-    
-    afe_iface_ = esp_afe_handle_from_config(afe_config);
-    afe_data_ = afe_iface_->create_from_config(afe_config);
-
-    xTaskCreate([](void* arg) {
-        auto this_ = (AfeWakeWord*)arg;
-        this_->AudioDetectionTask();
-        vTaskDelete(NULL);
-    }, "audio_detection", 4096, this, 3, nullptr);
 
+    session_->SetConsumerStages(kAfeConsumerWakeWord, stages);
+    session_->Subscribe(kAfeConsumerWakeWord, [this](const afe_fetch_result_t* res, int64_t capture_time_us) {
+        OnFetch(res);
+    });
     return true;
 }
 
@@ -90,54 +71,31 @@ void AfeWakeWord::OnWakeWordDetected(std::function<void(const std::string& wake_
 }
 
 void AfeWakeWord::Start() {
-    xEventGroupSetBits(event_group_, DETECTION_RUNNING_EVENT);
+    session_->SetActive(kAfeConsumerWakeWord, true);
 }
 
 void AfeWakeWord::Stop() {
-    xEventGroupClearBits(event_group_, DETECTION_RUNNING_EVENT);
-    if (afe_data_ != nullptr) {
-        afe_iface_->reset_buffer(afe_data_);
-    }
+    session_->SetActive(kAfeConsumerWakeWord, false);
 }
 
 void AfeWakeWord::Feed(const std::vector<int16_t>& data) {
-    if (afe_data_ == nullptr) {
-        return;
-    }
-    afe_iface_->feed(afe_data_, data.data());
+    session_->Feed(data.data());
 }
 
 size_t AfeWakeWord::GetFeedSize() {
-    if (afe_data_ == nullptr) {
-        return 0;
-    }
-    return afe_iface_->get_feed_chunksize(afe_data_);
+    return session_->GetFeedSize();
 }
 
-void AfeWakeWord::AudioDetectionTask() {
-    auto fetch_size = afe_iface_->get_fetch_chunksize(afe_data_);
-    auto feed_size = afe_iface_->get_feed_chunksize(afe_data_);
-    ESP_LOGI(TAG, "Audio detection task started, feed size: %d fetch size: %d",
-        feed_size, fetch_size);
-
-    while (true) {
-        xEventGroupWaitBits(event_group_, DETECTION_RUNNING_EVENT, pdFALSE, pdTRUE, portMAX_DELAY);
-
-        auto res = afe_iface_->fetch_with_delay(afe_data_, portMAX_DELAY);
-        if (res == nullptr || res->ret_value == ESP_FAIL) {
-            continue;;
-        }
-
-        // Store the wake word data for voice recognition, like who is speaking
-        StoreWakeWordData(res->data, res->data_size / sizeof(int16_t));
+void AfeWakeWord::OnFetch(const afe_fetch_result_t* res) {
+    // Store the wake word data for voice recognition, like who is speaking
+    StoreWakeWordData(res->data, res->data_size / sizeof(int16_t));
 
-        if (res->wakeup_state == WAKENET_DETECTED) {
-            Stop();
-            last_detected_wake_word_ = wake_words_[res->wakenet_model_index - 1];
+    if (res->wakeup_state == WAKENET_DETECTED) {
+        Stop();
+        last_detected_wake_word_ = wake_words_[res->wakenet_model_index - 1];
 
-            if (wake_word_detected_callback_) {
-                wake_word_detected_callback_(last_detected_wake_word_);
-            }
+        if (wake_word_detected_callback_) {
+            wake_word_detected_callback_(last_detected_wake_word_);
         }
     }
 }
@@ -10,6 +10,7 @@
 #include <model_path.h>
 
 #include <deque>
+#include <memory>
 #include <string>
 #include <vector>
 #include <functional>
@@ -18,10 +19,12 @@
 
 #include "audio_codec.h"
 #include "wake_word.h"
+#include "processors/afe_session.h"
 
 class AfeWakeWord : public WakeWord {
 public:
-    AfeWakeWord();
+    // Pass a shared session to run on the same AFE as the audio processor
+    AfeWakeWord(std::shared_ptr<AfeSession> session = nullptr);
     ~AfeWakeWord();
 
     bool Initialize(AudioCodec* codec);
@@ -35,12 +38,8 @@ public:
     const std::string& GetLastDetectedWakeWord() const { return last_detected_wake_word_; }
 
 private:
-    srmodel_list_t *models_ = nullptr;
-    esp_afe_sr_iface_t* afe_iface_ = nullptr;
-    esp_afe_sr_data_t* afe_data_ = nullptr;
-    char* wakenet_model_ = NULL;
+    std::shared_ptr<AfeSession> session_;
     std::vector<std::string> wake_words_;
-    EventGroupHandle_t event_group_;
     std::function<void(const std::string& wake_word)> wake_word_detected_callback_;
     AudioCodec* codec_ = nullptr;
     std::string last_detected_wake_word_;
@@ -54,7 +53,7 @@ private:
     std::condition_variable wake_word_cv_;
 
     void StoreWakeWordData(const int16_t* data, size_t size);
-    void AudioDetectionTask();
+    void OnFetch(const afe_fetch_result_t* res);
 };
 
 #endif
@@ -196,6 +196,9 @@ private:
     }
 
     void InitializeButtons() {
+        middle_button_.OnPressDown([]() {
+            Application::GetInstance().PrewarmAudioChannel();
+        });
         middle_button_.OnClick([this]() {
             auto& app = Application::GetInstance();
 
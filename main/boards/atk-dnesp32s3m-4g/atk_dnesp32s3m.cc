@@ -62,6 +62,9 @@ private:
     }
 
     void InitializeButtons() {
+        boot_button_.OnPressDown([]() {
+            Application::GetInstance().PrewarmAudioChannel();
+        });
         boot_button_.OnClick([this]() {
             Application::GetInstance().ToggleChatState();
         });
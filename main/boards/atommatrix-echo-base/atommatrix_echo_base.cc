@@ -89,6 +89,9 @@ private:
 
 
     void InitializeButtons() {
+        face_button_.OnPressDown([]() {
+            Application::GetInstance().PrewarmAudioChannel();
+        });
         face_button_.OnClick([this]() {
 
             ESP_LOGI(TAG, "  ===>>>  face_button_.OnClick ");
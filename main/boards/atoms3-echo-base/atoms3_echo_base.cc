@@ -187,6 +187,9 @@ private:
         }
 
     void InitializeButtons() {
+        boot_button_.OnPressDown([]() {
+            Application::GetInstance().PrewarmAudioChannel();
+        });
         boot_button_.OnClick([this]() {
             auto& app = Application::GetInstance();
             if (app.GetDeviceState() == kDeviceStateStarting && !WifiStation::GetInstance().IsConnected()) {
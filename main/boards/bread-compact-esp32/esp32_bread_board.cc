@@ -108,6 +108,9 @@ private:
         };
         gpio_config(&io_conf);  // 应用配置
 
+        boot_button_.OnPressDown([]() {
+            Application::GetInstance().PrewarmAudioChannel();
+        });
         boot_button_.OnClick([this]() {
             auto& app = Application::GetInstance();
             if (app.GetDeviceState() == kDeviceStateStarting && !WifiStation::GetInstance().IsConnected()) {
@@ -117,6 +120,9 @@ private:
             app.ToggleChatState();
         });
 
+        asr_button_.OnPressDown([]() {
+            Application::GetInstance().PrewarmAudioChannel();
+        });
         asr_button_.OnClick([this]() {
             std::string wake_word="你好小智";
             Application::GetInstance().WakeWordInvoke(wake_word);
@@ -1,4 +1,5 @@
 #include "button.h"
+#include "application.h"
 
 #include <button_gpio.h>
 #include <esp_log.h>
@@ -91,6 +92,13 @@ void Button::OnClick(std::function<void()> callback) {
             button->on_click_();
         }
     }, this);
+
+#if CONFIG_AUDIO_CHANNEL_POLICY_SPECULATIVE || CONFIG_AUDIO_CHANNEL_POLICY_PERSISTENT
+    // The click is reported on release, start the handshake as soon as the button goes down
+    iot_button_register_cb(button_handle_, BUTTON_PRESS_DOWN, nullptr, [](void* handle, void* usr_data) {
+        Application::GetInstance().PrewarmAudioChannel();
+    }, nullptr);
+#endif
 }
 
 void Button::OnDoubleClick(std::function<void()> callback) {
@@ -4,20 +4,53 @@
 #include "assets/lang_config.h"
 #include "settings.h"
 #include <esp_log.h>
+#include <ssid_manager.h>
 
 static const char *TAG = "DualNetworkBoard";
 
-DualNetworkBoard::DualNetworkBoard(gpio_num_t ml307_tx_pin, gpio_num_t ml307_rx_pin, gpio_num_t ml307_dtr_pin, int32_t default_net_type) 
-    : Board(), 
-      ml307_tx_pin_(ml307_tx_pin), 
-      ml307_rx_pin_(ml307_rx_pin), 
+static const char* GetNetworkName(NetworkType type) {
+    return type == NetworkType::WIFI ? "WiFi" : "4G";
+}
+
+static NetworkType GetOtherNetwork(NetworkType type) {
+    return type == NetworkType::WIFI ? NetworkType::ML307 : NetworkType::WIFI;
+}
+
+DualNetworkBoard::DualNetworkBoard(gpio_num_t ml307_tx_pin, gpio_num_t ml307_rx_pin, gpio_num_t ml307_dtr_pin, int32_t default_net_type)
+    : Board(),
+      ml307_tx_pin_(ml307_tx_pin),
+      ml307_rx_pin_(ml307_rx_pin),
       ml307_dtr_pin_(ml307_dtr_pin) {
-    
+
     // 从Settings加载网络类型
     network_type_ = LoadNetworkTypeFromSettings(default_net_type);
-    
-    // 只初始化当前网络类型对应的板卡
-    InitializeCurrentBoard();
+    preferred_type_ = network_type_;
+
+    InitializeBoards();
+
+    esp_timer_create_args_t probe_timer_args = {
+        .callback = [](void* arg) {
+            auto board = (DualNetworkBoard*)arg;
+            if (!board->probe_pending_.exchange(true)) {
+                Application::GetInstance().Schedule([board]() {
+                    board->probe_pending_ = false;
+                    board->ProbeNetwork();
+                });
+            }
+        },
+        .arg = this,
+        .dispatch_method = ESP_TIMER_TASK,
+        .name = "network_probe",
+        .skip_unhandled_events = true
+    };
+    esp_timer_create(&probe_timer_args, &probe_timer_);
+}
+
+DualNetworkBoard::~DualNetworkBoard() {
+    if (probe_timer_ != nullptr) {
+        esp_timer_stop(probe_timer_);
+        esp_timer_delete(probe_timer_);
+    }
 }
 
 NetworkType DualNetworkBoard::LoadNetworkTypeFromSettings(int32_t default_net_type) {
@@ -32,62 +65,253 @@ void DualNetworkBoard::SaveNetworkTypeToSettings(NetworkType type) {
     settings.SetInt("type", network_type);
 }
 
-void DualNetworkBoard::InitializeCurrentBoard() {
-    if (network_type_ == NetworkType::ML307) {
-        ESP_LOGI(TAG, "Initialize ML307 board");
-        current_board_ = std::make_unique<Ml307Board>(ml307_tx_pin_, ml307_rx_pin_, ml307_dtr_pin_);
-    } else {
-        ESP_LOGI(TAG, "Initialize WiFi board");
-        current_board_ = std::make_unique<WifiBoard>();
+void DualNetworkBoard::InitializeBoards() {
+    // The network stacks only allocate memory when they are started
+    ESP_LOGI(TAG, "Initialize WiFi and ML307 boards, current network %s", GetNetworkName(network_type_));
+    wifi_board_ = std::make_unique<WifiBoard>();
+    ml307_board_ = std::make_unique<Ml307Board>(ml307_tx_pin_, ml307_rx_pin_, ml307_dtr_pin_);
+    current_board_ = GetBoard(network_type_);
+}
+
+Board* DualNetworkBoard::GetBoard(NetworkType type) const {
+    if (type == NetworkType::WIFI) {
+        return wifi_board_.get();
+    }
+    return ml307_board_.get();
+}
+
+bool DualNetworkBoard::IsNetworkReady(NetworkType type) const {
+    if (type == NetworkType::WIFI) {
+        return wifi_started_ && wifi_board_->IsNetworkReady();
+    }
+    return ml307_board_->IsNetworkReady();
+}
+
+bool DualNetworkBoard::StartLink(NetworkType type, int timeout_ms, std::unique_ptr<AtModem>& modem) {
+    if (type == NetworkType::ML307) {
+        return ml307_board_->StartModem(timeout_ms, modem);
+    }
+    // Once started, the station keeps reconnecting and rescanning by itself
+    if (wifi_started_) {
+        return wifi_board_->IsNetworkReady();
+    }
+    if (SsidManager::GetInstance().GetSsidList().empty()) {
+        return false;
     }
+    wifi_started_ = true;
+    return wifi_board_->StartStation(timeout_ms, false);
 }
 
 void DualNetworkBoard::SwitchNetworkType() {
-    auto display = GetDisplay();
-    if (network_type_ == NetworkType::WIFI) {    
-        SaveNetworkTypeToSettings(NetworkType::ML307);
-        display->ShowNotification(Lang::Strings::SWITCH_TO_4G_NETWORK);
-    } else {
-        SaveNetworkTypeToSettings(NetworkType::WIFI);
-        display->ShowNotification(Lang::Strings::SWITCH_TO_WIFI_NETWORK);
+#if CONFIG_DUAL_NETWORK_AUTO_FAILOVER
+    // Called from the button tasks, the switching state belongs to the main loop. Before the
+    // network is up, StartNetwork may be blocked in either stack, which still takes a reboot
+    if (network_started_) {
+        Application::GetInstance().Schedule([this]() {
+            SwitchPreferredNetwork();
+        });
+        return;
     }
+#endif
+    auto type = GetOtherNetwork(network_type_);
+    SaveNetworkTypeToSettings(type);
+    GetDisplay()->ShowNotification(type == NetworkType::ML307 ? Lang::Strings::SWITCH_TO_4G_NETWORK : Lang::Strings::SWITCH_TO_WIFI_NETWORK);
     vTaskDelay(pdMS_TO_TICKS(1000));
     auto& app = Application::GetInstance();
     app.Reboot();
 }
 
- 
+void DualNetworkBoard::SwitchPreferredNetwork() {
+    auto type = GetOtherNetwork(network_type_);
+    SaveNetworkTypeToSettings(type);
+    preferred_type_ = type;
+    GetDisplay()->ShowNotification(type == NetworkType::ML307 ? Lang::Strings::SWITCH_TO_4G_NETWORK : Lang::Strings::SWITCH_TO_WIFI_NETWORK);
+
+    // WiFi without a saved SSID needs the configuration mode
+    if (type == NetworkType::WIFI && SsidManager::GetInstance().GetSsidList().empty()) {
+        Application::GetInstance().Reboot();
+        return;
+    }
+    if (IsNetworkReady(type)) {
+        SwitchTo(type);
+    } else {
+        StartStandbyNetwork();
+    }
+}
+
+void DualNetworkBoard::StartStandbyNetwork() {
+    if (standby_starting_) {
+        return;
+    }
+    standby_starting_ = true;
+    standby_type_ = GetOtherNetwork(network_type_);
+    // The task only connects, the result is handled in the main loop
+    auto ret = xTaskCreate([](void* arg) {
+        auto board = (DualNetworkBoard*)arg;
+        auto type = board->standby_type_;
+        auto start_time = esp_timer_get_time();
+        std::unique_ptr<AtModem> modem;
+        bool ready = board->StartLink(type, DUAL_NETWORK_STANDBY_TIMEOUT_MS, modem);
+        ESP_LOGI(TAG, "Standby network %s %s in %d ms", GetNetworkName(type), ready ? "ready" : "not ready",
+            (int)((esp_timer_get_time() - start_time) / 1000));
+        Application::GetInstance().Schedule([board, type, ready, modem = modem.release()]() {
+            board->HandleStandbyResult(type, ready, std::unique_ptr<AtModem>(modem));
+        });
+        vTaskDelete(NULL);
+    }, "network_standby", 4096, this, 2, nullptr);
+    if (ret != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create the standby network task");
+        standby_starting_ = false;
+    }
+}
+
+void DualNetworkBoard::HandleStandbyResult(NetworkType type, bool ready, std::unique_ptr<AtModem> modem) {
+    standby_starting_ = false;
+    // A modem detected by the standby task is kept even if the network is not ready yet,
+    // the next attempt only waits for it again
+    if (modem != nullptr) {
+        ml307_board_->SetModem(std::move(modem));
+    }
+    if (!ready || type == network_type_) {
+        return;
+    }
+    // Move right away if the user asked for it or the current network is still down
+    if (type == preferred_type_ || !IsNetworkReady(network_type_)) {
+        SwitchTo(type);
+    }
+}
+
+void DualNetworkBoard::ProbeNetwork() {
+    auto type = network_type_.load();
+    if (IsNetworkReady(type)) {
+        if (down_probes_ > 0) {
+            ESP_LOGI(TAG, "%s network recovered after %d ms", GetNetworkName(type),
+                (int)((esp_timer_get_time() - link_down_since_us_) / 1000));
+            down_probes_ = 0;
+        }
+        // Fail back only while idle, a session keeps the network it is running on
+        if (type != preferred_type_ && IsNetworkReady(preferred_type_)) {
+            preferred_up_probes_++;
+            if (preferred_up_probes_ >= DUAL_NETWORK_FAILBACK_PROBES &&
+                Application::GetInstance().GetDeviceState() == kDeviceStateIdle) {
+                SwitchTo(preferred_type_);
+            }
+        } else {
+            preferred_up_probes_ = 0;
+        }
+        return;
+    }
+
+    if (down_probes_++ == 0) {
+        link_down_since_us_ = esp_timer_get_time();
+        ESP_LOGW(TAG, "%s network is down", GetNetworkName(type));
+    }
+    if (down_probes_ < DUAL_NETWORK_FAILOVER_PROBES) {
+        return;
+    }
+
+    auto standby = GetOtherNetwork(type);
+    if (IsNetworkReady(standby)) {
+        SwitchTo(standby);
+    } else {
+        StartStandbyNetwork();
+    }
+}
+
+void DualNetworkBoard::SwitchTo(NetworkType type) {
+    if (network_type_ != type) {
+        auto old_board = current_board_.load();
+        network_type_ = type;
+        current_board_ = GetBoard(type);
+        // Let the standby WiFi save power, it may still serve as a failover target
+        old_board->SetPowerSaveMode(true);
+
+        auto display = GetDisplay();
+        display->ShowNotification(type == NetworkType::ML307 ? Lang::Strings::SWITCH_TO_4G_NETWORK : Lang::Strings::SWITCH_TO_WIFI_NETWORK);
+        display->UpdateStatusBar(true);
+
+        // The protocol reconnects through GetNetwork(), which now returns the new network.
+        // The connects run on their own tasks, the main loop does not wait for them
+        Application::GetInstance().MigrateNetwork();
+        failovers_++;
+        if (down_probes_ > 0) {
+            ESP_LOGI(TAG, "Failed over to %s, %d ms after the link went down, %d switches",
+                GetNetworkName(type), (int)((esp_timer_get_time() - link_down_since_us_) / 1000), failovers_);
+        } else {
+            ESP_LOGI(TAG, "Switched to %s, %d switches", GetNetworkName(type), failovers_);
+        }
+    }
+    down_probes_ = 0;
+    preferred_up_probes_ = 0;
+}
+
 std::string DualNetworkBoard::GetBoardType() {
-    return current_board_->GetBoardType();
+    return current_board_.load()->GetBoardType();
 }
 
 void DualNetworkBoard::StartNetwork() {
     auto display = Board::GetInstance().GetDisplay();
-    
+
     if (network_type_ == NetworkType::WIFI) {
         display->SetStatus(Lang::Strings::CONNECTING);
     } else {
         display->SetStatus(Lang::Strings::DETECTING_MODULE);
     }
-    current_board_->StartNetwork();
+
+#if CONFIG_DUAL_NETWORK_AUTO_FAILOVER
+    // A saved WiFi that can not be reached at boot falls back to 4G instead of the configuration mode
+    if (network_type_ == NetworkType::WIFI && !wifi_board_->wifi_config_mode() &&
+        !SsidManager::GetInstance().GetSsidList().empty()) {
+        wifi_started_ = true;
+        if (!wifi_board_->StartStation(60 * 1000, true)) {
+            ESP_LOGW(TAG, "WiFi is not available, trying 4G");
+            display->SetStatus(Lang::Strings::DETECTING_MODULE);
+            // Nothing else reads the modem before the network is started
+            std::unique_ptr<AtModem> modem;
+            bool ready = ml307_board_->StartModem(DUAL_NETWORK_STANDBY_TIMEOUT_MS, modem);
+            if (modem != nullptr) {
+                ml307_board_->SetModem(std::move(modem));
+            }
+            if (!ready) {
+                // Neither network works, configure the WiFi as before
+                wifi_board_->ResetWifiConfiguration();
+                return;
+            }
+            network_type_ = NetworkType::ML307;
+            current_board_ = ml307_board_.get();
+        }
+    } else {
+        current_board_.load()->StartNetwork();
+        wifi_started_ = network_type_ == NetworkType::WIFI;
+    }
+
+    network_started_ = true;
+    esp_timer_start_periodic(probe_timer_, DUAL_NETWORK_PROBE_INTERVAL_MS * 1000);
+#if CONFIG_DUAL_NETWORK_HOT_STANDBY
+    StartStandbyNetwork();
+#endif
+#else
+    current_board_.load()->StartNetwork();
+    network_started_ = true;
+#endif
 }
 
 NetworkInterface* DualNetworkBoard::GetNetwork() {
-    return current_board_->GetNetwork();
+    return current_board_.load()->GetNetwork();
 }
 
 const char* DualNetworkBoard::GetNetworkStateIcon() {
-    return current_board_->GetNetworkStateIcon();
+    return current_board_.load()->GetNetworkStateIcon();
 }
 
 void DualNetworkBoard::SetPowerSaveMode(bool enabled) {
-    current_board_->SetPowerSaveMode(enabled);
+    current_board_.load()->SetPowerSaveMode(enabled);
 }
 
-std::string DualNetworkBoard::GetBoardJson() {   
-    return current_board_->GetBoardJson();
+std::string DualNetworkBoard::GetBoardJson() {
+    return current_board_.load()->GetBoardJson();
 }
 
 std::string DualNetworkBoard::GetDeviceStatusJson() {
-    return current_board_->GetDeviceStatusJson();
+    return current_board_.load()->GetDeviceStatusJson();
 }
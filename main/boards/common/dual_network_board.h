@@ -4,7 +4,16 @@
 #include "board.h"
 #include "wifi_board.h"
 #include "ml307_board.h"
+#include <esp_timer.h>
 #include <memory>
+#include <atomic>
+
+// 每秒探测一次当前网络，连续 3 次断开时切换，首选网络恢复 10 秒且设备空闲时切回
+#define DUAL_NETWORK_PROBE_INTERVAL_MS 1000
+#define DUAL_NETWORK_FAILOVER_PROBES 3
+#define DUAL_NETWORK_FAILBACK_PROBES 10
+// 备用网络的最长连接时间
+#define DUAL_NETWORK_STANDBY_TIMEOUT_MS 30000
 
 //enum NetworkType
 enum class NetworkType {
@@ -15,37 +24,70 @@ enum class NetworkType {
 // 双网络板卡类，可以在WiFi和ML307之间切换
 class DualNetworkBoard : public Board {
 private:
-    // 使用基类指针存储当前活动的板卡
-    std::unique_ptr<Board> current_board_;
-    NetworkType network_type_ = NetworkType::ML307;  // Default to ML307
+    // 两个网络都可以在运行时使用，current_board_ 指向当前活动的板卡
+    // 切换只在主循环中进行，其他任务只读取这两个原子变量
+    std::unique_ptr<WifiBoard> wifi_board_;
+    std::unique_ptr<Ml307Board> ml307_board_;
+    std::atomic<Board*> current_board_ = nullptr;
+    std::atomic<NetworkType> network_type_ = NetworkType::ML307;  // Default to ML307
+    // 保存在Settings中的首选网络，故障切换后会在空闲时切回，只在主循环中使用
+    NetworkType preferred_type_ = NetworkType::ML307;
 
     // ML307的引脚配置
     gpio_num_t ml307_tx_pin_;
     gpio_num_t ml307_rx_pin_;
     gpio_num_t ml307_dtr_pin_;
-    
+
+    std::atomic<bool> network_started_ = false;
+    // 由备用网络任务写入
+    std::atomic<bool> wifi_started_ = false;
+    // 探测已提交到主循环，主循环繁忙时跳过探测而不是堆积
+    std::atomic<bool> probe_pending_ = false;
+    esp_timer_handle_t probe_timer_ = nullptr;
+    // 以下状态只在主循环中使用，standby_type_ 在创建备用网络任务前写入
+    bool standby_starting_ = false;
+    NetworkType standby_type_ = NetworkType::WIFI;
+    int down_probes_ = 0;
+    int preferred_up_probes_ = 0;
+    int64_t link_down_since_us_ = 0;
+    int failovers_ = 0;
+
     // 从Settings加载网络类型
     NetworkType LoadNetworkTypeFromSettings(int32_t default_net_type);
-    
+
     // 保存网络类型到Settings
     void SaveNetworkTypeToSettings(NetworkType type);
 
-    // 初始化当前网络类型对应的板卡
-    void InitializeCurrentBoard();
- 
+    // 初始化两个网络对应的板卡
+    void InitializeBoards();
+
+    Board* GetBoard(NetworkType type) const;
+    bool IsNetworkReady(NetworkType type) const;
+    // 连接指定网络，不进入配网模式，也不会一直阻塞，新检测到的ML307模组通过 modem 返回
+    bool StartLink(NetworkType type, int timeout_ms, std::unique_ptr<AtModem>& modem);
+    // 在后台任务中连接备用网络，结果交回主循环处理
+    void StartStandbyNetwork();
+    void HandleStandbyResult(NetworkType type, bool ready, std::unique_ptr<AtModem> modem);
+    // 定时探测当前网络，决定是否切换，在主循环中运行
+    void ProbeNetwork();
+    // 在主循环中切换首选网络
+    void SwitchPreferredNetwork();
+    // 在主循环中切换到指定网络，并把连接迁移过去
+    void SwitchTo(NetworkType type);
+
 public:
     DualNetworkBoard(gpio_num_t ml307_tx_pin, gpio_num_t ml307_rx_pin, gpio_num_t ml307_dtr_pin = GPIO_NUM_NC, int32_t default_net_type = 1);
-    virtual ~DualNetworkBoard() = default;
- 
-    // 切换网络类型
+    virtual ~DualNetworkBoard();
+
+    // 切换网络类型，网络启动后无需重启
     void SwitchNetworkType();
-    
+
     // 获取当前网络类型
     NetworkType GetNetworkType() const { return network_type_; }
-    
+
     // 获取当前活动的板卡引用
-    Board& GetCurrentBoard() const { return *current_board_; }
-    
+    Board& GetCurrentBoard() const { return *current_board_.load(); }
+
     // 重写Board接口
     virtual std::string GetBoardType() override;
     virtual void StartNetwork() override;
@@ -56,4 +98,4 @@ public:
     virtual std::string GetDeviceStatusJson() override;
 };
 
-#endif // DUAL_NETWORK_BOARD_H 
\ No newline at end of file
+#endif // DUAL_NETWORK_BOARD_H
\ No newline at end of file
@@ -68,6 +68,31 @@ void Ml307Board::StartNetwork() {
     ESP_LOGI(TAG, "ML307 ICCID: %s", iccid.c_str());
 }
 
+bool Ml307Board::StartModem(int timeout_ms, std::unique_ptr<AtModem>& detected) {
+    // modem_ is only written by SetModem on the main loop, which waits for this result first
+    auto modem = modem_.get();
+    if (modem == nullptr) {
+        detected = AtModem::Detect(tx_pin_, rx_pin_, dtr_pin_, 921600);
+        if (detected == nullptr) {
+            ESP_LOGW(TAG, "ML307 modem not detected");
+            return false;
+        }
+        detected->OnNetworkStateChanged([](bool network_ready) {
+            ESP_LOGI(TAG, "Network is %s", network_ready ? "ready" : "down");
+        });
+        modem = detected.get();
+    }
+    return modem->WaitForNetworkReady(timeout_ms) == NetworkStatus::Ready;
+}
+
+void Ml307Board::SetModem(std::unique_ptr<AtModem> modem) {
+    modem_ = std::move(modem);
+}
+
+bool Ml307Board::IsNetworkReady() const {
+    return modem_ != nullptr && modem_->network_ready();
+}
+
 NetworkInterface* Ml307Board::GetNetwork() {
     return modem_.get();
 }
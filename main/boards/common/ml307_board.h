@@ -24,6 +24,12 @@ public:
     virtual void SetPowerSaveMode(bool enabled) override;
     virtual AudioCodec* GetAudioCodec() override { return nullptr; }
     virtual std::string GetDeviceStatusJson() override;
+    // Detect the modem and wait for the network without blocking forever or alerting the user.
+    // Runs on other tasks while the main loop reads modem_, so a newly detected modem is only
+    // returned in detected, the main loop hands it over with SetModem
+    bool StartModem(int timeout_ms, std::unique_ptr<AtModem>& detected);
+    void SetModem(std::unique_ptr<AtModem> modem);
+    bool IsNetworkReady() const;
 };
 
 #endif // ML307_BOARD_H
@@ -84,35 +84,48 @@ void WifiBoard::StartNetwork() {
         return;
     }
 
-    auto& wifi_station = WifiStation::GetInstance();
-    wifi_station.OnScanBegin([this]() {
-        auto display = Board::GetInstance().GetDisplay();
-        display->ShowNotification(Lang::Strings::SCANNING_WIFI, 30000);
-    });
-    wifi_station.OnConnect([this](const std::string& ssid) {
-        auto display = Board::GetInstance().GetDisplay();
-        std::string notification = Lang::Strings::CONNECT_TO;
-        notification += ssid;
-        notification += "...";
-        display->ShowNotification(notification.c_str(), 30000);
-    });
-    wifi_station.OnConnected([this](const std::string& ssid) {
-        auto display = Board::GetInstance().GetDisplay();
-        std::string notification = Lang::Strings::CONNECTED_TO;
-        notification += ssid;
-        display->ShowNotification(notification.c_str(), 30000);
-    });
-    wifi_station.Start();
-
     // Try to connect to WiFi, if failed, launch the WiFi configuration AP
-    if (!wifi_station.WaitForConnected(60 * 1000)) {
-        wifi_station.Stop();
+    if (!StartStation(60 * 1000, true)) {
+        WifiStation::GetInstance().Stop();
         wifi_config_mode_ = true;
         EnterWifiConfigMode();
         return;
     }
 }
 
+bool WifiBoard::StartStation(int timeout_ms, bool notify) {
+    if (SsidManager::GetInstance().GetSsidList().empty()) {
+        return false;
+    }
+
+    auto& wifi_station = WifiStation::GetInstance();
+    if (notify) {
+        wifi_station.OnScanBegin([this]() {
+            auto display = Board::GetInstance().GetDisplay();
+            display->ShowNotification(Lang::Strings::SCANNING_WIFI, 30000);
+        });
+        wifi_station.OnConnect([this](const std::string& ssid) {
+            auto display = Board::GetInstance().GetDisplay();
+            std::string notification = Lang::Strings::CONNECT_TO;
+            notification += ssid;
+            notification += "...";
+            display->ShowNotification(notification.c_str(), 30000);
+        });
+        wifi_station.OnConnected([this](const std::string& ssid) {
+            auto display = Board::GetInstance().GetDisplay();
+            std::string notification = Lang::Strings::CONNECTED_TO;
+            notification += ssid;
+            display->ShowNotification(notification.c_str(), 30000);
+        });
+    }
+    wifi_station.Start();
+    return wifi_station.WaitForConnected(timeout_ms);
+}
+
+bool WifiBoard::IsNetworkReady() {
+    return !wifi_config_mode_ && WifiStation::GetInstance().IsConnected();
+}
+
 NetworkInterface* WifiBoard::GetNetwork() {
     static EspNetwork network;
     return &network;
@@ -17,6 +17,10 @@ public:
     virtual const char* GetNetworkStateIcon() override;
     virtual void SetPowerSaveMode(bool enabled) override;
     virtual void ResetWifiConfiguration();
+    // Connect to a saved WiFi without entering the configuration mode on failure
+    bool StartStation(int timeout_ms, bool notify);
+    bool IsNetworkReady();
+    bool wifi_config_mode() const { return wifi_config_mode_; }
     virtual AudioCodec* GetAudioCodec() override { return nullptr; }
     virtual std::string GetDeviceStatusJson() override;
 };
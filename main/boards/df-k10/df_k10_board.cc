@@ -119,6 +119,9 @@ private:
             return !instance_->IoExpanderGetLevel(IO_EXPANDER_PIN_NUM_2);
         };
         ESP_ERROR_CHECK(iot_button_create(&btn_a_config, btn_a_driver_, &btn_a));
+        iot_button_register_cb(btn_a, BUTTON_PRESS_DOWN, nullptr, [](void* button_handle, void* usr_data) {
+            Application::GetInstance().PrewarmAudioChannel();
+        }, nullptr);
         iot_button_register_cb(btn_a, BUTTON_SINGLE_CLICK, nullptr, [](void* button_handle, void* usr_data) {
             auto self = static_cast<Df_K10Board*>(usr_data);
             auto& app = Application::GetInstance();
@@ -149,6 +152,9 @@ private:
             return !instance_->IoExpanderGetLevel(IO_EXPANDER_PIN_NUM_12);
         };
         ESP_ERROR_CHECK(iot_button_create(&btn_b_config, btn_b_driver_, &btn_b));
+        iot_button_register_cb(btn_b, BUTTON_PRESS_DOWN, nullptr, [](void* button_handle, void* usr_data) {
+            Application::GetInstance().PrewarmAudioChannel();
+        }, nullptr);
         iot_button_register_cb(btn_b, BUTTON_SINGLE_CLICK, nullptr, [](void* button_handle, void* usr_data) {
             auto self = static_cast<Df_K10Board*>(usr_data);
             auto& app = Application::GetInstance();
@@ -24,6 +24,9 @@ private:
     void InitializeButtons() {
         click_times = 0;
         check_time = 0;
+        boot_button_.OnPressDown([]() {
+            Application::GetInstance().PrewarmAudioChannel();
+        });
         boot_button_.OnClick([this]() {
             if(click_times==0) {
                 check_time = esp_timer_get_time()/1000;
@@ -150,7 +150,9 @@ private:
         });
 
         auto break_button = adc_button_[BSP_ADC_BUTTON_ENTER];
+        break_button->OnPressDown([]() {Application::GetInstance().PrewarmAudioChannel();});
         break_button->OnClick([this]() {TogleState();});
+        boot_button_.OnPressDown([]() {Application::GetInstance().PrewarmAudioChannel();});
         boot_button_.OnClick([this]() {TogleState();});
     }
 
@@ -169,6 +169,9 @@ private:
         static int64_t last_trigger_time = 0;
         static int gesture_state = 0;  // 0: init, 1: wait second long interval, 2: wait oscillation
 
+        boot_button_.OnPressDown([]() {
+            Application::GetInstance().PrewarmAudioChannel();
+        });
         boot_button_.OnClick([this]() {
             auto &app = Application::GetInstance();
             if (app.GetDeviceState() == kDeviceStateStarting && !WifiStation::GetInstance().IsConnected()) {
@@ -398,7 +401,7 @@ public:
         InitializeLcdDisplay();
         InitializeTools();
 
-        DeviceStateEventManager::GetInstance().RegisterStateChangeCallback([this](DeviceState previous_state, DeviceState current_state) {
+        DeviceStateEventManager::GetInstance().Subscribe("esp_hi_speaker", kEventDeliveryDeferred, [this](DeviceState previous_state, DeviceState current_state) {
             ESP_LOGD(TAG, "Device state changed from %d to %d", previous_state, current_state);
             this->GetAudioCodec()->EnableOutput(current_state == kDeviceStateSpeaking);
         });
@@ -88,6 +88,9 @@ private:
             ResetWifiConfiguration();
         });
 
+        key_button_.OnPressDown([]() {
+            Application::GetInstance().PrewarmAudioChannel();
+        });
         key_button_.OnClick([this]() {
             auto& app = Application::GetInstance();
             app.ToggleChatState();
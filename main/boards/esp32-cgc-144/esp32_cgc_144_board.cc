@@ -135,6 +135,9 @@ void InitializePowerManager() {
  
     void InitializeButtons() {
         
+        boot_button_.OnPressDown([]() {
+            Application::GetInstance().PrewarmAudioChannel();
+        });
         boot_button_.OnClick([this]() {
             power_save_timer_->WakeUp();
             auto& app = Application::GetInstance();
@@ -144,6 +147,9 @@ void InitializePowerManager() {
             app.ToggleChatState();
         });
 
+        asr_button_.OnPressDown([]() {
+            Application::GetInstance().PrewarmAudioChannel();
+        });
         asr_button_.OnClick([this]() {
             power_save_timer_->WakeUp();
             std::string wake_word="你好小智";
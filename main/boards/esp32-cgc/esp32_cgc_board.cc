@@ -136,6 +136,9 @@ private:
  
     void InitializeButtons() {
         
+        boot_button_.OnPressDown([]() {
+            Application::GetInstance().PrewarmAudioChannel();
+        });
         boot_button_.OnClick([this]() {
             auto& app = Application::GetInstance();
             if (app.GetDeviceState() == kDeviceStateStarting && !WifiStation::GetInstance().IsConnected()) {
@@ -144,6 +147,9 @@ private:
             app.ToggleChatState();
         });
 
+        asr_button_.OnPressDown([]() {
+            Application::GetInstance().PrewarmAudioChannel();
+        });
         asr_button_.OnClick([this]() {
             std::string wake_word="你好小智";
             Application::GetInstance().WakeWordInvoke(wake_word);
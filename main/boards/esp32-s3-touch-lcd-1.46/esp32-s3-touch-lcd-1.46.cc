@@ -175,6 +175,9 @@ private:
             return !gpio_get_level(BOOT_BUTTON_GPIO);
         };
         ESP_ERROR_CHECK(iot_button_create(&boot_btn_config, boot_btn_driver_, &boot_btn));
+        iot_button_register_cb(boot_btn, BUTTON_PRESS_DOWN, nullptr, [](void* button_handle, void* usr_data) {
+            Application::GetInstance().PrewarmAudioChannel();
+        }, nullptr);
         iot_button_register_cb(boot_btn, BUTTON_SINGLE_CLICK, nullptr, [](void* button_handle, void* usr_data) {
             auto self = static_cast<CustomBoard*>(usr_data);
             auto& app = Application::GetInstance();
@@ -182,6 +182,7 @@ private:
         // 高电平有效长按关机逻辑
         pwr_button_.OnPressDown([this]() {
             pwrbutton_unreleased = false;
+            Application::GetInstance().PrewarmAudioChannel();
         });
         pwr_button_.OnLongPress([this]()
                                 {
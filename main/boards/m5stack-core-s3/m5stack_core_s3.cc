@@ -212,6 +212,7 @@ private:
         if (touch_point.num > 0 && !was_touched) {
             was_touched = true;
             touch_start_time = esp_timer_get_time() / 1000; // 转换为毫秒
+            Application::GetInstance().PrewarmAudioChannel();
         } 
         // 检测触摸释放
         else if (touch_point.num == 0 && was_touched) {
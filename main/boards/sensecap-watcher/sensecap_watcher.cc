@@ -249,6 +249,9 @@ private:
         
         ESP_ERROR_CHECK(iot_button_create(&btn_config, btn_driver_, &btns));
         
+        iot_button_register_cb(btns, BUTTON_PRESS_DOWN, nullptr, [](void* button_handle, void* usr_data) {
+            Application::GetInstance().PrewarmAudioChannel();
+        }, nullptr);
         iot_button_register_cb(btns, BUTTON_SINGLE_CLICK, nullptr, [](void* button_handle, void* usr_data) {
             auto self = static_cast<SensecapWatcher*>(usr_data);
             auto& app = Application::GetInstance();
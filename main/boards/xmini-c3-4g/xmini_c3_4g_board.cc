@@ -153,6 +153,8 @@ private:
         boot_button_.OnPressDown([this]() {
             if (press_to_talk_tool_ && press_to_talk_tool_->IsPressToTalkEnabled()) {
                 Application::GetInstance().StartListening();
+            } else {
+                Application::GetInstance().PrewarmAudioChannel();
             }
         });
         boot_button_.OnPressUp([this]() {
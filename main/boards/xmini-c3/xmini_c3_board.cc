@@ -137,6 +137,8 @@ private:
             }
             if (press_to_talk_tool_ && press_to_talk_tool_->IsPressToTalkEnabled()) {
                 Application::GetInstance().StartListening();
+            } else {
+                Application::GetInstance().PrewarmAudioChannel();
             }
         });
         boot_button_.OnPressUp([this]() {
@@ -0,0 +1,179 @@
+#include "boot_sequence.h"
+
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <cJSON.h>
+#include <cstring>
+#include <algorithm>
+#include <chrono>
+#include <utility>
+
+#define TAG "BootSequence"
+
+void BootSequence::AddPhase(const char* name, std::initializer_list<const char*> dependencies, std::function<void()> run) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (running_) {
+        ESP_LOGE(TAG, "Cannot add phase %s while the boot sequence is running", name);
+        return;
+    }
+    Phase phase;
+    phase.name = name;
+    phase.dependencies = dependencies;
+    phase.run = std::move(run);
+    phases_.push_back(std::move(phase));
+}
+
+BootSequence::Phase* BootSequence::FindPhase(const char* name) {
+    for (auto& phase : phases_) {
+        if (strcmp(phase.name, name) == 0) {
+            return &phase;
+        }
+    }
+    return nullptr;
+}
+
+bool BootSequence::IsReady(const Phase& phase) {
+    for (auto dependency : phase.dependencies) {
+        auto other = FindPhase(dependency);
+        if (other != nullptr && other->state != kPhaseStateDone) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void BootSequence::Run() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    running_ = true;
+    while (true) {
+        // Start every phase that became ready, the first one runs on this task
+        Phase* next = nullptr;
+        bool running = false;
+        bool pending = false;
+        for (auto& phase : phases_) {
+            if (phase.state == kPhaseStateRunning) {
+                running = true;
+            }
+            if (phase.state != kPhaseStatePending) {
+                continue;
+            }
+            if (!IsReady(phase)) {
+                pending = true;
+                continue;
+            }
+            phase.state = kPhaseStateRunning;
+            phase.start_time_us = esp_timer_get_time();
+            if (next == nullptr) {
+                next = &phase;
+                continue;
+            }
+
+            running = true;
+            phase.own_task = true;
+            auto ret = xTaskCreate([](void* arg) {
+                auto context = (std::pair<BootSequence*, Phase*>*)arg;
+                context->first->RunPhase(*context->second);
+                delete context;
+                vTaskDelete(NULL);
+            }, phase.name, BOOT_PHASE_TASK_STACK_SIZE, new std::pair<BootSequence*, Phase*>(this, &phase),
+                uxTaskPriorityGet(NULL), nullptr);
+            if (ret != pdPASS) {
+                // Leave it for this task once the current phase is done
+                ESP_LOGW(TAG, "Failed to create a task for boot phase %s, running it in sequence", phase.name);
+                phase.state = kPhaseStatePending;
+                phase.own_task = false;
+            }
+        }
+
+        if (next != nullptr) {
+            lock.unlock();
+            RunPhase(*next);
+            lock.lock();
+            continue;
+        }
+        if (!running) {
+            if (pending) {
+                ESP_LOGE(TAG, "Boot phases left with dependencies that never finish");
+            }
+            break;
+        }
+        condition_.wait(lock);
+    }
+    running_ = false;
+
+    int64_t end_time_us = 0;
+    for (auto& phase : phases_) {
+        end_time_us = std::max(end_time_us, phase.end_time_us);
+    }
+    ESP_LOGI(TAG, "Boot sequence done at %d ms", (int)(end_time_us / 1000));
+}
+
+void BootSequence::RunPhase(Phase& phase) {
+    phase.run();
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    phase.end_time_us = esp_timer_get_time();
+    phase.state = kPhaseStateDone;
+    ESP_LOGI(TAG, "Boot phase %s done at %d ms, took %d ms%s%s%s", phase.name, (int)(phase.end_time_us / 1000),
+        (int)((phase.end_time_us - phase.start_time_us) / 1000), phase.own_task ? " in parallel" : "",
+        phase.note != nullptr ? ", " : "", phase.note != nullptr ? phase.note : "");
+    condition_.notify_all();
+}
+
+bool BootSequence::WaitFor(const char* name, int timeout_ms) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    auto phase = FindPhase(name);
+    if (phase == nullptr) {
+        return true;
+    }
+    return condition_.wait_for(lock, std::chrono::milliseconds(timeout_ms), [phase]() {
+        return phase->state == kPhaseStateDone;
+    });
+}
+
+void BootSequence::SetPhaseNote(const char* name, const char* note) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto phase = FindPhase(name);
+    if (phase != nullptr) {
+        phase->note = note;
+    }
+}
+
+std::string BootSequence::GetTimelineJson() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    cJSON* root = cJSON_CreateObject();
+    cJSON* phases = cJSON_CreateArray();
+    int64_t ready_time_us = 0;
+    for (auto& phase : phases_) {
+        cJSON* item = cJSON_CreateObject();
+        cJSON_AddStringToObject(item, "name", phase.name);
+        cJSON* dependencies = cJSON_CreateArray();
+        for (auto dependency : phase.dependencies) {
+            cJSON_AddItemToArray(dependencies, cJSON_CreateString(dependency));
+        }
+        cJSON_AddItemToObject(item, "depends_on", dependencies);
+        if (phase.state != kPhaseStatePending) {
+            cJSON_AddNumberToObject(item, "start_ms", phase.start_time_us / 1000);
+        }
+        if (phase.state == kPhaseStateDone) {
+            cJSON_AddNumberToObject(item, "end_ms", phase.end_time_us / 1000);
+            cJSON_AddNumberToObject(item, "duration_ms", (phase.end_time_us - phase.start_time_us) / 1000);
+            ready_time_us = std::max(ready_time_us, phase.end_time_us);
+        }
+        cJSON_AddBoolToObject(item, "parallel", phase.own_task);
+        if (phase.note != nullptr) {
+            cJSON_AddStringToObject(item, "note", phase.note);
+        }
+        cJSON_AddItemToArray(phases, item);
+    }
+    cJSON_AddItemToObject(root, "phases", phases);
+    cJSON_AddNumberToObject(root, "ready_ms", ready_time_us / 1000);
+
+    auto json_str = cJSON_PrintUnformatted(root);
+    std::string result(json_str);
+    cJSON_free(json_str);
+    cJSON_Delete(root);
+    return result;
+}
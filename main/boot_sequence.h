@@ -0,0 +1,65 @@
+#ifndef _BOOT_SEQUENCE_H_
+#define _BOOT_SEQUENCE_H_
+
+#include <cstdint>
+#include <functional>
+#include <initializer_list>
+#include <mutex>
+#include <condition_variable>
+#include <string>
+#include <vector>
+
+// Same as the main task, a phase may run on either
+#define BOOT_PHASE_TASK_STACK_SIZE 8192
+
+/*
+ * BootSequence runs the boot phases as a dependency graph.
+ *
+ * A phase starts as soon as all the phases it depends on are done, phases that
+ * become ready together run in parallel: the calling task takes the first one in
+ * the order they were added and each of the others gets its own task. Run returns
+ * when every phase is done.
+ *
+ * The start and end time of each phase since power on are kept for the log and
+ * the boot timeline MCP tool.
+ */
+class BootSequence {
+public:
+    void AddPhase(const char* name, std::initializer_list<const char*> dependencies, std::function<void()> run);
+    void Run();
+    // Block until the phase is done, returns true at once if there is no such phase
+    // and false if it is not done within timeout_ms
+    bool WaitFor(const char* name, int timeout_ms);
+    // Short remark shown with the phase in the timeline, the string must stay valid
+    void SetPhaseNote(const char* name, const char* note);
+    std::string GetTimelineJson() const;
+
+private:
+    enum PhaseState {
+        kPhaseStatePending,
+        kPhaseStateRunning,
+        kPhaseStateDone,
+    };
+
+    struct Phase {
+        const char* name;
+        std::vector<const char*> dependencies;
+        std::function<void()> run;
+        PhaseState state = kPhaseStatePending;
+        bool own_task = false;
+        const char* note = nullptr;
+        int64_t start_time_us = 0;
+        int64_t end_time_us = 0;
+    };
+
+    mutable std::mutex mutex_;
+    std::condition_variable condition_;
+    std::vector<Phase> phases_;
+    bool running_ = false;
+
+    Phase* FindPhase(const char* name);
+    bool IsReady(const Phase& phase);
+    void RunPhase(Phase& phase);
+};
+
+#endif // _BOOT_SEQUENCE_H_
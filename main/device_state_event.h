@@ -3,9 +3,9 @@
 
 #include <esp_event.h>
 #include <functional>
-#include <vector>
-#include <mutex>
+#include <string>
 #include "device_state.h"
+#include "event_bus.h"
 
 ESP_EVENT_DECLARE_BASE(XIAOZHI_STATE_EVENTS);
 
@@ -24,16 +24,18 @@ public:
     DeviceStateEventManager(const DeviceStateEventManager&) = delete;
     DeviceStateEventManager& operator=(const DeviceStateEventManager&) = delete;
 
+    // Synchronous subscribers run inside Application::SetDeviceState on the main loop
+    bool Subscribe(const char* name, EventDelivery delivery, std::function<void(DeviceState, DeviceState)> callback);
+    // Deferred delivery on the event loop task
     void RegisterStateChangeCallback(std::function<void(DeviceState, DeviceState)> callback);
     void PostStateChangeEvent(DeviceState previous_state, DeviceState current_state);
-    std::vector<std::function<void(DeviceState, DeviceState)>> GetCallbacks();
+    std::string GetStatsJson() const { return bus_.GetStatsJson(); }
 
 private:
     DeviceStateEventManager();
-    ~DeviceStateEventManager();
+    ~DeviceStateEventManager() = default;
 
-    std::vector<std::function<void(DeviceState, DeviceState)>> callbacks_;
-    std::mutex mutex_;
+    EventBus<device_state_event_data_t> bus_;
 };
 
-#endif // _DEVICE_STATE_EVENT_H_ 
\ No newline at end of file
+#endif // _DEVICE_STATE_EVENT_H_ 
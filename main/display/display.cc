@@ -30,6 +30,18 @@ Display::Display() {
     };
     ESP_ERROR_CHECK(esp_timer_create(&notification_timer_args, &notification_timer_));
 
+    esp_timer_create_args_t mailbox_timer_args = {
+        .callback = [](void *arg) {
+            Display *display = static_cast<Display*>(arg);
+            display->DrainMailbox();
+        },
+        .arg = this,
+        .dispatch_method = ESP_TIMER_TASK,
+        .name = "display_mailbox",
+        .skip_unhandled_events = true,
+    };
+    ESP_ERROR_CHECK(esp_timer_create(&mailbox_timer_args, &mailbox_timer_));
+
     // Create a power management lock
     auto ret = esp_pm_lock_create(ESP_PM_APB_FREQ_MAX, 0, "display_update", &pm_lock_);
     if (ret == ESP_ERR_NOT_SUPPORTED) {
@@ -44,6 +56,10 @@ Display::~Display() {
         esp_timer_stop(notification_timer_);
         esp_timer_delete(notification_timer_);
     }
+    if (mailbox_timer_ != nullptr) {
+        esp_timer_stop(mailbox_timer_);
+        esp_timer_delete(mailbox_timer_);
+    }
 
     if (network_label_ != nullptr) {
         lv_obj_del(network_label_);
@@ -90,6 +106,57 @@ void Display::ShowNotification(const char* notification, int duration_ms) {
     ESP_ERROR_CHECK(esp_timer_start_once(notification_timer_, duration_ms * 1000));
 }
 
+void Display::Post(DisplayMailboxSlot slot, const char* text) {
+    portENTER_CRITICAL(&mailbox_lock_);
+    strlcpy(mailbox_[slot].text, text, sizeof(mailbox_[slot].text));
+    mailbox_[slot].pending = true;
+    portEXIT_CRITICAL(&mailbox_lock_);
+    // Fails if a drain is already armed, it picks up this value too
+    esp_timer_start_once(mailbox_timer_, 0);
+}
+
+void Display::ClearPosted(DisplayMailboxSlot slot) {
+    // A drain that already took the value draws it under the display lock, wait for it to finish
+    DisplayLockGuard lock(this);
+    portENTER_CRITICAL(&mailbox_lock_);
+    mailbox_[slot].pending = false;
+    portEXIT_CRITICAL(&mailbox_lock_);
+}
+
+void Display::DrainMailbox() {
+    // Held from taking a value until it is drawn, so ClearPosted can not return in between
+    DisplayLockGuard lock(this);
+    for (int i = 0; i < kDisplayMailboxSlotCount; i++) {
+        char text[DISPLAY_MAILBOX_TEXT_SIZE];
+        portENTER_CRITICAL(&mailbox_lock_);
+        bool pending = mailbox_[i].pending;
+        if (pending) {
+            memcpy(text, mailbox_[i].text, sizeof(text));
+            mailbox_[i].pending = false;
+        }
+        portEXIT_CRITICAL(&mailbox_lock_);
+        if (!pending) {
+            continue;
+        }
+
+        switch (i) {
+            case kDisplayMailboxSystemMessage:
+                SetChatMessage("system", text);
+                break;
+            case kDisplayMailboxBatteryIcon:
+                if (battery_label_ != nullptr) {
+                    lv_label_set_text(battery_label_, text);
+                }
+                break;
+            case kDisplayMailboxNetworkIcon:
+                if (network_label_ != nullptr) {
+                    lv_label_set_text(network_label_, text);
+                }
+                break;
+        }
+    }
+}
+
 void Display::UpdateStatusBar(bool update_all) {
     auto& app = Application::GetInstance();
     auto& board = Board::GetInstance();
@@ -148,13 +215,13 @@ void Display::UpdateStatusBar(bool update_all) {
             };
             icon = levels[battery_level / 20];
         }
-        DisplayLockGuard lock(this);
-        if (battery_label_ != nullptr && battery_icon_ != icon) {
+        if (battery_icon_ != icon) {
             battery_icon_ = icon;
-            lv_label_set_text(battery_label_, battery_icon_);
+            Post(kDisplayMailboxBatteryIcon, battery_icon_);
         }
 
         if (low_battery_popup_ != nullptr) {
+            DisplayLockGuard lock(this);
             if (strcmp(icon, FONT_AWESOME_BATTERY_EMPTY) == 0 && discharging) {
                 if (lv_obj_has_flag(low_battery_popup_, LV_OBJ_FLAG_HIDDEN)) { // 如果低电量提示框隐藏，则显示
                     lv_obj_clear_flag(low_battery_popup_, LV_OBJ_FLAG_HIDDEN);
@@ -183,10 +250,9 @@ void Display::UpdateStatusBar(bool update_all) {
         };
         if (std::find(allowed_states.begin(), allowed_states.end(), device_state) != allowed_states.end()) {
             icon = board.GetNetworkStateIcon();
-            if (network_label_ != nullptr && icon != nullptr && network_icon_ != icon) {
-                DisplayLockGuard lock(this);
+            if (icon != nullptr && network_icon_ != icon) {
                 network_icon_ = icon;
-                lv_label_set_text(network_label_, network_icon_);
+                Post(kDisplayMailboxNetworkIcon, network_icon_);
             }
         }
     }
@@ -5,10 +5,21 @@
 #include <esp_timer.h>
 #include <esp_log.h>
 #include <esp_pm.h>
+#include <freertos/FreeRTOS.h>
 
 #include <string>
 #include <chrono>
 
+#define DISPLAY_MAILBOX_TEXT_SIZE 64
+
+// Slots of the display mailbox, each keeps only the latest posted value
+enum DisplayMailboxSlot {
+    kDisplayMailboxSystemMessage,
+    kDisplayMailboxBatteryIcon,
+    kDisplayMailboxNetworkIcon,
+    kDisplayMailboxSlotCount,
+};
+
 struct DisplayFonts {
     const lv_font_t* text_font = nullptr;
     const lv_font_t* icon_font = nullptr;
@@ -31,6 +42,12 @@ public:
     virtual std::string GetTheme() { return current_theme_name_; }
     virtual void UpdateStatusBar(bool update_all = false);
     virtual void SetPowerSaveMode(bool on);
+    // Publish from any task without waiting for the display lock or allocating. Values
+    // posted before the display got to them are replaced, only the latest one is drawn
+    void Post(DisplayMailboxSlot slot, const char* text);
+    // Drop a posted value that was not drawn yet and wait for a drain that is drawing it,
+    // call before setting the same element directly
+    void ClearPosted(DisplayMailboxSlot slot);
 
     inline int width() const { return width_; }
     inline int height() const { return height_; }
@@ -60,6 +77,17 @@ protected:
     std::chrono::system_clock::time_point last_status_update_time_;
     esp_timer_handle_t notification_timer_ = nullptr;
 
+    struct MailboxSlot {
+        bool pending = false;
+        char text[DISPLAY_MAILBOX_TEXT_SIZE] = {0};
+    };
+    portMUX_TYPE mailbox_lock_ = portMUX_INITIALIZER_UNLOCKED;
+    MailboxSlot mailbox_[kDisplayMailboxSlotCount];
+    // Draws the posted values on the esp_timer task, like the status bar and notifications
+    esp_timer_handle_t mailbox_timer_ = nullptr;
+
+    void DrainMailbox();
+
     friend class DisplayLockGuard;
     virtual bool Lock(int timeout_ms = 0) = 0;
     virtual void Unlock() = 0;
@@ -0,0 +1,210 @@
+#ifndef _EVENT_BUS_H_
+#define _EVENT_BUS_H_
+
+#include <esp_event.h>
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <cJSON.h>
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <type_traits>
+
+// Subscribers are registered at startup and never removed
+#define EVENT_BUS_MAX_SUBSCRIBERS 8
+// A full event loop queue drops the deferred event instead of blocking the publisher
+#define EVENT_BUS_POST_TIMEOUT_MS 10
+// Synchronous subscribers run inside the publisher, usually the main loop
+#define EVENT_BUS_SLOW_RUN_TIME_US 10000
+
+enum EventDelivery {
+    // Called in the publisher's task before Publish returns, keep it short
+    kEventDeliverySync,
+    // Called later on the esp_event default loop task
+    kEventDeliveryDeferred,
+};
+
+/*
+ * Typed publish/subscribe bus.
+ *
+ * Subscribers live in a preallocated table. Subscribe constructs the entry and then
+ * publishes it with a release store of the count, entries are never removed, so
+ * Publish walks the table without a lock and without copying the callbacks.
+ *
+ * Each subscriber picks its delivery: synchronous ones are called by Publish, deferred
+ * ones get the event through the esp_event default loop with the base and id of the
+ * bus. One post per event serves all the deferred subscribers, the payload starts with
+ * the event so plain esp_event handlers of the same id can still read it. Nothing is
+ * posted when there is no deferred subscriber.
+ *
+ * Calls, run time and (for deferred subscribers) the delay between Publish and the
+ * call are kept per subscriber.
+ */
+template <typename Event>
+class EventBus {
+    static_assert(std::is_trivially_copyable<Event>::value, "Events are copied through the esp_event queue");
+
+public:
+    EventBus(esp_event_base_t base, int32_t id) : base_(base), id_(id) {}
+    ~EventBus() {
+        if (handler_instance_ != nullptr) {
+            esp_event_handler_instance_unregister(base_, id_, handler_instance_);
+        }
+    }
+    EventBus(const EventBus&) = delete;
+    EventBus& operator=(const EventBus&) = delete;
+
+    // The name must stay valid, returns false when the table is full
+    bool Subscribe(const char* name, EventDelivery delivery, std::function<void(const Event&)> callback) {
+        std::lock_guard<std::mutex> lock(subscribe_mutex_);
+        int count = count_.load(std::memory_order_relaxed);
+        if (count >= EVENT_BUS_MAX_SUBSCRIBERS) {
+            ESP_LOGE("EventBus", "Too many subscribers for %s, dropping %s", base_, name);
+            return false;
+        }
+        if (delivery == kEventDeliveryDeferred && !RegisterHandler()) {
+            return false;
+        }
+
+        auto& subscriber = subscribers_[count];
+        subscriber.name = name;
+        subscriber.delivery = delivery;
+        subscriber.callback = std::move(callback);
+        if (delivery == kEventDeliveryDeferred) {
+            has_deferred_.store(true, std::memory_order_relaxed);
+        }
+        count_.store(count + 1, std::memory_order_release);
+        return true;
+    }
+
+    void Publish(const Event& event) {
+        int count = count_.load(std::memory_order_acquire);
+        int64_t publish_time_us = esp_timer_get_time();
+        for (int i = 0; i < count; i++) {
+            if (subscribers_[i].delivery == kEventDeliverySync) {
+                Deliver(subscribers_[i], event, publish_time_us);
+            }
+        }
+
+        if (!has_deferred_.load(std::memory_order_relaxed)) {
+            return;
+        }
+        DeferredEvent deferred = {
+            .event = event,
+            .publish_time_us = publish_time_us,
+        };
+        if (esp_event_post(base_, id_, &deferred, sizeof(deferred), pdMS_TO_TICKS(EVENT_BUS_POST_TIMEOUT_MS)) != ESP_OK) {
+            if (dropped_.fetch_add(1, std::memory_order_relaxed) == 0) {
+                ESP_LOGW("EventBus", "Event loop busy, dropped a %s event", base_);
+            }
+        }
+    }
+
+    std::string GetStatsJson() const {
+        int count = count_.load(std::memory_order_acquire);
+        cJSON* root = cJSON_CreateObject();
+        cJSON_AddStringToObject(root, "event", base_);
+        cJSON_AddNumberToObject(root, "dropped", dropped_.load(std::memory_order_relaxed));
+        cJSON* subscribers = cJSON_CreateArray();
+        for (int i = 0; i < count; i++) {
+            auto& subscriber = subscribers_[i];
+            uint32_t calls = subscriber.calls.load(std::memory_order_relaxed);
+            uint32_t total_run_time_us = subscriber.total_run_time_us.load(std::memory_order_relaxed);
+            cJSON* item = cJSON_CreateObject();
+            cJSON_AddStringToObject(item, "name", subscriber.name);
+            cJSON_AddStringToObject(item, "delivery", subscriber.delivery == kEventDeliverySync ? "sync" : "deferred");
+            cJSON_AddNumberToObject(item, "calls", calls);
+            cJSON_AddNumberToObject(item, "avg_run_time_us", calls > 0 ? total_run_time_us / calls : 0);
+            cJSON_AddNumberToObject(item, "max_run_time_us", subscriber.max_run_time_us.load(std::memory_order_relaxed));
+            if (subscriber.delivery == kEventDeliveryDeferred) {
+                cJSON_AddNumberToObject(item, "max_delay_us", subscriber.max_delay_us.load(std::memory_order_relaxed));
+            }
+            cJSON_AddItemToArray(subscribers, item);
+        }
+        cJSON_AddItemToObject(root, "subscribers", subscribers);
+
+        auto json_str = cJSON_PrintUnformatted(root);
+        std::string result(json_str);
+        cJSON_free(json_str);
+        cJSON_Delete(root);
+        return result;
+    }
+
+private:
+    struct Subscriber {
+        const char* name = nullptr;
+        EventDelivery delivery = kEventDeliverySync;
+        std::function<void(const Event&)> callback;
+        std::atomic<uint32_t> calls = 0;
+        std::atomic<uint32_t> total_run_time_us = 0;
+        std::atomic<uint32_t> max_run_time_us = 0;
+        std::atomic<uint32_t> max_delay_us = 0;
+    };
+
+    struct DeferredEvent {
+        Event event;
+        int64_t publish_time_us;
+    };
+
+    esp_event_base_t base_;
+    int32_t id_;
+    Subscriber subscribers_[EVENT_BUS_MAX_SUBSCRIBERS];
+    std::atomic<int> count_ = 0;
+    std::atomic<bool> has_deferred_ = false;
+    std::atomic<uint32_t> dropped_ = 0;
+    std::mutex subscribe_mutex_;
+    esp_event_handler_instance_t handler_instance_ = nullptr;
+
+    static void UpdateMax(std::atomic<uint32_t>& max, uint32_t value) {
+        uint32_t current = max.load(std::memory_order_relaxed);
+        while (value > current && !max.compare_exchange_weak(current, value, std::memory_order_relaxed)) {
+        }
+    }
+
+    void Deliver(Subscriber& subscriber, const Event& event, int64_t publish_time_us) {
+        int64_t start_time_us = esp_timer_get_time();
+        subscriber.callback(event);
+        uint32_t run_time_us = (uint32_t)(esp_timer_get_time() - start_time_us);
+
+        subscriber.calls.fetch_add(1, std::memory_order_relaxed);
+        subscriber.total_run_time_us.fetch_add(run_time_us, std::memory_order_relaxed);
+        UpdateMax(subscriber.max_run_time_us, run_time_us);
+        if (subscriber.delivery == kEventDeliveryDeferred) {
+            UpdateMax(subscriber.max_delay_us, (uint32_t)(start_time_us - publish_time_us));
+        } else if (run_time_us > EVENT_BUS_SLOW_RUN_TIME_US) {
+            ESP_LOGW("EventBus", "Subscriber %s of %s took %d ms in the publisher", subscriber.name, base_, (int)(run_time_us / 1000));
+        }
+    }
+
+    // Called with subscribe_mutex_ held
+    bool RegisterHandler() {
+        if (handler_instance_ != nullptr) {
+            return true;
+        }
+        esp_err_t err = esp_event_loop_create_default();
+        if (err != ESP_OK && err != ESP_ERR_INVALID_STATE) {
+            ESP_LOGE("EventBus", "Failed to create the default event loop: %s", esp_err_to_name(err));
+            return false;
+        }
+        err = esp_event_handler_instance_register(base_, id_, [](void* handler_args, esp_event_base_t base, int32_t id, void* event_data) {
+            auto bus = static_cast<EventBus*>(handler_args);
+            auto deferred = static_cast<DeferredEvent*>(event_data);
+            int count = bus->count_.load(std::memory_order_acquire);
+            for (int i = 0; i < count; i++) {
+                if (bus->subscribers_[i].delivery == kEventDeliveryDeferred) {
+                    bus->Deliver(bus->subscribers_[i], deferred->event, deferred->publish_time_us);
+                }
+            }
+        }, this, &handler_instance_);
+        if (err != ESP_OK) {
+            ESP_LOGE("EventBus", "Failed to register the %s handler: %s", base_, esp_err_to_name(err));
+            return false;
+        }
+        return true;
+    }
+};
+
+#endif // _EVENT_BUS_H_
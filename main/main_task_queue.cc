@@ -0,0 +1,129 @@
+#include "main_task_queue.h"
+
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+#define TAG "MainTaskQueue"
+
+// Callbacks block the main loop, including the audio sending
+#define MAIN_TASK_SLOW_RUN_TIME_US 50000
+
+static_assert((MAIN_TASK_QUEUE_SIZE & (MAIN_TASK_QUEUE_SIZE - 1)) == 0, "MAIN_TASK_QUEUE_SIZE must be a power of two");
+
+MainTaskQueue::MainTaskQueue() {
+    for (uint32_t i = 0; i < MAIN_TASK_QUEUE_SIZE; i++) {
+        slots_[i].sequence.store(i, std::memory_order_relaxed);
+        slots_[i].invoke = nullptr;
+    }
+}
+
+MainTaskQueue::~MainTaskQueue() {
+    auto end = enqueue_position_.load(std::memory_order_acquire);
+    for (auto position = dequeue_position_.load(std::memory_order_relaxed); position != end; position++) {
+        auto& slot = slots_[position & (MAIN_TASK_QUEUE_SIZE - 1)];
+        if (slot.sequence.load(std::memory_order_acquire) == position + 1) {
+            slot.invoke(slot.storage, false);
+        }
+    }
+}
+
+MainTaskQueue::Slot* MainTaskQueue::Acquire(uint32_t& position) {
+    auto current = enqueue_position_.load(std::memory_order_relaxed);
+    while (true) {
+        auto& slot = slots_[current & (MAIN_TASK_QUEUE_SIZE - 1)];
+        auto difference = (int32_t)(slot.sequence.load(std::memory_order_acquire) - current);
+        if (difference == 0) {
+            if (enqueue_position_.compare_exchange_weak(current, current + 1, std::memory_order_relaxed)) {
+                break;
+            }
+        } else if (difference < 0) {
+            // The consumer has not released this slot yet, the ring is full
+            return nullptr;
+        } else {
+            current = enqueue_position_.load(std::memory_order_relaxed);
+        }
+    }
+
+    position = current;
+    int depth = (int)(current + 1 - dequeue_position_.load(std::memory_order_relaxed));
+    int max_depth = max_depth_.load(std::memory_order_relaxed);
+    while (depth > max_depth && !max_depth_.compare_exchange_weak(max_depth, depth, std::memory_order_relaxed)) {
+    }
+    return &slots_[current & (MAIN_TASK_QUEUE_SIZE - 1)];
+}
+
+void MainTaskQueue::PushOverflow(std::function<void()>&& callback) {
+    std::lock_guard<std::mutex> lock(overflow_mutex_);
+    if (!overflowing_.load(std::memory_order_relaxed)) {
+        ESP_LOGW(TAG, "Queue full (%d tasks), falling back to the heap", MAIN_TASK_QUEUE_SIZE);
+    }
+    overflow_tasks_.push_back(std::move(callback));
+    overflowing_.store(true, std::memory_order_release);
+    overflowed_.fetch_add(1, std::memory_order_relaxed);
+}
+
+void MainTaskQueue::RunPending() {
+    if (!overflowing_.load(std::memory_order_acquire)) {
+        RunSlots(enqueue_position_.load(std::memory_order_acquire));
+        return;
+    }
+
+    // Take the end position together with the overflow list, the slots claimed before
+    // the list was taken were scheduled before the callbacks in it
+    std::deque<std::function<void()>> overflow_tasks;
+    uint32_t end;
+    {
+        std::lock_guard<std::mutex> lock(overflow_mutex_);
+        end = enqueue_position_.load(std::memory_order_acquire);
+        overflow_tasks.swap(overflow_tasks_);
+        overflowing_.store(false, std::memory_order_release);
+    }
+    RunSlots(end);
+    for (auto& task : overflow_tasks) {
+        auto start_time = esp_timer_get_time();
+        task();
+        RecordRunTime(start_time);
+    }
+}
+
+void MainTaskQueue::RunSlots(uint32_t end) {
+    auto position = dequeue_position_.load(std::memory_order_relaxed);
+    while (position != end) {
+        auto& slot = slots_[position & (MAIN_TASK_QUEUE_SIZE - 1)];
+        // A producer claimed the slot but is still moving the callback in, it may
+        // have a lower priority than the main loop so give it a tick
+        while (slot.sequence.load(std::memory_order_acquire) != position + 1) {
+            vTaskDelay(1);
+        }
+
+        auto start_time = esp_timer_get_time();
+        slot.invoke(slot.storage, true);
+        RecordRunTime(start_time);
+
+        slot.sequence.store(position + MAIN_TASK_QUEUE_SIZE, std::memory_order_release);
+        position++;
+        dequeue_position_.store(position, std::memory_order_relaxed);
+    }
+}
+
+void MainTaskQueue::RecordRunTime(int64_t start_time) {
+    int run_time = (int)(esp_timer_get_time() - start_time);
+    executed_.fetch_add(1, std::memory_order_relaxed);
+    if (run_time > max_run_time_us_.load(std::memory_order_relaxed)) {
+        max_run_time_us_.store(run_time, std::memory_order_relaxed);
+    }
+    if (run_time > MAIN_TASK_SLOW_RUN_TIME_US) {
+        ESP_LOGW(TAG, "Main loop task took %d ms", run_time / 1000);
+    }
+}
+
+MainTaskQueueStats MainTaskQueue::GetStats() const {
+    MainTaskQueueStats stats;
+    stats.executed = executed_.load(std::memory_order_relaxed);
+    stats.overflowed = overflowed_.load(std::memory_order_relaxed);
+    stats.max_depth = max_depth_.load(std::memory_order_relaxed);
+    stats.max_run_time_us = max_run_time_us_.load(std::memory_order_relaxed);
+    return stats;
+}
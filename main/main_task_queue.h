@@ -0,0 +1,103 @@
+#ifndef _MAIN_TASK_QUEUE_H_
+#define _MAIN_TASK_QUEUE_H_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <new>
+#include <string>
+#include <type_traits>
+#include <utility>
+
+// Room for the captures of a scheduled lambda: this, one more pointer and a std::string
+#define MAIN_TASK_INLINE_SIZE (sizeof(void*) * 2 + sizeof(std::string))
+// Must be a power of two
+#define MAIN_TASK_QUEUE_SIZE 64
+
+struct MainTaskQueueStats {
+    uint32_t executed;
+    // Pushed while the slots were full, they went to the heap fallback list
+    uint32_t overflowed;
+    int max_depth;
+    int max_run_time_us;
+};
+
+/*
+ * Queue of the callbacks that run on the main loop, Application::Schedule pushes here.
+ *
+ * The callables are move constructed into preallocated slots, so scheduling a lambda
+ * never allocates. Producers on any task claim a slot with a CAS on the enqueue
+ * position and publish it with the per slot sequence (a bounded MPSC ring), the main
+ * loop is the only consumer. A lambda that does not fit a slot is a compile error.
+ *
+ * When all slots are taken the callback goes to a mutex protected std::function list
+ * instead, so nothing is dropped. Once a callback overflowed, the following ones go to
+ * the list too until the consumer takes it, which keeps the order of the callbacks
+ * scheduled from one task.
+ */
+class MainTaskQueue {
+public:
+    MainTaskQueue();
+    ~MainTaskQueue();
+    MainTaskQueue(const MainTaskQueue&) = delete;
+    MainTaskQueue& operator=(const MainTaskQueue&) = delete;
+
+    template <typename F>
+    void Push(F&& callback) {
+        using Callable = std::decay_t<F>;
+        static_assert(sizeof(Callable) <= MAIN_TASK_INLINE_SIZE, "Scheduled callback captures too much, capture a pointer instead");
+        static_assert(alignof(Callable) <= alignof(std::max_align_t), "Scheduled callback is over aligned");
+
+        uint32_t position;
+        Slot* slot = overflowing_.load(std::memory_order_acquire) ? nullptr : Acquire(position);
+        if (slot == nullptr) {
+            PushOverflow(std::function<void()>(std::forward<F>(callback)));
+            return;
+        }
+        new (slot->storage) Callable(std::forward<F>(callback));
+        slot->invoke = [](void* storage, bool run) {
+            auto callable = std::launder(reinterpret_cast<Callable*>(storage));
+            if (run) {
+                (*callable)();
+            }
+            callable->~Callable();
+        };
+        slot->sequence.store(position + 1, std::memory_order_release);
+    }
+
+    // Run the callbacks queued so far, only from the main loop. Callbacks they schedule
+    // run on the next call, so other main loop events are not starved
+    void RunPending();
+    MainTaskQueueStats GetStats() const;
+
+private:
+    struct Slot {
+        std::atomic<uint32_t> sequence;
+        // Runs the callable if asked to, then destroys it
+        void (*invoke)(void* storage, bool run);
+        alignas(std::max_align_t) uint8_t storage[MAIN_TASK_INLINE_SIZE];
+    };
+
+    Slot slots_[MAIN_TASK_QUEUE_SIZE];
+    std::atomic<uint32_t> enqueue_position_ = 0;
+    std::atomic<uint32_t> dequeue_position_ = 0;
+
+    std::atomic<bool> overflowing_ = false;
+    std::mutex overflow_mutex_;
+    std::deque<std::function<void()>> overflow_tasks_;
+
+    std::atomic<uint32_t> executed_ = 0;
+    std::atomic<uint32_t> overflowed_ = 0;
+    std::atomic<int> max_depth_ = 0;
+    std::atomic<int> max_run_time_us_ = 0;
+
+    Slot* Acquire(uint32_t& position);
+    void PushOverflow(std::function<void()>&& callback);
+    void RunSlots(uint32_t end);
+    void RecordRunTime(int64_t start_time);
+};
+
+#endif // _MAIN_TASK_QUEUE_H_
@@ -13,6 +13,7 @@
 #include "application.h"
 #include "display.h"
 #include "board.h"
+#include "json_writer.h"
 
 #define TAG "MCP"
 
@@ -103,6 +104,82 @@ void McpServer::AddCommonTools() {
             });
     }
 
+#if CONFIG_USE_DIAGNOSTIC_TOOLS
+    AddTool("self.get_boot_timeline",
+        "Get when each boot phase (network, audio, ota, protocol...) started and finished since power on, "
+        "which phases ran in parallel and when the device was ready.",
+        PropertyList(),
+        [](const PropertyList& properties) -> ReturnValue {
+            return Application::GetInstance().GetBootSequence().GetTimelineJson();
+        });
+
+    AddTool("self.get_state_event_stats",
+        "Get the subscribers of the device state change event, how they are delivered, how often they were called, "
+        "how long they ran and how late the deferred ones were called.",
+        PropertyList(),
+        [](const PropertyList& properties) -> ReturnValue {
+            return DeviceStateEventManager::GetInstance().GetStatsJson();
+        });
+
+    AddTool("self.audio_speaker.get_output_stats",
+        "Get the playback statistics of the current speaking session, or the last one if the device is not speaking: "
+        "played duration, underruns, inserted silence and output latency.",
+        PropertyList(),
+        [](const PropertyList& properties) -> ReturnValue {
+            auto& app = Application::GetInstance();
+            auto codec = Board::GetInstance().GetAudioCodec();
+            auto stats = app.GetAudioService().GetOutputStats();
+            int sample_rate = codec->output_sample_rate();
+            cJSON* json = cJSON_CreateObject();
+            cJSON_AddNumberToObject(json, "played_ms", (double)stats.played_frames * 1000 / sample_rate);
+            cJSON_AddNumberToObject(json, "underruns", stats.underruns);
+            cJSON_AddNumberToObject(json, "silence_ms", (double)stats.silence_frames * 1000 / sample_rate);
+            cJSON_AddNumberToObject(json, "latency_ms", stats.latency_ms);
+            cJSON_AddNumberToObject(json, "min_latency_ms", stats.min_latency_ms);
+            cJSON_AddNumberToObject(json, "max_latency_ms", stats.max_latency_ms);
+            cJSON_AddNumberToObject(json, "dma_buffer_ms", AUDIO_CODEC_DMA_DESC_NUM * AUDIO_CODEC_DMA_FRAME_NUM * 1000 / sample_rate);
+            auto json_str = cJSON_PrintUnformatted(json);
+            std::string result(json_str);
+            cJSON_free(json_str);
+            cJSON_Delete(json);
+            return result;
+        });
+
+    AddTool("self.network.get_audio_channel_stats",
+        "Get the audio channel connect time percentiles and how long a prewarmed channel stayed open without being used.",
+        PropertyList(),
+        [](const PropertyList& properties) -> ReturnValue {
+            return Application::GetInstance().GetAudioChannelPolicy().GetStatsJson();
+        });
+
+    AddTool("self.network.get_protocol_stats",
+        "Get the traffic of the current or last voice session: packets and bytes in both directions, send failures, "
+        "UDP loss, reorder and duplicates, downlink jitter and the round trip time to the server.",
+        PropertyList(),
+        [](const PropertyList& properties) -> ReturnValue {
+            auto stats = Application::GetInstance().GetProtocolStats();
+            if (stats == nullptr) {
+                return std::string("{}");
+            }
+            return stats->GetStatsJson();
+        });
+#endif
+
+#if CONFIG_USE_AUDIO_DEBUGGER
+    AddTool("self.audio_debugger.set_taps",
+        "Select which audio debug taps are streamed to the audio debug server.\n"
+        "Args:\n"
+        "  `mask`: Bit mask of taps: 1 mic raw, 2 AEC reference, 4 AFE output, 8 encoder input, 16 decoder output.",
+        PropertyList({
+            Property("mask", kPropertyTypeInteger, 0, 31)
+        }),
+        [](const PropertyList& properties) -> ReturnValue {
+            auto& app = Application::GetInstance();
+            app.GetAudioService().SetAudioDebugTaps(properties["mask"].value<int>());
+            return true;
+        });
+#endif
+
     // Restore the original tools list to the end of the tools list
     tools_.insert(tools_.end(), original_tools.begin(), original_tools.end());
 }
@@ -238,20 +315,30 @@ void McpServer::ParseMessage(const cJSON* json) {
 }
 
 void McpServer::ReplyResult(int id, const std::string& result) {
-    std::string payload = "{\"jsonrpc\":\"2.0\",\"id\":";
-    payload += std::to_string(id) + ",\"result\":";
-    payload += result;
-    payload += "}";
-    Application::GetInstance().SendMcpMessage(payload);
+    // The payload is handed over to the main loop, so serialize it straight into the string that gets moved there
+    std::string payload(result.size() + 64, '\0');
+    JsonWriter writer(payload.data(), payload.size());
+    writer.BeginObject()
+        .AddString("jsonrpc", "2.0")
+        .AddNumber("id", id)
+        .AddRaw("result", result)
+        .EndObject();
+    payload.resize(writer.length());
+    Application::GetInstance().SendMcpMessage(std::move(payload));
 }
 
 void McpServer::ReplyError(int id, const std::string& message) {
-    std::string payload = "{\"jsonrpc\":\"2.0\",\"id\":";
-    payload += std::to_string(id);
-    payload += ",\"error\":{\"message\":\"";
-    payload += message;
-    payload += "\"}}";
-    Application::GetInstance().SendMcpMessage(payload);
+    std::string payload(message.size() * 6 + 96, '\0');
+    JsonWriter writer(payload.data(), payload.size());
+    writer.BeginObject()
+        .AddString("jsonrpc", "2.0")
+        .AddNumber("id", id)
+        .BeginObject("error")
+        .AddString("message", message)
+        .EndObject()
+        .EndObject();
+    payload.resize(writer.length());
+    Application::GetInstance().SendMcpMessage(std::move(payload));
 }
 
 void McpServer::GetToolsList(int id, const std::string& cursor) {
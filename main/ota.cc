@@ -15,14 +15,21 @@
 #endif
 
 #include <cstring>
+#include <ctime>
 #include <vector>
 #include <sstream>
 #include <algorithm>
 
 #define TAG "Ota"
 
+#define OTA_CONFIG_CACHE_NAMESPACE "ota_cache"
+// nvs_set_str limit
+#define OTA_CONFIG_CACHE_MAX_SIZE 4000
+// 2024-01-01, an earlier system time was never set and the age of the cache is unknown
+#define OTA_CONFIG_CACHE_MIN_VALID_TIME 1704067200
 
 Ota::Ota() {
+    current_version_ = esp_app_get_description()->version;
 #ifdef ESP_EFUSE_BLOCK_USR_DATA
     // Read Serial Number from efuse user_data
     uint8_t serial_number[33] = {0};
@@ -68,8 +75,121 @@ std::unique_ptr<Http> Ota::SetupHttp() {
     return http;
 }
 
+// The server sections of a check version response, to tell if the server moved
+static std::string GetServerConfig(const cJSON* root) {
+    std::string config;
+    for (auto name : {"mqtt", "websocket"}) {
+        auto section = cJSON_GetObjectItem(root, name);
+        if (cJSON_IsObject(section)) {
+            auto json_str = cJSON_PrintUnformatted(section);
+            config += json_str;
+            cJSON_free(json_str);
+        }
+        config += "|";
+    }
+    return config;
+}
+
+bool Ota::ReadConfigCache(std::string& response, std::string& etag) {
+#if CONFIG_OTA_CONFIG_CACHE_TTL_HOURS > 0
+    // The request carries the firmware version, a response to another firmware or OTA url does not count
+    Settings settings(OTA_CONFIG_CACHE_NAMESPACE, false);
+    if (settings.GetString("version") != current_version_ || settings.GetString("url") != GetCheckVersionUrl()) {
+        return false;
+    }
+    response = settings.GetString("response");
+    etag = settings.GetString("etag");
+    return !response.empty();
+#else
+    return false;
+#endif
+}
+
+void Ota::SaveConfigCache(const std::string& response, const std::string& etag) {
+#if CONFIG_OTA_CONFIG_CACHE_TTL_HOURS > 0
+    Settings settings(OTA_CONFIG_CACHE_NAMESPACE, true);
+    // Activation and upgrades must go through the check at boot, so only a plain config is kept
+    bool cacheable = (has_mqtt_config_ || has_websocket_config_) && !has_new_version_ &&
+        !has_activation_code_ && !has_activation_challenge_ && response.size() < OTA_CONFIG_CACHE_MAX_SIZE;
+    if (!cacheable) {
+        settings.EraseAll();
+        return;
+    }
+
+    const std::pair<const char*, std::string> items[] = {
+        { "response", response },
+        { "etag", etag },
+        { "version", current_version_ },
+        { "url", GetCheckVersionUrl() },
+    };
+    for (auto& [key, value] : items) {
+        if (settings.GetString(key) != value) {
+            settings.SetString(key, value);
+        }
+    }
+    time_t now = time(nullptr);
+    settings.SetInt("saved_at", now >= OTA_CONFIG_CACHE_MIN_VALID_TIME ? (int32_t)now : 0);
+#endif
+}
+
+int64_t Ota::GetConfigCacheAge() {
+    Settings settings(OTA_CONFIG_CACHE_NAMESPACE, false);
+    time_t saved_at = settings.GetInt("saved_at");
+    time_t now = time(nullptr);
+    // saved_at is 0 when the cache was saved before the clock was set
+    if (saved_at <= 0 || now < OTA_CONFIG_CACHE_MIN_VALID_TIME || now < saved_at) {
+        return -1;
+    }
+    return now - saved_at;
+}
+
+bool Ota::IsConfigCacheFresh() {
+#if CONFIG_OTA_CONFIG_CACHE_TTL_HOURS > 0
+    int64_t age = GetConfigCacheAge();
+    return age >= 0 && age <= CONFIG_OTA_CONFIG_CACHE_TTL_HOURS * 3600;
+#else
+    return false;
+#endif
+}
+
+bool Ota::LoadCachedConfig() {
+#if CONFIG_OTA_CONFIG_CACHE_TTL_HOURS > 0
+    std::string response;
+    std::string etag;
+    if (!ReadConfigCache(response, etag)) {
+        return false;
+    }
+
+    // The age is only known if the system time survived the reboot, otherwise the check at boot
+    // runs and its server_time sets the clock
+    int64_t age = GetConfigCacheAge();
+    if (age < 0) {
+        ESP_LOGI(TAG, "Cached server config not used, its age is unknown");
+        return false;
+    }
+    if (!IsConfigCacheFresh()) {
+        ESP_LOGI(TAG, "Cached server config expired, saved %d hours ago", (int)(age / 3600));
+        return false;
+    }
+
+    if (!ParseCheckVersionResponse(response, true)) {
+        return false;
+    }
+    config_from_cache_ = true;
+    ESP_LOGI(TAG, "Using the cached server config, saved %d minutes ago", (int)(age / 60));
+    return true;
+#else
+    return false;
+#endif
+}
+
 /* 
  * Specification: https://ccnphfhqs21z.feishu.cn/wiki/FjW6wZmisimNBBkov6OcmfvknVd
+ *
+ * The last good response is cached with its ETag. The next check sends it in If-None-Match,
+ * the server may answer 304 Not Modified if the response would be the same. A 304 carries
+ * no server time, so If-None-Match is only sent once the clock is set. A server with a firmware
+ * upgrade or activation for the device must answer 200.
  */
 bool Ota::CheckVersion() {
     auto& board = Board::GetInstance();
@@ -87,28 +207,65 @@ bool Ota::CheckVersion() {
 
     auto http = SetupHttp();
 
+    std::string cached_response;
+    std::string cached_etag;
+    bool has_cache = ReadConfigCache(cached_response, cached_etag);
+    // Without the server_time of a full response the clock would stay unset
+    if (has_cache && !cached_etag.empty() && time(nullptr) >= OTA_CONFIG_CACHE_MIN_VALID_TIME) {
+        http->SetHeader("If-None-Match", cached_etag);
+    }
+
     std::string data = board.GetJson();
     std::string method = data.length() > 0 ? "POST" : "GET";
     http->SetContent(std::move(data));
 
+    auto open_time = esp_timer_get_time();
     if (!http->Open(method, url)) {
         ESP_LOGE(TAG, "Failed to open HTTP connection");
         return false;
     }
+    // Includes DNS, TCP and the TLS handshake, compare it with the audio channel connect percentiles
+    ESP_LOGI(TAG, "Check version request opened in %d ms", (int)((esp_timer_get_time() - open_time) / 1000));
 
     auto status_code = http->GetStatusCode();
+    if (status_code == 304 && has_cache) {
+        http->Close();
+        ESP_LOGI(TAG, "Server config not modified");
+        config_changed_ = false;
+        if (!ParseCheckVersionResponse(cached_response, true)) {
+            return false;
+        }
+        SaveConfigCache(cached_response, cached_etag);
+        return true;
+    }
     if (status_code != 200) {
         ESP_LOGE(TAG, "Failed to check version, status code: %d", status_code);
         return false;
     }
 
     data = http->ReadAll();
+    std::string etag = http->GetResponseHeader("ETag");
     http->Close();
 
-    // Response: { "firmware": { "version": "1.0.0", "url": "http://" } }
-    // Parse the JSON response and check if the version is newer
-    // If it is, set has_new_version_ to true and store the new version and URL
-    
+    if (!ParseCheckVersionResponse(data, false)) {
+        return false;
+    }
+
+    if (has_cache) {
+        cJSON* cached_root = cJSON_Parse(cached_response.c_str());
+        cJSON* root = cJSON_Parse(data.c_str());
+        config_changed_ = cached_root == nullptr || GetServerConfig(cached_root) != GetServerConfig(root);
+        cJSON_Delete(cached_root);
+        cJSON_Delete(root);
+    }
+    SaveConfigCache(data, etag);
+    return true;
+}
+
+// Response: { "firmware": { "version": "1.0.0", "url": "http://" } }
+// Parse the JSON response and check if the version is newer
+// If it is, set has_new_version_ to true and store the new version and URL
+bool Ota::ParseCheckVersionResponse(const std::string& data, bool cached) {
     cJSON *root = cJSON_Parse(data.c_str());
     if (root == NULL) {
         ESP_LOGE(TAG, "Failed to parse JSON response");
@@ -183,7 +340,8 @@ bool Ota::CheckVersion() {
 
     has_server_time_ = false;
     cJSON *server_time = cJSON_GetObjectItem(root, "server_time");
-    if (cJSON_IsObject(server_time)) {
+    // The time in a cached response is old
+    if (cJSON_IsObject(server_time) && !cached) {
         cJSON *timestamp = cJSON_GetObjectItem(server_time, "timestamp");
         cJSON *timezone_offset = cJSON_GetObjectItem(server_time, "timezone_offset");
         
@@ -202,7 +360,7 @@ bool Ota::CheckVersion() {
             settimeofday(&tv, NULL);
             has_server_time_ = true;
         }
-    } else {
+    } else if (!cached) {
         ESP_LOGW(TAG, "No server_time section found!");
     }
 
@@ -13,6 +13,13 @@ public:
     ~Ota();
 
     bool CheckVersion();
+    // Use the last good check version response from NVS, false if there is none or it expired
+    bool LoadCachedConfig();
+    bool IsConfigFromCache() const { return config_from_cache_; }
+    // The cached response is younger than CONFIG_OTA_CONFIG_CACHE_TTL_HOURS, an unknown age counts as expired
+    bool IsConfigCacheFresh();
+    // The server config differs from the cached one, only set by CheckVersion
+    bool HasConfigChanged() const { return config_changed_; }
     esp_err_t Activate();
     bool HasActivationChallenge() { return has_activation_challenge_; }
     bool HasNewVersion() { return has_new_version_; }
@@ -39,6 +46,8 @@ private:
     bool has_activation_code_ = false;
     bool has_serial_number_ = false;
     bool has_activation_challenge_ = false;
+    bool config_from_cache_ = false;
+    bool config_changed_ = false;
     std::string current_version_;
     std::string firmware_version_;
     std::string firmware_url_;
@@ -52,6 +61,11 @@ private:
     bool IsNewVersionAvailable(const std::string& currentVersion, const std::string& newVersion);
     std::string GetActivationPayload();
     std::unique_ptr<Http> SetupHttp();
+    bool ParseCheckVersionResponse(const std::string& data, bool cached);
+    bool ReadConfigCache(std::string& response, std::string& etag);
+    // Seconds since the cache was saved, -1 if the system time is not set
+    int64_t GetConfigCacheAge();
+    void SaveConfigCache(const std::string& response, const std::string& etag);
 };
 
 #endif // _OTA_H
@@ -0,0 +1,154 @@
+#include "audio_channel_policy.h"
+
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <sdkconfig.h>
+#include <cJSON.h>
+#include <algorithm>
+
+#define TAG "AudioChannelPolicy"
+
+AudioChannelPolicy::AudioChannelPolicy() {
+#if CONFIG_AUDIO_CHANNEL_POLICY_PERSISTENT
+    mode_ = kChannelPolicyPersistent;
+#elif CONFIG_AUDIO_CHANNEL_POLICY_SPECULATIVE
+    mode_ = kChannelPolicySpeculative;
+#else
+    mode_ = kChannelPolicyOnDemand;
+#endif
+}
+
+void AudioChannelPolicy::OnSessionStart(bool channel_opened) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto now = esp_timer_get_time();
+    if (last_session_end_us_ > 0) {
+        int gap_ms = (now - last_session_end_us_) / 1000;
+        average_gap_ms_ = average_gap_ms_ == 0 ? gap_ms : (average_gap_ms_ * 3 + gap_ms) / 4;
+    }
+
+    sessions_++;
+    session_active_ = true;
+    if (channel_opened && prewarmed_) {
+        prewarm_hits_++;
+        idle_open_ms_ += (now - prewarm_start_us_) / 1000;
+        ESP_LOGI(TAG, "Session started on a prewarmed channel, saved about %d ms, %d/%d sessions prewarmed",
+            GetConnectPercentile(50), prewarm_hits_, sessions_);
+    }
+    prewarmed_ = false;
+}
+
+void AudioChannelPolicy::OnConnected(int64_t duration_us, bool success, bool prewarm) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!success) {
+        connect_failures_++;
+        if (!prewarm) {
+            session_active_ = false;
+        }
+        return;
+    }
+
+    connect_times_ms_[connect_count_ % AUDIO_CHANNEL_CONNECT_HISTORY] = duration_us / 1000;
+    connect_count_++;
+    if (prewarm) {
+        prewarms_++;
+        prewarmed_ = true;
+        prewarm_start_us_ = esp_timer_get_time();
+    }
+    ESP_LOGI(TAG, "Audio channel opened in %d ms%s, p50 %d ms, p90 %d ms, p99 %d ms over %d samples",
+        (int)(duration_us / 1000), prewarm ? " (prewarm)" : "", GetConnectPercentile(50),
+        GetConnectPercentile(90), GetConnectPercentile(99),
+        std::min(connect_count_, AUDIO_CHANNEL_CONNECT_HISTORY));
+}
+
+bool AudioChannelPolicy::OnChannelClosed() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    bool used = session_active_;
+    if (session_active_) {
+        session_active_ = false;
+        last_session_end_us_ = esp_timer_get_time();
+    }
+    if (prewarmed_) {
+        int open_ms = (esp_timer_get_time() - prewarm_start_us_) / 1000;
+        idle_open_ms_ += open_ms;
+        wasted_open_ms_ += open_ms;
+        prewarms_unused_++;
+        prewarmed_ = false;
+        ESP_LOGI(TAG, "Prewarmed channel closed unused after %d ms, idle open %d s in total, %d s wasted by %d/%d prewarms",
+            open_ms, (int)(idle_open_ms_ / 1000), (int)(wasted_open_ms_ / 1000), prewarms_unused_, prewarms_);
+    }
+    return used;
+}
+
+bool AudioChannelPolicy::ShouldPrewarm(bool after_session) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (mode_ == kChannelPolicyOnDemand || prewarmed_ || session_active_) {
+        return false;
+    }
+    if (after_session) {
+        if (mode_ != kChannelPolicyPersistent) {
+            return false;
+        }
+        // The user rarely comes back within the idle timeout, the channel would only burn power
+        if (average_gap_ms_ > CONFIG_AUDIO_CHANNEL_IDLE_TIMEOUT_MAX_SECONDS * 1000 * AUDIO_CHANNEL_SPARSE_USE_FACTOR) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool AudioChannelPolicy::IsIdleExpired() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!prewarmed_) {
+        return false;
+    }
+    return esp_timer_get_time() - prewarm_start_us_ > (int64_t)CalculateIdleTimeoutMs() * 1000;
+}
+
+int AudioChannelPolicy::GetIdleTimeoutMs() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return CalculateIdleTimeoutMs();
+}
+
+int AudioChannelPolicy::CalculateIdleTimeoutMs() const {
+    int max_timeout_ms = CONFIG_AUDIO_CHANNEL_IDLE_TIMEOUT_MAX_SECONDS * 1000;
+    if (average_gap_ms_ == 0) {
+        return max_timeout_ms;
+    }
+    return std::clamp(average_gap_ms_ * 2, AUDIO_CHANNEL_MIN_IDLE_TIMEOUT_MS, max_timeout_ms);
+}
+
+int AudioChannelPolicy::GetConnectPercentile(int percentile) const {
+    int count = std::min(connect_count_, AUDIO_CHANNEL_CONNECT_HISTORY);
+    if (count == 0) {
+        return 0;
+    }
+    int sorted[AUDIO_CHANNEL_CONNECT_HISTORY];
+    std::copy(connect_times_ms_, connect_times_ms_ + count, sorted);
+    std::sort(sorted, sorted + count);
+    return sorted[std::min(count - 1, count * percentile / 100)];
+}
+
+std::string AudioChannelPolicy::GetStatsJson() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    static const char* const mode_names[] = { "on_demand", "speculative", "persistent" };
+    cJSON* root = cJSON_CreateObject();
+    cJSON_AddStringToObject(root, "policy", mode_names[mode_]);
+    cJSON_AddNumberToObject(root, "connects", connect_count_);
+    cJSON_AddNumberToObject(root, "connect_failures", connect_failures_);
+    cJSON_AddNumberToObject(root, "connect_p50_ms", GetConnectPercentile(50));
+    cJSON_AddNumberToObject(root, "connect_p90_ms", GetConnectPercentile(90));
+    cJSON_AddNumberToObject(root, "connect_p99_ms", GetConnectPercentile(99));
+    cJSON_AddNumberToObject(root, "sessions", sessions_);
+    cJSON_AddNumberToObject(root, "prewarm_hits", prewarm_hits_);
+    cJSON_AddNumberToObject(root, "prewarms", prewarms_);
+    cJSON_AddNumberToObject(root, "prewarms_unused", prewarms_unused_);
+    cJSON_AddNumberToObject(root, "average_session_gap_ms", average_gap_ms_);
+    cJSON_AddNumberToObject(root, "idle_timeout_ms", CalculateIdleTimeoutMs());
+    cJSON_AddNumberToObject(root, "idle_open_seconds", (int)(idle_open_ms_ / 1000));
+    cJSON_AddNumberToObject(root, "wasted_open_seconds", (int)(wasted_open_ms_ / 1000));
+    auto json_str = cJSON_PrintUnformatted(root);
+    std::string result(json_str);
+    cJSON_free(json_str);
+    cJSON_Delete(root);
+    return result;
+}
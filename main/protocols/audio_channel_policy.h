@@ -0,0 +1,79 @@
+#ifndef AUDIO_CHANNEL_POLICY_H
+#define AUDIO_CHANNEL_POLICY_H
+
+#include <cstdint>
+#include <string>
+#include <mutex>
+
+#define AUDIO_CHANNEL_CONNECT_HISTORY 32
+// Shortest idle timeout of a prewarmed channel, the longest one comes from Kconfig
+#define AUDIO_CHANNEL_MIN_IDLE_TIMEOUT_MS 15000
+// Do not keep a channel open for users who come back less often than this multiple of the idle timeout
+#define AUDIO_CHANNEL_SPARSE_USE_FACTOR 4
+
+enum AudioChannelPolicyMode {
+    kChannelPolicyOnDemand,     // Open the channel when a session starts
+    kChannelPolicySpeculative,  // Also open it when a session is likely to start, e.g. on button down
+    kChannelPolicyPersistent,   // Also reopen it after every session, until it idles out
+};
+
+/*
+ * AudioChannelPolicy decides when the audio channel is opened ahead of a session
+ * and when an unused channel is closed again.
+ *
+ * A prewarmed channel keeps WiFi out of power save mode, so its idle timeout follows
+ * the average gap between sessions: 2x the gap, clamped to
+ * [AUDIO_CHANNEL_MIN_IDLE_TIMEOUT_MS, CONFIG_AUDIO_CHANNEL_IDLE_TIMEOUT_MAX_SECONDS].
+ * The maximum stays below the 120 s protocol timeout, websocket ping/pong keeps the
+ * connection itself alive in the meantime.
+ *
+ * The main event loop drives it, the methods lock so the stats can be read from other tasks.
+ */
+class AudioChannelPolicy {
+public:
+    AudioChannelPolicy();
+
+    AudioChannelPolicyMode mode() const { return mode_; }
+
+    // A session is starting, channel_opened tells whether the handshake is skipped
+    void OnSessionStart(bool channel_opened);
+    // An open attempt finished, prewarm is true if no session is waiting for it
+    void OnConnected(int64_t duration_us, bool success, bool prewarm);
+    // Returns true if a session used the channel
+    bool OnChannelClosed();
+
+    // Whether a prewarm is worth it, after_session is true right after a session ended
+    bool ShouldPrewarm(bool after_session) const;
+    // Whether the prewarmed channel has been unused for longer than the idle timeout
+    bool IsIdleExpired() const;
+    int GetIdleTimeoutMs() const;
+    std::string GetStatsJson() const;
+
+private:
+    AudioChannelPolicyMode mode_;
+    int connect_times_ms_[AUDIO_CHANNEL_CONNECT_HISTORY] = {};
+    int connect_count_ = 0;
+    int connect_failures_ = 0;
+
+    bool session_active_ = false;
+    bool prewarmed_ = false;
+    int64_t prewarm_start_us_ = 0;
+    int64_t last_session_end_us_ = 0;
+    // Exponential moving average of the gap between the end of a session and the start of the next one
+    int average_gap_ms_ = 0;
+
+    int sessions_ = 0;
+    int prewarm_hits_ = 0;
+    int prewarms_ = 0;
+    int prewarms_unused_ = 0;
+    // Time the channel stayed open without a session, the idle power cost of the policy
+    int64_t idle_open_ms_ = 0;
+    int64_t wasted_open_ms_ = 0;
+
+    mutable std::mutex mutex_;
+
+    int GetConnectPercentile(int percentile) const;
+    int CalculateIdleTimeoutMs() const;
+};
+
+#endif // AUDIO_CHANNEL_POLICY_H
@@ -0,0 +1,266 @@
+#include "cbor_codec.h"
+
+#include <cmath>
+#include <cstring>
+#include <string>
+
+#define CBOR_MAX_DEPTH 16
+#define CBOR_BREAK 0xFF
+#define CBOR_INDEFINITE 31
+// IANA tag for an embedded JSON document, used for MCP payloads
+#define CBOR_TAG_EMBEDDED_JSON 262
+
+// Shared with the server, only append to the end
+static const char* const kKeyDictionary[] = {
+    "type", "session_id", "state", "mode", "text", "reason", "payload", "emotion",
+    "timestamp", "stats", "command", "status", "message",
+    "jsonrpc", "id", "method", "params", "result", "error", "name", "arguments", "content", "isError", "code",
+    "duration_ms", "up_packets", "up_bytes", "down_packets", "down_bytes", "send_failures",
+    "lost", "reordered", "duplicates", "jitter_ms", "rtt_ms", "loss",
+    "max_send_delay_ms",
+};
+static const int kKeyDictionarySize = sizeof(kKeyDictionary) / sizeof(kKeyDictionary[0]);
+
+namespace CborCodec {
+
+int LookupKey(const char* key) {
+    for (int i = 0; i < kKeyDictionarySize; i++) {
+        if (strcmp(kKeyDictionary[i], key) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+namespace {
+
+class Reader {
+public:
+    Reader(const uint8_t* data, size_t size) : data_(data), size_(size) {}
+
+    bool AtEnd() const { return position_ == size_; }
+
+    cJSON* ReadItem(int depth) {
+        uint8_t major;
+        uint8_t info;
+        uint64_t value;
+        if (depth > CBOR_MAX_DEPTH || !ReadHead(major, info, value)) {
+            return nullptr;
+        }
+
+        switch (major) {
+            case 0:
+                return cJSON_CreateNumber((double)value);
+            case 1:
+                return cJSON_CreateNumber(-1.0 - (double)value);
+            case 2:
+            case 3: {
+                // Byte strings only appear if the server sends them, they become strings too
+                const char* text;
+                if (info == CBOR_INDEFINITE || !ReadBytes(value, text)) {
+                    return nullptr;
+                }
+                return CreateString(text, value);
+            }
+            case 4:
+                return ReadArray(info == CBOR_INDEFINITE, value, depth);
+            case 5:
+                return ReadMap(info == CBOR_INDEFINITE, value, depth);
+            case 6:
+                if (value == CBOR_TAG_EMBEDDED_JSON) {
+                    return ReadEmbeddedJson();
+                }
+                // Other tags carry no meaning for the control messages, use the tagged item
+                return ReadItem(depth + 1);
+            default:
+                return ReadSimple(info, value);
+        }
+    }
+
+private:
+    const uint8_t* data_;
+    size_t size_;
+    size_t position_ = 0;
+
+    bool ReadHead(uint8_t& major, uint8_t& info, uint64_t& value) {
+        if (position_ >= size_) {
+            return false;
+        }
+        uint8_t initial = data_[position_++];
+        major = initial >> 5;
+        info = initial & 0x1F;
+        if (info < 24 || info == CBOR_INDEFINITE) {
+            value = info;
+            return info != CBOR_INDEFINITE || (major >= 2 && major <= 5);
+        }
+        if (info > 27) {
+            return false;
+        }
+        size_t length = 1 << (info - 24);
+        if (size_ - position_ < length) {
+            return false;
+        }
+        value = 0;
+        for (size_t i = 0; i < length; i++) {
+            value = (value << 8) | data_[position_++];
+        }
+        return true;
+    }
+
+    bool ReadBytes(uint64_t length, const char*& bytes) {
+        if (size_ - position_ < length) {
+            return false;
+        }
+        bytes = (const char*)data_ + position_;
+        position_ += length;
+        return true;
+    }
+
+    bool AtBreak() {
+        if (position_ < size_ && data_[position_] == CBOR_BREAK) {
+            position_++;
+            return true;
+        }
+        return false;
+    }
+
+    static cJSON* CreateString(const char* text, size_t length) {
+        // cJSON wants a terminated string, short ones are terminated on the stack
+        char stack_buffer[64];
+        if (length < sizeof(stack_buffer)) {
+            memcpy(stack_buffer, text, length);
+            stack_buffer[length] = '\0';
+            return cJSON_CreateString(stack_buffer);
+        }
+        return cJSON_CreateString(std::string(text, length).c_str());
+    }
+
+    cJSON* ReadEmbeddedJson() {
+        uint8_t major;
+        uint8_t info;
+        uint64_t value;
+        const char* json;
+        if (!ReadHead(major, info, value) || major != 2 || info == CBOR_INDEFINITE ||
+            !ReadBytes(value, json)) {
+            return nullptr;
+        }
+        return cJSON_ParseWithLength(json, value);
+    }
+
+    cJSON* ReadArray(bool indefinite, uint64_t count, int depth) {
+        cJSON* array = cJSON_CreateArray();
+        for (uint64_t i = 0; indefinite || i < count; i++) {
+            if (indefinite && AtBreak()) {
+                break;
+            }
+            cJSON* item = ReadItem(depth + 1);
+            if (item == nullptr) {
+                cJSON_Delete(array);
+                return nullptr;
+            }
+            cJSON_AddItemToArray(array, item);
+        }
+        return array;
+    }
+
+    cJSON* ReadMap(bool indefinite, uint64_t count, int depth) {
+        cJSON* object = cJSON_CreateObject();
+        for (uint64_t i = 0; indefinite || i < count; i++) {
+            if (indefinite && AtBreak()) {
+                break;
+            }
+            if (!ReadMember(object, depth)) {
+                cJSON_Delete(object);
+                return nullptr;
+            }
+        }
+        return object;
+    }
+
+    bool ReadMember(cJSON* object, int depth) {
+        uint8_t major;
+        uint8_t info;
+        uint64_t value;
+        if (!ReadHead(major, info, value)) {
+            return false;
+        }
+
+        if (major == 0) {
+            if (value >= (uint64_t)kKeyDictionarySize) {
+                return false;
+            }
+            cJSON* item = ReadItem(depth + 1);
+            if (item == nullptr) {
+                return false;
+            }
+            // Dictionary keys are literals, cJSON can keep a reference instead of a copy
+            cJSON_AddItemToObjectCS(object, kKeyDictionary[value], item);
+            return true;
+        }
+
+        const char* key;
+        if (major != 3 || info == CBOR_INDEFINITE || !ReadBytes(value, key)) {
+            return false;
+        }
+        std::string key_string(key, value);
+        cJSON* item = ReadItem(depth + 1);
+        if (item == nullptr) {
+            return false;
+        }
+        cJSON_AddItemToObject(object, key_string.c_str(), item);
+        return true;
+    }
+
+    cJSON* ReadSimple(uint8_t info, uint64_t value) {
+        switch (info) {
+            case 20:
+                return cJSON_CreateFalse();
+            case 21:
+                return cJSON_CreateTrue();
+            case 22:
+            case 23:
+                return cJSON_CreateNull();
+            case 25: {
+                // Half precision float
+                int exponent = (value >> 10) & 0x1F;
+                int mantissa = value & 0x3FF;
+                double number;
+                if (exponent == 0) {
+                    number = ldexp(mantissa, -24);
+                } else if (exponent != 31) {
+                    number = ldexp(mantissa + 1024, exponent - 25);
+                } else {
+                    number = mantissa == 0 ? INFINITY : NAN;
+                }
+                return cJSON_CreateNumber(value & 0x8000 ? -number : number);
+            }
+            case 26: {
+                uint32_t bits = value;
+                float number;
+                memcpy(&number, &bits, sizeof(number));
+                return cJSON_CreateNumber(number);
+            }
+            case 27: {
+                double number;
+                memcpy(&number, &value, sizeof(number));
+                return cJSON_CreateNumber(number);
+            }
+            default:
+                return nullptr;
+        }
+    }
+};
+
+}
+
+cJSON* Decode(const uint8_t* data, size_t size) {
+    Reader reader(data, size);
+    cJSON* root = reader.ReadItem(0);
+    if (root != nullptr && !reader.AtEnd()) {
+        cJSON_Delete(root);
+        return nullptr;
+    }
+    return root;
+}
+
+}
@@ -0,0 +1,34 @@
+#ifndef CBOR_CODEC_H
+#define CBOR_CODEC_H
+
+#include <cJSON.h>
+#include <cstddef>
+#include <cstdint>
+
+/*
+ * Compact binary encoding of the control messages, negotiated with "cbor" in the
+ * hello features (see docs/websocket.md).
+ *
+ * Messages are CBOR maps with the same structure as the JSON messages. Keys in
+ * the shared dictionary are sent as their index, any other key as a text string.
+ * Payloads that are already serialized JSON (MCP) are embedded as a byte string
+ * with tag 262.
+ * The dictionary is part of the protocol, new keys may only be appended.
+ */
+namespace CborCodec {
+
+// Index of the key in the dictionary, or -1
+int LookupKey(const char* key);
+
+// Decode a CBOR message into the same cJSON tree the JSON text would give,
+// returns nullptr if the data is not valid CBOR. The caller deletes the tree.
+cJSON* Decode(const uint8_t* data, size_t size);
+
+// Whether a received payload is a CBOR map rather than JSON text
+inline bool IsCborMessage(const uint8_t* data, size_t size) {
+    return size > 0 && (data[0] >> 5) == 5;
+}
+
+}
+
+#endif // CBOR_CODEC_H
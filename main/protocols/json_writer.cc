@@ -0,0 +1,222 @@
+#include "json_writer.h"
+#include "cbor_codec.h"
+
+#include <cstdio>
+#include <cstring>
+
+#define CBOR_MAJOR_UNSIGNED 0
+#define CBOR_MAJOR_NEGATIVE 1
+#define CBOR_MAJOR_BYTES 2
+#define CBOR_MAJOR_TEXT 3
+#define CBOR_MAJOR_TAG 6
+#define CBOR_MAP_INDEFINITE 0xBF
+#define CBOR_BREAK 0xFF
+#define CBOR_FALSE 0xF4
+#define CBOR_TRUE 0xF5
+// IANA tag for an embedded JSON document
+#define CBOR_TAG_EMBEDDED_JSON 262
+
+JsonWriter::JsonWriter(char* buffer, size_t size, MessageEncoding encoding)
+    : buffer_(buffer), size_(size), encoding_(encoding) {
+    if (size_ > 0) {
+        buffer_[0] = '\0';
+    } else {
+        overflow_ = true;
+    }
+}
+
+void JsonWriter::Append(char c) {
+    if (overflow_) {
+        return;
+    }
+    // Keep one byte for the terminator
+    if (length_ + 1 >= size_) {
+        Overflow();
+        return;
+    }
+    buffer_[length_++] = c;
+}
+
+void JsonWriter::Append(std::string_view text) {
+    if (overflow_) {
+        return;
+    }
+    if (length_ + text.size() >= size_) {
+        Overflow();
+        return;
+    }
+    memcpy(buffer_ + length_, text.data(), text.size());
+    length_ += text.size();
+}
+
+void JsonWriter::Overflow() {
+    overflow_ = true;
+    buffer_[length_] = '\0';
+}
+
+void JsonWriter::AppendEscaped(std::string_view text) {
+    Append('"');
+    size_t start = 0;
+    for (size_t i = 0; i < text.size(); i++) {
+        unsigned char c = text[i];
+        if (c >= 0x20 && c != '"' && c != '\\') {
+            continue;
+        }
+        // Copy the plain run in one go, then the escape sequence
+        Append(text.substr(start, i - start));
+        start = i + 1;
+        switch (c) {
+            case '"': Append("\\\""); break;
+            case '\\': Append("\\\\"); break;
+            case '\n': Append("\\n"); break;
+            case '\r': Append("\\r"); break;
+            case '\t': Append("\\t"); break;
+            case '\b': Append("\\b"); break;
+            case '\f': Append("\\f"); break;
+            default: {
+                char escaped[7];
+                snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+                Append(escaped);
+                break;
+            }
+        }
+    }
+    Append(text.substr(start));
+    Append('"');
+}
+
+void JsonWriter::AppendKey(const char* key) {
+    if (depth_ > 0) {
+        uint32_t bit = 1u << (depth_ - 1);
+        if (has_members_ & bit) {
+            Append(',');
+        }
+        has_members_ |= bit;
+    }
+    if (key != nullptr) {
+        Append('"');
+        Append(key);
+        Append("\":");
+    }
+}
+
+void JsonWriter::AppendCborHead(uint8_t major, uint32_t value) {
+    major <<= 5;
+    if (value < 24) {
+        Append((char)(major | value));
+    } else if (value <= 0xFF) {
+        Append((char)(major | 24));
+        Append((char)value);
+    } else if (value <= 0xFFFF) {
+        Append((char)(major | 25));
+        Append((char)(value >> 8));
+        Append((char)value);
+    } else {
+        Append((char)(major | 26));
+        Append((char)(value >> 24));
+        Append((char)(value >> 16));
+        Append((char)(value >> 8));
+        Append((char)value);
+    }
+}
+
+void JsonWriter::AppendCborText(std::string_view text) {
+    AppendCborHead(CBOR_MAJOR_TEXT, text.size());
+    Append(text);
+}
+
+void JsonWriter::AppendCborKey(const char* key) {
+    if (key == nullptr) {
+        return;
+    }
+    int index = CborCodec::LookupKey(key);
+    if (index >= 0) {
+        AppendCborHead(CBOR_MAJOR_UNSIGNED, index);
+    } else {
+        AppendCborText(key);
+    }
+}
+
+JsonWriter& JsonWriter::BeginObject(const char* key) {
+    if (depth_ >= 32) {
+        Overflow();
+        return *this;
+    }
+    if (encoding_ == kMessageEncodingCbor) {
+        // Indefinite length maps, so members need not be counted up front
+        AppendCborKey(key);
+        Append((char)CBOR_MAP_INDEFINITE);
+        depth_++;
+        return *this;
+    }
+    AppendKey(key);
+    Append('{');
+    depth_++;
+    has_members_ &= ~(1u << (depth_ - 1));
+    return *this;
+}
+
+JsonWriter& JsonWriter::EndObject() {
+    if (depth_ > 0) {
+        depth_--;
+    }
+    Append(encoding_ == kMessageEncodingCbor ? (char)CBOR_BREAK : '}');
+    if (!overflow_) {
+        buffer_[length_] = '\0';
+    }
+    return *this;
+}
+
+JsonWriter& JsonWriter::AddString(const char* key, std::string_view value) {
+    if (encoding_ == kMessageEncodingCbor) {
+        AppendCborKey(key);
+        AppendCborText(value);
+        return *this;
+    }
+    AppendKey(key);
+    AppendEscaped(value);
+    return *this;
+}
+
+JsonWriter& JsonWriter::AddNumber(const char* key, int value) {
+    if (encoding_ == kMessageEncodingCbor) {
+        AppendCborKey(key);
+        if (value >= 0) {
+            AppendCborHead(CBOR_MAJOR_UNSIGNED, value);
+        } else {
+            AppendCborHead(CBOR_MAJOR_NEGATIVE, -1 - value);
+        }
+        return *this;
+    }
+    char number[12];
+    int length = snprintf(number, sizeof(number), "%d", value);
+    AppendKey(key);
+    Append(std::string_view(number, length));
+    return *this;
+}
+
+JsonWriter& JsonWriter::AddBool(const char* key, bool value) {
+    if (encoding_ == kMessageEncodingCbor) {
+        AppendCborKey(key);
+        Append((char)(value ? CBOR_TRUE : CBOR_FALSE));
+        return *this;
+    }
+    AppendKey(key);
+    Append(value ? "true" : "false");
+    return *this;
+}
+
+JsonWriter& JsonWriter::AddRaw(const char* key, std::string_view json) {
+    if (encoding_ == kMessageEncodingCbor) {
+        // Already serialized, embed the JSON text rather than parsing it again
+        AppendCborKey(key);
+        // The IANA CBOR tags registry defines tag 262 on a byte string
+        AppendCborHead(CBOR_MAJOR_TAG, CBOR_TAG_EMBEDDED_JSON);
+        AppendCborHead(CBOR_MAJOR_BYTES, json.size());
+        Append(json);
+        return *this;
+    }
+    AppendKey(key);
+    Append(json);
+    return *this;
+}
@@ -0,0 +1,69 @@
+#ifndef JSON_WRITER_H
+#define JSON_WRITER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+/*
+ * Minimal JSON serializer that writes into a caller provided buffer, so
+ * control messages can be built on the stack without heap allocation.
+ *
+ * String values are escaped (quotes, backslashes and control characters), UTF-8
+ * is copied as is. Keys are expected to be plain literals and are not escaped.
+ * If the buffer is too small the writer stops and ok() returns false. The output
+ * is NUL terminated after every EndObject and on overflow.
+ *
+ *   char buffer[PROTOCOL_MESSAGE_BUFFER_SIZE];
+ *   JsonWriter writer(buffer, sizeof(buffer));
+ *   writer.BeginObject().AddString("type", "listen").AddNumber("id", 1).EndObject();
+ *   SendText(writer.view());
+ *
+ * With kMessageEncodingCbor the same calls produce the compact binary form of
+ * the message (see cbor_codec.h) instead of JSON text, view() then holds bytes.
+ */
+enum MessageEncoding {
+    kMessageEncodingJson,
+    kMessageEncodingCbor,
+};
+
+class JsonWriter {
+public:
+    JsonWriter(char* buffer, size_t size, MessageEncoding encoding = kMessageEncodingJson);
+
+    // Start an object, as a member of the enclosing object if key is not null
+    JsonWriter& BeginObject(const char* key = nullptr);
+    JsonWriter& EndObject();
+    JsonWriter& AddString(const char* key, std::string_view value);
+    JsonWriter& AddNumber(const char* key, int value);
+    JsonWriter& AddBool(const char* key, bool value);
+    // Add a value that is already serialized JSON, e.g. an MCP payload
+    JsonWriter& AddRaw(const char* key, std::string_view json);
+
+    MessageEncoding encoding() const { return encoding_; }
+    bool ok() const { return !overflow_; }
+    size_t length() const { return length_; }
+    const char* c_str() const { return buffer_; }
+    std::string_view view() const { return std::string_view(buffer_, length_); }
+
+private:
+    char* buffer_;
+    size_t size_;
+    MessageEncoding encoding_;
+    size_t length_ = 0;
+    bool overflow_ = false;
+    int depth_ = 0;
+    // One bit per nesting level, set once the level has a member
+    uint32_t has_members_ = 0;
+
+    void Append(char c);
+    void Append(std::string_view text);
+    void AppendEscaped(std::string_view text);
+    void AppendKey(const char* key);
+    void AppendCborHead(uint8_t major, uint32_t value);
+    void AppendCborKey(const char* key);
+    void AppendCborText(std::string_view text);
+    void Overflow();
+};
+
+#endif // JSON_WRITER_H
@@ -2,9 +2,11 @@
 #include "board.h"
 #include "application.h"
 #include "settings.h"
+#include "cbor_codec.h"
 
 #include <esp_log.h>
 #include <cstring>
+#include <algorithm>
 #include <arpa/inet.h>
 #include "assets/lang_config.h"
 
@@ -12,10 +14,19 @@
 
 MqttProtocol::MqttProtocol() {
     event_group_handle_ = xEventGroupCreate();
+    mbedtls_aes_init(&encrypt_ctx_);
+    mbedtls_aes_init(&decrypt_ctx_);
+    send_buffer_.reserve(MQTT_AUDIO_SEND_BUFFER_SIZE);
+    for (auto& packet : sent_packets_) {
+        packet.reserve(MQTT_AUDIO_SEND_BUFFER_SIZE);
+    }
 }
 
 MqttProtocol::~MqttProtocol() {
     ESP_LOGI(TAG, "MqttProtocol deinit");
+    udp_.reset();
+    mbedtls_aes_free(&encrypt_ctx_);
+    mbedtls_aes_free(&decrypt_ctx_);
     vEventGroupDelete(event_group_handle_);
 }
 
@@ -24,39 +35,59 @@ bool MqttProtocol::Start() {
 }
 
 bool MqttProtocol::StartMqttClient(bool report_error) {
+    close_session_on_connect_ = false;
     if (mqtt_ != nullptr) {
         ESP_LOGW(TAG, "Mqtt client already started");
         mqtt_.reset();
     }
 
-    Settings settings("mqtt", false);
-    auto endpoint = settings.GetString("endpoint");
-    auto client_id = settings.GetString("client_id");
-    auto username = settings.GetString("username");
-    auto password = settings.GetString("password");
-    int keepalive_interval = settings.GetInt("keepalive", 240);
-    publish_topic_ = settings.GetString("publish_topic");
-
-    if (endpoint.empty()) {
-        ESP_LOGW(TAG, "MQTT endpoint is not specified");
+    mqtt_ = CreateMqttClient();
+    if (mqtt_ == nullptr) {
         if (report_error) {
             SetError(Lang::Strings::SERVER_NOT_FOUND);
         }
         return false;
     }
+    if (!ConnectMqttClient(mqtt_.get())) {
+        SetError(Lang::Strings::SERVER_NOT_CONNECTED);
+        return false;
+    }
+    return true;
+}
+
+// Creates the client of a new generation without connecting it, nullptr without an endpoint
+std::unique_ptr<Mqtt> MqttProtocol::CreateMqttClient() {
+    Settings settings("mqtt", false);
+    if (settings.GetString("endpoint").empty()) {
+        ESP_LOGW(TAG, "MQTT endpoint is not specified");
+        return nullptr;
+    }
+    int keepalive_interval = settings.GetInt("keepalive", 240);
+    publish_topic_ = settings.GetString("publish_topic");
 
     auto network = Board::GetInstance().GetNetwork();
-    mqtt_ = network->CreateMqtt(0);
-    mqtt_->SetKeepAlive(keepalive_interval);
+    auto mqtt = network->CreateMqtt(0);
+    mqtt->SetKeepAlive(keepalive_interval);
 
-    mqtt_->OnDisconnected([this]() {
+    uint32_t generation = ++mqtt_generation_;
+    mqtt->OnDisconnected([this, generation]() {
         ESP_LOGI(TAG, "Disconnected from endpoint");
+        Application::GetInstance().Schedule([this, generation]() {
+            HandleDisconnected(generation);
+        });
     });
 
-    mqtt_->OnMessage([this](const std::string& topic, const std::string& payload) {
-        cJSON* root = cJSON_Parse(payload.c_str());
+    mqtt->OnMessage([this](const std::string& topic, const std::string& payload) {
+        // CBOR messages start with a map header, JSON ones with '{'
+        auto data = (const uint8_t*)payload.data();
+        cJSON* root;
+        if (CborCodec::IsCborMessage(data, payload.size())) {
+            root = CborCodec::Decode(data, payload.size());
+        } else {
+            root = cJSON_ParseWithLength(payload.data(), payload.size());
+        }
         if (root == nullptr) {
-            ESP_LOGE(TAG, "Failed to parse json message %s", payload.c_str());
+            ESP_LOGE(TAG, "Failed to parse message, %u bytes", (unsigned)payload.size());
             return;
         }
         cJSON* type = cJSON_GetObjectItem(root, "type");
@@ -68,6 +99,10 @@ bool MqttProtocol::StartMqttClient(bool report_error) {
 
         if (strcmp(type->valuestring, "hello") == 0) {
             ParseServerHello(root);
+        } else if (strcmp(type->valuestring, "pong") == 0) {
+            HandlePong(root);
+        } else if (strcmp(type->valuestring, "feedback") == 0) {
+            HandleLossFeedback(root);
         } else if (strcmp(type->valuestring, "goodbye") == 0) {
             auto session_id = cJSON_GetObjectItem(root, "session_id");
             ESP_LOGI(TAG, "Received goodbye message, session_id: %s", session_id ? session_id->valuestring : "null");
@@ -83,6 +118,17 @@ bool MqttProtocol::StartMqttClient(bool report_error) {
         last_incoming_time_ = std::chrono::steady_clock::now();
     });
 
+    return mqtt;
+}
+
+// Blocks until the broker answers, may run outside the main loop
+bool MqttProtocol::ConnectMqttClient(Mqtt* mqtt) {
+    Settings settings("mqtt", false);
+    auto endpoint = settings.GetString("endpoint");
+    auto client_id = settings.GetString("client_id");
+    auto username = settings.GetString("username");
+    auto password = settings.GetString("password");
+
     ESP_LOGI(TAG, "Connecting to endpoint %s", endpoint.c_str());
     std::string broker_address;
     int broker_port = 8883;
@@ -93,9 +139,8 @@ bool MqttProtocol::StartMqttClient(bool report_error) {
     } else {
         broker_address = endpoint;
     }
-    if (!mqtt_->Connect(broker_address, broker_port, client_id, username, password)) {
+    if (!mqtt->Connect(broker_address, broker_port, client_id, username, password)) {
         ESP_LOGE(TAG, "Failed to connect to endpoint");
-        SetError(Lang::Strings::SERVER_NOT_CONNECTED);
         return false;
     }
 
@@ -103,12 +148,120 @@ bool MqttProtocol::StartMqttClient(bool report_error) {
     return true;
 }
 
-bool MqttProtocol::SendText(const std::string& text) {
+// The old client stays in place until the new one is connected, so the control messages
+// keep being buffered and the main loop is not blocked by the broker
+void MqttProtocol::StartMqttClientAsync() {
+    auto mqtt = CreateMqttClient().release();
+    if (mqtt == nullptr) {
+        return;
+    }
+    // A connect that is still running belongs to an older generation, its result is dropped
+    uint32_t generation = mqtt_generation_;
+    bool started = StartConnectTask("mqtt_connect", [this, generation, mqtt]() {
+        bool connected = ConnectMqttClient(mqtt);
+        Application::GetInstance().Schedule([this, generation, mqtt, connected]() {
+            HandleConnectResult(generation, mqtt, connected);
+        });
+    });
+    if (!started) {
+        delete mqtt;
+        HandleConnectResult(generation, nullptr, false);
+    }
+}
+
+void MqttProtocol::HandleConnectResult(uint32_t generation, Mqtt* mqtt, bool connected) {
+    std::unique_ptr<Mqtt> client(mqtt);
+    if (generation != mqtt_generation_) {
+        // Another client was started in the meantime
+        return;
+    }
+    if (connected) {
+        mqtt_ = std::move(client);
+    }
+    if (close_session_on_connect_) {
+        close_session_on_connect_ = false;
+        if (udp_ != nullptr) {
+            CloseAudioChannel();
+        }
+        return;
+    }
+    if (!connected) {
+        if (udp_ != nullptr && !ScheduleReconnect()) {
+            CloseAudioChannel();
+        }
+        return;
+    }
+
+    CancelReconnect();
+    if (udp_ != nullptr) {
+        ESP_LOGI(TAG, "Reconnected, session %s continues", session_id_.c_str());
+        FlushControlMessages();
+    }
+}
+
+void MqttProtocol::HandleDisconnected(uint32_t generation) {
+    // Outside a session the next OpenAudioChannel connects again
+    if (generation != mqtt_generation_ || reconnect_attempts_ > 0 || udp_ == nullptr) {
+        return;
+    }
+    // The audio keeps flowing over UDP, only the control messages wait for the broker
+    ESP_LOGW(TAG, "Connection lost during session %s, reconnecting", session_id_.c_str());
+    if (!ScheduleReconnect()) {
+        CloseAudioChannel();
+    }
+}
+
+void MqttProtocol::Reconnect() {
+    if (udp_ == nullptr) {
+        CancelReconnect();
+        return;
+    }
+    if (mqtt_ != nullptr && mqtt_->IsConnected()) {
+        ESP_LOGI(TAG, "Reconnected, session %s continues", session_id_.c_str());
+        CancelReconnect();
+        FlushControlMessages();
+        return;
+    }
+    StartMqttClientAsync();
+}
+
+void MqttProtocol::MigrateNetwork() {
+    ESP_LOGI(TAG, "Network changed, reconnecting to the endpoint");
+    CancelReconnect();
+    // The UDP channel is bound to the old network and only a new hello assigns another one,
+    // the session is closed once the new client can carry the goodbye
+    close_session_on_connect_ = udp_ != nullptr;
+    StartMqttClientAsync();
+}
+
+bool MqttProtocol::SendText(std::string_view text) {
+    if (publish_topic_.empty()) {
+        return false;
+    }
+    if (reconnect_attempts_ > 0 && !mqtt_->IsConnected()) {
+        // Sent once the broker is back, the session is only reported lost when the retries run out
+        BufferControlMessage(text, false);
+        return true;
+    }
+    if (!mqtt_->Publish(publish_topic_, std::string(text))) {
+        ESP_LOGE(TAG, "Failed to publish message: %.*s", (int)text.size(), text.data());
+        SetError(Lang::Strings::SERVER_ERROR);
+        return false;
+    }
+    return true;
+}
+
+bool MqttProtocol::SendCbor(std::string_view data) {
+    // MQTT payloads are binary safe, the server tells CBOR from JSON by the first byte
     if (publish_topic_.empty()) {
         return false;
     }
-    if (!mqtt_->Publish(publish_topic_, text)) {
-        ESP_LOGE(TAG, "Failed to publish message: %s", text.c_str());
+    if (reconnect_attempts_ > 0 && !mqtt_->IsConnected()) {
+        BufferControlMessage(data, true);
+        return true;
+    }
+    if (!mqtt_->Publish(publish_topic_, std::string(data))) {
+        ESP_LOGE(TAG, "Failed to publish CBOR message, %u bytes", (unsigned)data.size());
         SetError(Lang::Strings::SERVER_ERROR);
         return false;
     }
@@ -121,37 +274,94 @@ bool MqttProtocol::SendAudio(std::unique_ptr<AudioStreamPacket> packet) {
         return false;
     }
 
-    std::string nonce(aes_nonce_);
-    *(uint16_t*)&nonce[2] = htons(packet->payload.size());
-    *(uint32_t*)&nonce[8] = htonl(packet->timestamp);
-    *(uint32_t*)&nonce[12] = htonl(++local_sequence_);
-
-    std::string encrypted;
-    encrypted.resize(aes_nonce_.size() + packet->payload.size());
-    memcpy(encrypted.data(), nonce.data(), nonce.size());
-
+    // Build the header in place, resize does not allocate once the reserved capacity covers the packet
+    send_buffer_.resize(MQTT_AUDIO_NONCE_SIZE + packet->payload.size());
+    auto header = (uint8_t*)send_buffer_.data();
+    memcpy(header, aes_nonce_.data(), MQTT_AUDIO_NONCE_SIZE);
+    *(uint16_t*)&header[2] = htons(packet->payload.size());
+    *(uint32_t*)&header[8] = htonl(packet->timestamp);
+    *(uint32_t*)&header[12] = htonl(++local_sequence_);
+
+    // The counter block is advanced by mbedtls, so it must be a copy of the header
+    uint8_t counter[MQTT_AUDIO_NONCE_SIZE];
+    memcpy(counter, header, MQTT_AUDIO_NONCE_SIZE);
     size_t nc_off = 0;
     uint8_t stream_block[16] = {0};
-    if (mbedtls_aes_crypt_ctr(&aes_ctx_, packet->payload.size(), &nc_off, (uint8_t*)nonce.c_str(), stream_block,
-        (uint8_t*)packet->payload.data(), (uint8_t*)&encrypted[nonce.size()]) != 0) {
+    if (mbedtls_aes_crypt_ctr(&encrypt_ctx_, packet->payload.size(), &nc_off, counter, stream_block,
+        packet->payload.data(), header + MQTT_AUDIO_NONCE_SIZE) != 0) {
         ESP_LOGE(TAG, "Failed to encrypt audio data");
         return false;
     }
 
-    return udp_->Send(encrypted) > 0;
+    bool sent = udp_->Send(send_buffer_) > 0;
+    stats_.OnUplink(send_buffer_.size(), sent);
+    if (sent) {
+        stats_.OnSendDelay(packet->enqueue_time_us);
+    }
+    if (redundancy_ == 0) {
+        return sent;
+    }
+
+    // Repeat the previous packets as they were, the server keeps the first copy of each sequence
+    for (int i = 1; i <= std::min(redundancy_, sent_packets_count_); i++) {
+        udp_->Send(sent_packets_[(sent_packets_head_ + MQTT_AUDIO_MAX_REDUNDANCY - i) % MQTT_AUDIO_MAX_REDUNDANCY]);
+    }
+    std::swap(send_buffer_, sent_packets_[sent_packets_head_]);
+    sent_packets_head_ = (sent_packets_head_ + 1) % MQTT_AUDIO_MAX_REDUNDANCY;
+    sent_packets_count_ = std::min(sent_packets_count_ + 1, MQTT_AUDIO_MAX_REDUNDANCY);
+    return sent;
+}
+
+void MqttProtocol::HandleLossFeedback(const cJSON* root) {
+    auto loss = cJSON_GetObjectItem(root, "loss");
+    if (!cJSON_IsNumber(loss)) {
+        ESP_LOGW(TAG, "Feedback without loss");
+        return;
+    }
+
+    int loss_percent = std::clamp(loss->valueint, 0, 100);
+    int redundancy = 0;
+    if (loss_percent >= MQTT_AUDIO_REDUNDANCY_2_LOSS_PERCENT) {
+        redundancy = 2;
+    } else if (loss_percent >= MQTT_AUDIO_REDUNDANCY_1_LOSS_PERCENT) {
+        redundancy = 1;
+    }
+    SetRedundancy(redundancy);
+    if (on_uplink_loss_ != nullptr) {
+        on_uplink_loss_(loss_percent);
+    }
+}
+
+void MqttProtocol::SetRedundancy(int redundancy) {
+    std::lock_guard<std::mutex> lock(channel_mutex_);
+    if (redundancy == redundancy_) {
+        return;
+    }
+    ESP_LOGI(TAG, "Uplink redundancy %d -> %d", redundancy_, redundancy);
+    redundancy_ = redundancy;
+    sent_packets_count_ = 0;
 }
 
 void MqttProtocol::CloseAudioChannel() {
+    CancelReconnect();
+    control_buffer_.clear();
     {
         std::lock_guard<std::mutex> lock(channel_mutex_);
         udp_.reset();
     }
+    // The next session starts without FEC until the server reports loss again
+    SetRedundancy(0);
+    if (on_uplink_loss_ != nullptr) {
+        on_uplink_loss_(0);
+    }
 
-    std::string message = "{";
-    message += "\"session_id\":\"" + session_id_ + "\",";
-    message += "\"type\":\"goodbye\"";
-    message += "}";
-    SendText(message);
+    char buffer[PROTOCOL_MESSAGE_BUFFER_SIZE * 2];
+    JsonWriter writer(buffer, sizeof(buffer), message_encoding_);
+    WriteGoodbyeMessage(writer);
+    SendMessage(writer);
+    LogStats();
+    // The next hello negotiates the encoding again
+    message_encoding_ = kMessageEncodingJson;
 
     if (on_audio_channel_closed_ != nullptr) {
         on_audio_channel_closed_();
@@ -168,10 +378,15 @@ bool MqttProtocol::OpenAudioChannel() {
 
     error_occurred_ = false;
     session_id_ = "";
+    stats_.Reset();
+    message_encoding_ = kMessageEncodingJson;
     xEventGroupClearBits(event_group_handle_, MQTT_PROTOCOL_SERVER_HELLO_EVENT);
 
-    auto message = GetHelloMessage();
-    if (!SendText(message)) {
+    char buffer[PROTOCOL_MESSAGE_BUFFER_SIZE];
+    JsonWriter writer(buffer, sizeof(buffer));
+    WriteHelloMessage(writer);
+    auto hello_time = esp_timer_get_time();
+    if (!SendMessage(writer)) {
         return false;
     }
 
@@ -182,6 +397,7 @@ bool MqttProtocol::OpenAudioChannel() {
         SetError(Lang::Strings::SERVER_TIMEOUT);
         return false;
     }
+    stats_.OnRtt((esp_timer_get_time() - hello_time) / 1000);
 
     std::lock_guard<std::mutex> lock(channel_mutex_);
     auto network = Board::GetInstance().GetNetwork();
@@ -192,7 +408,7 @@ bool MqttProtocol::OpenAudioChannel() {
          * |type 1u|flags 1u|payload_len 2u|ssrc 4u|timestamp 4u|sequence 4u|
          * |payload payload_len|
          */
-        if (data.size() < sizeof(aes_nonce_)) {
+        if (data.size() < MQTT_AUDIO_NONCE_SIZE) {
             ESP_LOGE(TAG, "Invalid audio packet size: %u", data.size());
             return;
         }
@@ -202,25 +418,26 @@ bool MqttProtocol::OpenAudioChannel() {
         }
         uint32_t timestamp = ntohl(*(uint32_t*)&data[8]);
         uint32_t sequence = ntohl(*(uint32_t*)&data[12]);
-        if (sequence < remote_sequence_) {
-            ESP_LOGW(TAG, "Received audio packet with old sequence: %lu, expected: %lu", sequence, remote_sequence_);
+        // Late and duplicate packets are counted and dropped, gaps show up as loss in the session stats
+        if (!stats_.OnDownlinkSequence(sequence)) {
+            ESP_LOGW(TAG, "Received audio packet with old sequence: %lu", sequence);
             return;
         }
-        if (sequence != remote_sequence_ + 1) {
-            ESP_LOGW(TAG, "Received audio packet with wrong sequence: %lu, expected: %lu", sequence, remote_sequence_ + 1);
-        }
+        stats_.OnDownlink(data.size(), timestamp, server_frame_duration_);
 
-        size_t decrypted_size = data.size() - aes_nonce_.size();
+        size_t decrypted_size = data.size() - MQTT_AUDIO_NONCE_SIZE;
         size_t nc_off = 0;
         uint8_t stream_block[16] = {0};
-        auto nonce = (uint8_t*)data.data();
-        auto encrypted = (uint8_t*)data.data() + aes_nonce_.size();
+        uint8_t counter[MQTT_AUDIO_NONCE_SIZE];
+        memcpy(counter, data.data(), MQTT_AUDIO_NONCE_SIZE);
+        auto encrypted = (const uint8_t*)data.data() + MQTT_AUDIO_NONCE_SIZE;
+        // Decrypt straight into the packet that goes to the decoder, it is the only copy of the payload
         auto packet = std::make_unique<AudioStreamPacket>();
         packet->sample_rate = server_sample_rate_;
         packet->frame_duration = server_frame_duration_;
         packet->timestamp = timestamp;
         packet->payload.resize(decrypted_size);
-        int ret = mbedtls_aes_crypt_ctr(&aes_ctx_, decrypted_size, &nc_off, nonce, stream_block, encrypted, (uint8_t*)packet->payload.data());
+        int ret = mbedtls_aes_crypt_ctr(&decrypt_ctx_, decrypted_size, &nc_off, counter, stream_block, encrypted, packet->payload.data());
         if (ret != 0) {
             ESP_LOGE(TAG, "Failed to decrypt audio data, ret: %d", ret);
             return;
@@ -228,7 +445,6 @@ bool MqttProtocol::OpenAudioChannel() {
         if (on_incoming_audio_ != nullptr) {
             on_incoming_audio_(std::move(packet));
         }
-        remote_sequence_ = sequence;
         last_incoming_time_ = std::chrono::steady_clock::now();
     });
 
@@ -240,29 +456,28 @@ bool MqttProtocol::OpenAudioChannel() {
     return true;
 }
 
-std::string MqttProtocol::GetHelloMessage() {
+void MqttProtocol::WriteHelloMessage(JsonWriter& writer) {
     // 发送 hello 消息申请 UDP 通道
-    cJSON* root = cJSON_CreateObject();
-    cJSON_AddStringToObject(root, "type", "hello");
-    cJSON_AddNumberToObject(root, "version", 3);
-    cJSON_AddStringToObject(root, "transport", "udp");
-    cJSON* features = cJSON_CreateObject();
+    writer.BeginObject();
+    writer.AddString("type", "hello");
+    writer.AddNumber("version", 3);
+    writer.AddString("transport", "udp");
+    writer.BeginObject("features");
 #if CONFIG_USE_SERVER_AEC
-    cJSON_AddBoolToObject(features, "aec", true);
+    writer.AddBool("aec", true);
 #endif
-    cJSON_AddBoolToObject(features, "mcp", true);
-    cJSON_AddItemToObject(root, "features", features);
-    cJSON* audio_params = cJSON_CreateObject();
-    cJSON_AddStringToObject(audio_params, "format", "opus");
-    cJSON_AddNumberToObject(audio_params, "sample_rate", 16000);
-    cJSON_AddNumberToObject(audio_params, "channels", 1);
-    cJSON_AddNumberToObject(audio_params, "frame_duration", OPUS_FRAME_DURATION_MS);
-    cJSON_AddItemToObject(root, "audio_params", audio_params);
-    auto json_str = cJSON_PrintUnformatted(root);
-    std::string message(json_str);
-    cJSON_free(json_str);
-    cJSON_Delete(root);
-    return message;
+    writer.AddBool("mcp", true);
+    writer.AddBool("ping", true);
+    writer.AddBool("cbor", true);
+    writer.AddBool("fec", true);
+    writer.EndObject();
+    writer.BeginObject("audio_params");
+    writer.AddString("format", "opus");
+    writer.AddNumber("sample_rate", 16000);
+    writer.AddNumber("channels", 1);
+    writer.AddNumber("frame_duration", OPUS_FRAME_DURATION_MS);
+    writer.EndObject();
+    writer.EndObject();
 }
 
 void MqttProtocol::ParseServerHello(const cJSON* root) {
@@ -277,6 +492,7 @@ void MqttProtocol::ParseServerHello(const cJSON* root) {
         session_id_ = session_id->valuestring;
         ESP_LOGI(TAG, "Session ID: %s", session_id_.c_str());
     }
+    ParseServerFeatures(root);
 
     // Get sample rate from hello message
     auto audio_params = cJSON_GetObjectItem(root, "audio_params");
@@ -304,10 +520,19 @@ void MqttProtocol::ParseServerHello(const cJSON* root) {
     // auto encryption = cJSON_GetObjectItem(udp, "encryption")->valuestring;
     // ESP_LOGI(TAG, "UDP server: %s, port: %d, encryption: %s", udp_server_.c_str(), udp_port_, encryption);
     aes_nonce_ = DecodeHexString(nonce);
-    mbedtls_aes_init(&aes_ctx_);
-    mbedtls_aes_setkey_enc(&aes_ctx_, (const unsigned char*)DecodeHexString(key).c_str(), 128);
+    if (aes_nonce_.size() != MQTT_AUDIO_NONCE_SIZE) {
+        ESP_LOGE(TAG, "Invalid nonce size: %u", aes_nonce_.size());
+        return;
+    }
+    auto aes_key = DecodeHexString(key);
+    if (aes_key.size() != 16) {
+        ESP_LOGE(TAG, "Invalid key size: %u", aes_key.size());
+        return;
+    }
+    // CTR mode decrypts with the encryption key schedule too
+    mbedtls_aes_setkey_enc(&encrypt_ctx_, (const unsigned char*)aes_key.data(), 128);
+    mbedtls_aes_setkey_enc(&decrypt_ctx_, (const unsigned char*)aes_key.data(), 128);
     local_sequence_ = 0;
-    remote_sequence_ = 0;
     xEventGroupSetBits(event_group_handle_, MQTT_PROTOCOL_SERVER_HELLO_EVENT);
 }
 
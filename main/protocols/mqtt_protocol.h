@@ -10,6 +10,7 @@
 #include <freertos/FreeRTOS.h>
 #include <freertos/event_groups.h>
 
+#include <array>
 #include <functional>
 #include <string>
 #include <map>
@@ -20,6 +21,16 @@
 
 #define MQTT_PROTOCOL_SERVER_HELLO_EVENT (1 << 0)
 
+// The 16 byte packet header doubles as the AES-CTR nonce
+#define MQTT_AUDIO_NONCE_SIZE 16
+// Reserved once for the encrypted packet, large enough for any opus frame
+#define MQTT_AUDIO_SEND_BUFFER_SIZE 1500
+// Each uplink packet is followed by copies of the previous one or two packets once the
+// server reports this much loss, so bursts longer than the in-band FEC covers survive
+#define MQTT_AUDIO_REDUNDANCY_1_LOSS_PERCENT 5
+#define MQTT_AUDIO_REDUNDANCY_2_LOSS_PERCENT 15
+#define MQTT_AUDIO_MAX_REDUNDANCY 2
+
 class MqttProtocol : public Protocol {
 public:
     MqttProtocol();
@@ -30,6 +41,7 @@ public:
     bool OpenAudioChannel() override;
     void CloseAudioChannel() override;
     bool IsAudioChannelOpened() const override;
+    void MigrateNetwork() override;
 
 private:
     EventGroupHandle_t event_group_handle_;
@@ -38,20 +50,40 @@ private:
 
     std::mutex channel_mutex_;
     std::unique_ptr<Mqtt> mqtt_;
+    // Bumped for every new client, disconnects of older clients are ignored
+    uint32_t mqtt_generation_ = 0;
+    // The network changed during a session, which ends when the new client is connected
+    bool close_session_on_connect_ = false;
     std::unique_ptr<Udp> udp_;
-    mbedtls_aes_context aes_ctx_;
+    // The send path runs under channel_mutex_, the receive path in the UDP task, so each gets its own context
+    mbedtls_aes_context encrypt_ctx_;
+    mbedtls_aes_context decrypt_ctx_;
     std::string aes_nonce_;
+    std::string send_buffer_;
     std::string udp_server_;
     int udp_port_;
     uint32_t local_sequence_;
-    uint32_t remote_sequence_;
+    // Last sent packets for the redundant copies, a ring that swaps buffers with send_buffer_
+    std::array<std::string, MQTT_AUDIO_MAX_REDUNDANCY> sent_packets_;
+    int sent_packets_head_ = 0;
+    int sent_packets_count_ = 0;
+    int redundancy_ = 0;
 
     bool StartMqttClient(bool report_error=false);
+    std::unique_ptr<Mqtt> CreateMqttClient();
+    bool ConnectMqttClient(Mqtt* mqtt);
+    void StartMqttClientAsync();
+    void HandleConnectResult(uint32_t generation, Mqtt* mqtt, bool connected);
+    void HandleDisconnected(uint32_t generation);
+    void Reconnect() override;
     void ParseServerHello(const cJSON* root);
+    void HandleLossFeedback(const cJSON* root);
+    void SetRedundancy(int redundancy);
     std::string DecodeHexString(const std::string& hex_string);
 
-    bool SendText(const std::string& text) override;
-    std::string GetHelloMessage();
+    bool SendText(std::string_view text) override;
+    bool SendCbor(std::string_view data) override;
+    void WriteHelloMessage(JsonWriter& writer);
 };
 
 
@@ -1,9 +1,35 @@
 #include "protocol.h"
+#include "application.h"
 
 #include <esp_log.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
 
 #define TAG "Protocol"
 
+Protocol::Protocol() {
+    esp_timer_create_args_t reconnect_timer_args = {
+        .callback = [](void* arg) {
+            auto protocol = (Protocol*)arg;
+            Application::GetInstance().Schedule([protocol]() {
+                protocol->Reconnect();
+            });
+        },
+        .arg = this,
+        .dispatch_method = ESP_TIMER_TASK,
+        .name = "protocol_reconnect",
+        .skip_unhandled_events = true
+    };
+    esp_timer_create(&reconnect_timer_args, &reconnect_timer_);
+}
+
+Protocol::~Protocol() {
+    if (reconnect_timer_ != nullptr) {
+        esp_timer_stop(reconnect_timer_);
+        esp_timer_delete(reconnect_timer_);
+    }
+}
+
 void Protocol::OnIncomingJson(std::function<void(const cJSON* root)> callback) {
     on_incoming_json_ = callback;
 }
@@ -24,6 +50,10 @@ void Protocol::OnNetworkError(std::function<void(const std::string& message)> ca
     on_network_error_ = callback;
 }
 
+void Protocol::OnUplinkLoss(std::function<void(int loss_percent)> callback) {
+    on_uplink_loss_ = callback;
+}
+
 void Protocol::SetError(const std::string& message) {
     error_occurred_ = true;
     if (on_network_error_ != nullptr) {
@@ -32,42 +62,214 @@ void Protocol::SetError(const std::string& message) {
 }
 
 void Protocol::SendAbortSpeaking(AbortReason reason) {
-    std::string message = "{\"session_id\":\"" + session_id_ + "\",\"type\":\"abort\"";
+    char buffer[PROTOCOL_MESSAGE_BUFFER_SIZE];
+    JsonWriter writer(buffer, sizeof(buffer), message_encoding_);
+    writer.BeginObject().AddString("session_id", session_id_).AddString("type", "abort");
     if (reason == kAbortReasonWakeWordDetected) {
-        message += ",\"reason\":\"wake_word_detected\"";
+        writer.AddString("reason", "wake_word_detected");
     }
-    message += "}";
-    SendText(message);
+    writer.EndObject();
+    SendMessage(writer);
 }
 
 void Protocol::SendWakeWordDetected(const std::string& wake_word) {
-    std::string json = "{\"session_id\":\"" + session_id_ + 
-                      "\",\"type\":\"listen\",\"state\":\"detect\",\"text\":\"" + wake_word + "\"}";
-    SendText(json);
+    char buffer[PROTOCOL_MESSAGE_BUFFER_SIZE];
+    JsonWriter writer(buffer, sizeof(buffer), message_encoding_);
+    writer.BeginObject()
+        .AddString("session_id", session_id_)
+        .AddString("type", "listen")
+        .AddString("state", "detect")
+        .AddString("text", wake_word)
+        .EndObject();
+    SendMessage(writer);
 }
 
 void Protocol::SendStartListening(ListeningMode mode) {
-    std::string message = "{\"session_id\":\"" + session_id_ + "\"";
-    message += ",\"type\":\"listen\",\"state\":\"start\"";
+    const char* mode_name = "manual";
     if (mode == kListeningModeRealtime) {
-        message += ",\"mode\":\"realtime\"";
+        mode_name = "realtime";
     } else if (mode == kListeningModeAutoStop) {
-        message += ",\"mode\":\"auto\"";
-    } else {
-        message += ",\"mode\":\"manual\"";
+        mode_name = "auto";
     }
-    message += "}";
-    SendText(message);
+    char buffer[PROTOCOL_MESSAGE_BUFFER_SIZE];
+    JsonWriter writer(buffer, sizeof(buffer), message_encoding_);
+    writer.BeginObject()
+        .AddString("session_id", session_id_)
+        .AddString("type", "listen")
+        .AddString("state", "start")
+        .AddString("mode", mode_name)
+        .EndObject();
+    SendMessage(writer);
 }
 
 void Protocol::SendStopListening() {
-    std::string message = "{\"session_id\":\"" + session_id_ + "\",\"type\":\"listen\",\"state\":\"stop\"}";
-    SendText(message);
+    char buffer[PROTOCOL_MESSAGE_BUFFER_SIZE];
+    JsonWriter writer(buffer, sizeof(buffer), message_encoding_);
+    writer.BeginObject()
+        .AddString("session_id", session_id_)
+        .AddString("type", "listen")
+        .AddString("state", "stop")
+        .EndObject();
+    SendMessage(writer);
 }
 
 void Protocol::SendMcpMessage(const std::string& payload) {
-    std::string message = "{\"session_id\":\"" + session_id_ + "\",\"type\":\"mcp\",\"payload\":" + payload + "}";
-    SendText(message);
+    // Small replies fit on the stack, tool lists and tool results get one exact size allocation
+    char stack_buffer[PROTOCOL_MESSAGE_BUFFER_SIZE];
+    std::unique_ptr<char[]> heap_buffer;
+    char* buffer = stack_buffer;
+    size_t size = payload.size() + session_id_.size() * 6 + 64;
+    if (size > sizeof(stack_buffer)) {
+        heap_buffer = std::make_unique<char[]>(size);
+        buffer = heap_buffer.get();
+    } else {
+        size = sizeof(stack_buffer);
+    }
+    JsonWriter writer(buffer, size, message_encoding_);
+    writer.BeginObject()
+        .AddString("session_id", session_id_)
+        .AddString("type", "mcp")
+        .AddRaw("payload", payload)
+        .EndObject();
+    SendMessage(writer);
+}
+
+bool Protocol::SendMessage(const JsonWriter& writer) {
+    if (!writer.ok()) {
+        if (writer.encoding() == kMessageEncodingCbor) {
+            ESP_LOGE(TAG, "CBOR message does not fit in the buffer");
+        } else {
+            ESP_LOGE(TAG, "Message does not fit in the buffer: %s", writer.c_str());
+        }
+        return false;
+    }
+    bool sent = writer.encoding() == kMessageEncodingCbor ? SendCbor(writer.view()) : SendText(writer.view());
+    if (!sent) {
+        stats_.OnSendFailure();
+        return false;
+    }
+    return true;
+}
+
+// Milliseconds since boot, wrapped to fit a JSON integer on both sides
+static int GetPingTimestamp() {
+    return (int)((esp_timer_get_time() / 1000) & 0x7FFFFFFF);
+}
+
+void Protocol::SendPing() {
+    if (!server_ping_supported_) {
+        return;
+    }
+    char buffer[PROTOCOL_MESSAGE_BUFFER_SIZE];
+    JsonWriter writer(buffer, sizeof(buffer), message_encoding_);
+    writer.BeginObject()
+        .AddString("session_id", session_id_)
+        .AddString("type", "ping")
+        .AddNumber("timestamp", GetPingTimestamp())
+        .EndObject();
+    SendMessage(writer);
+}
+
+void Protocol::ParseServerFeatures(const cJSON* root) {
+    auto features = cJSON_GetObjectItem(root, "features");
+    server_ping_supported_ = cJSON_IsTrue(cJSON_GetObjectItem(features, "ping"));
+    message_encoding_ = cJSON_IsTrue(cJSON_GetObjectItem(features, "cbor")) ? kMessageEncodingCbor : kMessageEncodingJson;
+    if (message_encoding_ == kMessageEncodingCbor) {
+        ESP_LOGI(TAG, "Server accepted CBOR control messages");
+    }
+}
+
+void Protocol::HandlePong(const cJSON* root) {
+    auto timestamp = cJSON_GetObjectItem(root, "timestamp");
+    if (!cJSON_IsNumber(timestamp)) {
+        ESP_LOGW(TAG, "Pong without timestamp");
+        return;
+    }
+    int rtt_ms = (GetPingTimestamp() - timestamp->valueint) & 0x7FFFFFFF;
+    stats_.OnRtt(rtt_ms);
+}
+
+void Protocol::WriteGoodbyeMessage(JsonWriter& writer) {
+    writer.BeginObject().AddString("session_id", session_id_).AddString("type", "goodbye");
+    writer.BeginObject("stats");
+    stats_.WriteSummary(writer);
+    writer.EndObject();
+    writer.EndObject();
+}
+
+void Protocol::LogStats() {
+    ESP_LOGI(TAG, "Session %s stats: %s", session_id_.c_str(), stats_.GetStatsJson().c_str());
+}
+
+bool Protocol::ScheduleReconnect() {
+    if (reconnect_attempts_ >= PROTOCOL_RECONNECT_MAX_ATTEMPTS) {
+        ESP_LOGW(TAG, "Giving up after %d reconnect attempts", reconnect_attempts_);
+        reconnect_attempts_ = 0;
+        return false;
+    }
+    int delay_ms = PROTOCOL_RECONNECT_BASE_DELAY_MS << reconnect_attempts_;
+    reconnect_attempts_++;
+    ESP_LOGI(TAG, "Reconnecting in %d ms, attempt %d/%d", delay_ms, reconnect_attempts_, PROTOCOL_RECONNECT_MAX_ATTEMPTS);
+    esp_timer_stop(reconnect_timer_);
+    esp_timer_start_once(reconnect_timer_, delay_ms * 1000);
+    return true;
+}
+
+void Protocol::CancelReconnect() {
+    esp_timer_stop(reconnect_timer_);
+    reconnect_attempts_ = 0;
+}
+
+bool Protocol::StartConnectTask(const char* name, std::function<void()> connect) {
+    auto task_connect = new std::function<void()>(std::move(connect));
+    auto ret = xTaskCreate([](void* arg) {
+        auto connect = (std::function<void()>*)arg;
+        (*connect)();
+        delete connect;
+        vTaskDelete(NULL);
+    }, name, PROTOCOL_CONNECT_TASK_STACK_SIZE, task_connect, 3, nullptr);
+    if (ret != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create the %s task", name);
+        delete task_connect;
+        return false;
+    }
+    return true;
+}
+
+void Protocol::BufferUplinkAudio(std::unique_ptr<AudioStreamPacket> packet) {
+    if (uplink_buffer_.empty()) {
+        uplink_dropped_ = 0;
+    }
+    if (uplink_buffer_.size() >= PROTOCOL_UPLINK_BUFFER_PACKETS) {
+        uplink_buffer_.pop_front();
+        uplink_dropped_++;
+    }
+    uplink_buffer_.push_back(std::move(packet));
+}
+
+void Protocol::BufferControlMessage(std::string_view data, bool cbor) {
+    if (control_buffer_.size() >= PROTOCOL_CONTROL_BUFFER_MESSAGES) {
+        ESP_LOGW(TAG, "Too many control messages while reconnecting, dropping the oldest");
+        control_buffer_.pop_front();
+    }
+    control_buffer_.push_back(BufferedMessage{cbor, std::string(data)});
+}
+
+bool Protocol::SendBufferedMessage(const BufferedMessage& message) {
+    return message.cbor ? SendCbor(message.data) : SendText(message.data);
+}
+
+bool Protocol::FlushControlMessages() {
+    while (!control_buffer_.empty()) {
+        if (!SendBufferedMessage(control_buffer_.front())) {
+            ESP_LOGW(TAG, "Failed to send the control messages buffered while reconnecting, %u dropped",
+                (unsigned)control_buffer_.size());
+            control_buffer_.clear();
+            return false;
+        }
+        control_buffer_.pop_front();
+    }
+    return true;
 }
 
 bool Protocol::IsTimeout() const {
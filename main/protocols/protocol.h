@@ -2,27 +2,59 @@
 #define PROTOCOL_H
 
 #include <cJSON.h>
+#include <esp_timer.h>
 #include <string>
+#include <string_view>
+#include <atomic>
+#include <memory>
 #include <functional>
 #include <chrono>
 #include <vector>
+#include <deque>
+
+#include "json_writer.h"
+#include "protocol_stats.h"
+
+// Stack buffer for control messages, larger MCP payloads are allocated on demand
+#define PROTOCOL_MESSAGE_BUFFER_SIZE 256
+
+// Reconnect after 0.5, 1, 2, 4 and 8 seconds before giving up the session
+#define PROTOCOL_RECONNECT_MAX_ATTEMPTS 5
+#define PROTOCOL_RECONNECT_BASE_DELAY_MS 500
+// Uplink audio kept while reconnecting, 3 seconds of 60 ms frames
+#define PROTOCOL_UPLINK_BUFFER_PACKETS 50
+// Control messages kept while reconnecting, they are sent before the buffered audio
+#define PROTOCOL_CONTROL_BUFFER_MESSAGES 16
+#define PROTOCOL_CONNECT_TASK_STACK_SIZE (4096 * 2)
+// Ping the server for an RTT sample while the audio channel is open, if the server supports it
+#define PROTOCOL_PING_INTERVAL_SECONDS 10
 
 struct AudioStreamPacket {
     int sample_rate = 0;
     int frame_duration = 0;
     uint32_t timestamp = 0;
+    // esp_timer time the packet entered the send queue, 0 for other packets
+    int64_t enqueue_time_us = 0;
     std::vector<uint8_t> payload;
 };
 
+struct BufferedMessage {
+    bool cbor;
+    std::string data;
+};
+
 struct BinaryProtocol2 {
     uint16_t version;
-    uint16_t type;          // Message type (0: OPUS, 1: JSON)
+    uint16_t type;          // Message type (0: OPUS, 1: JSON, 2: CBOR)
     uint32_t reserved;      // Reserved for future use
     uint32_t timestamp;     // Timestamp in milliseconds (used for server-side AEC)
     uint32_t payload_size;  // Payload size in bytes
     uint8_t payload[];      // Payload data
 } __attribute__((packed));
 
+#define BINARY_PROTOCOL_TYPE_OPUS 0
+#define BINARY_PROTOCOL_TYPE_CBOR 2
+
 struct BinaryProtocol3 {
     uint8_t type;
     uint8_t reserved;
@@ -43,7 +75,8 @@ enum ListeningMode {
 
 class Protocol {
 public:
-    virtual ~Protocol() = default;
+    Protocol();
+    virtual ~Protocol();
 
     inline int server_sample_rate() const {
         return server_sample_rate_;
@@ -54,15 +87,23 @@ public:
     inline const std::string& session_id() const {
         return session_id_;
     }
+    inline const ProtocolStats& stats() const {
+        return stats_;
+    }
 
     void OnIncomingAudio(std::function<void(std::unique_ptr<AudioStreamPacket> packet)> callback);
     void OnIncomingJson(std::function<void(const cJSON* root)> callback);
     void OnAudioChannelOpened(std::function<void()> callback);
     void OnAudioChannelClosed(std::function<void()> callback);
     void OnNetworkError(std::function<void(const std::string& message)> callback);
+    // Uplink packet loss in percent reported by the server, for the encoder FEC
+    void OnUplinkLoss(std::function<void(int loss_percent)> callback);
 
     virtual bool Start() = 0;
     virtual bool OpenAudioChannel() = 0;
+    // Like OpenAudioChannel, but may return as soon as the client hello is sent, so audio
+    // can follow it right away; the server hello is then handled when it arrives
+    virtual bool OpenAudioChannelEarly() { return OpenAudioChannel(); }
     virtual void CloseAudioChannel() = 0;
     virtual bool IsAudioChannelOpened() const = 0;
     virtual bool SendAudio(std::unique_ptr<AudioStreamPacket> packet) = 0;
@@ -71,6 +112,9 @@ public:
     virtual void SendStopListening();
     virtual void SendAbortSpeaking(AbortReason reason);
     virtual void SendMcpMessage(const std::string& message);
+    void SendPing();
+    // The board switched to another network, move the open connections over to it
+    virtual void MigrateNetwork() = 0;
 
 protected:
     std::function<void(const cJSON* root)> on_incoming_json_;
@@ -78,16 +122,53 @@ protected:
     std::function<void()> on_audio_channel_opened_;
     std::function<void()> on_audio_channel_closed_;
     std::function<void(const std::string& message)> on_network_error_;
+    std::function<void(int loss_percent)> on_uplink_loss_;
 
-    int server_sample_rate_ = 24000;
-    int server_frame_duration_ = 60;
+    // Written by the hello handling and read by the receive task for every packet
+    std::atomic<int> server_sample_rate_ = 24000;
+    std::atomic<int> server_frame_duration_ = 60;
     bool error_occurred_ = false;
     std::string session_id_;
     std::chrono::time_point<std::chrono::steady_clock> last_incoming_time_;
+    ProtocolStats stats_;
+    bool server_ping_supported_ = false;
+    // Control messages switch to CBOR once the server hello accepts it, hello itself is always JSON
+    MessageEncoding message_encoding_ = kMessageEncodingJson;
+    int reconnect_attempts_ = 0;
+    esp_timer_handle_t reconnect_timer_ = nullptr;
+    std::deque<std::unique_ptr<AudioStreamPacket>> uplink_buffer_;
+    int uplink_dropped_ = 0;
+    std::deque<BufferedMessage> control_buffer_;
+    // A connect task is running, only used by the main loop
+    bool reconnect_running_ = false;
 
-    virtual bool SendText(const std::string& text) = 0;
+    virtual bool SendText(std::string_view text) = 0;
+    virtual bool SendCbor(std::string_view data) = 0;
+    // Used by FlushControlMessages, a protocol that buffers in SendText / SendCbor sends past its buffer here
+    virtual bool SendBufferedMessage(const BufferedMessage& message);
+    bool SendMessage(const JsonWriter& writer);
     virtual void SetError(const std::string& message);
     virtual bool IsTimeout() const;
+    void ParseServerFeatures(const cJSON* root);
+    void HandlePong(const cJSON* root);
+    // Goodbye message with the session summary, so the server can track the network quality
+    void WriteGoodbyeMessage(JsonWriter& writer);
+    void LogStats();
+
+    // Start the backoff timer, returns false once all attempts are used up
+    bool ScheduleReconnect();
+    void CancelReconnect();
+    // Runs in the main loop when the backoff timer fires
+    virtual void Reconnect() {}
+    // Run a blocking connect on its own task so the main loop keeps going, the task
+    // posts its result back with Application::Schedule
+    bool StartConnectTask(const char* name, std::function<void()> connect);
+    // Keep the newest packets while the connection is down, the oldest are dropped
+    void BufferUplinkAudio(std::unique_ptr<AudioStreamPacket> packet);
+    // Control messages are kept in order while the connection is down and sent first on resume
+    void BufferControlMessage(std::string_view data, bool cbor);
+    // Returns false if a message could not be sent, the rest of the buffer is dropped
+    bool FlushControlMessages();
 };
 
 #endif // PROTOCOL_H
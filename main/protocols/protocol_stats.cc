@@ -0,0 +1,160 @@
+#include "protocol_stats.h"
+
+#include <esp_timer.h>
+#include <cJSON.h>
+#include <algorithm>
+#include <cstdlib>
+
+void ProtocolStats::Reset() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    start_time_us_ = esp_timer_get_time();
+    uplink_packets_ = 0;
+    uplink_bytes_ = 0;
+    downlink_packets_ = 0;
+    downlink_bytes_ = 0;
+    send_failures_ = 0;
+    max_send_delay_ms_ = 0;
+    has_sequence_ = false;
+    max_sequence_ = 0;
+    received_mask_ = 0;
+    lost_ = 0;
+    reordered_ = 0;
+    duplicates_ = 0;
+    last_arrival_us_ = 0;
+    last_timestamp_ = 0;
+    jitter_us_ = 0;
+    rtt_samples_ = 0;
+    smoothed_rtt_ms_ = 0;
+    min_rtt_ms_ = 0;
+    max_rtt_ms_ = 0;
+}
+
+void ProtocolStats::OnUplink(size_t bytes, bool success) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (success) {
+        uplink_packets_++;
+        uplink_bytes_ += bytes;
+    } else {
+        send_failures_++;
+    }
+}
+
+void ProtocolStats::OnSendFailure() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    send_failures_++;
+}
+
+void ProtocolStats::OnSendDelay(int64_t enqueue_time_us) {
+    if (enqueue_time_us == 0) {
+        return;
+    }
+    int delay_ms = (esp_timer_get_time() - enqueue_time_us) / 1000;
+    std::lock_guard<std::mutex> lock(mutex_);
+    max_send_delay_ms_ = std::max(max_send_delay_ms_, delay_ms);
+}
+
+void ProtocolStats::OnDownlink(size_t bytes, uint32_t timestamp, int frame_duration) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    downlink_packets_++;
+    downlink_bytes_ += bytes;
+
+    auto arrival_us = esp_timer_get_time();
+    int64_t interval_us = arrival_us - last_arrival_us_;
+    if (last_arrival_us_ > 0 && interval_us < PROTOCOL_STATS_BURST_GAP_MS * 1000) {
+        int64_t expected_us = frame_duration * 1000;
+        if (timestamp != 0 && last_timestamp_ != 0) {
+            expected_us = (int64_t)(int32_t)(timestamp - last_timestamp_) * 1000;
+        }
+        int64_t deviation_us = std::llabs(interval_us - expected_us);
+        jitter_us_ += (deviation_us - jitter_us_) / 16;
+    }
+    last_arrival_us_ = arrival_us;
+    last_timestamp_ = timestamp;
+}
+
+bool ProtocolStats::OnDownlinkSequence(uint32_t sequence) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!has_sequence_) {
+        has_sequence_ = true;
+        max_sequence_ = sequence;
+        received_mask_ = 1;
+        return true;
+    }
+
+    if (sequence > max_sequence_) {
+        uint32_t gap = sequence - max_sequence_;
+        lost_ += gap - 1;
+        received_mask_ = gap >= PROTOCOL_STATS_SEQUENCE_WINDOW ? 0 : received_mask_ << gap;
+        received_mask_ |= 1;
+        max_sequence_ = sequence;
+        return true;
+    }
+
+    uint32_t age = max_sequence_ - sequence;
+    if (age >= PROTOCOL_STATS_SEQUENCE_WINDOW) {
+        // Too old to tell, it was counted as lost and still is
+        reordered_++;
+    } else if (received_mask_ & (1ULL << age)) {
+        duplicates_++;
+    } else {
+        received_mask_ |= 1ULL << age;
+        reordered_++;
+        lost_--;
+    }
+    return false;
+}
+
+void ProtocolStats::OnRtt(int rtt_ms) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (rtt_samples_ == 0) {
+        smoothed_rtt_ms_ = rtt_ms;
+        min_rtt_ms_ = rtt_ms;
+        max_rtt_ms_ = rtt_ms;
+    } else {
+        smoothed_rtt_ms_ = (smoothed_rtt_ms_ * 7 + rtt_ms) / 8;
+        min_rtt_ms_ = std::min(min_rtt_ms_, rtt_ms);
+        max_rtt_ms_ = std::max(max_rtt_ms_, rtt_ms);
+    }
+    rtt_samples_++;
+}
+
+void ProtocolStats::WriteSummary(JsonWriter& writer) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    writer.AddNumber("duration_ms", (int)((esp_timer_get_time() - start_time_us_) / 1000));
+    writer.AddNumber("up_packets", uplink_packets_);
+    writer.AddNumber("up_bytes", uplink_bytes_);
+    writer.AddNumber("down_packets", downlink_packets_);
+    writer.AddNumber("down_bytes", downlink_bytes_);
+    writer.AddNumber("send_failures", send_failures_);
+    writer.AddNumber("lost", lost_);
+    writer.AddNumber("reordered", reordered_);
+    writer.AddNumber("duplicates", duplicates_);
+    writer.AddNumber("jitter_ms", (int)(jitter_us_ / 1000));
+    writer.AddNumber("rtt_ms", smoothed_rtt_ms_);
+    writer.AddNumber("max_send_delay_ms", max_send_delay_ms_);
+}
+
+std::string ProtocolStats::GetStatsJson() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    cJSON* root = cJSON_CreateObject();
+    cJSON_AddNumberToObject(root, "duration_ms", (int)((esp_timer_get_time() - start_time_us_) / 1000));
+    cJSON_AddNumberToObject(root, "uplink_packets", uplink_packets_);
+    cJSON_AddNumberToObject(root, "uplink_bytes", uplink_bytes_);
+    cJSON_AddNumberToObject(root, "downlink_packets", downlink_packets_);
+    cJSON_AddNumberToObject(root, "downlink_bytes", downlink_bytes_);
+    cJSON_AddNumberToObject(root, "send_failures", send_failures_);
+    cJSON_AddNumberToObject(root, "max_send_delay_ms", max_send_delay_ms_);
+    cJSON_AddNumberToObject(root, "lost", lost_);
+    cJSON_AddNumberToObject(root, "reordered", reordered_);
+    cJSON_AddNumberToObject(root, "duplicates", duplicates_);
+    cJSON_AddNumberToObject(root, "jitter_ms", jitter_us_ / 1000.0);
+    cJSON_AddNumberToObject(root, "rtt_ms", smoothed_rtt_ms_);
+    cJSON_AddNumberToObject(root, "rtt_min_ms", min_rtt_ms_);
+    cJSON_AddNumberToObject(root, "rtt_max_ms", max_rtt_ms_);
+    cJSON_AddNumberToObject(root, "rtt_samples", rtt_samples_);
+    auto json_str = cJSON_PrintUnformatted(root);
+    std::string result(json_str);
+    cJSON_free(json_str);
+    cJSON_Delete(root);
+    return result;
+}
@@ -0,0 +1,77 @@
+#ifndef PROTOCOL_STATS_H
+#define PROTOCOL_STATS_H
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <mutex>
+
+#include "json_writer.h"
+
+// Received sequence numbers remembered to tell a reordered packet from a duplicate
+#define PROTOCOL_STATS_SEQUENCE_WINDOW 64
+// A longer gap between downlink packets starts a new burst and is not counted as jitter
+#define PROTOCOL_STATS_BURST_GAP_MS 1000
+
+/*
+ * ProtocolStats counts the traffic of one audio session, from OpenAudioChannel
+ * until the channel is closed. A resumed session keeps counting.
+ *
+ * Uplink and downlink count audio packets and their bytes on the wire, send
+ * failures include control messages. Loss, reorder and duplicates come from
+ * the sequence numbers of the UDP transport, a late packet is counted as
+ * reordered and no longer as lost. Jitter is the RFC 3550 interarrival jitter
+ * of the downlink, based on the packet timestamps or on the frame duration when
+ * the transport carries none. RTT is smoothed like TCP SRTT over the hello
+ * round trips and the ping/pong samples. The send delay is the longest time an
+ * uplink packet waited between the encoder and the transport.
+ *
+ * The counters are updated from the network tasks and read from the main loop,
+ * every method takes the internal lock.
+ */
+class ProtocolStats {
+public:
+    void Reset();
+
+    void OnUplink(size_t bytes, bool success);
+    void OnSendFailure();
+    void OnSendDelay(int64_t enqueue_time_us);
+    void OnDownlink(size_t bytes, uint32_t timestamp, int frame_duration);
+    // Returns false if the packet is a duplicate or arrives after a newer one
+    bool OnDownlinkSequence(uint32_t sequence);
+    void OnRtt(int rtt_ms);
+
+    // Compact members for the goodbye message
+    void WriteSummary(JsonWriter& writer) const;
+    std::string GetStatsJson() const;
+
+private:
+    mutable std::mutex mutex_;
+    int64_t start_time_us_ = 0;
+
+    int uplink_packets_ = 0;
+    int uplink_bytes_ = 0;
+    int downlink_packets_ = 0;
+    int downlink_bytes_ = 0;
+    int send_failures_ = 0;
+    int max_send_delay_ms_ = 0;
+
+    bool has_sequence_ = false;
+    uint32_t max_sequence_ = 0;
+    // Bit n is set if max_sequence_ - n has been received
+    uint64_t received_mask_ = 0;
+    int lost_ = 0;
+    int reordered_ = 0;
+    int duplicates_ = 0;
+
+    int64_t last_arrival_us_ = 0;
+    uint32_t last_timestamp_ = 0;
+    int64_t jitter_us_ = 0;
+
+    int rtt_samples_ = 0;
+    int smoothed_rtt_ms_ = 0;
+    int min_rtt_ms_ = 0;
+    int max_rtt_ms_ = 0;
+};
+
+#endif // PROTOCOL_STATS_H
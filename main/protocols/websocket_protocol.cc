@@ -3,6 +3,7 @@
 #include "system_info.h"
 #include "application.h"
 #include "settings.h"
+#include "cbor_codec.h"
 
 #include <cstring>
 #include <cJSON.h>
@@ -14,9 +15,26 @@
 
 WebsocketProtocol::WebsocketProtocol() {
     event_group_handle_ = xEventGroupCreate();
+
+    esp_timer_create_args_t hello_timer_args = {
+        .callback = [](void* arg) {
+            auto protocol = (WebsocketProtocol*)arg;
+            Application::GetInstance().Schedule([protocol]() {
+                protocol->OnServerHelloTimeout();
+            });
+        },
+        .arg = this,
+        .dispatch_method = ESP_TIMER_TASK,
+        .name = "ws_server_hello",
+        .skip_unhandled_events = true
+    };
+    esp_timer_create(&hello_timer_args, &hello_timer_);
 }
 
 WebsocketProtocol::~WebsocketProtocol() {
+    esp_timer_stop(hello_timer_);
+    esp_timer_delete(hello_timer_);
+    cJSON_Delete(resume_hello_.exchange(nullptr));
     vEventGroupDelete(event_group_handle_);
 }
 
@@ -26,10 +44,21 @@ bool WebsocketProtocol::Start() {
 }
 
 bool WebsocketProtocol::SendAudio(std::unique_ptr<AudioStreamPacket> packet) {
+    std::lock_guard<std::mutex> lock(channel_mutex_);
+    if (reconnecting_) {
+        BufferUplinkAudio(std::move(packet));
+        return true;
+    }
+    return SendAudioLocked(std::move(packet));
+}
+
+bool WebsocketProtocol::SendAudioLocked(std::unique_ptr<AudioStreamPacket> packet) {
     if (websocket_ == nullptr || !websocket_->IsConnected()) {
         return false;
     }
 
+    bool sent;
+    size_t size;
     if (version_ == 2) {
         std::string serialized;
         serialized.resize(sizeof(BinaryProtocol2) + packet->payload.size());
@@ -41,7 +70,8 @@ bool WebsocketProtocol::SendAudio(std::unique_ptr<AudioStreamPacket> packet) {
         bp2->payload_size = htonl(packet->payload.size());
         memcpy(bp2->payload, packet->payload.data(), packet->payload.size());
 
-        return websocket_->Send(serialized.data(), serialized.size(), true);
+        sent = websocket_->Send(serialized.data(), serialized.size(), true);
+        size = serialized.size();
     } else if (version_ == 3) {
         std::string serialized;
         serialized.resize(sizeof(BinaryProtocol3) + packet->payload.size());
@@ -51,19 +81,106 @@ bool WebsocketProtocol::SendAudio(std::unique_ptr<AudioStreamPacket> packet) {
         bp3->payload_size = htons(packet->payload.size());
         memcpy(bp3->payload, packet->payload.data(), packet->payload.size());
 
-        return websocket_->Send(serialized.data(), serialized.size(), true);
+        sent = websocket_->Send(serialized.data(), serialized.size(), true);
+        size = serialized.size();
     } else {
-        return websocket_->Send(packet->payload.data(), packet->payload.size(), true);
+        sent = websocket_->Send(packet->payload.data(), packet->payload.size(), true);
+        size = packet->payload.size();
     }
+    stats_.OnUplink(size, sent);
+    if (sent) {
+        stats_.OnSendDelay(packet->enqueue_time_us);
+    }
+    return sent;
 }
 
-bool WebsocketProtocol::SendText(const std::string& text) {
-    if (websocket_ == nullptr || !websocket_->IsConnected()) {
+void WebsocketProtocol::FlushUplinkAudio() {
+    if (!uplink_buffer_.empty()) {
+        ESP_LOGI(TAG, "Sending %u audio packets buffered while reconnecting, %d dropped",
+            uplink_buffer_.size(), uplink_dropped_);
+    }
+    while (!uplink_buffer_.empty()) {
+        auto packet = std::move(uplink_buffer_.front());
+        uplink_buffer_.pop_front();
+        if (!SendAudioLocked(std::move(packet))) {
+            break;
+        }
+    }
+    uplink_buffer_.clear();
+}
+
+bool WebsocketProtocol::SendText(std::string_view text) {
+    if (reconnecting_) {
+        BufferControlMessage(text, false);
+        return true;
+    }
+    return SendTextFrame(text);
+}
+
+bool WebsocketProtocol::SendCbor(std::string_view data) {
+    if (reconnecting_) {
+        BufferControlMessage(data, true);
+        return true;
+    }
+    return SendCborFrame(data);
+}
+
+bool WebsocketProtocol::SendBufferedMessage(const BufferedMessage& message) {
+    return message.cbor ? SendCborFrame(message.data) : SendTextFrame(message.data);
+}
+
+bool WebsocketProtocol::SendTextFrame(std::string_view text) {
+    bool sent;
+    {
+        std::lock_guard<std::mutex> lock(channel_mutex_);
+        if (websocket_ == nullptr || !websocket_->IsConnected()) {
+            return false;
+        }
+        sent = websocket_->Send(text.data(), text.size(), false);
+    }
+    if (!sent) {
+        ESP_LOGE(TAG, "Failed to send text: %.*s", (int)text.size(), text.data());
+        SetError(Lang::Strings::SERVER_ERROR);
         return false;
     }
 
-    if (!websocket_->Send(text)) {
-        ESP_LOGE(TAG, "Failed to send text: %s", text.c_str());
+    return true;
+}
+
+bool WebsocketProtocol::SendCborFrame(std::string_view data) {
+    // CBOR is only negotiated with version 2 and 3, it shares the binary frames with the audio
+    std::string serialized;
+    if (version_ == 2) {
+        serialized.resize(sizeof(BinaryProtocol2) + data.size());
+        auto bp2 = (BinaryProtocol2*)serialized.data();
+        bp2->version = htons(version_);
+        bp2->type = htons(BINARY_PROTOCOL_TYPE_CBOR);
+        bp2->reserved = 0;
+        bp2->timestamp = 0;
+        bp2->payload_size = htonl(data.size());
+        memcpy(bp2->payload, data.data(), data.size());
+    } else if (version_ == 3) {
+        serialized.resize(sizeof(BinaryProtocol3) + data.size());
+        auto bp3 = (BinaryProtocol3*)serialized.data();
+        bp3->type = BINARY_PROTOCOL_TYPE_CBOR;
+        bp3->reserved = 0;
+        bp3->payload_size = htons(data.size());
+        memcpy(bp3->payload, data.data(), data.size());
+    } else {
+        ESP_LOGE(TAG, "CBOR is not supported by protocol version %d", version_);
+        return false;
+    }
+
+    bool sent;
+    {
+        std::lock_guard<std::mutex> lock(channel_mutex_);
+        if (websocket_ == nullptr || !websocket_->IsConnected()) {
+            return false;
+        }
+        sent = websocket_->Send(serialized.data(), serialized.size(), true);
+    }
+    if (!sent) {
+        ESP_LOGE(TAG, "Failed to send CBOR message, %u bytes", (unsigned)data.size());
         SetError(Lang::Strings::SERVER_ERROR);
         return false;
     }
@@ -72,17 +189,240 @@ bool WebsocketProtocol::SendText(const std::string& text) {
 }
 
 bool WebsocketProtocol::IsAudioChannelOpened() const {
-    return websocket_ != nullptr && websocket_->IsConnected() && !error_occurred_ && !IsTimeout();
+    // A session that is being resumed still counts as open, so the application keeps its state
+    bool connected = reconnecting_ || (websocket_ != nullptr && websocket_->IsConnected());
+    return connected && !error_occurred_ && !IsTimeout();
 }
 
 void WebsocketProtocol::CloseAudioChannel() {
-    websocket_.reset();
+    CancelReconnect();
+    StopWaitingServerHello();
+    {
+        std::lock_guard<std::mutex> lock(channel_mutex_);
+        reconnecting_ = false;
+        uplink_buffer_.clear();
+    }
+    resume_token_.clear();
+    control_buffer_.clear();
+    connection_id_++;
+    if (websocket_ != nullptr && websocket_->IsConnected()) {
+        char buffer[PROTOCOL_MESSAGE_BUFFER_SIZE * 2];
+        JsonWriter writer(buffer, sizeof(buffer), message_encoding_);
+        WriteGoodbyeMessage(writer);
+        SendMessage(writer);
+    }
+    LogStats();
+    std::unique_ptr<WebSocket> websocket;
+    {
+        std::lock_guard<std::mutex> lock(channel_mutex_);
+        websocket = std::move(websocket_);
+    }
+    // Closed outside the lock, the uplink task only finds no connection meanwhile
+    websocket.reset();
+    if (on_audio_channel_closed_ != nullptr) {
+        on_audio_channel_closed_();
+    }
 }
 
 bool WebsocketProtocol::OpenAudioChannel() {
+    return OpenChannel(true);
+}
+
+bool WebsocketProtocol::OpenAudioChannelEarly() {
+    return OpenChannel(!CanSendEarlyData());
+}
+
+bool WebsocketProtocol::OpenChannel(bool wait_server_hello) {
+    CancelReconnect();
+    StopWaitingServerHello();
+    {
+        std::lock_guard<std::mutex> lock(channel_mutex_);
+        reconnecting_ = false;
+        uplink_buffer_.clear();
+    }
+    resume_token_.clear();
+    control_buffer_.clear();
+    stats_.Reset();
+    if (!Connect(wait_server_hello)) {
+        return false;
+    }
+
+    if (on_audio_channel_opened_ != nullptr) {
+        on_audio_channel_opened_();
+    }
+    return true;
+}
+
+void WebsocketProtocol::HandleDisconnected(uint32_t connection_id) {
+    // Closed on purpose, replaced by a newer connection, or a reconnect is already running
+    if (connection_id != connection_id_ || reconnecting_) {
+        return;
+    }
+    if (resume_token_.empty()) {
+        StopWaitingServerHello();
+        if (on_audio_channel_closed_ != nullptr) {
+            on_audio_channel_closed_();
+        }
+        return;
+    }
+
+    ESP_LOGW(TAG, "Connection lost, trying to resume session %s", session_id_.c_str());
+    reconnecting_ = true;
+    if (!ScheduleReconnect()) {
+        CloseAudioChannel();
+    }
+}
+
+void WebsocketProtocol::Reconnect() {
+    if (!reconnecting_ || reconnect_running_) {
+        return;
+    }
+
+    Settings settings("websocket", false);
+    std::string url = settings.GetString("url");
+    uint32_t connection_id = ++connection_id_;
+    auto websocket = CreateWebSocket(connection_id, settings.GetString("token")).release();
+    if (websocket == nullptr) {
+        if (!ScheduleReconnect()) {
+            CloseAudioChannel();
+        }
+        return;
+    }
+
+    // The hello carries the session state, so it is written here and the task only sends it
+    char buffer[PROTOCOL_MESSAGE_BUFFER_SIZE * 2];
+    JsonWriter writer(buffer, sizeof(buffer));
+    WriteHelloMessage(writer, true);
+    if (!writer.ok()) {
+        ESP_LOGE(TAG, "Resume hello does not fit in the buffer");
+        delete websocket;
+        CloseAudioChannel();
+        return;
+    }
+
+    // Connecting and waiting for the server hello takes seconds, the main loop keeps
+    // buffering audio and control messages in the meantime
+    reconnect_running_ = true;
+    bool started = StartConnectTask("ws_reconnect", [this, connection_id, websocket, url, hello = std::string(writer.view())]() {
+        int rtt_ms = 0;
+        cJSON* server_hello = ResumeConnection(websocket, url, hello, rtt_ms);
+        Application::GetInstance().Schedule([this, connection_id, websocket, server_hello, rtt_ms]() {
+            HandleReconnectResult(connection_id, websocket, server_hello, rtt_ms);
+        });
+    });
+    if (!started) {
+        reconnect_running_ = false;
+        delete websocket;
+        if (!ScheduleReconnect()) {
+            CloseAudioChannel();
+        }
+    }
+}
+
+// Runs in the reconnect task, returns the server hello for the main loop or nullptr
+cJSON* WebsocketProtocol::ResumeConnection(WebSocket* websocket, const std::string& url, const std::string& hello, int& rtt_ms) {
+    cJSON_Delete(resume_hello_.exchange(nullptr));
+    xEventGroupClearBits(event_group_handle_, WEBSOCKET_PROTOCOL_RESUME_HELLO_EVENT);
+
+    // A failed resume is retried quietly, the session is only reported lost when the retries run out
+    ESP_LOGI(TAG, "Reconnecting to websocket server: %s", url.c_str());
+    if (!websocket->Connect(url.c_str())) {
+        ESP_LOGE(TAG, "Failed to reconnect to websocket server");
+        return nullptr;
+    }
+    auto hello_time = esp_timer_get_time();
+    if (!websocket->Send(hello.data(), hello.size(), false)) {
+        ESP_LOGE(TAG, "Failed to send the resume hello");
+        return nullptr;
+    }
+    EventBits_t bits = xEventGroupWaitBits(event_group_handle_, WEBSOCKET_PROTOCOL_RESUME_HELLO_EVENT, pdTRUE, pdFALSE,
+        pdMS_TO_TICKS(WEBSOCKET_PROTOCOL_SERVER_HELLO_TIMEOUT_MS));
+    if (!(bits & WEBSOCKET_PROTOCOL_RESUME_HELLO_EVENT)) {
+        ESP_LOGE(TAG, "Failed to receive server hello");
+        return nullptr;
+    }
+    rtt_ms = (esp_timer_get_time() - hello_time) / 1000;
+    return resume_hello_.exchange(nullptr);
+}
+
+void WebsocketProtocol::HandleReconnectResult(uint32_t connection_id, WebSocket* websocket, cJSON* server_hello, int rtt_ms) {
+    reconnect_running_ = false;
+    std::unique_ptr<WebSocket> connection(websocket);
+    if (!reconnecting_) {
+        // The session was closed while connecting
+        cJSON_Delete(server_hello);
+        return;
+    }
+    if (connection_id != connection_id_) {
+        // The network changed while connecting, start over on the new one
+        cJSON_Delete(server_hello);
+        Reconnect();
+        return;
+    }
+    if (server_hello == nullptr) {
+        if (!ScheduleReconnect()) {
+            CloseAudioChannel();
+        }
+        return;
+    }
+
+    auto session_id = session_id_;
+    {
+        std::lock_guard<std::mutex> lock(channel_mutex_);
+        websocket_ = std::move(connection);
+    }
+    error_occurred_ = false;
+    ParseServerHello(server_hello);
+    cJSON_Delete(server_hello);
+    stats_.OnRtt(rtt_ms);
+    CancelReconnect();
+    if (session_id_ != session_id) {
+        ESP_LOGW(TAG, "Server did not resume session %s", session_id.c_str());
+        CloseAudioChannel();
+        return;
+    }
+    ESP_LOGI(TAG, "Session %s resumed", session_id_.c_str());
+    // The control messages go first, the uplink task keeps buffering its audio until reconnecting_ is cleared
+    if (!FlushControlMessages()) {
+        CloseAudioChannel();
+        return;
+    }
+    {
+        // Under the lock, so the next packet of the uplink task goes out after the buffered audio
+        std::lock_guard<std::mutex> lock(channel_mutex_);
+        reconnecting_ = false;
+        FlushUplinkAudio();
+    }
+}
+
+void WebsocketProtocol::MigrateNetwork() {
+    if (websocket_ == nullptr && !reconnecting_) {
+        return;
+    }
+    if (resume_token_.empty()) {
+        ESP_LOGW(TAG, "Network changed, the server does not support resuming, closing the session");
+        CloseAudioChannel();
+        return;
+    }
+
+    // The old socket may take minutes to notice the dead link, resume on the new one right away
+    ESP_LOGI(TAG, "Network changed, moving session %s to the new network", session_id_.c_str());
+    std::unique_ptr<WebSocket> websocket;
+    {
+        std::lock_guard<std::mutex> lock(channel_mutex_);
+        reconnecting_ = true;
+        websocket = std::move(websocket_);
+    }
+    websocket.reset();
+    // A reconnect that is still running uses the old network, its result is dropped
+    connection_id_++;
+    CancelReconnect();
+    Reconnect();
+}
+
+bool WebsocketProtocol::Connect(bool wait_server_hello) {
     Settings settings("websocket", false);
     std::string url = settings.GetString("url");
-    std::string token = settings.GetString("token");
     int version = settings.GetInt("version");
     if (version != 0) {
         version_ = version;
@@ -90,11 +430,64 @@ bool WebsocketProtocol::OpenAudioChannel() {
 
     error_occurred_ = false;
 
+    auto websocket = CreateWebSocket(++connection_id_, settings.GetString("token"));
+    if (websocket == nullptr) {
+        return false;
+    }
+    {
+        std::lock_guard<std::mutex> lock(channel_mutex_);
+        websocket_ = std::move(websocket);
+    }
+
+    ESP_LOGI(TAG, "Connecting to websocket server: %s with version: %d", url.c_str(), version_);
+    if (!websocket_->Connect(url.c_str())) {
+        ESP_LOGE(TAG, "Failed to connect to websocket server");
+        SetError(Lang::Strings::SERVER_NOT_CONNECTED);
+        return false;
+    }
+
+    // Send hello message to describe the client.
+    // Hello is always JSON, the server hello decides the encoding of the messages after it
+    message_encoding_ = kMessageEncodingJson;
+    char buffer[PROTOCOL_MESSAGE_BUFFER_SIZE * 2];
+    JsonWriter writer(buffer, sizeof(buffer));
+    WriteHelloMessage(writer, false);
+    xEventGroupClearBits(event_group_handle_, WEBSOCKET_PROTOCOL_SERVER_HELLO_EVENT);
+    auto hello_time = esp_timer_get_time();
+    hello_time_ = hello_time;
+    // Set before sending, the server hello may arrive before SendMessage returns
+    waiting_server_hello_ = !wait_server_hello;
+    if (!SendMessage(writer)) {
+        waiting_server_hello_ = false;
+        return false;
+    }
+
+    if (!wait_server_hello) {
+        // The server handles the messages of a connection in order, so the audio can follow the hello
+        // right away. A missing server hello is reported by the timer instead
+        ESP_LOGI(TAG, "Sending early data before the server hello");
+        esp_timer_start_once(hello_timer_, WEBSOCKET_PROTOCOL_SERVER_HELLO_TIMEOUT_MS * 1000);
+        return true;
+    }
+
+    // Wait for server hello
+    EventBits_t bits = xEventGroupWaitBits(event_group_handle_, WEBSOCKET_PROTOCOL_SERVER_HELLO_EVENT, pdTRUE, pdFALSE,
+        pdMS_TO_TICKS(WEBSOCKET_PROTOCOL_SERVER_HELLO_TIMEOUT_MS));
+    if (!(bits & WEBSOCKET_PROTOCOL_SERVER_HELLO_EVENT)) {
+        ESP_LOGE(TAG, "Failed to receive server hello");
+        SetError(Lang::Strings::SERVER_TIMEOUT);
+        return false;
+    }
+    stats_.OnRtt((esp_timer_get_time() - hello_time) / 1000);
+    return true;
+}
+
+std::unique_ptr<WebSocket> WebsocketProtocol::CreateWebSocket(uint32_t connection_id, std::string token) {
     auto network = Board::GetInstance().GetNetwork();
-    websocket_ = network->CreateWebSocket(1);
-    if (websocket_ == nullptr) {
+    auto websocket = network->CreateWebSocket(1);
+    if (websocket == nullptr) {
         ESP_LOGE(TAG, "Failed to create websocket");
-        return false;
+        return nullptr;
     }
 
     if (!token.empty()) {
@@ -102,22 +495,41 @@ bool WebsocketProtocol::OpenAudioChannel() {
         if (token.find(" ") == std::string::npos) {
             token = "Bearer " + token;
         }
-        websocket_->SetHeader("Authorization", token.c_str());
+        websocket->SetHeader("Authorization", token.c_str());
     }
-    websocket_->SetHeader("Protocol-Version", std::to_string(version_).c_str());
-    websocket_->SetHeader("Device-Id", SystemInfo::GetMacAddress().c_str());
-    websocket_->SetHeader("Client-Id", Board::GetInstance().GetUuid().c_str());
+    websocket->SetHeader("Protocol-Version", std::to_string(version_).c_str());
+    websocket->SetHeader("Device-Id", SystemInfo::GetMacAddress().c_str());
+    websocket->SetHeader("Client-Id", Board::GetInstance().GetUuid().c_str());
 
-    websocket_->OnData([this](const char* data, size_t len, bool binary) {
+    websocket->OnData([this, connection_id](const char* data, size_t len, bool binary) {
+        // A replaced or closed connection may still deliver its last frames
+        if (connection_id != connection_id_) {
+            return;
+        }
         if (binary) {
             if (on_incoming_audio_ != nullptr) {
                 if (version_ == 2) {
+                    if (len < sizeof(BinaryProtocol2)) {
+                        ESP_LOGE(TAG, "Binary frame too short: %u bytes", (unsigned)len);
+                        return;
+                    }
                     BinaryProtocol2* bp2 = (BinaryProtocol2*)data;
                     bp2->version = ntohs(bp2->version);
                     bp2->type = ntohs(bp2->type);
                     bp2->timestamp = ntohl(bp2->timestamp);
                     bp2->payload_size = ntohl(bp2->payload_size);
+                    if (bp2->payload_size > len - sizeof(BinaryProtocol2)) {
+                        ESP_LOGE(TAG, "Binary frame payload size %lu exceeds the frame (%u bytes)",
+                            (unsigned long)bp2->payload_size, (unsigned)len);
+                        return;
+                    }
                     auto payload = (uint8_t*)bp2->payload;
+                    if (bp2->type == BINARY_PROTOCOL_TYPE_CBOR) {
+                        HandleControlMessage(connection_id, CborCodec::Decode(payload, bp2->payload_size));
+                        last_incoming_time_ = std::chrono::steady_clock::now();
+                        return;
+                    }
+                    stats_.OnDownlink(len, bp2->timestamp, server_frame_duration_);
                     on_incoming_audio_(std::make_unique<AudioStreamPacket>(AudioStreamPacket{
                         .sample_rate = server_sample_rate_,
                         .frame_duration = server_frame_duration_,
@@ -125,10 +537,25 @@ bool WebsocketProtocol::OpenAudioChannel() {
                         .payload = std::vector<uint8_t>(payload, payload + bp2->payload_size)
                     }));
                 } else if (version_ == 3) {
+                    if (len < sizeof(BinaryProtocol3)) {
+                        ESP_LOGE(TAG, "Binary frame too short: %u bytes", (unsigned)len);
+                        return;
+                    }
                     BinaryProtocol3* bp3 = (BinaryProtocol3*)data;
                     bp3->type = bp3->type;
                     bp3->payload_size = ntohs(bp3->payload_size);
+                    if (bp3->payload_size > len - sizeof(BinaryProtocol3)) {
+                        ESP_LOGE(TAG, "Binary frame payload size %u exceeds the frame (%u bytes)",
+                            (unsigned)bp3->payload_size, (unsigned)len);
+                        return;
+                    }
                     auto payload = (uint8_t*)bp3->payload;
+                    if (bp3->type == BINARY_PROTOCOL_TYPE_CBOR) {
+                        HandleControlMessage(connection_id, CborCodec::Decode(payload, bp3->payload_size));
+                        last_incoming_time_ = std::chrono::steady_clock::now();
+                        return;
+                    }
+                    stats_.OnDownlink(len, 0, server_frame_duration_);
                     on_incoming_audio_(std::make_unique<AudioStreamPacket>(AudioStreamPacket{
                         .sample_rate = server_sample_rate_,
                         .frame_duration = server_frame_duration_,
@@ -136,6 +563,7 @@ bool WebsocketProtocol::OpenAudioChannel() {
                         .payload = std::vector<uint8_t>(payload, payload + bp3->payload_size)
                     }));
                 } else {
+                    stats_.OnDownlink(len, 0, server_frame_duration_);
                     on_incoming_audio_(std::make_unique<AudioStreamPacket>(AudioStreamPacket{
                         .sample_rate = server_sample_rate_,
                         .frame_duration = server_frame_duration_,
@@ -145,83 +573,95 @@ bool WebsocketProtocol::OpenAudioChannel() {
                 }
             }
         } else {
-            // Parse JSON data
-            auto root = cJSON_Parse(data);
-            auto type = cJSON_GetObjectItem(root, "type");
-            if (cJSON_IsString(type)) {
-                if (strcmp(type->valuestring, "hello") == 0) {
-                    ParseServerHello(root);
-                } else {
-                    if (on_incoming_json_ != nullptr) {
-                        on_incoming_json_(root);
-                    }
-                }
-            } else {
-                ESP_LOGE(TAG, "Missing message type, data: %s", data);
-            }
-            cJSON_Delete(root);
+            // Parse JSON data, text frames are not NUL terminated
+            HandleControlMessage(connection_id, cJSON_ParseWithLength(data, len));
         }
         last_incoming_time_ = std::chrono::steady_clock::now();
     });
 
-    websocket_->OnDisconnected([this]() {
+    websocket->OnDisconnected([this, connection_id]() {
         ESP_LOGI(TAG, "Websocket disconnected");
-        if (on_audio_channel_closed_ != nullptr) {
-            on_audio_channel_closed_();
-        }
+        Application::GetInstance().Schedule([this, connection_id]() {
+            HandleDisconnected(connection_id);
+        });
     });
+    return websocket;
+}
 
-    ESP_LOGI(TAG, "Connecting to websocket server: %s with version: %d", url.c_str(), version_);
-    if (!websocket_->Connect(url.c_str())) {
-        ESP_LOGE(TAG, "Failed to connect to websocket server");
-        SetError(Lang::Strings::SERVER_NOT_CONNECTED);
-        return false;
+void WebsocketProtocol::WriteHelloMessage(JsonWriter& writer, bool resume) {
+    // keys: message type, version, audio_params (format, sample_rate, channels)
+    writer.BeginObject();
+    writer.AddString("type", "hello");
+    writer.AddNumber("version", version_);
+    if (resume) {
+        writer.AddString("session_id", session_id_);
+        writer.AddString("resume_token", resume_token_);
     }
-
-    // Send hello message to describe the client
-    auto message = GetHelloMessage();
-    if (!SendText(message)) {
-        return false;
+    writer.BeginObject("features");
+#if CONFIG_USE_SERVER_AEC
+    writer.AddBool("aec", true);
+#endif
+    writer.AddBool("mcp", true);
+    writer.AddBool("ping", true);
+#if CONFIG_WEBSOCKET_EARLY_DATA
+    writer.AddBool("early_data", true);
+#endif
+    // CBOR messages travel in binary frames, which need the header of version 2 or 3
+    if (version_ >= 2) {
+        writer.AddBool("cbor", true);
     }
+    writer.EndObject();
+    writer.AddString("transport", "websocket");
+    writer.BeginObject("audio_params");
+    writer.AddString("format", "opus");
+    writer.AddNumber("sample_rate", 16000);
+    writer.AddNumber("channels", 1);
+    writer.AddNumber("frame_duration", OPUS_FRAME_DURATION_MS);
+    writer.EndObject();
+    writer.EndObject();
+}
 
-    // Wait for server hello
-    EventBits_t bits = xEventGroupWaitBits(event_group_handle_, WEBSOCKET_PROTOCOL_SERVER_HELLO_EVENT, pdTRUE, pdFALSE, pdMS_TO_TICKS(10000));
-    if (!(bits & WEBSOCKET_PROTOCOL_SERVER_HELLO_EVENT)) {
-        ESP_LOGE(TAG, "Failed to receive server hello");
-        SetError(Lang::Strings::SERVER_TIMEOUT);
-        return false;
+void WebsocketProtocol::HandleControlMessage(uint32_t connection_id, cJSON* root) {
+    if (root == nullptr) {
+        ESP_LOGE(TAG, "Failed to parse control message");
+        return;
     }
-
-    if (on_audio_channel_opened_ != nullptr) {
-        on_audio_channel_opened_();
+    auto type = cJSON_GetObjectItem(root, "type");
+    if (cJSON_IsString(type)) {
+        if (strcmp(type->valuestring, "hello") == 0) {
+            if (reconnecting_) {
+                // The main loop is still sending with the old session state, the reconnect task hands it over
+                cJSON_Delete(resume_hello_.exchange(root));
+                xEventGroupSetBits(event_group_handle_, WEBSOCKET_PROTOCOL_RESUME_HELLO_EVENT);
+                return;
+            }
+            if (waiting_server_hello_) {
+                // This task stamps the audio that follows the hello, so the audio params apply right away.
+                // The session state belongs to the main loop, which drops the hello if the connection
+                // was closed or replaced in the meantime
+                ParseServerAudioParams(root);
+                Application::GetInstance().Schedule([this, root, connection_id]() {
+                    if (connection_id == connection_id_ && waiting_server_hello_) {
+                        ParseServerHello(root);
+                    } else {
+                        ESP_LOGW(TAG, "Dropping the server hello of connection %lu", (unsigned long)connection_id);
+                    }
+                    cJSON_Delete(root);
+                });
+                return;
+            }
+            ParseServerHello(root);
+        } else if (strcmp(type->valuestring, "pong") == 0) {
+            HandlePong(root);
+        } else {
+            if (on_incoming_json_ != nullptr) {
+                on_incoming_json_(root);
+            }
+        }
+    } else {
+        ESP_LOGE(TAG, "Missing message type");
     }
-
-    return true;
-}
-
-std::string WebsocketProtocol::GetHelloMessage() {
-    // keys: message type, version, audio_params (format, sample_rate, channels)
-    cJSON* root = cJSON_CreateObject();
-    cJSON_AddStringToObject(root, "type", "hello");
-    cJSON_AddNumberToObject(root, "version", version_);
-    cJSON* features = cJSON_CreateObject();
-#if CONFIG_USE_SERVER_AEC
-    cJSON_AddBoolToObject(features, "aec", true);
-#endif
-    cJSON_AddBoolToObject(features, "mcp", true);
-    cJSON_AddItemToObject(root, "features", features);
-    cJSON_AddStringToObject(root, "transport", "websocket");
-    cJSON* audio_params = cJSON_CreateObject();
-    cJSON_AddStringToObject(audio_params, "format", "opus");
-    cJSON_AddNumberToObject(audio_params, "sample_rate", 16000);
-    cJSON_AddNumberToObject(audio_params, "channels", 1);
-    cJSON_AddNumberToObject(audio_params, "frame_duration", OPUS_FRAME_DURATION_MS);
-    cJSON_AddItemToObject(root, "audio_params", audio_params);
-    auto json_str = cJSON_PrintUnformatted(root);
-    std::string message(json_str);
-    cJSON_free(json_str);
     cJSON_Delete(root);
-    return message;
 }
 
 void WebsocketProtocol::ParseServerHello(const cJSON* root) {
@@ -237,6 +677,30 @@ void WebsocketProtocol::ParseServerHello(const cJSON* root) {
         ESP_LOGI(TAG, "Session ID: %s", session_id_.c_str());
     }
 
+    ParseServerFeatures(root);
+    auto features = cJSON_GetObjectItem(root, "features");
+    SetEarlyDataSupported(cJSON_IsTrue(cJSON_GetObjectItem(features, "early_data")));
+
+    // Servers that can continue a session after a reconnect hand out a resume token
+    auto resume_token = cJSON_GetObjectItem(root, "resume_token");
+    if (cJSON_IsString(resume_token)) {
+        resume_token_ = resume_token->valuestring;
+    } else {
+        resume_token_.clear();
+    }
+
+    ParseServerAudioParams(root);
+
+    if (waiting_server_hello_) {
+        StopWaitingServerHello();
+        int rtt_ms = (esp_timer_get_time() - hello_time_) / 1000;
+        stats_.OnRtt(rtt_ms);
+        ESP_LOGI(TAG, "Server hello arrived %d ms after the early data started", rtt_ms);
+    }
+    xEventGroupSetBits(event_group_handle_, WEBSOCKET_PROTOCOL_SERVER_HELLO_EVENT);
+}
+
+void WebsocketProtocol::ParseServerAudioParams(const cJSON* root) {
     auto audio_params = cJSON_GetObjectItem(root, "audio_params");
     if (cJSON_IsObject(audio_params)) {
         auto sample_rate = cJSON_GetObjectItem(audio_params, "sample_rate");
@@ -248,6 +712,48 @@ void WebsocketProtocol::ParseServerHello(const cJSON* root) {
             server_frame_duration_ = frame_duration->valueint;
         }
     }
+}
 
-    xEventGroupSetBits(event_group_handle_, WEBSOCKET_PROTOCOL_SERVER_HELLO_EVENT);
+bool WebsocketProtocol::CanSendEarlyData() {
+#if CONFIG_WEBSOCKET_EARLY_DATA
+    // Only servers that announced early data before, a new URL may be another server
+    Settings settings("websocket", false);
+    auto url = settings.GetString("url");
+    return !url.empty() && settings.GetString("early_data_url") == url;
+#else
+    return false;
+#endif
+}
+
+void WebsocketProtocol::SetEarlyDataSupported(bool supported) {
+#if CONFIG_WEBSOCKET_EARLY_DATA
+    if (supported == CanSendEarlyData()) {
+        return;
+    }
+    Settings settings("websocket", true);
+    if (supported) {
+        ESP_LOGI(TAG, "Server supports early data, the next sessions skip the hello wait");
+        settings.SetString("early_data_url", settings.GetString("url"));
+    } else {
+        ESP_LOGI(TAG, "Server does not support early data");
+        settings.SetString("early_data_url", "");
+    }
+#endif
+}
+
+void WebsocketProtocol::StopWaitingServerHello() {
+    waiting_server_hello_ = false;
+    esp_timer_stop(hello_timer_);
+}
+
+void WebsocketProtocol::OnServerHelloTimeout() {
+    if (!waiting_server_hello_) {
+        return;
+    }
+    ESP_LOGE(TAG, "Failed to receive server hello after early data");
+    // Wait for the hello again next time, the server may have lost the support
+    SetEarlyDataSupported(false);
+    StopWaitingServerHello();
+    SetError(Lang::Strings::SERVER_TIMEOUT);
+    CloseAudioChannel();
 }
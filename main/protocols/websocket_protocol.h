@@ -5,10 +5,15 @@
 #include "protocol.h"
 
 #include <web_socket.h>
+#include <atomic>
+#include <mutex>
 #include <freertos/FreeRTOS.h>
 #include <freertos/event_groups.h>
 
 #define WEBSOCKET_PROTOCOL_SERVER_HELLO_EVENT (1 << 0)
+// The server hello of a resumed connection, waited for by the reconnect task
+#define WEBSOCKET_PROTOCOL_RESUME_HELLO_EVENT (1 << 1)
+#define WEBSOCKET_PROTOCOL_SERVER_HELLO_TIMEOUT_MS 10000
 
 class WebsocketProtocol : public Protocol {
 public:
@@ -18,17 +23,54 @@ public:
     bool Start() override;
     bool SendAudio(std::unique_ptr<AudioStreamPacket> packet) override;
     bool OpenAudioChannel() override;
+    bool OpenAudioChannelEarly() override;
     void CloseAudioChannel() override;
     bool IsAudioChannelOpened() const override;
+    void MigrateNetwork() override;
 
 private:
     EventGroupHandle_t event_group_handle_;
+    // Audio is sent from the uplink task, every send and every change of websocket_ and
+    // the uplink buffer takes the lock. websocket_ is only changed by the main loop
+    std::mutex channel_mutex_;
     std::unique_ptr<WebSocket> websocket_;
     int version_ = 1;
+    std::string resume_token_;
+    std::atomic<bool> reconnecting_ = false;
+    // Bumped for every new connection and on close, callbacks of older connections are ignored
+    std::atomic<uint32_t> connection_id_ = 0;
+    // Server hello of the connection being resumed, handed to the main loop by the reconnect task
+    std::atomic<cJSON*> resume_hello_ = nullptr;
+    // Early data: the channel is used before the server hello, which is checked by a timer
+    std::atomic<bool> waiting_server_hello_ = false;
+    int64_t hello_time_ = 0;
+    esp_timer_handle_t hello_timer_ = nullptr;
 
+    bool OpenChannel(bool wait_server_hello);
+    bool Connect(bool wait_server_hello);
+    std::unique_ptr<WebSocket> CreateWebSocket(uint32_t connection_id, std::string token);
+    cJSON* ResumeConnection(WebSocket* websocket, const std::string& url, const std::string& hello, int& rtt_ms);
+    void HandleReconnectResult(uint32_t connection_id, WebSocket* websocket, cJSON* server_hello, int rtt_ms);
+    bool CanSendEarlyData();
+    void SetEarlyDataSupported(bool supported);
+    void StopWaitingServerHello();
+    void OnServerHelloTimeout();
+    void HandleDisconnected(uint32_t connection_id);
+    void Reconnect() override;
     void ParseServerHello(const cJSON* root);
-    bool SendText(const std::string& text) override;
-    std::string GetHelloMessage();
+    void ParseServerAudioParams(const cJSON* root);
+    // Dispatch a received control message of the connection, JSON or CBOR, and free it
+    void HandleControlMessage(uint32_t connection_id, cJSON* root);
+    // Called with channel_mutex_ held
+    bool SendAudioLocked(std::unique_ptr<AudioStreamPacket> packet);
+    void FlushUplinkAudio();
+    bool SendText(std::string_view text) override;
+    bool SendCbor(std::string_view data) override;
+    bool SendBufferedMessage(const BufferedMessage& message) override;
+    // Send on the connection even while reconnecting_ is set
+    bool SendTextFrame(std::string_view text);
+    bool SendCborFrame(std::string_view data);
+    void WriteHelloMessage(JsonWriter& writer, bool resume);
 };
 
 #endif
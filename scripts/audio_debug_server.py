@@ -1,54 +1,195 @@
 import socket
+import struct
 import wave
 import argparse
 
 
 '''
   Create a UDP socket and bind it to the server's IP:8000.
-  Listen for incoming messages and print them to the console.
-  Save the audio to a WAV file.
+  Listen for incoming audio debug packets, demux them by tap and
+  save every tap to its own time-aligned WAV file.
+
+  Packet format (little-endian, see main/audio/processors/audio_debugger.h):
+  |magic 4u|version 1u|tap 1u|channels 1u|encoding 1u|sample_rate 4u|sequence 4u|
+  |sample_index 4u|timestamp_us 8u|frames 2u|payload_size 2u|adpcm_predictor 2s|adpcm_index 1u|reserved 1u|
+  |payload payload_size|
 '''
-def main(samplerate, channels):
-    # Create a UDP socket
+
+HEADER_FORMAT = '<IBBBBIIIQHHhBB'
+HEADER_SIZE = struct.calcsize(HEADER_FORMAT)
+MAGIC = 0x44415a58
+
+ENCODING_PCM16 = 0
+ENCODING_IMA_ADPCM = 1
+
+TAP_NAMES = ['mic_raw', 'reference', 'afe_output', 'encoder_input', 'decoder_output']
+
+IMA_STEP_TABLE = [
+    7, 8, 9, 10, 11, 12, 13, 14, 16, 17, 19, 21, 23, 25, 28, 31, 34, 37, 41, 45,
+    50, 55, 60, 66, 73, 80, 88, 97, 107, 118, 130, 143, 157, 173, 190, 209, 230, 253, 279, 307,
+    337, 371, 408, 449, 494, 544, 598, 658, 724, 796, 876, 963, 1060, 1166, 1282, 1411, 1552, 1707, 1878, 2066,
+    2272, 2499, 2749, 3024, 3327, 3660, 4026, 4428, 4871, 5358, 5894, 6484, 7132, 7845, 8630, 9493, 10442, 11487, 12635, 13899,
+    15289, 16818, 18500, 20350, 22385, 24623, 27086, 29794, 32767
+]
+IMA_INDEX_TABLE = [-1, -1, -1, -1, 2, 4, 6, 8, -1, -1, -1, -1, 2, 4, 6, 8]
+
+
+def decode_ima_adpcm(payload, frames, predictor, index):
+    samples = []
+    for i in range(frames):
+        byte = payload[i // 2]
+        nibble = (byte >> 4) if (i & 1) else (byte & 0x0F)
+        step = IMA_STEP_TABLE[index]
+        delta = step >> 3
+        if nibble & 4:
+            delta += step
+        if nibble & 2:
+            delta += step >> 1
+        if nibble & 1:
+            delta += step >> 2
+        predictor += -delta if (nibble & 8) else delta
+        predictor = max(-32768, min(32767, predictor))
+        index = max(0, min(88, index + IMA_INDEX_TABLE[nibble]))
+        samples.append(predictor)
+    return struct.pack(f'<{len(samples)}h', *samples)
+
+
+class TapWriter:
+    '''
+      Writes one tap to a WAV file. Gaps in sample_index (frames dropped on the
+      device or lost on the network) are zero-filled so all taps stay aligned.
+    '''
+    def __init__(self, prefix, name, sample_rate, channels, lead_frames):
+        self.filename = f"{prefix}{name}_{sample_rate}_{channels}.wav"
+        self.channels = channels
+        self.wav = wave.open(self.filename, 'wb')
+        self.wav.setnchannels(channels)
+        self.wav.setsampwidth(2)
+        self.wav.setframerate(sample_rate)
+        self.next_index = None
+        self.lead_frames = lead_frames
+        self.gap_frames = 0
+        self.late_packets = 0
+
+    def write(self, sample_index, frames, pcm):
+        if self.next_index is None:
+            # Align the first packet of this tap to the first packet of any tap
+            self.write_silence(self.lead_frames)
+            self.next_index = sample_index
+        delta = (sample_index - self.next_index) & 0xFFFFFFFF
+        if delta >= 0x80000000:
+            # Reordered or duplicated packet, the WAV is append-only so skip it
+            self.late_packets += 1
+            return
+        if delta > 0:
+            self.gap_frames += delta
+            self.write_silence(delta)
+        self.wav.writeframes(pcm)
+        self.next_index = (sample_index + frames) & 0xFFFFFFFF
+
+    def write_silence(self, frames):
+        if frames > 0:
+            self.wav.writeframes(b'\x00\x00' * self.channels * frames)
+
+    def close(self):
+        self.wav.close()
+
+
+def main_raw(samplerate, channels, port):
     server_socket = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
-    server_socket.bind(('0.0.0.0', 8000))
+    server_socket.bind(('0.0.0.0', port))
 
-    # Create WAV file with parameters
     filename = f"{samplerate}_{channels}.wav"
     wav_file = wave.open(filename, "wb")
-    wav_file.setnchannels(channels)     # channels parameter
-    wav_file.setsampwidth(2)            # 2 bytes per sample (16-bit)
-    wav_file.setframerate(samplerate)   # samplerate parameter
-
-    print(f"Start saving audio from 0.0.0.0:8000 to {filename}...")
+    wav_file.setnchannels(channels)
+    wav_file.setsampwidth(2)
+    wav_file.setframerate(samplerate)
 
+    print(f"Start saving raw audio from 0.0.0.0:{port} to {filename}...")
     try:
         while True:
-            # Receive a message from the client
             message, address = server_socket.recvfrom(8000)
-            
-            # Write PCM data to WAV file
             wav_file.writeframes(message)
-
-            # Print length of the message
             print(f"Received {len(message)} bytes from {address}")
-    
     except KeyboardInterrupt:
         print("\nStopping recording...")
-    
     finally:
-        # Close files and socket
         wav_file.close()
         server_socket.close()
         print(f"WAV file '{filename}' saved successfully")
 
 
+def main(port, prefix):
+    server_socket = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    server_socket.bind(('0.0.0.0', port))
+
+    writers = {}
+    first_timestamp_us = None
+    last_sequence = None
+    lost_packets = 0
+
+    print(f"Start receiving audio debug taps from 0.0.0.0:{port}...")
+    try:
+        while True:
+            message, address = server_socket.recvfrom(65536)
+            if len(message) < HEADER_SIZE:
+                continue
+            (magic, version, tap, channels, encoding, sample_rate, sequence, sample_index,
+             timestamp_us, frames, payload_size, adpcm_predictor, adpcm_index, _) = \
+                struct.unpack_from(HEADER_FORMAT, message)
+            if magic != MAGIC or tap >= len(TAP_NAMES):
+                print(f"Ignoring unknown packet of {len(message)} bytes from {address}")
+                continue
+
+            if last_sequence is not None:
+                gap = (sequence - last_sequence - 1) & 0xFFFFFFFF
+                if gap < 0x80000000:
+                    lost_packets += gap
+            last_sequence = sequence
+
+            payload = message[HEADER_SIZE:HEADER_SIZE + payload_size]
+            if encoding == ENCODING_IMA_ADPCM:
+                pcm = decode_ima_adpcm(payload, frames, adpcm_predictor, adpcm_index)
+            else:
+                pcm = payload
+
+            if first_timestamp_us is None:
+                first_timestamp_us = timestamp_us
+            writer = writers.get(tap)
+            if writer is None:
+                lead_frames = max(0, (timestamp_us - first_timestamp_us) * sample_rate // 1000000)
+                writer = TapWriter(prefix, TAP_NAMES[tap], sample_rate, channels, lead_frames)
+                writers[tap] = writer
+                print(f"New tap {TAP_NAMES[tap]}: {sample_rate}Hz {channels}ch -> {writer.filename}")
+            writer.write(sample_index, frames, pcm)
+
+    except KeyboardInterrupt:
+        print("\nStopping recording...")
+
+    finally:
+        for writer in writers.values():
+            writer.close()
+            print(f"WAV file '{writer.filename}' saved, zero-filled {writer.gap_frames} frames, "
+                  f"skipped {writer.late_packets} late packets")
+        print(f"Lost {lost_packets} packets in total")
+        server_socket.close()
+
+
 if __name__ == "__main__":
-    parser = argparse.ArgumentParser(description='UDP音频数据接收器，保存为WAV文件')
-    parser.add_argument('--samplerate', '-s', type=int, default=16000, 
-                        help='采样率 (默认: 16000)')
-    parser.add_argument('--channels', '-c', type=int, default=2, 
-                        help='声道数 (默认: 2)')
-    
+    parser = argparse.ArgumentParser(description='UDP音频调试数据接收器，按采集点位保存为时间对齐的WAV文件')
+    parser.add_argument('--port', '-p', type=int, default=8000,
+                        help='监听端口 (默认: 8000)')
+    parser.add_argument('--prefix', type=str, default='',
+                        help='输出文件名前缀')
+    parser.add_argument('--raw', action='store_true',
+                        help='接收旧版固件发送的无包头 PCM 数据')
+    parser.add_argument('--samplerate', '-s', type=int, default=16000,
+                        help='采样率，仅用于 --raw 模式 (默认: 16000)')
+    parser.add_argument('--channels', '-c', type=int, default=2,
+                        help='声道数，仅用于 --raw 模式 (默认: 2)')
+
     args = parser.parse_args()
-    main(args.samplerate, args.channels)
+    if args.raw:
+        main_raw(args.samplerate, args.channels, args.port)
+    else:
+        main(args.port, args.prefix)
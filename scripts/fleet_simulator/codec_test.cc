@@ -0,0 +1,195 @@
+#include "json_writer.h"
+#include "cbor_codec.h"
+
+#include <cJSON.h>
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+/*
+ * Host test of JsonWriter and CborCodec on well formed, truncated and oversized
+ * input. Run with ctest, or directly: ./codec_test
+ */
+
+static int failures = 0;
+
+#define CHECK(condition) do { \
+        if (!(condition)) { \
+            fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #condition); \
+            failures++; \
+        } \
+    } while (0)
+
+static const char* kMcpPayload = "{\"jsonrpc\":\"2.0\",\"id\":7,\"result\":{\"content\":[{\"type\":\"text\",\"text\":\"ok\"}]}}";
+
+static void WriteMessage(JsonWriter& writer) {
+    writer.BeginObject()
+        .AddString("session_id", "abc")
+        .AddString("type", "mcp")
+        .AddString("text", "quote \" backslash \\ newline \n tab \t bell \x07 utf-8 你好")
+        .AddString("unknown_key", std::string(300, 'x'))
+        .AddNumber("id", 123456)
+        .AddNumber("code", -25)
+        .AddBool("isError", false)
+        .BeginObject("stats")
+            .AddNumber("rtt_ms", 42)
+            .AddBool("loss", true)
+        .EndObject()
+        .AddRaw("payload", kMcpPayload)
+        .EndObject();
+}
+
+static std::vector<uint8_t> Bytes(const JsonWriter& writer) {
+    return std::vector<uint8_t>(writer.c_str(), writer.c_str() + writer.length());
+}
+
+static cJSON* Decode(const std::vector<uint8_t>& data) {
+    return CborCodec::Decode(data.data(), data.size());
+}
+
+static void TestCborMatchesJson() {
+    char json_buffer[1024];
+    JsonWriter json(json_buffer, sizeof(json_buffer));
+    WriteMessage(json);
+    CHECK(json.ok());
+    CHECK(json.length() == strlen(json_buffer));
+
+    char cbor_buffer[1024];
+    JsonWriter cbor(cbor_buffer, sizeof(cbor_buffer), kMessageEncodingCbor);
+    WriteMessage(cbor);
+    CHECK(cbor.ok());
+    CHECK(CborCodec::IsCborMessage((const uint8_t*)cbor.c_str(), cbor.length()));
+    CHECK(cbor.length() < json.length());
+
+    cJSON* from_json = cJSON_ParseWithLength(json.c_str(), json.length());
+    cJSON* from_cbor = Decode(Bytes(cbor));
+    CHECK(from_json != nullptr);
+    CHECK(from_cbor != nullptr);
+    // AddRaw gives an object in the JSON text and the decoded embedded document in CBOR
+    CHECK(cJSON_Compare(from_json, from_cbor, true));
+    cJSON_Delete(from_json);
+    cJSON_Delete(from_cbor);
+}
+
+static void TestEmbeddedJsonIsByteString() {
+    char buffer[256];
+    JsonWriter writer(buffer, sizeof(buffer), kMessageEncodingCbor);
+    writer.BeginObject().AddRaw("payload", "{}").EndObject();
+    CHECK(writer.ok());
+    // Map, key 6, tag 262, byte string of length 2, break
+    const uint8_t expected[] = {0xBF, 0x06, 0xD9, 0x01, 0x06, 0x42, '{', '}', 0xFF};
+    CHECK(writer.length() == sizeof(expected));
+    CHECK(memcmp(writer.c_str(), expected, sizeof(expected)) == 0);
+
+    // Tag 262 on a text string is not an embedded JSON document
+    const uint8_t text_tagged[] = {0xBF, 0x06, 0xD9, 0x01, 0x06, 0x62, '{', '}', 0xFF};
+    CHECK(CborCodec::Decode(text_tagged, sizeof(text_tagged)) == nullptr);
+    // Nor is a byte string that is not JSON
+    const uint8_t not_json[] = {0xBF, 0x06, 0xD9, 0x01, 0x06, 0x42, '{', '{', 0xFF};
+    CHECK(CborCodec::Decode(not_json, sizeof(not_json)) == nullptr);
+}
+
+static void TestTruncatedCbor() {
+    char buffer[1024];
+    JsonWriter writer(buffer, sizeof(buffer), kMessageEncodingCbor);
+    WriteMessage(writer);
+    auto message = Bytes(writer);
+    for (size_t length = 0; length < message.size(); length++) {
+        std::vector<uint8_t> truncated(message.begin(), message.begin() + length);
+        // Decode from a heap copy of the exact size, so AddressSanitizer catches reads past it
+        cJSON* root = Decode(truncated);
+        CHECK(root == nullptr);
+        cJSON_Delete(root);
+    }
+
+    // Trailing bytes after a complete message
+    message.push_back(0x00);
+    CHECK(Decode(message) == nullptr);
+}
+
+static void TestOversizedCbor() {
+    // Text string claiming 4 GB, then 2^64 - 1 bytes
+    CHECK(Decode({0xA1, 0x04, 0x7A, 0xFF, 0xFF, 0xFF, 0xFF, 'a'}) == nullptr);
+    CHECK(Decode({0xA1, 0x04, 0x7B, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 'a'}) == nullptr);
+    // Embedded JSON claiming more bytes than the message has
+    CHECK(Decode({0xA1, 0x06, 0xD9, 0x01, 0x06, 0x5A, 0x00, 0x01, 0x00, 0x00, '{', '}'}) == nullptr);
+    // Map and array counts larger than the items that follow
+    CHECK(Decode({0xBB, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0x00, 0x00}) == nullptr);
+    CHECK(Decode({0x9A, 0xFF, 0xFF, 0xFF, 0xFF, 0x01}) == nullptr);
+    // Key index past the end of the dictionary
+    CHECK(Decode({0xA1, 0x18, 0xFF, 0x00}) == nullptr);
+    // Reserved additional information and a lone break
+    CHECK(Decode({0x1C}) == nullptr);
+    CHECK(Decode({0xFF}) == nullptr);
+
+    // Nesting deeper than the decoder allows, through arrays and through tags
+    std::vector<uint8_t> arrays(1000, 0x81);
+    arrays.push_back(0x00);
+    CHECK(Decode(arrays) == nullptr);
+    std::vector<uint8_t> tags;
+    for (int i = 0; i < 1000; i++) {
+        tags.push_back(0xC1);
+    }
+    tags.push_back(0x00);
+    CHECK(Decode(tags) == nullptr);
+
+    // A long string still decodes
+    std::vector<uint8_t> long_text = {0xA1, 0x04, 0x79, 0x10, 0x00};
+    long_text.insert(long_text.end(), 0x1000, 'y');
+    cJSON* root = Decode(long_text);
+    CHECK(root != nullptr);
+    auto text = cJSON_GetObjectItem(root, "text");
+    CHECK(cJSON_IsString(text) && strlen(text->valuestring) == 0x1000);
+    cJSON_Delete(root);
+}
+
+static void TestWriterOverflow(MessageEncoding encoding) {
+    char full_buffer[1024];
+    JsonWriter full(full_buffer, sizeof(full_buffer), encoding);
+    WriteMessage(full);
+    CHECK(full.ok());
+
+    // Every buffer size up to the one that fits, with a guard after the buffer
+    const size_t guard = 16;
+    for (size_t size = 0; size <= full.length() + 1; size++) {
+        std::vector<char> buffer(size + guard, '#');
+        JsonWriter writer(buffer.data(), size, encoding);
+        WriteMessage(writer);
+        CHECK(writer.ok() == (size > full.length()));
+        CHECK(writer.length() < size || size == 0);
+        for (size_t i = size; i < buffer.size(); i++) {
+            CHECK(buffer[i] == '#');
+        }
+        if (size > 0) {
+            CHECK(buffer[writer.length()] == '\0');
+        }
+        if (writer.ok()) {
+            CHECK(memcmp(buffer.data(), full.c_str(), full.length()) == 0);
+        }
+    }
+
+    // Nesting deeper than the writer allows overflows instead of corrupting the member bits
+    char buffer[256];
+    JsonWriter deep(buffer, sizeof(buffer), encoding);
+    for (int i = 0; i < 40; i++) {
+        deep.BeginObject(i == 0 ? nullptr : "stats");
+    }
+    CHECK(!deep.ok());
+}
+
+int main() {
+    TestCborMatchesJson();
+    TestEmbeddedJsonIsByteString();
+    TestTruncatedCbor();
+    TestOversizedCbor();
+    TestWriterOverflow(kMessageEncodingJson);
+    TestWriterOverflow(kMessageEncodingCbor);
+    if (failures > 0) {
+        fprintf(stderr, "%d checks failed\n", failures);
+        return 1;
+    }
+    printf("All checks passed\n");
+    return 0;
+}
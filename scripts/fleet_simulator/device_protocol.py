@@ -0,0 +1,93 @@
+import ctypes
+import ctypes.util
+import struct
+
+'''
+  Wire format of the device audio for the reference server, see docs/websocket.md and docs/mqtt-udp.md.
+
+  Binary protocol version 2 (big-endian):
+  |version 2u|type 2u|reserved 4u|timestamp 4u|payload_size 4u|payload payload_size|
+  Binary protocol version 3:
+  |type 1u|reserved 1u|payload_size 2u|payload payload_size|
+  Version 1 sends the bare Opus packet.
+
+  UDP packets of the MQTT transport, the header is the AES-128-CTR counter of the payload:
+  |type 1u|flags 1u|payload_len 2u|ssrc 4u|timestamp 4u|sequence 4u|payload payload_len|
+'''
+
+BP2_FORMAT = '!HHIII'
+BP2_SIZE = struct.calcsize(BP2_FORMAT)
+BP3_FORMAT = '!BBH'
+BP3_SIZE = struct.calcsize(BP3_FORMAT)
+
+
+def pack_audio(version, payload, timestamp=0):
+    if version == 2:
+        return struct.pack(BP2_FORMAT, version, 0, 0, timestamp, len(payload)) + payload
+    if version == 3:
+        return struct.pack(BP3_FORMAT, 0, 0, len(payload)) + payload
+    return payload
+
+UDP_FORMAT = '!BBHIII'
+UDP_HEADER_SIZE = struct.calcsize(UDP_FORMAT)
+_libcrypto = None
+
+
+def aes_ctr(key, counter, data):
+    '''
+      AES-128-CTR through the OpenSSL libcrypto, loaded on first use so the websocket server runs without it.
+    '''
+    global _libcrypto
+    if _libcrypto is None:
+        path = ctypes.util.find_library('crypto')
+        if path is None:
+            raise RuntimeError('libcrypto not found, the UDP audio channel needs OpenSSL')
+        _libcrypto = ctypes.CDLL(path)
+        _libcrypto.EVP_CIPHER_CTX_new.restype = ctypes.c_void_p
+        _libcrypto.EVP_CIPHER_CTX_free.argtypes = [ctypes.c_void_p]
+        _libcrypto.EVP_aes_128_ctr.restype = ctypes.c_void_p
+        _libcrypto.EVP_EncryptInit_ex.argtypes = [ctypes.c_void_p, ctypes.c_void_p, ctypes.c_void_p,
+                                                  ctypes.c_char_p, ctypes.c_char_p]
+        _libcrypto.EVP_EncryptUpdate.argtypes = [ctypes.c_void_p, ctypes.c_char_p, ctypes.POINTER(ctypes.c_int),
+                                                 ctypes.c_char_p, ctypes.c_int]
+    context = _libcrypto.EVP_CIPHER_CTX_new()
+    try:
+        _libcrypto.EVP_EncryptInit_ex(context, _libcrypto.EVP_aes_128_ctr(), None, key, counter)
+        output = ctypes.create_string_buffer(len(data))
+        output_size = ctypes.c_int(0)
+        _libcrypto.EVP_EncryptUpdate(context, output, ctypes.byref(output_size), data, len(data))
+        return output.raw[:output_size.value]
+    finally:
+        _libcrypto.EVP_CIPHER_CTX_free(context)
+
+
+def pack_udp_audio(key, ssrc, payload, timestamp, sequence):
+    header = struct.pack(UDP_FORMAT, 1, 0, len(payload), ssrc, timestamp, sequence)
+    return header + aes_ctr(key, header, payload)
+
+
+def read_ogg_opus_packets(path):
+    '''
+      Extract the Opus packets of an Ogg Opus file, without the OpusHead and OpusTags headers.
+    '''
+    with open(path, 'rb') as f:
+        data = f.read()
+
+    packets = []
+    partial = b''
+    offset = 0
+    while offset + 27 <= len(data):
+        if data[offset:offset + 4] != b'OggS':
+            raise ValueError(f'{path}: bad Ogg page at offset {offset}')
+        segment_count = data[offset + 26]
+        lacing = data[offset + 27:offset + 27 + segment_count]
+        offset += 27 + segment_count
+        for size in lacing:
+            partial += data[offset:offset + size]
+            offset += size
+            # A lacing value below 255 ends the packet
+            if size < 255:
+                packets.append(partial)
+                partial = b''
+
+    return [p for p in packets if not p.startswith(b'OpusHead') and not p.startswith(b'OpusTags')]
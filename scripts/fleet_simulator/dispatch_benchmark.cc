@@ -0,0 +1,244 @@
+#include "json_writer.h"
+#include "cbor_codec.h"
+
+#include <cJSON.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+/*
+ * Host benchmark of the incoming control message path over a file of server
+ * messages, one JSON message per line (testdata/server_messages.jsonl by default):
+ *
+ * - parsing each message as the protocols do, from JSON text and from CBOR
+ * - looking up the type the way Application::HandleIncomingJson does, against a
+ *   hash table and a switch on the first character
+ * - handing an MCP payload to McpServer, serialized and parsed again as before
+ *   or passed as the sub-tree
+ *
+ *   ./dispatch_benchmark [messages.jsonl] [iterations]
+ */
+
+static const char* kDefaultMessages = DISPATCH_BENCHMARK_DEFAULT_MESSAGES;
+
+// The types in the order of the HandleIncomingJson chain
+static const char* const kTypes[] = {"tts", "stt", "llm", "mcp", "system", "alert", "custom"};
+static const int kTypeCount = sizeof(kTypes) / sizeof(kTypes[0]);
+
+static volatile uintptr_t sink;
+
+struct Message {
+    std::string type;
+    std::string json;
+    std::vector<uint8_t> cbor;
+};
+
+static int LookupChain(const char* type) {
+    if (strcmp(type, "tts") == 0) {
+        return 0;
+    } else if (strcmp(type, "stt") == 0) {
+        return 1;
+    } else if (strcmp(type, "llm") == 0) {
+        return 2;
+    } else if (strcmp(type, "mcp") == 0) {
+        return 3;
+    } else if (strcmp(type, "system") == 0) {
+        return 4;
+    } else if (strcmp(type, "alert") == 0) {
+        return 5;
+    } else if (strcmp(type, "custom") == 0) {
+        return 6;
+    }
+    return -1;
+}
+
+static int LookupHash(const char* type) {
+    static const std::unordered_map<std::string_view, int> table = [] {
+        std::unordered_map<std::string_view, int> table;
+        for (int i = 0; i < kTypeCount; i++) {
+            table[kTypes[i]] = i;
+        }
+        return table;
+    }();
+    auto it = table.find(type);
+    return it == table.end() ? -1 : it->second;
+}
+
+static int LookupFirstChar(const char* type) {
+    switch (type[0]) {
+        case 't': return strcmp(type, "tts") == 0 ? 0 : -1;
+        case 's': return strcmp(type, "stt") == 0 ? 1 : strcmp(type, "system") == 0 ? 4 : -1;
+        case 'l': return strcmp(type, "llm") == 0 ? 2 : -1;
+        case 'm': return strcmp(type, "mcp") == 0 ? 3 : -1;
+        case 'a': return strcmp(type, "alert") == 0 ? 5 : -1;
+        case 'c': return strcmp(type, "custom") == 0 ? 6 : -1;
+        default: return -1;
+    }
+}
+
+// The CBOR form of a message as the server would send it, payloads embedded as JSON like JsonWriter::AddRaw
+static void WriteCbor(JsonWriter& writer, const cJSON* object) {
+    for (auto item = object->child; item != nullptr; item = item->next) {
+        if (cJSON_IsString(item)) {
+            writer.AddString(item->string, item->valuestring);
+        } else if (cJSON_IsBool(item)) {
+            writer.AddBool(item->string, cJSON_IsTrue(item));
+        } else if (cJSON_IsNumber(item)) {
+            writer.AddNumber(item->string, item->valueint);
+        } else if (cJSON_IsObject(item) && strcmp(item->string, "payload") != 0) {
+            writer.BeginObject(item->string);
+            WriteCbor(writer, item);
+            writer.EndObject();
+        } else {
+            auto json = cJSON_PrintUnformatted(item);
+            writer.AddRaw(item->string, json);
+            cJSON_free(json);
+        }
+    }
+}
+
+static bool LoadMessages(const char* path, std::vector<Message>& messages) {
+    std::ifstream file(path);
+    if (!file) {
+        return false;
+    }
+    std::string line;
+    while (std::getline(file, line)) {
+        if (line.empty()) {
+            continue;
+        }
+        cJSON* root = cJSON_ParseWithLength(line.data(), line.size());
+        auto type = cJSON_GetObjectItem(root, "type");
+        if (!cJSON_IsString(type)) {
+            fprintf(stderr, "Skipping a line without a type: %s\n", line.c_str());
+            cJSON_Delete(root);
+            continue;
+        }
+        char buffer[4096];
+        JsonWriter writer(buffer, sizeof(buffer), kMessageEncodingCbor);
+        writer.BeginObject();
+        WriteCbor(writer, root);
+        writer.EndObject();
+        if (!writer.ok()) {
+            fprintf(stderr, "Skipping a message too large for CBOR: %s\n", line.c_str());
+            cJSON_Delete(root);
+            continue;
+        }
+        Message message;
+        message.type = type->valuestring;
+        message.json = line;
+        message.cbor.assign((const uint8_t*)writer.c_str(), (const uint8_t*)writer.c_str() + writer.length());
+        messages.push_back(std::move(message));
+        cJSON_Delete(root);
+    }
+    return true;
+}
+
+// Nanoseconds per call of run over all messages
+template <typename Run>
+static double Measure(const std::vector<Message>& messages, int iterations, Run run) {
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; i++) {
+        for (auto& message : messages) {
+            run(message);
+        }
+    }
+    std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+    return elapsed.count() / iterations / messages.size();
+}
+
+static void ParseJson(const Message& message) {
+    cJSON* root = cJSON_ParseWithLength(message.json.data(), message.json.size());
+    sink = sink + (uintptr_t)root;
+    cJSON_Delete(root);
+}
+
+static void ParseCbor(const Message& message) {
+    cJSON* root = CborCodec::Decode(message.cbor.data(), message.cbor.size());
+    sink = sink + (uintptr_t)root;
+    cJSON_Delete(root);
+}
+
+int main(int argc, char* argv[]) {
+    const char* path = argc > 1 ? argv[1] : kDefaultMessages;
+    int iterations = argc > 2 ? atoi(argv[2]) : 2000;
+    std::vector<Message> messages;
+    if (!LoadMessages(path, messages) || messages.empty() || iterations <= 0) {
+        fprintf(stderr, "Usage: %s [messages.jsonl] [iterations], no messages in %s\n", argv[0], path);
+        return 1;
+    }
+
+    for (auto& message : messages) {
+        if (LookupChain(message.type.c_str()) != LookupHash(message.type.c_str()) ||
+            LookupChain(message.type.c_str()) != LookupFirstChar(message.type.c_str())) {
+            fprintf(stderr, "Lookups disagree on %s\n", message.type.c_str());
+            return 1;
+        }
+    }
+
+    size_t json_bytes = 0;
+    size_t cbor_bytes = 0;
+    std::map<std::string, std::vector<Message>> by_type;
+    for (auto& message : messages) {
+        json_bytes += message.json.size();
+        cbor_bytes += message.cbor.size();
+        by_type[message.type].push_back(message);
+    }
+    printf("%zu messages from %s, %d iterations, %.0f bytes JSON / %.0f bytes CBOR on average\n\n", messages.size(),
+        path, iterations, (double)json_bytes / messages.size(), (double)cbor_bytes / messages.size());
+
+    printf("%-8s %6s %14s %14s\n", "type", "count", "JSON parse ns", "CBOR parse ns");
+    for (auto& [type, list] : by_type) {
+        printf("%-8s %6zu %14.0f %14.0f\n", type.c_str(), list.size(),
+            Measure(list, iterations, ParseJson), Measure(list, iterations, ParseCbor));
+    }
+
+    auto lookup = [&](int (*function)(const char*)) {
+        // Repeat the lookups, one pass over the messages is too short for the clock
+        return Measure(messages, iterations, [function](const Message& message) {
+            for (int i = 0; i < 16; i++) {
+                sink = sink + function(message.type.c_str());
+            }
+        }) / 16;
+    };
+    printf("\nPer message, averaged over the traffic:\n");
+    printf("  parse JSON text              %8.1f ns\n", Measure(messages, iterations, ParseJson));
+    printf("  parse CBOR                   %8.1f ns\n", Measure(messages, iterations, ParseCbor));
+    printf("  type lookup, strcmp chain    %8.1f ns\n", lookup(LookupChain));
+    printf("  type lookup, hash table      %8.1f ns\n", lookup(LookupHash));
+    printf("  type lookup, first character %8.1f ns\n", lookup(LookupFirstChar));
+
+    // McpServer used to get the payload as text: serialize the sub-tree, then parse it again
+    auto& mcp = by_type["mcp"];
+    if (!mcp.empty()) {
+        std::vector<cJSON*> roots;
+        for (auto& message : mcp) {
+            roots.push_back(cJSON_ParseWithLength(message.json.data(), message.json.size()));
+        }
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < iterations; i++) {
+            for (auto root : roots) {
+                auto text = cJSON_PrintUnformatted(cJSON_GetObjectItem(root, "payload"));
+                cJSON* payload = cJSON_Parse(text);
+                sink = sink + (uintptr_t)payload;
+                cJSON_Delete(payload);
+                cJSON_free(text);
+            }
+        }
+        std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+        printf("  mcp payload print + reparse  %8.1f ns per mcp message, passing the sub-tree costs nothing\n",
+            elapsed.count() / iterations / roots.size());
+        for (auto root : roots) {
+            cJSON_Delete(root);
+        }
+    }
+    return 0;
+}
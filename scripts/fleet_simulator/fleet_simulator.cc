@@ -0,0 +1,202 @@
+#include "simulated_device.h"
+#include "ogg_reader.h"
+
+#include <esp_log.h>
+#include <esp_timer.h>
+
+#include <getopt.h>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <memory>
+
+/*
+ * Fleet simulator: runs the firmware protocol classes (main/protocols) for
+ * many devices in one process against a server, see README.md.
+ */
+
+static const char* kDefaultAudio = FLEET_SIMULATOR_DEFAULT_AUDIO;
+
+static int Percentile(std::vector<int> values, int p) {
+    if (values.empty()) {
+        return 0;
+    }
+    std::sort(values.begin(), values.end());
+    return values[std::min(values.size() - 1, values.size() * p / 100)];
+}
+
+static void PrintPercentiles(const char* name, const std::vector<int>& values) {
+    printf("%-16s p50 %6d  p90 %6d  p99 %6d  (%zu samples)\n", name, Percentile(values, 50), Percentile(values, 90),
+        Percentile(values, 99), values.size());
+}
+
+static std::vector<int> Merge(const std::vector<std::unique_ptr<SimulatedDevice>>& devices,
+    std::vector<int> DeviceStats::*member) {
+    std::vector<int> merged;
+    for (auto& device : devices) {
+        auto& values = device->stats().*member;
+        merged.insert(merged.end(), values.begin(), values.end());
+    }
+    return merged;
+}
+
+static void Report(const std::vector<std::unique_ptr<SimulatedDevice>>& devices, double elapsed, const std::string& csv_path) {
+    int sessions = 0;
+    int failures = 0;
+    int lost = 0;
+    uint64_t bytes_sent = 0;
+    uint64_t bytes_received = 0;
+    for (auto& device : devices) {
+        auto& stats = device->stats();
+        sessions += stats.sessions;
+        failures += stats.failures;
+        lost += stats.lost;
+        bytes_sent += stats.bytes_sent;
+        bytes_received += stats.bytes_received;
+    }
+
+    if (devices.size() <= 20) {
+        printf("device  sessions  failures  connect p50/p99 ms  open p50/p99 ms  response p50/p99 ms\n");
+        for (auto& device : devices) {
+            auto& stats = device->stats();
+            printf("%6d  %8d  %8d  %8d/%-8d  %7d/%-7d  %8d/%-8d\n", device->index(), stats.sessions, stats.failures,
+                Percentile(stats.connect_ms, 50), Percentile(stats.connect_ms, 99),
+                Percentile(stats.open_ms, 50), Percentile(stats.open_ms, 99),
+                Percentile(stats.response_ms, 50), Percentile(stats.response_ms, 99));
+        }
+    }
+
+    printf("\n%zu devices, %d sessions, %d failures in %.1f s\n", devices.size(), sessions, failures, elapsed);
+    PrintPercentiles("connect ms", Merge(devices, &DeviceStats::connect_ms));
+    PrintPercentiles("open channel ms", Merge(devices, &DeviceStats::open_ms));
+    PrintPercentiles("first audio ms", Merge(devices, &DeviceStats::first_audio_ms));
+    PrintPercentiles("response ms", Merge(devices, &DeviceStats::response_ms));
+    PrintPercentiles("rtt ms", Merge(devices, &DeviceStats::rtt_ms));
+    printf("throughput       uplink %.1f kbps, downlink %.1f kbps, %.2f sessions/s, %d UDP packets lost\n",
+        bytes_sent * 8 / elapsed / 1000, bytes_received * 8 / elapsed / 1000, sessions / elapsed, lost);
+
+    if (csv_path.empty()) {
+        return;
+    }
+    std::ofstream csv(csv_path);
+    csv << "device,sessions,failures,connect_p50_ms,connect_p99_ms,open_p50_ms,open_p99_ms,"
+        "response_p50_ms,response_p90_ms,response_p99_ms,rtt_p50_ms,lost,bytes_sent,bytes_received\n";
+    for (auto& device : devices) {
+        auto& stats = device->stats();
+        csv << device->device_id() << ',' << stats.sessions << ',' << stats.failures << ','
+            << Percentile(stats.connect_ms, 50) << ',' << Percentile(stats.connect_ms, 99) << ','
+            << Percentile(stats.open_ms, 50) << ',' << Percentile(stats.open_ms, 99) << ','
+            << Percentile(stats.response_ms, 50) << ',' << Percentile(stats.response_ms, 90) << ','
+            << Percentile(stats.response_ms, 99) << ',' << Percentile(stats.rtt_ms, 50) << ','
+            << stats.lost << ',' << stats.bytes_sent << ',' << stats.bytes_received << '\n';
+    }
+    printf("Per device results saved to %s\n", csv_path.c_str());
+}
+
+static void PrintUsage(const char* program) {
+    printf("Usage: %s [options]\n"
+        "  --transport websocket|mqtt  Protocol of the devices (websocket)\n"
+        "  --url URL                   Websocket server, ws:// only (ws://127.0.0.1:8000/)\n"
+        "  --protocol-version 1|2|3    Websocket binary protocol version (1)\n"
+        "  --mqtt-endpoint HOST:PORT   MQTT broker, plain TCP (127.0.0.1:1883)\n"
+        "  --token TOKEN               Websocket access token or MQTT password\n"
+        "  -n, --devices N             Number of devices (10)\n"
+        "  -s, --sessions N            Sessions per device (3)\n"
+        "  --audio FILE                Ogg Opus file streamed as the uplink\n"
+        "  --frame-duration MS         Duration of one uplink packet (%d)\n"
+        "  --wake-word TEXT            Sent with \"listen detect\"\n"
+        "  --ramp-seconds S            Spread the first sessions over this time (5)\n"
+        "  --think-time S              Average pause between sessions (2)\n"
+        "  --session-timeout S         Give up a session after this time (60)\n"
+        "  --csv FILE                  Save the per device results\n"
+        "  -v, --verbose               Log the protocol messages of every device\n",
+        program, OPUS_FRAME_DURATION_MS);
+}
+
+int main(int argc, char* argv[]) {
+    SimulatorOptions options;
+    std::string audio_path = kDefaultAudio;
+    std::string csv_path;
+    bool verbose = false;
+
+    enum {
+        kOptionTransport = 256, kOptionUrl, kOptionProtocolVersion, kOptionMqttEndpoint, kOptionToken, kOptionAudio,
+        kOptionFrameDuration, kOptionWakeWord, kOptionRampSeconds, kOptionThinkTime, kOptionSessionTimeout, kOptionCsv,
+    };
+    static const option long_options[] = {
+        {"transport", required_argument, nullptr, kOptionTransport},
+        {"url", required_argument, nullptr, kOptionUrl},
+        {"protocol-version", required_argument, nullptr, kOptionProtocolVersion},
+        {"mqtt-endpoint", required_argument, nullptr, kOptionMqttEndpoint},
+        {"token", required_argument, nullptr, kOptionToken},
+        {"devices", required_argument, nullptr, 'n'},
+        {"sessions", required_argument, nullptr, 's'},
+        {"audio", required_argument, nullptr, kOptionAudio},
+        {"frame-duration", required_argument, nullptr, kOptionFrameDuration},
+        {"wake-word", required_argument, nullptr, kOptionWakeWord},
+        {"ramp-seconds", required_argument, nullptr, kOptionRampSeconds},
+        {"think-time", required_argument, nullptr, kOptionThinkTime},
+        {"session-timeout", required_argument, nullptr, kOptionSessionTimeout},
+        {"csv", required_argument, nullptr, kOptionCsv},
+        {"verbose", no_argument, nullptr, 'v'},
+        {"help", no_argument, nullptr, 'h'},
+        {nullptr, 0, nullptr, 0},
+    };
+    int option;
+    while ((option = getopt_long(argc, argv, "n:s:vh", long_options, nullptr)) != -1) {
+        switch (option) {
+            case kOptionTransport: options.transport = optarg; break;
+            case kOptionUrl: options.url = optarg; break;
+            case kOptionProtocolVersion: options.protocol_version = atoi(optarg); break;
+            case kOptionMqttEndpoint: options.mqtt_endpoint = optarg; break;
+            case kOptionToken: options.token = optarg; break;
+            case 'n': options.devices = atoi(optarg); break;
+            case 's': options.sessions = atoi(optarg); break;
+            case kOptionAudio: audio_path = optarg; break;
+            case kOptionFrameDuration: options.frame_duration = atoi(optarg); break;
+            case kOptionWakeWord: options.wake_word = optarg; break;
+            case kOptionRampSeconds: options.ramp_seconds = atof(optarg); break;
+            case kOptionThinkTime: options.think_time = atof(optarg); break;
+            case kOptionSessionTimeout: options.session_timeout = atof(optarg); break;
+            case kOptionCsv: csv_path = optarg; break;
+            case 'v': verbose = true; break;
+            case 'h': PrintUsage(argv[0]); return 0;
+            default: PrintUsage(argv[0]); return 1;
+        }
+    }
+    if (options.transport != "websocket" && options.transport != "mqtt") {
+        fprintf(stderr, "Unknown transport %s\n", options.transport.c_str());
+        return 1;
+    }
+    if (options.protocol_version < 1 || options.protocol_version > 3 || options.devices < 1 || options.frame_duration <= 0) {
+        PrintUsage(argv[0]);
+        return 1;
+    }
+    esp_log_level_set("*", verbose ? ESP_LOG_INFO : ESP_LOG_WARN);
+    // The report is often piped, keep the log lines in order with it
+    setvbuf(stdout, nullptr, _IOLBF, 0);
+
+    std::vector<std::vector<uint8_t>> uplink_packets;
+    if (!ReadOggOpusPackets(audio_path, uplink_packets) || uplink_packets.empty()) {
+        fprintf(stderr, "No Opus packets in %s\n", audio_path.c_str());
+        return 1;
+    }
+    printf("Simulating %d devices x %d sessions over %s against %s, %zu uplink packets per session\n",
+        options.devices, options.sessions, options.transport.c_str(),
+        options.transport == "mqtt" ? options.mqtt_endpoint.c_str() : options.url.c_str(), uplink_packets.size());
+
+    std::vector<std::unique_ptr<SimulatedDevice>> devices;
+    for (int i = 0; i < options.devices; i++) {
+        devices.push_back(std::make_unique<SimulatedDevice>(i, options, uplink_packets));
+    }
+    auto start_time = esp_timer_get_time();
+    for (auto& device : devices) {
+        device->Start();
+    }
+    for (auto& device : devices) {
+        device->Join();
+    }
+    Report(devices, (esp_timer_get_time() - start_time) / 1e6, csv_path);
+    return 0;
+}
@@ -0,0 +1,239 @@
+#include "host_device.h"
+
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/event_groups.h>
+#include <freertos/task.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <thread>
+
+#define TAG "HostRuntime"
+
+static const auto start_time = std::chrono::steady_clock::now();
+
+int64_t esp_timer_get_time() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start_time).count();
+}
+
+struct EventGroup {
+    std::mutex mutex;
+    std::condition_variable condition;
+    EventBits_t bits = 0;
+};
+
+EventGroupHandle_t xEventGroupCreate() {
+    return new EventGroup();
+}
+
+void vEventGroupDelete(EventGroupHandle_t event_group) {
+    delete event_group;
+}
+
+EventBits_t xEventGroupSetBits(EventGroupHandle_t event_group, EventBits_t bits) {
+    std::lock_guard<std::mutex> lock(event_group->mutex);
+    event_group->bits |= bits;
+    event_group->condition.notify_all();
+    return event_group->bits;
+}
+
+EventBits_t xEventGroupClearBits(EventGroupHandle_t event_group, EventBits_t bits) {
+    std::lock_guard<std::mutex> lock(event_group->mutex);
+    EventBits_t previous = event_group->bits;
+    event_group->bits &= ~bits;
+    return previous;
+}
+
+EventBits_t xEventGroupGetBits(EventGroupHandle_t event_group) {
+    std::lock_guard<std::mutex> lock(event_group->mutex);
+    return event_group->bits;
+}
+
+EventBits_t xEventGroupWaitBits(EventGroupHandle_t event_group, EventBits_t bits_to_wait_for, BaseType_t clear_on_exit,
+    BaseType_t wait_for_all_bits, TickType_t ticks_to_wait) {
+    std::unique_lock<std::mutex> lock(event_group->mutex);
+    auto satisfied = [&]() {
+        EventBits_t set = event_group->bits & bits_to_wait_for;
+        return wait_for_all_bits ? set == bits_to_wait_for : set != 0;
+    };
+    bool done;
+    if (ticks_to_wait == portMAX_DELAY) {
+        event_group->condition.wait(lock, satisfied);
+        done = true;
+    } else {
+        done = event_group->condition.wait_for(lock, std::chrono::milliseconds(ticks_to_wait * portTICK_PERIOD_MS), satisfied);
+    }
+    EventBits_t bits = event_group->bits;
+    if (done && clear_on_exit) {
+        event_group->bits &= ~bits_to_wait_for;
+    }
+    return bits;
+}
+
+BaseType_t xTaskCreate(TaskFunction_t task_code, const char* name, uint32_t stack_depth, void* parameters,
+    UBaseType_t priority, TaskHandle_t* created_task) {
+    StartDeviceThread(name, [task_code, parameters]() {
+        task_code(parameters);
+    }).detach();
+    if (created_task != nullptr) {
+        *created_task = nullptr;
+    }
+    return pdPASS;
+}
+
+void vTaskDelete(TaskHandle_t task) {
+    if (task != nullptr) {
+        ESP_LOGE(TAG, "vTaskDelete of another task is not supported on the host");
+    }
+}
+
+void vTaskDelay(TickType_t ticks) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(ticks * portTICK_PERIOD_MS));
+}
+
+struct esp_timer {
+    esp_timer_cb_t callback;
+    void* arg;
+    const char* name;
+    HostDevice* device;
+    int64_t period_us = 0;
+    bool armed = false;
+    std::multimap<int64_t, esp_timer*>::iterator alarm;
+};
+
+/*
+ * One dispatch thread for all timers, like the esp_timer task. Callbacks run
+ * without the lock, stop and delete wait for a running callback to return
+ * unless they are called from the callback itself.
+ */
+class TimerService {
+public:
+    static TimerService& GetInstance() {
+        // Never destroyed, the dispatch thread still waits on it when the process exits
+        static TimerService* instance = new TimerService();
+        return *instance;
+    }
+
+    esp_err_t Start(esp_timer* timer, uint64_t timeout_us, uint64_t period_us) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (timer->armed) {
+            return ESP_ERR_INVALID_STATE;
+        }
+        Arm(timer, esp_timer_get_time() + timeout_us);
+        timer->period_us = period_us;
+        condition_.notify_all();
+        return ESP_OK;
+    }
+
+    esp_err_t Stop(esp_timer* timer) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        WaitIdle(lock, timer);
+        if (!timer->armed) {
+            return ESP_ERR_INVALID_STATE;
+        }
+        Disarm(timer);
+        return ESP_OK;
+    }
+
+    void Delete(esp_timer* timer) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        WaitIdle(lock, timer);
+        if (timer->armed) {
+            Disarm(timer);
+        }
+        delete timer;
+    }
+
+private:
+    std::mutex mutex_;
+    std::condition_variable condition_;
+    std::multimap<int64_t, esp_timer*> alarms_;
+    esp_timer* running_ = nullptr;
+    std::thread::id thread_id_;
+
+    TimerService() {
+        std::thread thread([this]() {
+            Run();
+        });
+        thread_id_ = thread.get_id();
+        thread.detach();
+    }
+
+    void Arm(esp_timer* timer, int64_t alarm_us) {
+        timer->alarm = alarms_.emplace(alarm_us, timer);
+        timer->armed = true;
+    }
+
+    void Disarm(esp_timer* timer) {
+        alarms_.erase(timer->alarm);
+        timer->armed = false;
+    }
+
+    void WaitIdle(std::unique_lock<std::mutex>& lock, esp_timer* timer) {
+        if (std::this_thread::get_id() != thread_id_) {
+            condition_.wait(lock, [this, timer]() {
+                return running_ != timer;
+            });
+        }
+    }
+
+    void Run() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (true) {
+            if (alarms_.empty()) {
+                condition_.wait(lock);
+                continue;
+            }
+            auto next = alarms_.begin();
+            int64_t delay_us = next->first - esp_timer_get_time();
+            if (delay_us > 0) {
+                condition_.wait_for(lock, std::chrono::microseconds(delay_us));
+                continue;
+            }
+
+            auto timer = next->second;
+            Disarm(timer);
+            if (timer->period_us > 0) {
+                Arm(timer, next->first + timer->period_us);
+            }
+            running_ = timer;
+            lock.unlock();
+            HostDevice::SetCurrent(timer->device);
+            timer->callback(timer->arg);
+            lock.lock();
+            running_ = nullptr;
+            condition_.notify_all();
+        }
+    }
+};
+
+esp_err_t esp_timer_create(const esp_timer_create_args_t* create_args, esp_timer_handle_t* out_handle) {
+    *out_handle = new esp_timer{
+        .callback = create_args->callback,
+        .arg = create_args->arg,
+        .name = create_args->name,
+        .device = HostDevice::Current(),
+    };
+    return ESP_OK;
+}
+
+esp_err_t esp_timer_start_once(esp_timer_handle_t timer, uint64_t timeout_us) {
+    return TimerService::GetInstance().Start(timer, timeout_us, 0);
+}
+
+esp_err_t esp_timer_start_periodic(esp_timer_handle_t timer, uint64_t period) {
+    return TimerService::GetInstance().Start(timer, period, period);
+}
+
+esp_err_t esp_timer_stop(esp_timer_handle_t timer) {
+    return TimerService::GetInstance().Stop(timer);
+}
+
+esp_err_t esp_timer_delete(esp_timer_handle_t timer) {
+    TimerService::GetInstance().Delete(timer);
+    return ESP_OK;
+}
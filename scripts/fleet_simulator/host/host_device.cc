@@ -0,0 +1,210 @@
+#include "host_device.h"
+
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <settings.h>
+#include <system_info.h>
+
+#include <pthread.h>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+
+static thread_local HostDevice* current_device = nullptr;
+static std::atomic<int> log_level = ESP_LOG_WARN;
+
+HostDevice::HostDevice(int index) : index_(index) {
+    // Locally administered, unicast
+    char mac[18];
+    snprintf(mac, sizeof(mac), "02:00:%02x:%02x:%02x:%02x", (index >> 24) & 0xFF, (index >> 16) & 0xFF,
+        (index >> 8) & 0xFF, index & 0xFF);
+    mac_address_ = mac;
+
+    std::random_device random;
+    std::uniform_int_distribution<int> digit(0, 15);
+    std::string uuid = "xxxxxxxx-xxxx-4xxx-8xxx-xxxxxxxxxxxx";
+    for (auto& c : uuid) {
+        if (c == 'x') {
+            c = "0123456789abcdef"[digit(random)];
+        }
+    }
+    board_.uuid_ = uuid;
+}
+
+std::string HostDevice::GetSetting(const std::string& ns, const std::string& key, const std::string& default_value) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto space = settings_.find(ns);
+    if (space == settings_.end()) {
+        return default_value;
+    }
+    auto item = space->second.find(key);
+    return item == space->second.end() ? default_value : item->second;
+}
+
+void HostDevice::SetSetting(const std::string& ns, const std::string& key, const std::string& value) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    settings_[ns][key] = value;
+}
+
+void HostDevice::EraseSetting(const std::string& ns, const std::string& key) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    settings_[ns].erase(key);
+}
+
+void HostDevice::EraseSettings(const std::string& ns) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    settings_.erase(ns);
+}
+
+void HostDevice::OnConnect(int64_t duration_us) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    connect_times_ms_.push_back((int)(duration_us / 1000));
+}
+
+void HostDevice::OnTraffic(size_t sent, size_t received) {
+    bytes_sent_ += sent;
+    bytes_received_ += received;
+}
+
+std::vector<int> HostDevice::TakeConnectTimes() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return std::move(connect_times_ms_);
+}
+
+void HostDevice::SetCurrent(HostDevice* device) {
+    current_device = device;
+}
+
+HostDevice* HostDevice::Current() {
+    return current_device;
+}
+
+std::thread StartDeviceThread(const char* name, std::function<void()> function) {
+    auto device = current_device;
+    std::thread thread([device, function = std::move(function)]() {
+        current_device = device;
+        function();
+    });
+    // Shows up in top and gdb, Linux limits the name to 15 characters
+    char thread_name[16];
+    snprintf(thread_name, sizeof(thread_name), "%s", name);
+    pthread_setname_np(thread.native_handle(), thread_name);
+    return thread;
+}
+
+static HostDevice& CurrentDevice() {
+    if (current_device == nullptr) {
+        fprintf(stderr, "GetInstance called outside of a simulated device\n");
+        abort();
+    }
+    return *current_device;
+}
+
+Application& Application::GetInstance() {
+    return CurrentDevice().application();
+}
+
+void Application::Schedule(std::function<void()> callback) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        main_tasks_.push_back(std::move(callback));
+    }
+    condition_.notify_one();
+}
+
+void Application::RunPending(int64_t deadline_us) {
+    std::deque<std::function<void()>> tasks;
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (main_tasks_.empty()) {
+            int64_t timeout_us = deadline_us - esp_timer_get_time();
+            if (timeout_us <= 0) {
+                return;
+            }
+            condition_.wait_for(lock, std::chrono::microseconds(timeout_us));
+        }
+        tasks.swap(main_tasks_);
+    }
+    for (auto& task : tasks) {
+        task();
+    }
+}
+
+Board& Board::GetInstance() {
+    return CurrentDevice().board();
+}
+
+Settings::Settings(const std::string& ns, bool read_write) : ns_(ns), read_write_(read_write) {
+}
+
+Settings::~Settings() {
+}
+
+std::string Settings::GetString(const std::string& key, const std::string& default_value) {
+    return CurrentDevice().GetSetting(ns_, key, default_value);
+}
+
+void Settings::SetString(const std::string& key, const std::string& value) {
+    if (!read_write_) {
+        ESP_LOGW("Settings", "Namespace %s is not open for writing", ns_.c_str());
+        return;
+    }
+    CurrentDevice().SetSetting(ns_, key, value);
+}
+
+int32_t Settings::GetInt(const std::string& key, int32_t default_value) {
+    auto value = GetString(key);
+    return value.empty() ? default_value : (int32_t)strtol(value.c_str(), nullptr, 10);
+}
+
+void Settings::SetInt(const std::string& key, int32_t value) {
+    SetString(key, std::to_string(value));
+}
+
+bool Settings::GetBool(const std::string& key, bool default_value) {
+    return GetInt(key, default_value ? 1 : 0) != 0;
+}
+
+void Settings::SetBool(const std::string& key, bool value) {
+    SetInt(key, value ? 1 : 0);
+}
+
+void Settings::EraseKey(const std::string& key) {
+    if (read_write_) {
+        CurrentDevice().EraseSetting(ns_, key);
+    }
+}
+
+void Settings::EraseAll() {
+    if (read_write_) {
+        CurrentDevice().EraseSettings(ns_);
+    }
+}
+
+std::string SystemInfo::GetMacAddress() {
+    return CurrentDevice().mac_address();
+}
+
+void esp_log_level_set(const char* tag, esp_log_level_t level) {
+    log_level = level;
+}
+
+void host_log_write(esp_log_level_t level, const char* tag, const char* format, ...) {
+    if (level > log_level) {
+        return;
+    }
+    // One write per line, so the lines of concurrent devices do not interleave
+    char line[1024];
+    int length = snprintf(line, sizeof(line), "%c (%lld) [%d] %s: ", " EWIDV"[level],
+        (long long)(esp_timer_get_time() / 1000), current_device ? current_device->index() : -1, tag);
+    va_list args;
+    va_start(args, format);
+    length += vsnprintf(line + length, sizeof(line) - length - 1, format, args);
+    va_end(args);
+    if (length > (int)sizeof(line) - 2) {
+        length = sizeof(line) - 2;
+    }
+    line[length++] = '\n';
+    fwrite(line, 1, length, stdout);
+}
@@ -0,0 +1,69 @@
+#ifndef _HOST_DEVICE_H_
+#define _HOST_DEVICE_H_
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <application.h>
+#include <board.h>
+
+/*
+ * One simulated device: the Application and Board singletons the protocol
+ * sources reach through GetInstance, the NVS settings and the identity.
+ *
+ * The firmware has one of each per chip, the simulator has one per device, so
+ * GetInstance returns the device of the calling thread. A thread becomes a
+ * device with SetCurrent, and every thread the host runtime starts (tasks, socket
+ * receivers, timer callbacks) runs as the device that started it.
+ */
+class HostDevice {
+public:
+    explicit HostDevice(int index);
+    HostDevice(const HostDevice&) = delete;
+    HostDevice& operator=(const HostDevice&) = delete;
+
+    int index() const { return index_; }
+    const std::string& mac_address() const { return mac_address_; }
+    Application& application() { return application_; }
+    Board& board() { return board_; }
+
+    std::string GetSetting(const std::string& ns, const std::string& key, const std::string& default_value);
+    void SetSetting(const std::string& ns, const std::string& key, const std::string& value);
+    void EraseSetting(const std::string& ns, const std::string& key);
+    void EraseSettings(const std::string& ns);
+
+    // Called by the sockets of this device, for the report
+    void OnConnect(int64_t duration_us);
+    void OnTraffic(size_t sent, size_t received);
+    std::vector<int> TakeConnectTimes();
+    uint64_t bytes_sent() const { return bytes_sent_; }
+    uint64_t bytes_received() const { return bytes_received_; }
+
+    // Make the calling thread run as the device
+    static void SetCurrent(HostDevice* device);
+    // The device of the calling thread, nullptr on threads that are not a device
+    static HostDevice* Current();
+
+private:
+    int index_;
+    std::string mac_address_;
+    Application application_;
+    Board board_;
+
+    std::mutex mutex_;
+    std::map<std::string, std::map<std::string, std::string>> settings_;
+    std::vector<int> connect_times_ms_;
+    std::atomic<uint64_t> bytes_sent_ = 0;
+    std::atomic<uint64_t> bytes_received_ = 0;
+};
+
+// Start a thread that runs as the device of the calling thread
+std::thread StartDeviceThread(const char* name, std::function<void()> function);
+
+#endif // _HOST_DEVICE_H_
@@ -0,0 +1,33 @@
+#ifndef _HOST_APPLICATION_H_
+#define _HOST_APPLICATION_H_
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+
+// From audio_service.h, the uplink frame duration announced in the hello
+#define OPUS_FRAME_DURATION_MS 60
+
+/*
+ * The main loop of one simulated device. The protocols post their callbacks
+ * with Schedule like in the firmware, the simulator runs them on the device
+ * thread between the steps of its session.
+ */
+class Application {
+public:
+    // The application of the simulated device running on the calling thread
+    static Application& GetInstance();
+
+    void Schedule(std::function<void()> callback);
+    // Wait until a callback is scheduled or the deadline passes, then run all pending ones
+    void RunPending(int64_t deadline_us);
+
+private:
+    std::mutex mutex_;
+    std::condition_variable condition_;
+    std::deque<std::function<void()>> main_tasks_;
+};
+
+#endif // _HOST_APPLICATION_H_
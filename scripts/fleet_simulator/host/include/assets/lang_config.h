@@ -0,0 +1,14 @@
+#ifndef _HOST_LANG_CONFIG_H_
+#define _HOST_LANG_CONFIG_H_
+
+// The error messages the protocols report, the simulator prints the key instead of the text
+namespace Lang {
+    namespace Strings {
+        constexpr const char* SERVER_ERROR = "SERVER_ERROR";
+        constexpr const char* SERVER_NOT_CONNECTED = "SERVER_NOT_CONNECTED";
+        constexpr const char* SERVER_NOT_FOUND = "SERVER_NOT_FOUND";
+        constexpr const char* SERVER_TIMEOUT = "SERVER_TIMEOUT";
+    }
+}
+
+#endif // _HOST_LANG_CONFIG_H_
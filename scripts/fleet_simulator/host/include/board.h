@@ -0,0 +1,27 @@
+#ifndef _HOST_BOARD_H_
+#define _HOST_BOARD_H_
+
+#include <string>
+
+#include <web_socket.h>
+#include <mqtt.h>
+#include <udp.h>
+#include <network_interface.h>
+
+// The part of the board the protocols use, one per simulated device
+class Board {
+public:
+    // The board of the simulated device running on the calling thread
+    static Board& GetInstance();
+
+    std::string GetUuid() { return uuid_; }
+    NetworkInterface* GetNetwork() { return &network_; }
+
+private:
+    friend class HostDevice;
+
+    std::string uuid_;
+    NetworkInterface network_;
+};
+
+#endif // _HOST_BOARD_H_
@@ -0,0 +1,26 @@
+#ifndef _HOST_ESP_LOG_H_
+#define _HOST_ESP_LOG_H_
+
+#include "esp_err.h"
+
+typedef enum {
+    ESP_LOG_NONE,
+    ESP_LOG_ERROR,
+    ESP_LOG_WARN,
+    ESP_LOG_INFO,
+    ESP_LOG_DEBUG,
+    ESP_LOG_VERBOSE
+} esp_log_level_t;
+
+// Applies to all tags, "*" is the only tag the host knows
+void esp_log_level_set(const char* tag, esp_log_level_t level);
+// Prints one line prefixed with the simulated device of the calling thread
+void host_log_write(esp_log_level_t level, const char* tag, const char* format, ...);
+
+#define ESP_LOGE(tag, format, ...) host_log_write(ESP_LOG_ERROR, tag, format, ##__VA_ARGS__)
+#define ESP_LOGW(tag, format, ...) host_log_write(ESP_LOG_WARN, tag, format, ##__VA_ARGS__)
+#define ESP_LOGI(tag, format, ...) host_log_write(ESP_LOG_INFO, tag, format, ##__VA_ARGS__)
+#define ESP_LOGD(tag, format, ...) host_log_write(ESP_LOG_DEBUG, tag, format, ##__VA_ARGS__)
+#define ESP_LOGV(tag, format, ...) host_log_write(ESP_LOG_VERBOSE, tag, format, ##__VA_ARGS__)
+
+#endif // _HOST_ESP_LOG_H_
@@ -0,0 +1,34 @@
+#ifndef _HOST_ESP_TIMER_H_
+#define _HOST_ESP_TIMER_H_
+
+#include <cstdint>
+#include "esp_err.h"
+
+typedef struct esp_timer* esp_timer_handle_t;
+typedef void (*esp_timer_cb_t)(void* arg);
+
+typedef enum {
+    ESP_TIMER_TASK,
+} esp_timer_dispatch_t;
+
+typedef struct {
+    esp_timer_cb_t callback;
+    void* arg;
+    esp_timer_dispatch_t dispatch_method;
+    const char* name;
+    bool skip_unhandled_events;
+} esp_timer_create_args_t;
+
+/*
+ * All timers of the process share one dispatch thread like the esp_timer task.
+ * A callback runs with the simulated device that created its timer.
+ */
+esp_err_t esp_timer_create(const esp_timer_create_args_t* create_args, esp_timer_handle_t* out_handle);
+esp_err_t esp_timer_start_once(esp_timer_handle_t timer, uint64_t timeout_us);
+esp_err_t esp_timer_start_periodic(esp_timer_handle_t timer, uint64_t period);
+esp_err_t esp_timer_stop(esp_timer_handle_t timer);
+esp_err_t esp_timer_delete(esp_timer_handle_t timer);
+// Microseconds since the process started
+int64_t esp_timer_get_time();
+
+#endif // _HOST_ESP_TIMER_H_
@@ -0,0 +1,20 @@
+#ifndef _HOST_FREERTOS_H_
+#define _HOST_FREERTOS_H_
+
+#include <cstdint>
+#include "sdkconfig.h"
+
+typedef uint32_t TickType_t;
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+
+#define pdFALSE 0
+#define pdTRUE 1
+#define pdFAIL 0
+#define pdPASS 1
+#define portMAX_DELAY ((TickType_t)0xffffffffUL)
+// The host tick is one millisecond
+#define portTICK_PERIOD_MS 1
+#define pdMS_TO_TICKS(ms) ((TickType_t)(ms))
+
+#endif // _HOST_FREERTOS_H_
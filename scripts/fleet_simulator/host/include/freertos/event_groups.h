@@ -0,0 +1,18 @@
+#ifndef _HOST_EVENT_GROUPS_H_
+#define _HOST_EVENT_GROUPS_H_
+
+#include "FreeRTOS.h"
+
+typedef uint32_t EventBits_t;
+typedef struct EventGroup* EventGroupHandle_t;
+
+EventGroupHandle_t xEventGroupCreate();
+void vEventGroupDelete(EventGroupHandle_t event_group);
+EventBits_t xEventGroupSetBits(EventGroupHandle_t event_group, EventBits_t bits);
+// Returns the bits before they were cleared
+EventBits_t xEventGroupClearBits(EventGroupHandle_t event_group, EventBits_t bits);
+EventBits_t xEventGroupGetBits(EventGroupHandle_t event_group);
+EventBits_t xEventGroupWaitBits(EventGroupHandle_t event_group, EventBits_t bits_to_wait_for, BaseType_t clear_on_exit,
+    BaseType_t wait_for_all_bits, TickType_t ticks_to_wait);
+
+#endif // _HOST_EVENT_GROUPS_H_
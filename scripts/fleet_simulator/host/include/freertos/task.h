@@ -0,0 +1,19 @@
+#ifndef _HOST_TASK_H_
+#define _HOST_TASK_H_
+
+#include "FreeRTOS.h"
+
+typedef struct Task* TaskHandle_t;
+typedef void (*TaskFunction_t)(void* arg);
+
+/*
+ * Tasks are detached threads that run with the simulated device of their creator.
+ * Stack depth and priority are ignored, there is no handle to wait on.
+ */
+BaseType_t xTaskCreate(TaskFunction_t task_code, const char* name, uint32_t stack_depth, void* parameters,
+    UBaseType_t priority, TaskHandle_t* created_task);
+// Only vTaskDelete(NULL) at the end of a task is supported, the thread ends when the task returns
+void vTaskDelete(TaskHandle_t task);
+void vTaskDelay(TickType_t ticks);
+
+#endif // _HOST_TASK_H_
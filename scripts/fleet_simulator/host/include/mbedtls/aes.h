@@ -0,0 +1,17 @@
+#ifndef _HOST_MBEDTLS_AES_H_
+#define _HOST_MBEDTLS_AES_H_
+
+#include <cstddef>
+
+// AES-CTR of the UDP audio channel on top of OpenSSL, same semantics as mbedtls
+typedef struct {
+    void* cipher;
+} mbedtls_aes_context;
+
+void mbedtls_aes_init(mbedtls_aes_context* ctx);
+void mbedtls_aes_free(mbedtls_aes_context* ctx);
+int mbedtls_aes_setkey_enc(mbedtls_aes_context* ctx, const unsigned char* key, unsigned int keybits);
+int mbedtls_aes_crypt_ctr(mbedtls_aes_context* ctx, size_t length, size_t* nc_off, unsigned char nonce_counter[16],
+    unsigned char stream_block[16], const unsigned char* input, unsigned char* output);
+
+#endif // _HOST_MBEDTLS_AES_H_
@@ -0,0 +1,49 @@
+#ifndef _HOST_MQTT_H_
+#define _HOST_MQTT_H_
+
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+
+/*
+ * MQTT 3.1.1 client over a plain TCP socket with the API of the network
+ * component. QoS 0 only; the broker delivers the device's messages without a
+ * subscription, like the production broker does.
+ */
+class Mqtt {
+public:
+    Mqtt(int connect_id);
+    ~Mqtt();
+
+    void SetKeepAlive(int keep_alive_seconds);
+    bool Connect(const std::string broker_address, int broker_port, const std::string client_id,
+        const std::string username, const std::string password);
+    void Disconnect();
+    bool Publish(const std::string topic, const std::string payload, int qos = 0);
+    bool Subscribe(const std::string topic, int qos = 0);
+    bool IsConnected();
+
+    void OnConnected(std::function<void()> callback);
+    void OnDisconnected(std::function<void()> callback);
+    void OnMessage(std::function<void(const std::string& topic, const std::string& payload)> callback);
+
+private:
+    int fd_ = -1;
+    int keep_alive_seconds_ = 120;
+    uint16_t packet_id_ = 0;
+    std::atomic<bool> connected_ = false;
+    std::atomic<bool> closing_ = false;
+    std::mutex send_mutex_;
+    std::thread receive_thread_;
+
+    std::function<void()> on_connected_;
+    std::function<void()> on_disconnected_;
+    std::function<void(const std::string& topic, const std::string& payload)> on_message_;
+
+    bool SendPacket(uint8_t header, const std::string& body);
+    void ReceiveLoop();
+};
+
+#endif // _HOST_MQTT_H_
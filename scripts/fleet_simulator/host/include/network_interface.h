@@ -0,0 +1,18 @@
+#ifndef _HOST_NETWORK_INTERFACE_H_
+#define _HOST_NETWORK_INTERFACE_H_
+
+#include <memory>
+
+#include "web_socket.h"
+#include "mqtt.h"
+#include "udp.h"
+
+// The transports of the host network, every simulated device shares the host's sockets
+class NetworkInterface {
+public:
+    std::unique_ptr<WebSocket> CreateWebSocket(int connect_id);
+    std::unique_ptr<Mqtt> CreateMqtt(int connect_id);
+    std::unique_ptr<Udp> CreateUdp(int connect_id);
+};
+
+#endif // _HOST_NETWORK_INTERFACE_H_
@@ -0,0 +1,7 @@
+#ifndef _HOST_SDKCONFIG_H_
+#define _HOST_SDKCONFIG_H_
+
+// The options of the firmware build that the protocol sources look at
+#define CONFIG_WEBSOCKET_EARLY_DATA 1
+
+#endif // _HOST_SDKCONFIG_H_
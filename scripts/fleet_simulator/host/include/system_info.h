@@ -0,0 +1,12 @@
+#ifndef _HOST_SYSTEM_INFO_H_
+#define _HOST_SYSTEM_INFO_H_
+
+#include <string>
+
+class SystemInfo {
+public:
+    // Locally administered address derived from the index of the simulated device
+    static std::string GetMacAddress();
+};
+
+#endif // _HOST_SYSTEM_INFO_H_
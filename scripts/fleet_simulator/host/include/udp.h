@@ -0,0 +1,30 @@
+#ifndef _HOST_UDP_H_
+#define _HOST_UDP_H_
+
+#include <atomic>
+#include <functional>
+#include <string>
+#include <thread>
+
+// Connected UDP socket with the API of the network component
+class Udp {
+public:
+    Udp(int connect_id);
+    ~Udp();
+
+    bool Connect(const std::string& host, int port);
+    void Disconnect();
+    int Send(const std::string& data);
+
+    void OnMessage(std::function<void(const std::string& data)> callback);
+
+private:
+    int fd_ = -1;
+    std::atomic<bool> closing_ = false;
+    std::thread receive_thread_;
+    std::function<void(const std::string& data)> on_message_;
+
+    void ReceiveLoop();
+};
+
+#endif // _HOST_UDP_H_
@@ -0,0 +1,51 @@
+#ifndef _HOST_WEB_SOCKET_H_
+#define _HOST_WEB_SOCKET_H_
+
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+
+/*
+ * RFC 6455 client over a plain TCP socket (ws:// only), with the API of the
+ * network component. Frames are received on a thread of its own and handed to
+ * OnData in a writable buffer, like the firmware's receive task.
+ */
+class WebSocket {
+public:
+    WebSocket(int connect_id);
+    ~WebSocket();
+
+    void SetHeader(const char* key, const char* value);
+    bool IsConnected() const;
+    bool Connect(const char* uri);
+    bool Send(const std::string& data);
+    bool Send(const void* data, size_t len, bool binary = false, bool fin = true);
+    void Close();
+
+    void OnConnected(std::function<void()> callback);
+    void OnDisconnected(std::function<void()> callback);
+    void OnData(std::function<void(const char*, size_t, bool binary)> callback);
+    void OnError(std::function<void(int)> callback);
+
+private:
+    int fd_ = -1;
+    std::map<std::string, std::string> headers_;
+    std::atomic<bool> connected_ = false;
+    std::atomic<bool> closing_ = false;
+    std::mutex send_mutex_;
+    std::thread receive_thread_;
+
+    std::function<void()> on_connected_;
+    std::function<void()> on_disconnected_;
+    std::function<void(const char*, size_t, bool binary)> on_data_;
+    std::function<void(int)> on_error_;
+
+    bool SendFrame(int opcode, const void* data, size_t len, bool fin);
+    void ReceiveLoop();
+};
+
+#endif // _HOST_WEB_SOCKET_H_
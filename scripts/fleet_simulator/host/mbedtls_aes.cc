@@ -0,0 +1,56 @@
+#include <mbedtls/aes.h>
+
+#include <openssl/evp.h>
+
+// The block cipher comes from OpenSSL, the counter handling is the one of mbedtls
+
+void mbedtls_aes_init(mbedtls_aes_context* ctx) {
+    ctx->cipher = EVP_CIPHER_CTX_new();
+}
+
+void mbedtls_aes_free(mbedtls_aes_context* ctx) {
+    EVP_CIPHER_CTX_free((EVP_CIPHER_CTX*)ctx->cipher);
+    ctx->cipher = nullptr;
+}
+
+int mbedtls_aes_setkey_enc(mbedtls_aes_context* ctx, const unsigned char* key, unsigned int keybits) {
+    const EVP_CIPHER* cipher;
+    switch (keybits) {
+        case 128: cipher = EVP_aes_128_ecb(); break;
+        case 192: cipher = EVP_aes_192_ecb(); break;
+        case 256: cipher = EVP_aes_256_ecb(); break;
+        default: return -1;
+    }
+    auto evp = (EVP_CIPHER_CTX*)ctx->cipher;
+    if (EVP_EncryptInit_ex(evp, cipher, nullptr, key, nullptr) != 1) {
+        return -1;
+    }
+    EVP_CIPHER_CTX_set_padding(evp, 0);
+    return 0;
+}
+
+int mbedtls_aes_crypt_ctr(mbedtls_aes_context* ctx, size_t length, size_t* nc_off, unsigned char nonce_counter[16],
+    unsigned char stream_block[16], const unsigned char* input, unsigned char* output) {
+    size_t n = *nc_off;
+    if (n > 0x0F) {
+        return -1;
+    }
+    auto evp = (EVP_CIPHER_CTX*)ctx->cipher;
+    while (length--) {
+        if (n == 0) {
+            int out_length;
+            if (EVP_EncryptUpdate(evp, stream_block, &out_length, nonce_counter, 16) != 1) {
+                return -1;
+            }
+            for (int i = 16; i > 0; i--) {
+                if (++nonce_counter[i - 1] != 0) {
+                    break;
+                }
+            }
+        }
+        *output++ = *input++ ^ stream_block[n];
+        n = (n + 1) & 0x0F;
+    }
+    *nc_off = n;
+    return 0;
+}
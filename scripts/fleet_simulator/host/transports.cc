@@ -0,0 +1,650 @@
+#include "host_device.h"
+
+#include <network_interface.h>
+#include <esp_log.h>
+#include <esp_timer.h>
+
+#include <openssl/evp.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstring>
+#include <random>
+#include <vector>
+
+#define TAG "HostNetwork"
+
+#define HOST_CONNECT_TIMEOUT_SECONDS 10
+#define WEBSOCKET_OPCODE_CONTINUATION 0x0
+#define WEBSOCKET_OPCODE_TEXT 0x1
+#define WEBSOCKET_OPCODE_BINARY 0x2
+#define WEBSOCKET_OPCODE_CLOSE 0x8
+#define WEBSOCKET_OPCODE_PING 0x9
+#define WEBSOCKET_OPCODE_PONG 0xA
+#define MQTT_PACKET_CONNECT 0x10
+#define MQTT_PACKET_CONNACK 0x20
+#define MQTT_PACKET_PUBLISH 0x30
+#define MQTT_PACKET_SUBSCRIBE 0x82
+#define MQTT_PACKET_PINGREQ 0xC0
+#define MQTT_PACKET_DISCONNECT 0xE0
+// Close the UDP receive loop within this time after Disconnect
+#define UDP_POLL_INTERVAL_MS 200
+
+static int ConnectSocket(const std::string& host, int port, int type) {
+    addrinfo hints = {};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = type;
+    addrinfo* result = nullptr;
+    if (getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &result) != 0) {
+        ESP_LOGE(TAG, "Failed to resolve %s", host.c_str());
+        return -1;
+    }
+    int fd = -1;
+    for (auto address = result; address != nullptr; address = address->ai_next) {
+        fd = socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+        if (fd < 0) {
+            continue;
+        }
+        // Bounds connect and the handshakes, cleared once the connection is up
+        timeval timeout = {.tv_sec = HOST_CONNECT_TIMEOUT_SECONDS, .tv_usec = 0};
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        if (type == SOCK_STREAM) {
+            int one = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        }
+        if (connect(fd, address->ai_addr, address->ai_addrlen) == 0) {
+            break;
+        }
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(result);
+    if (fd < 0) {
+        ESP_LOGE(TAG, "Failed to connect to %s:%d", host.c_str(), port);
+    }
+    return fd;
+}
+
+static void ClearTimeouts(int fd) {
+    timeval timeout = {};
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+}
+
+static bool SendAll(int fd, const void* data, size_t len) {
+    auto bytes = (const uint8_t*)data;
+    while (len > 0) {
+        ssize_t sent = send(fd, bytes, len, MSG_NOSIGNAL);
+        if (sent <= 0) {
+            return false;
+        }
+        bytes += sent;
+        len -= sent;
+    }
+    return true;
+}
+
+static bool ReceiveAll(int fd, void* data, size_t len) {
+    auto bytes = (uint8_t*)data;
+    while (len > 0) {
+        ssize_t received = recv(fd, bytes, len, 0);
+        if (received <= 0) {
+            return false;
+        }
+        bytes += received;
+        len -= received;
+    }
+    return true;
+}
+
+static uint32_t RandomWord() {
+    static thread_local std::mt19937 generator(std::random_device{}());
+    return generator();
+}
+
+static std::string Base64(const uint8_t* data, size_t len) {
+    std::string encoded(4 * ((len + 2) / 3), '\0');
+    EVP_EncodeBlock((uint8_t*)encoded.data(), data, len);
+    return encoded;
+}
+
+static void CountTraffic(HostDevice* device, size_t sent, size_t received) {
+    if (device != nullptr) {
+        device->OnTraffic(sent, received);
+    }
+}
+
+WebSocket::WebSocket(int connect_id) {
+}
+
+WebSocket::~WebSocket() {
+    Close();
+}
+
+void WebSocket::SetHeader(const char* key, const char* value) {
+    headers_[key] = value;
+}
+
+bool WebSocket::IsConnected() const {
+    return connected_;
+}
+
+bool WebSocket::Connect(const char* uri) {
+    std::string url = uri;
+    if (url.rfind("ws://", 0) != 0) {
+        ESP_LOGE(TAG, "Only ws:// URLs are supported on the host: %s", uri);
+        return false;
+    }
+    auto host_end = url.find('/', 5);
+    auto host_port = url.substr(5, host_end == std::string::npos ? std::string::npos : host_end - 5);
+    auto path = host_end == std::string::npos ? "/" : url.substr(host_end);
+    auto host = host_port;
+    int port = 80;
+    auto colon = host_port.rfind(':');
+    if (colon != std::string::npos) {
+        host = host_port.substr(0, colon);
+        port = atoi(host_port.c_str() + colon + 1);
+    }
+
+    auto device = HostDevice::Current();
+    auto start_time = esp_timer_get_time();
+    fd_ = ConnectSocket(host, port, SOCK_STREAM);
+    if (fd_ < 0) {
+        return false;
+    }
+
+    uint8_t nonce[16];
+    for (int i = 0; i < 16; i += 4) {
+        uint32_t word = RandomWord();
+        memcpy(nonce + i, &word, 4);
+    }
+    auto key = Base64(nonce, sizeof(nonce));
+    std::string request = "GET " + path + " HTTP/1.1\r\nHost: " + host_port +
+        "\r\nUpgrade: websocket\r\nConnection: Upgrade\r\nSec-WebSocket-Key: " + key +
+        "\r\nSec-WebSocket-Version: 13\r\n";
+    for (auto& [name, value] : headers_) {
+        request += name + ": " + value + "\r\n";
+    }
+    request += "\r\n";
+    if (!SendAll(fd_, request.data(), request.size())) {
+        ESP_LOGE(TAG, "Failed to send the websocket upgrade");
+        close(fd_);
+        fd_ = -1;
+        return false;
+    }
+
+    // Byte by byte, so nothing after the headers is consumed
+    std::string response;
+    char c;
+    while (response.size() < 4096 && (response.size() < 4 || response.compare(response.size() - 4, 4, "\r\n\r\n") != 0)) {
+        if (recv(fd_, &c, 1, 0) != 1) {
+            break;
+        }
+        response += c;
+    }
+    std::string accept_source = key + "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+    uint8_t digest[EVP_MAX_MD_SIZE];
+    unsigned int digest_length = 0;
+    EVP_Digest(accept_source.data(), accept_source.size(), digest, &digest_length, EVP_sha1(), nullptr);
+    if (response.compare(0, 12, "HTTP/1.1 101") != 0 || response.find(Base64(digest, digest_length)) == std::string::npos) {
+        ESP_LOGE(TAG, "Websocket upgrade failed: %.*s", (int)response.find('\r'), response.c_str());
+        close(fd_);
+        fd_ = -1;
+        return false;
+    }
+    ClearTimeouts(fd_);
+    CountTraffic(device, request.size(), response.size());
+    if (device != nullptr) {
+        device->OnConnect(esp_timer_get_time() - start_time);
+    }
+
+    connected_ = true;
+    receive_thread_ = StartDeviceThread("ws_receive", [this]() {
+        ReceiveLoop();
+    });
+    if (on_connected_ != nullptr) {
+        on_connected_();
+    }
+    return true;
+}
+
+bool WebSocket::Send(const std::string& data) {
+    return Send(data.data(), data.size(), false, true);
+}
+
+bool WebSocket::Send(const void* data, size_t len, bool binary, bool fin) {
+    if (!connected_) {
+        return false;
+    }
+    return SendFrame(binary ? WEBSOCKET_OPCODE_BINARY : WEBSOCKET_OPCODE_TEXT, data, len, fin);
+}
+
+bool WebSocket::SendFrame(int opcode, const void* data, size_t len, bool fin) {
+    std::vector<uint8_t> frame;
+    frame.reserve(len + 14);
+    frame.push_back((fin ? 0x80 : 0) | opcode);
+    if (len < 126) {
+        frame.push_back(0x80 | len);
+    } else if (len < 65536) {
+        frame.push_back(0x80 | 126);
+        frame.push_back(len >> 8);
+        frame.push_back(len & 0xFF);
+    } else {
+        frame.push_back(0x80 | 127);
+        for (int shift = 56; shift >= 0; shift -= 8) {
+            frame.push_back((uint64_t)len >> shift);
+        }
+    }
+    uint32_t mask_word = RandomWord();
+    uint8_t mask[4];
+    memcpy(mask, &mask_word, 4);
+    frame.insert(frame.end(), mask, mask + 4);
+    auto payload = (const uint8_t*)data;
+    for (size_t i = 0; i < len; i++) {
+        frame.push_back(payload[i] ^ mask[i & 3]);
+    }
+
+    std::lock_guard<std::mutex> lock(send_mutex_);
+    if (fd_ < 0 || !SendAll(fd_, frame.data(), frame.size())) {
+        return false;
+    }
+    CountTraffic(HostDevice::Current(), frame.size(), 0);
+    return true;
+}
+
+void WebSocket::ReceiveLoop() {
+    auto device = HostDevice::Current();
+    std::vector<char> message;
+    bool binary = false;
+    while (!closing_) {
+        uint8_t header[2];
+        if (!ReceiveAll(fd_, header, 2)) {
+            break;
+        }
+        int opcode = header[0] & 0x0F;
+        bool fin = header[0] & 0x80;
+        uint64_t len = header[1] & 0x7F;
+        size_t header_size = 2;
+        if (len >= 126) {
+            uint8_t extended[8];
+            size_t size = len == 126 ? 2 : 8;
+            if (!ReceiveAll(fd_, extended, size)) {
+                break;
+            }
+            len = 0;
+            for (size_t i = 0; i < size; i++) {
+                len = (len << 8) | extended[i];
+            }
+            header_size += size;
+        }
+        uint8_t mask[4] = {0};
+        bool masked = header[1] & 0x80;
+        if (masked && !ReceiveAll(fd_, mask, 4)) {
+            break;
+        }
+        std::vector<char> payload(len);
+        if (len > 0 && !ReceiveAll(fd_, payload.data(), len)) {
+            break;
+        }
+        if (masked) {
+            for (size_t i = 0; i < len; i++) {
+                payload[i] ^= mask[i & 3];
+            }
+        }
+        CountTraffic(device, 0, header_size + (masked ? 4 : 0) + len);
+
+        if (opcode == WEBSOCKET_OPCODE_PING) {
+            SendFrame(WEBSOCKET_OPCODE_PONG, payload.data(), payload.size(), true);
+            continue;
+        } else if (opcode == WEBSOCKET_OPCODE_PONG) {
+            continue;
+        } else if (opcode == WEBSOCKET_OPCODE_CLOSE) {
+            SendFrame(WEBSOCKET_OPCODE_CLOSE, payload.data(), std::min<size_t>(payload.size(), 2), true);
+            break;
+        }
+        if (opcode != WEBSOCKET_OPCODE_CONTINUATION) {
+            binary = opcode == WEBSOCKET_OPCODE_BINARY;
+            message.clear();
+        }
+        message.insert(message.end(), payload.begin(), payload.end());
+        if (fin && on_data_ != nullptr) {
+            on_data_(message.data(), message.size(), binary);
+        }
+    }
+
+    connected_ = false;
+    if (!closing_ && on_disconnected_ != nullptr) {
+        on_disconnected_();
+    }
+}
+
+void WebSocket::Close() {
+    if (closing_.exchange(true)) {
+        return;
+    }
+    if (connected_) {
+        uint8_t code[2] = {0x03, 0xE8};
+        SendFrame(WEBSOCKET_OPCODE_CLOSE, code, sizeof(code), true);
+    }
+    connected_ = false;
+    if (fd_ >= 0) {
+        shutdown(fd_, SHUT_RDWR);
+    }
+    if (receive_thread_.joinable()) {
+        if (receive_thread_.get_id() == std::this_thread::get_id()) {
+            receive_thread_.detach();
+        } else {
+            receive_thread_.join();
+        }
+    }
+    if (fd_ >= 0) {
+        close(fd_);
+        fd_ = -1;
+    }
+}
+
+void WebSocket::OnConnected(std::function<void()> callback) {
+    on_connected_ = callback;
+}
+
+void WebSocket::OnDisconnected(std::function<void()> callback) {
+    on_disconnected_ = callback;
+}
+
+void WebSocket::OnData(std::function<void(const char*, size_t, bool binary)> callback) {
+    on_data_ = callback;
+}
+
+void WebSocket::OnError(std::function<void(int)> callback) {
+    on_error_ = callback;
+}
+
+static void AppendMqttString(std::string& body, const std::string& value) {
+    body.push_back(value.size() >> 8);
+    body.push_back(value.size() & 0xFF);
+    body += value;
+}
+
+Mqtt::Mqtt(int connect_id) {
+}
+
+Mqtt::~Mqtt() {
+    Disconnect();
+}
+
+void Mqtt::SetKeepAlive(int keep_alive_seconds) {
+    keep_alive_seconds_ = keep_alive_seconds;
+}
+
+bool Mqtt::Connect(const std::string broker_address, int broker_port, const std::string client_id,
+    const std::string username, const std::string password) {
+    auto device = HostDevice::Current();
+    auto start_time = esp_timer_get_time();
+    fd_ = ConnectSocket(broker_address, broker_port, SOCK_STREAM);
+    if (fd_ < 0) {
+        return false;
+    }
+
+    // Clean session, with the user name and password flags when they are set
+    std::string body;
+    AppendMqttString(body, "MQTT");
+    body.push_back(4);
+    body.push_back(0x02 | (username.empty() ? 0 : 0x80) | (password.empty() ? 0 : 0x40));
+    body.push_back(keep_alive_seconds_ >> 8);
+    body.push_back(keep_alive_seconds_ & 0xFF);
+    AppendMqttString(body, client_id);
+    if (!username.empty()) {
+        AppendMqttString(body, username);
+    }
+    if (!password.empty()) {
+        AppendMqttString(body, password);
+    }
+    uint8_t connack[4];
+    if (!SendPacket(MQTT_PACKET_CONNECT, body) || !ReceiveAll(fd_, connack, sizeof(connack))) {
+        ESP_LOGE(TAG, "No CONNACK from %s:%d", broker_address.c_str(), broker_port);
+        close(fd_);
+        fd_ = -1;
+        return false;
+    }
+    if (connack[0] != MQTT_PACKET_CONNACK || connack[3] != 0) {
+        ESP_LOGE(TAG, "Broker refused the connection, return code %d", connack[3]);
+        close(fd_);
+        fd_ = -1;
+        return false;
+    }
+    ClearTimeouts(fd_);
+    CountTraffic(device, 0, sizeof(connack));
+    if (device != nullptr) {
+        device->OnConnect(esp_timer_get_time() - start_time);
+    }
+
+    connected_ = true;
+    receive_thread_ = StartDeviceThread("mqtt_receive", [this]() {
+        ReceiveLoop();
+    });
+    if (on_connected_ != nullptr) {
+        on_connected_();
+    }
+    return true;
+}
+
+bool Mqtt::SendPacket(uint8_t header, const std::string& body) {
+    std::string packet(1, (char)header);
+    size_t remaining = body.size();
+    do {
+        uint8_t digit = remaining & 0x7F;
+        remaining >>= 7;
+        packet.push_back(digit | (remaining > 0 ? 0x80 : 0));
+    } while (remaining > 0);
+    packet += body;
+
+    std::lock_guard<std::mutex> lock(send_mutex_);
+    if (fd_ < 0 || !SendAll(fd_, packet.data(), packet.size())) {
+        return false;
+    }
+    CountTraffic(HostDevice::Current(), packet.size(), 0);
+    return true;
+}
+
+void Mqtt::ReceiveLoop() {
+    auto device = HostDevice::Current();
+    // Ping at half the keep alive, the broker drops the client after 1.5 times of it
+    int ping_interval_ms = keep_alive_seconds_ > 0 ? keep_alive_seconds_ * 500 : -1;
+    while (!closing_) {
+        pollfd poll_fd = {.fd = fd_, .events = POLLIN, .revents = 0};
+        int ready = poll(&poll_fd, 1, ping_interval_ms);
+        if (ready == 0) {
+            SendPacket(MQTT_PACKET_PINGREQ, "");
+            continue;
+        }
+        uint8_t header;
+        if (ready < 0 || !ReceiveAll(fd_, &header, 1)) {
+            break;
+        }
+        size_t length = 0;
+        int shift = 0;
+        uint8_t digit;
+        bool ok = true;
+        do {
+            if (!ReceiveAll(fd_, &digit, 1) || shift > 21) {
+                ok = false;
+                break;
+            }
+            length |= (size_t)(digit & 0x7F) << shift;
+            shift += 7;
+        } while (digit & 0x80);
+        std::string body(length, '\0');
+        if (!ok || (length > 0 && !ReceiveAll(fd_, body.data(), length))) {
+            break;
+        }
+        CountTraffic(device, 0, 2 + length);
+
+        if ((header & 0xF0) != MQTT_PACKET_PUBLISH || length < 2) {
+            continue;
+        }
+        size_t topic_length = ((uint8_t)body[0] << 8) | (uint8_t)body[1];
+        // QoS 1 and 2 carry a packet id behind the topic
+        size_t offset = 2 + topic_length + ((header & 0x06) ? 2 : 0);
+        if (offset > length) {
+            continue;
+        }
+        if (on_message_ != nullptr) {
+            on_message_(body.substr(2, topic_length), body.substr(offset));
+        }
+    }
+
+    connected_ = false;
+    if (!closing_ && on_disconnected_ != nullptr) {
+        on_disconnected_();
+    }
+}
+
+void Mqtt::Disconnect() {
+    if (closing_.exchange(true)) {
+        return;
+    }
+    if (connected_) {
+        SendPacket(MQTT_PACKET_DISCONNECT, "");
+    }
+    connected_ = false;
+    if (fd_ >= 0) {
+        shutdown(fd_, SHUT_RDWR);
+    }
+    if (receive_thread_.joinable()) {
+        if (receive_thread_.get_id() == std::this_thread::get_id()) {
+            receive_thread_.detach();
+        } else {
+            receive_thread_.join();
+        }
+    }
+    if (fd_ >= 0) {
+        close(fd_);
+        fd_ = -1;
+    }
+}
+
+bool Mqtt::Publish(const std::string topic, const std::string payload, int qos) {
+    if (!connected_) {
+        return false;
+    }
+    std::string body;
+    AppendMqttString(body, topic);
+    body += payload;
+    return SendPacket(MQTT_PACKET_PUBLISH, body);
+}
+
+bool Mqtt::Subscribe(const std::string topic, int qos) {
+    if (!connected_) {
+        return false;
+    }
+    std::string body;
+    uint16_t packet_id = ++packet_id_;
+    body.push_back(packet_id >> 8);
+    body.push_back(packet_id & 0xFF);
+    AppendMqttString(body, topic);
+    body.push_back(0);
+    return SendPacket(MQTT_PACKET_SUBSCRIBE, body);
+}
+
+bool Mqtt::IsConnected() {
+    return connected_;
+}
+
+void Mqtt::OnConnected(std::function<void()> callback) {
+    on_connected_ = callback;
+}
+
+void Mqtt::OnDisconnected(std::function<void()> callback) {
+    on_disconnected_ = callback;
+}
+
+void Mqtt::OnMessage(std::function<void(const std::string& topic, const std::string& payload)> callback) {
+    on_message_ = callback;
+}
+
+Udp::Udp(int connect_id) {
+}
+
+Udp::~Udp() {
+    Disconnect();
+}
+
+bool Udp::Connect(const std::string& host, int port) {
+    fd_ = ConnectSocket(host, port, SOCK_DGRAM);
+    if (fd_ < 0) {
+        return false;
+    }
+    ClearTimeouts(fd_);
+    receive_thread_ = StartDeviceThread("udp_receive", [this]() {
+        ReceiveLoop();
+    });
+    return true;
+}
+
+void Udp::Disconnect() {
+    closing_ = true;
+    if (receive_thread_.joinable()) {
+        if (receive_thread_.get_id() == std::this_thread::get_id()) {
+            receive_thread_.detach();
+        } else {
+            receive_thread_.join();
+        }
+    }
+    if (fd_ >= 0) {
+        close(fd_);
+        fd_ = -1;
+    }
+}
+
+int Udp::Send(const std::string& data) {
+    if (fd_ < 0) {
+        return -1;
+    }
+    int sent = send(fd_, data.data(), data.size(), 0);
+    if (sent > 0) {
+        CountTraffic(HostDevice::Current(), sent, 0);
+    }
+    return sent;
+}
+
+void Udp::ReceiveLoop() {
+    auto device = HostDevice::Current();
+    std::string buffer(2048, '\0');
+    while (!closing_) {
+        // A connected UDP socket is not woken by shutdown, so the loop polls for the close
+        pollfd poll_fd = {.fd = fd_, .events = POLLIN, .revents = 0};
+        if (poll(&poll_fd, 1, UDP_POLL_INTERVAL_MS) <= 0) {
+            continue;
+        }
+        ssize_t received = recv(fd_, buffer.data(), buffer.size(), 0);
+        if (received <= 0) {
+            continue;
+        }
+        CountTraffic(device, 0, received);
+        if (on_message_ != nullptr) {
+            on_message_(buffer.substr(0, received));
+        }
+    }
+}
+
+void Udp::OnMessage(std::function<void(const std::string& data)> callback) {
+    on_message_ = callback;
+}
+
+std::unique_ptr<WebSocket> NetworkInterface::CreateWebSocket(int connect_id) {
+    return std::make_unique<WebSocket>(connect_id);
+}
+
+std::unique_ptr<Mqtt> NetworkInterface::CreateMqtt(int connect_id) {
+    return std::make_unique<Mqtt>(connect_id);
+}
+
+std::unique_ptr<Udp> NetworkInterface::CreateUdp(int connect_id) {
+    return std::make_unique<Udp>(connect_id);
+}
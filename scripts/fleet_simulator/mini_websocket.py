@@ -0,0 +1,164 @@
+import asyncio
+import base64
+import hashlib
+import os
+import struct
+
+'''
+  Minimal RFC 6455 WebSocket server side on asyncio streams, so the reference
+  server runs without third party packages.
+  Supports text and binary messages, fragmented frames, ping/pong and close.
+  Extensions (permessage-deflate) are not negotiated.
+'''
+
+GUID = '258EAFA5-E914-47DA-95CA-C5AB0DC85B11'
+
+OP_CONTINUATION = 0x0
+OP_TEXT = 0x1
+OP_BINARY = 0x2
+OP_CLOSE = 0x8
+OP_PING = 0x9
+OP_PONG = 0xA
+
+
+class ConnectionClosed(Exception):
+    pass
+
+
+class WebSocket:
+    def __init__(self, reader, writer, is_client):
+        self.reader = reader
+        self.writer = writer
+        self.is_client = is_client
+        self.closed = False
+        self.bytes_sent = 0
+        self.bytes_received = 0
+
+    async def send(self, data):
+        if isinstance(data, str):
+            await self._send_frame(OP_TEXT, data.encode('utf-8'))
+        else:
+            await self._send_frame(OP_BINARY, bytes(data))
+
+    async def recv(self):
+        '''
+          Returns str for text and bytes for binary messages, answers pings on the way.
+        '''
+        opcode = None
+        chunks = []
+        while True:
+            fin, frame_opcode, payload = await self._read_frame()
+            if frame_opcode == OP_PING:
+                await self._send_frame(OP_PONG, payload)
+                continue
+            if frame_opcode == OP_PONG:
+                continue
+            if frame_opcode == OP_CLOSE:
+                if not self.closed:
+                    await self._send_frame(OP_CLOSE, payload[:2])
+                    self.closed = True
+                raise ConnectionClosed()
+            if frame_opcode != OP_CONTINUATION:
+                opcode = frame_opcode
+            chunks.append(payload)
+            if fin:
+                break
+        message = b''.join(chunks)
+        return message.decode('utf-8') if opcode == OP_TEXT else message
+
+    async def close(self):
+        if not self.closed:
+            self.closed = True
+            try:
+                await self._send_frame(OP_CLOSE, struct.pack('!H', 1000))
+            except (ConnectionError, OSError):
+                pass
+        self.writer.close()
+        try:
+            await self.writer.wait_closed()
+        except (ConnectionError, OSError):
+            pass
+
+    async def _send_frame(self, opcode, payload):
+        header = bytearray([0x80 | opcode])
+        mask_bit = 0x80 if self.is_client else 0
+        length = len(payload)
+        if length < 126:
+            header.append(mask_bit | length)
+        elif length < 65536:
+            header.append(mask_bit | 126)
+            header += struct.pack('!H', length)
+        else:
+            header.append(mask_bit | 127)
+            header += struct.pack('!Q', length)
+        if self.is_client:
+            mask = os.urandom(4)
+            header += mask
+            payload = _apply_mask(payload, mask)
+        self.writer.write(bytes(header) + payload)
+        self.bytes_sent += len(header) + length
+        await self.writer.drain()
+
+    async def _read_frame(self):
+        try:
+            head = await self.reader.readexactly(2)
+            fin = head[0] & 0x80 != 0
+            opcode = head[0] & 0x0F
+            masked = head[1] & 0x80 != 0
+            length = head[1] & 0x7F
+            header_size = 2
+            if length == 126:
+                length = struct.unpack('!H', await self.reader.readexactly(2))[0]
+                header_size += 2
+            elif length == 127:
+                length = struct.unpack('!Q', await self.reader.readexactly(8))[0]
+                header_size += 8
+            mask = await self.reader.readexactly(4) if masked else None
+            payload = await self.reader.readexactly(length) if length else b''
+        except (asyncio.IncompleteReadError, ConnectionError, OSError):
+            self.closed = True
+            raise ConnectionClosed()
+        if mask:
+            payload = _apply_mask(payload, mask)
+            header_size += 4
+        self.bytes_received += header_size + length
+        return fin, opcode, payload
+
+
+def _apply_mask(payload, mask):
+    # Mask 4 bytes at a time through a big integer, much faster than a byte loop
+    if not payload:
+        return payload
+    repeated = (mask * (len(payload) // 4 + 1))[:len(payload)]
+    return (int.from_bytes(payload, 'little') ^ int.from_bytes(repeated, 'little')).to_bytes(len(payload), 'little')
+
+
+async def _read_http_headers(reader):
+    data = await reader.readuntil(b'\r\n\r\n')
+    lines = data.decode('latin-1').split('\r\n')
+    headers = {}
+    for line in lines[1:]:
+        if ':' in line:
+            key, value = line.split(':', 1)
+            headers[key.strip().lower()] = value.strip()
+    return lines[0], headers
+
+
+async def accept(reader, writer):
+    '''
+      Server side handshake, returns the WebSocket and the request headers.
+    '''
+    _, headers = await _read_http_headers(reader)
+    key = headers.get('sec-websocket-key')
+    if key is None:
+        writer.write(b'HTTP/1.1 400 Bad Request\r\nContent-Length: 0\r\n\r\n')
+        await writer.drain()
+        writer.close()
+        raise ConnectionError('Not a websocket request')
+    accept_key = base64.b64encode(hashlib.sha1((key + GUID).encode()).digest()).decode()
+    writer.write(('HTTP/1.1 101 Switching Protocols\r\n'
+                  'Upgrade: websocket\r\n'
+                  'Connection: Upgrade\r\n'
+                  f'Sec-WebSocket-Accept: {accept_key}\r\n\r\n').encode('latin-1'))
+    await writer.drain()
+    return WebSocket(reader, writer, is_client=False), headers
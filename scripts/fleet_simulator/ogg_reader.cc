@@ -0,0 +1,47 @@
+#include "ogg_reader.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+
+bool ReadOggOpusPackets(const std::string& path, std::vector<std::vector<uint8_t>>& packets) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file) {
+        fprintf(stderr, "Failed to open %s\n", path.c_str());
+        return false;
+    }
+    std::vector<uint8_t> data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+    std::vector<uint8_t> partial;
+    size_t offset = 0;
+    while (offset + 27 <= data.size()) {
+        if (memcmp(&data[offset], "OggS", 4) != 0) {
+            fprintf(stderr, "%s: bad Ogg page at offset %zu\n", path.c_str(), offset);
+            return false;
+        }
+        size_t segment_count = data[offset + 26];
+        size_t lacing = offset + 27;
+        offset = lacing + segment_count;
+        for (size_t i = 0; i < segment_count && lacing + i < data.size(); i++) {
+            size_t size = data[lacing + i];
+            if (offset + size > data.size()) {
+                fprintf(stderr, "%s: truncated Ogg page\n", path.c_str());
+                return false;
+            }
+            partial.insert(partial.end(), data.begin() + offset, data.begin() + offset + size);
+            offset += size;
+            // A lacing value below 255 ends the packet
+            if (size < 255) {
+                bool header = partial.size() >= 8 &&
+                    (memcmp(partial.data(), "OpusHead", 8) == 0 || memcmp(partial.data(), "OpusTags", 8) == 0);
+                if (!header) {
+                    packets.push_back(std::move(partial));
+                }
+                partial.clear();
+            }
+        }
+    }
+    return true;
+}
@@ -0,0 +1,10 @@
+#ifndef _OGG_READER_H_
+#define _OGG_READER_H_
+
+#include <string>
+#include <vector>
+
+// The Opus packets of an Ogg Opus file, without the OpusHead and OpusTags headers
+bool ReadOggOpusPackets(const std::string& path, std::vector<std::vector<uint8_t>>& packets);
+
+#endif // _OGG_READER_H_
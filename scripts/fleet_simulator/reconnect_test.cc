@@ -0,0 +1,393 @@
+#include "websocket_protocol.h"
+#include "host_device.h"
+
+#include <cJSON.h>
+#include <esp_timer.h>
+#include <settings.h>
+
+#include <openssl/evp.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/*
+ * Host test of resuming a websocket session: a server in this process drops the
+ * socket in the middle of a session, the device keeps sending control messages
+ * and audio while it reconnects, and the server checks what arrives on the new
+ * connection. Run with ctest, or directly: ./reconnect_test
+ */
+
+static int failures = 0;
+
+#define CHECK(condition) do { \
+        if (!(condition)) { \
+            fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #condition); \
+            failures++; \
+        } \
+    } while (0)
+
+#define SESSION_ID "session-1"
+#define RESUME_TOKEN "token-1"
+// The resume hello is answered late, so the device buffers for longer than the reconnect delay alone
+#define RESUME_HELLO_DELAY_MS 300
+#define UPLINK_INTERVAL_MS 20
+
+struct Frame {
+    int connection;
+    bool binary;
+    std::string data;
+};
+
+static std::string Base64(const uint8_t* data, size_t len) {
+    std::string encoded(4 * ((len + 2) / 3), '\0');
+    EVP_EncodeBlock((uint8_t*)encoded.data(), data, len);
+    return encoded;
+}
+
+static bool ReceiveAll(int fd, void* data, size_t len) {
+    auto bytes = (uint8_t*)data;
+    while (len > 0) {
+        ssize_t received = recv(fd, bytes, len, 0);
+        if (received <= 0) {
+            return false;
+        }
+        bytes += received;
+        len -= received;
+    }
+    return true;
+}
+
+/*
+ * Websocket server for one device, the connections are served one after the
+ * other on a thread of their own and every frame is recorded in order.
+ */
+class TestServer {
+public:
+    ~TestServer() {
+        Stop();
+    }
+
+    int Start() {
+        listen_fd_ = socket(AF_INET, SOCK_STREAM, 0);
+        sockaddr_in address = {};
+        address.sin_family = AF_INET;
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        socklen_t length = sizeof(address);
+        if (bind(listen_fd_, (sockaddr*)&address, sizeof(address)) != 0 || listen(listen_fd_, 4) != 0 ||
+            getsockname(listen_fd_, (sockaddr*)&address, &length) != 0) {
+            return -1;
+        }
+        thread_ = std::thread([this]() {
+            int connection = 0;
+            while (true) {
+                int fd = accept(listen_fd_, nullptr, nullptr);
+                if (fd < 0) {
+                    break;
+                }
+                connection_fd_ = fd;
+                Serve(fd, ++connection);
+                connection_fd_ = -1;
+                close(fd);
+            }
+        });
+        return ntohs(address.sin_port);
+    }
+
+    void Stop() {
+        if (thread_.joinable()) {
+            // Wakes up accept
+            shutdown(listen_fd_, SHUT_RDWR);
+            thread_.join();
+            close(listen_fd_);
+        }
+    }
+
+    // The fault: the connection goes away without a close frame, like a lost network
+    void DropConnection() {
+        int fd = connection_fd_;
+        if (fd >= 0) {
+            shutdown(fd, SHUT_RDWR);
+        }
+    }
+
+    std::vector<Frame> frames() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return frames_;
+    }
+
+private:
+    int listen_fd_ = -1;
+    std::atomic<int> connection_fd_ = -1;
+    std::thread thread_;
+    std::mutex mutex_;
+    std::vector<Frame> frames_;
+
+    void Serve(int fd, int connection) {
+        std::string request;
+        char c;
+        while (request.size() < 4 || request.compare(request.size() - 4, 4, "\r\n\r\n") != 0) {
+            if (recv(fd, &c, 1, 0) != 1) {
+                return;
+            }
+            request += c;
+        }
+        auto key_start = request.find("Sec-WebSocket-Key: ");
+        if (key_start == std::string::npos) {
+            return;
+        }
+        key_start += strlen("Sec-WebSocket-Key: ");
+        std::string accept_source = request.substr(key_start, request.find("\r\n", key_start) - key_start) +
+            "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+        uint8_t digest[EVP_MAX_MD_SIZE];
+        unsigned int digest_length = 0;
+        EVP_Digest(accept_source.data(), accept_source.size(), digest, &digest_length, EVP_sha1(), nullptr);
+        std::string response = "HTTP/1.1 101 Switching Protocols\r\nUpgrade: websocket\r\nConnection: Upgrade\r\n"
+            "Sec-WebSocket-Accept: " + Base64(digest, digest_length) + "\r\n\r\n";
+        send(fd, response.data(), response.size(), MSG_NOSIGNAL);
+
+        while (true) {
+            uint8_t header[2];
+            if (!ReceiveAll(fd, header, 2)) {
+                return;
+            }
+            int opcode = header[0] & 0x0F;
+            uint64_t len = header[1] & 0x7F;
+            if (len >= 126) {
+                uint8_t extended[8];
+                size_t size = len == 126 ? 2 : 8;
+                if (!ReceiveAll(fd, extended, size)) {
+                    return;
+                }
+                len = 0;
+                for (size_t i = 0; i < size; i++) {
+                    len = (len << 8) | extended[i];
+                }
+            }
+            uint8_t mask[4];
+            std::string payload(len, '\0');
+            if (!ReceiveAll(fd, mask, 4) || (len > 0 && !ReceiveAll(fd, payload.data(), len))) {
+                return;
+            }
+            for (size_t i = 0; i < len; i++) {
+                payload[i] ^= mask[i & 3];
+            }
+            if (opcode == 0x8) {
+                return;
+            } else if (opcode != 0x1 && opcode != 0x2) {
+                continue;
+            }
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                frames_.push_back(Frame{connection, opcode == 0x2, payload});
+            }
+            if (opcode == 0x1) {
+                HandleText(fd, payload);
+            }
+        }
+    }
+
+    void HandleText(int fd, const std::string& text) {
+        cJSON* root = cJSON_Parse(text.c_str());
+        auto type = cJSON_GetObjectItem(root, "type");
+        if (cJSON_IsString(type) && strcmp(type->valuestring, "hello") == 0) {
+            if (cJSON_GetObjectItem(root, "resume_token") != nullptr) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(RESUME_HELLO_DELAY_MS));
+            }
+            SendText(fd, "{\"type\":\"hello\",\"transport\":\"websocket\",\"session_id\":\"" SESSION_ID "\","
+                "\"resume_token\":\"" RESUME_TOKEN "\",\"audio_params\":{\"format\":\"opus\",\"sample_rate\":24000,"
+                "\"channels\":1,\"frame_duration\":60}}");
+        }
+        cJSON_Delete(root);
+    }
+
+    static void SendText(int fd, const std::string& text) {
+        std::string frame;
+        frame += (char)0x81;
+        if (text.size() < 126) {
+            frame += (char)text.size();
+        } else {
+            frame += (char)126;
+            frame += (char)(text.size() >> 8);
+            frame += (char)(text.size() & 0xFF);
+        }
+        frame += text;
+        send(fd, frame.data(), frame.size(), MSG_NOSIGNAL);
+    }
+};
+
+static std::string MessageType(const Frame& frame) {
+    cJSON* root = cJSON_ParseWithLength(frame.data.data(), frame.data.size());
+    auto type = cJSON_GetObjectItem(root, "type");
+    auto state = cJSON_GetObjectItem(root, "state");
+    std::string result = cJSON_IsString(type) ? type->valuestring : "";
+    if (cJSON_IsString(state)) {
+        result += std::string(":") + state->valuestring;
+    }
+    cJSON_Delete(root);
+    return result;
+}
+
+static uint32_t AudioSequence(const Frame& frame) {
+    uint32_t sequence = 0;
+    memcpy(&sequence, frame.data.data(), std::min(frame.data.size(), sizeof(sequence)));
+    return sequence;
+}
+
+static void RunFor(int64_t duration_us) {
+    int64_t deadline = esp_timer_get_time() + duration_us;
+    while (esp_timer_get_time() < deadline) {
+        Application::GetInstance().RunPending(deadline);
+    }
+}
+
+// Control messages sent while the session is being resumed arrive right after the resume
+// hello, before any audio, and no audio is reordered
+static void TestControlBeforeAudioOnResume() {
+    TestServer server;
+    int port = server.Start();
+    CHECK(port > 0);
+    if (port <= 0) {
+        return;
+    }
+
+    HostDevice device(0);
+    HostDevice::SetCurrent(&device);
+    {
+        Settings settings("websocket", true);
+        settings.SetString("url", "ws://127.0.0.1:" + std::to_string(port) + "/");
+        settings.SetInt("version", 1);
+    }
+
+    auto protocol = std::make_unique<WebsocketProtocol>();
+    protocol->Start();
+    CHECK(protocol->OpenAudioChannel());
+
+    // Like the audio uplink task of Application, the packets are sent from their own thread
+    // the whole time, so some of them race with the resume
+    std::atomic<bool> stop_uplink = false;
+    auto uplink = StartDeviceThread("uplink", [&protocol, &stop_uplink]() {
+        for (uint32_t sequence = 0; !stop_uplink; sequence++) {
+            auto packet = std::make_unique<AudioStreamPacket>();
+            packet->sample_rate = 16000;
+            packet->frame_duration = OPUS_FRAME_DURATION_MS;
+            packet->payload.resize(sizeof(sequence));
+            memcpy(packet->payload.data(), &sequence, sizeof(sequence));
+            protocol->SendAudio(std::move(packet));
+            std::this_thread::sleep_for(std::chrono::milliseconds(UPLINK_INTERVAL_MS));
+        }
+    });
+
+    protocol->SendWakeWordDetected("你好小智");
+    protocol->SendStartListening(kListeningModeManualStop);
+    RunFor(200 * 1000);
+
+    server.DropConnection();
+    // The disconnect reaches the main loop right away, the reconnect starts after PROTOCOL_RECONNECT_BASE_DELAY_MS
+    RunFor(100 * 1000);
+    CHECK(protocol->IsAudioChannelOpened());
+    protocol->SendStopListening();
+    protocol->SendAbortSpeaking(kAbortReasonNone);
+    protocol->SendStartListening(kListeningModeManualStop);
+    const std::vector<std::string> expected_control = {"listen:stop", "abort", "listen:start"};
+
+    // Done once the resumed connection carried a second of audio, the buffered packets included
+    auto resumed = [&server]() {
+        size_t audio = 0;
+        for (auto& frame : server.frames()) {
+            if (frame.connection == 2 && frame.binary) {
+                audio++;
+            }
+        }
+        return audio >= 1000 / UPLINK_INTERVAL_MS;
+    };
+    int64_t deadline = esp_timer_get_time() + 10 * 1000000LL;
+    while (!resumed() && esp_timer_get_time() < deadline) {
+        Application::GetInstance().RunPending(std::min(deadline, esp_timer_get_time() + 50 * 1000));
+    }
+    CHECK(protocol->IsAudioChannelOpened());
+    stop_uplink = true;
+    uplink.join();
+    protocol->CloseAudioChannel();
+    Application::GetInstance().RunPending(0);
+    protocol.reset();
+    server.Stop();
+
+    std::vector<Frame> first;
+    std::vector<Frame> second;
+    for (auto& frame : server.frames()) {
+        (frame.connection == 1 ? first : second).push_back(frame);
+    }
+    CHECK(!first.empty() && MessageType(first[0]) == "hello");
+    CHECK(second.size() > expected_control.size() + 1);
+    if (second.size() <= expected_control.size() + 1) {
+        fprintf(stderr, "The session was not resumed\n");
+        return;
+    }
+
+    // The resume hello, then the buffered control messages in the order they were sent, then the audio
+    cJSON* hello = cJSON_ParseWithLength(second[0].data.data(), second[0].data.size());
+    auto session_id = cJSON_GetObjectItem(hello, "session_id");
+    auto resume_token = cJSON_GetObjectItem(hello, "resume_token");
+    CHECK(cJSON_IsString(session_id) && strcmp(session_id->valuestring, SESSION_ID) == 0);
+    CHECK(cJSON_IsString(resume_token) && strcmp(resume_token->valuestring, RESUME_TOKEN) == 0);
+    cJSON_Delete(hello);
+    for (size_t i = 0; i < expected_control.size(); i++) {
+        auto& frame = second[1 + i];
+        CHECK(!frame.binary);
+        if (frame.binary) {
+            fprintf(stderr, "Audio packet %u arrived before control message %s\n", AudioSequence(frame),
+                expected_control[i].c_str());
+        } else {
+            CHECK(MessageType(frame) == expected_control[i]);
+        }
+    }
+
+    // Packets sent into the dead socket before the disconnect was noticed are lost, but none
+    // arrive twice or out of order, and the resumed connection has no gaps
+    uint32_t last_sequence = 0;
+    bool has_last = false;
+    for (auto& frame : first) {
+        if (frame.binary) {
+            CHECK(!has_last || AudioSequence(frame) == last_sequence + 1);
+            last_sequence = AudioSequence(frame);
+            has_last = true;
+        }
+    }
+    bool first_resumed = true;
+    for (size_t i = 1 + expected_control.size(); i < second.size(); i++) {
+        auto& frame = second[i];
+        if (!frame.binary) {
+            // The goodbye of CloseAudioChannel
+            CHECK(i == second.size() - 1 && MessageType(frame) == "goodbye");
+            continue;
+        }
+        uint32_t sequence = AudioSequence(frame);
+        if (first_resumed) {
+            CHECK(!has_last || sequence > last_sequence);
+            first_resumed = false;
+        } else {
+            CHECK(sequence == last_sequence + 1);
+        }
+        last_sequence = sequence;
+        has_last = true;
+    }
+}
+
+int main() {
+    TestControlBeforeAudioOnResume();
+    if (failures > 0) {
+        fprintf(stderr, "%d checks failed\n", failures);
+        return 1;
+    }
+    printf("All checks passed\n");
+    return 0;
+}
@@ -0,0 +1,355 @@
+import argparse
+import asyncio
+import json
+import os
+import struct
+import time
+import uuid
+
+import mini_websocket
+from device_protocol import pack_audio, pack_udp_audio, read_ogg_opus_packets, UDP_FORMAT, UDP_HEADER_SIZE
+
+'''
+  Reference server stub for the fleet simulator.
+
+  Speaks the server side of docs/websocket.md and of docs/mqtt-udp.md: answers
+  hello (announcing ping, and early data on websocket), pong to ping, and after
+  "listen stop" replies with stt, tts start, the Opus packets of an Ogg file
+  paced in real time, and tts stop. No ASR, LLM or TTS runs, so it measures the
+  transport and the session handling only.
+
+  For MQTT it is the broker as well: the devices connect with MQTT 3.1.1 over
+  TCP, publish to any topic and get the replies on devices/p2p/<client id>
+  without subscribing. The audio of a session goes over UDP with the key and
+  nonce handed out in the hello; the uplink is counted, not decrypted.
+'''
+
+DEFAULT_AUDIO = os.path.join(os.path.dirname(__file__), '../../main/assets/locales/zh-CN/welcome.ogg')
+
+
+class ServerStats:
+    def __init__(self):
+        self.connections = 0
+        self.active = 0
+        self.sessions = 0
+        self.uplink_packets = 0
+        self.uplink_bytes = 0
+        self.downlink_packets = 0
+        self.downlink_bytes = 0
+        self.goodbyes = []
+
+
+class DeviceSession:
+    '''
+      Control messages and the TTS reply of one device connection, the transport sends them.
+    '''
+    def __init__(self, server, transport):
+        self.server = server
+        self.transport = transport
+        self.session_id = ''
+        self.uplink_packets = 0
+        self.tts_task = None
+
+    def on_uplink(self, size):
+        self.uplink_packets += 1
+        self.server.stats.uplink_packets += 1
+        self.server.stats.uplink_bytes += size
+
+    async def handle_json(self, message):
+        message_type = message.get('type')
+        if message_type == 'hello':
+            # Session setup on a real server, messages behind the hello wait in order
+            await asyncio.sleep(self.server.args.hello_delay_ms / 1000)
+            self.cancel_tts()
+            self.session_id = str(uuid.uuid4())
+            hello = {
+                'type': 'hello',
+                'session_id': self.session_id,
+                'audio_params': {
+                    'format': 'opus',
+                    'sample_rate': 16000,
+                    'channels': 1,
+                    'frame_duration': self.server.args.frame_duration,
+                },
+            }
+            hello.update(self.transport.hello_params())
+            await self.transport.send_json(hello)
+        elif message_type == 'ping':
+            await self.transport.send_json({'session_id': self.session_id, 'type': 'pong', 'timestamp': message.get('timestamp')})
+        elif message_type == 'listen':
+            state = message.get('state')
+            if state == 'start':
+                self.uplink_packets = 0
+            elif state == 'stop':
+                self.server.stats.sessions += 1
+                self.tts_task = asyncio.create_task(self.speak())
+        elif message_type == 'abort':
+            self.cancel_tts()
+        elif message_type == 'goodbye':
+            self.cancel_tts()
+            self.server.stats.goodbyes.append(message.get('stats', {}))
+            self.transport.close_session()
+
+    async def speak(self):
+        args = self.server.args
+        await asyncio.sleep(args.response_delay_ms / 1000)
+        await self.transport.send_json({'session_id': self.session_id, 'type': 'stt', 'text': f'{self.uplink_packets} packets received'})
+        await self.transport.send_json({'session_id': self.session_id, 'type': 'tts', 'state': 'start'})
+        await self.transport.send_json({'session_id': self.session_id, 'type': 'tts', 'state': 'sentence_start', 'text': 'simulated reply'})
+        # Send a few frames ahead like a real server, then keep real time pace
+        start_time = time.monotonic()
+        frame_seconds = args.frame_duration / 1000
+        for i, packet in enumerate(self.server.tts_packets):
+            send_at = start_time + max(0, i - args.prebuffer_frames) * frame_seconds
+            delay = send_at - time.monotonic()
+            if delay > 0:
+                await asyncio.sleep(delay)
+            size = await self.transport.send_audio(packet, i * args.frame_duration)
+            self.server.stats.downlink_packets += 1
+            self.server.stats.downlink_bytes += size
+        await self.transport.send_json({'session_id': self.session_id, 'type': 'tts', 'state': 'stop'})
+
+    def cancel_tts(self):
+        if self.tts_task:
+            self.tts_task.cancel()
+            self.tts_task = None
+
+
+class WebsocketTransport:
+    def __init__(self, websocket, headers):
+        self.websocket = websocket
+        self.version = int(headers.get('protocol-version', '1'))
+
+    def hello_params(self):
+        return {'transport': 'websocket', 'features': {'ping': True, 'early_data': True}}
+
+    async def send_json(self, message):
+        await self.websocket.send(json.dumps(message))
+
+    async def send_audio(self, packet, timestamp):
+        data = pack_audio(self.version, packet, timestamp)
+        await self.websocket.send(data)
+        return len(data)
+
+    def close_session(self):
+        pass
+
+
+class MqttTransport:
+    '''
+      One MQTT client connection, every hello on it starts a UDP session with a new key.
+    '''
+    def __init__(self, server, reader, writer):
+        self.server = server
+        self.reader = reader
+        self.writer = writer
+        self.client_id = ''
+        self.session = DeviceSession(server, self)
+        self.ssrc = None
+        self.key = None
+        self.sequence = 0
+        self.udp_address = None
+
+    async def run(self):
+        header, body = await self.read_packet()
+        if header >> 4 != 1:
+            return
+        self.parse_connect(body)
+        self.writer.write(bytes([0x20, 2, 0, 0]))
+        await self.writer.drain()
+        try:
+            while True:
+                header, body = await self.read_packet()
+                packet_type = header >> 4
+                if packet_type == 3:
+                    topic_size = struct.unpack_from('!H', body)[0]
+                    # QoS 1 and 2 carry a packet id behind the topic
+                    offset = 2 + topic_size + (2 if header & 0x06 else 0)
+                    await self.session.handle_json(json.loads(body[offset:]))
+                elif packet_type == 8:
+                    self.writer.write(bytes([0x90, 3]) + body[:2] + b'\x00')
+                elif packet_type == 12:
+                    self.writer.write(bytes([0xD0, 0]))
+                elif packet_type == 14:
+                    break
+        finally:
+            self.session.cancel_tts()
+            self.close_session()
+
+    def parse_connect(self, body):
+        offset = 2 + struct.unpack_from('!H', body)[0]
+        offset += 4
+        size = struct.unpack_from('!H', body, offset)[0]
+        self.client_id = body[offset + 2:offset + 2 + size].decode('utf-8')
+
+    async def read_packet(self):
+        header = (await self.reader.readexactly(1))[0]
+        length = 0
+        shift = 0
+        while True:
+            digit = (await self.reader.readexactly(1))[0]
+            length |= (digit & 0x7F) << shift
+            shift += 7
+            if not digit & 0x80:
+                break
+        body = await self.reader.readexactly(length) if length else b''
+        return header, body
+
+    def hello_params(self):
+        self.close_session()
+        self.ssrc = self.server.new_ssrc()
+        self.key = os.urandom(16)
+        self.sequence = 0
+        self.udp_address = None
+        self.server.udp_sessions[self.ssrc] = self
+        nonce = struct.pack(UDP_FORMAT, 1, 0, 0, self.ssrc, 0, 0)
+        return {
+            'transport': 'udp',
+            'features': {'ping': True},
+            'udp': {
+                'server': self.server.args.udp_address or self.server.args.host,
+                'port': self.server.args.udp_port,
+                'encryption': 'aes-128-ctr',
+                'key': self.key.hex(),
+                'nonce': nonce.hex(),
+            },
+        }
+
+    def close_session(self):
+        if self.ssrc is not None:
+            self.server.udp_sessions.pop(self.ssrc, None)
+            self.ssrc = None
+
+    async def send_json(self, message):
+        topic = f'devices/p2p/{self.client_id}'.encode('utf-8')
+        body = struct.pack('!H', len(topic)) + topic + json.dumps(message).encode('utf-8')
+        length = len(body)
+        header = bytearray([0x30])
+        while True:
+            digit = length & 0x7F
+            length >>= 7
+            header.append(digit | (0x80 if length else 0))
+            if not length:
+                break
+        self.writer.write(bytes(header) + body)
+        await self.writer.drain()
+
+    async def send_audio(self, packet, timestamp):
+        # The device address is known once its first uplink packet arrived
+        if self.udp_address is None or self.ssrc is None:
+            return 0
+        self.sequence += 1
+        data = pack_udp_audio(self.key, self.ssrc, packet, timestamp, self.sequence)
+        self.server.udp_transport.sendto(data, self.udp_address)
+        return len(data)
+
+
+class UdpAudioProtocol(asyncio.DatagramProtocol):
+    def __init__(self, server):
+        self.server = server
+
+    def datagram_received(self, data, address):
+        if len(data) < UDP_HEADER_SIZE or data[0] != 1:
+            return
+        ssrc = struct.unpack_from(UDP_FORMAT, data)[3]
+        transport = self.server.udp_sessions.get(ssrc)
+        if transport is None:
+            return
+        transport.udp_address = address
+        transport.session.on_uplink(len(data))
+
+
+class ReferenceServer:
+    def __init__(self, args):
+        self.args = args
+        self.stats = ServerStats()
+        self.tts_packets = read_ogg_opus_packets(args.audio)
+        self.udp_sessions = {}
+        self.udp_transport = None
+        self.next_ssrc = 0
+
+    def new_ssrc(self):
+        self.next_ssrc = (self.next_ssrc + 1) & 0xFFFFFFFF
+        return self.next_ssrc
+
+    async def handle_websocket_client(self, reader, writer):
+        try:
+            websocket, headers = await mini_websocket.accept(reader, writer)
+        except (ConnectionError, asyncio.IncompleteReadError, asyncio.LimitOverrunError):
+            return
+        self.stats.connections += 1
+        self.stats.active += 1
+        session = DeviceSession(self, WebsocketTransport(websocket, headers))
+        try:
+            while True:
+                message = await websocket.recv()
+                if isinstance(message, bytes):
+                    session.on_uplink(len(message))
+                else:
+                    await session.handle_json(json.loads(message))
+        except (mini_websocket.ConnectionClosed, ConnectionError, OSError):
+            pass
+        finally:
+            session.cancel_tts()
+            self.stats.active -= 1
+            await websocket.close()
+
+    async def handle_mqtt_client(self, reader, writer):
+        self.stats.connections += 1
+        self.stats.active += 1
+        try:
+            await MqttTransport(self, reader, writer).run()
+        except (asyncio.IncompleteReadError, ConnectionError, OSError, ValueError):
+            pass
+        finally:
+            self.stats.active -= 1
+            writer.close()
+
+    async def report(self):
+        last_up = last_down = 0
+        while True:
+            await asyncio.sleep(self.args.report_interval)
+            up = self.stats.uplink_bytes - last_up
+            down = self.stats.downlink_bytes - last_down
+            last_up, last_down = self.stats.uplink_bytes, self.stats.downlink_bytes
+            print(f'active {self.stats.active}, connections {self.stats.connections}, sessions {self.stats.sessions}, '
+                  f'uplink {up * 8 / self.args.report_interval / 1000:.1f} kbps, '
+                  f'downlink {down * 8 / self.args.report_interval / 1000:.1f} kbps, goodbyes {len(self.stats.goodbyes)}')
+
+    async def serve(self):
+        args = self.args
+        websocket_server = await asyncio.start_server(self.handle_websocket_client, args.host, args.port,
+                                                      backlog=4096, limit=1 << 20)
+        mqtt_server = await asyncio.start_server(self.handle_mqtt_client, args.host, args.mqtt_port,
+                                                 backlog=4096, limit=1 << 20)
+        self.udp_transport, _ = await asyncio.get_running_loop().create_datagram_endpoint(
+            lambda: UdpAudioProtocol(self), local_addr=(args.host, args.udp_port))
+        print(f'Reference server listening on ws://{args.host}:{args.port}, mqtt {args.host}:{args.mqtt_port}, '
+              f'udp {args.host}:{args.udp_port}, {len(self.tts_packets)} TTS packets from {args.audio}')
+        asyncio.create_task(self.report())
+        async with websocket_server, mqtt_server:
+            await asyncio.gather(websocket_server.serve_forever(), mqtt_server.serve_forever())
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Reference websocket and MQTT + UDP server stub for the fleet simulator')
+    parser.add_argument('--host', default='127.0.0.1')
+    parser.add_argument('--port', type=int, default=8000, help='Websocket port')
+    parser.add_argument('--mqtt-port', type=int, default=1883)
+    parser.add_argument('--udp-port', type=int, default=8884)
+    parser.add_argument('--udp-address', help='UDP server address handed to the devices, defaults to --host')
+    parser.add_argument('--audio', default=DEFAULT_AUDIO, help='Ogg Opus file sent as the TTS reply')
+    parser.add_argument('--frame-duration', type=int, default=60, help='Duration of one Opus packet in ms')
+    parser.add_argument('--prebuffer-frames', type=int, default=5, help='Frames sent ahead of real time')
+    parser.add_argument('--response-delay-ms', type=int, default=300, help='Simulated ASR + LLM + TTS delay')
+    parser.add_argument('--hello-delay-ms', type=int, default=0, help='Simulated session setup before the hello reply')
+    parser.add_argument('--report-interval', type=float, default=5)
+    args = parser.parse_args()
+    try:
+        asyncio.run(ReferenceServer(args).serve())
+    except KeyboardInterrupt:
+        pass
+
+
+if __name__ == '__main__':
+    main()
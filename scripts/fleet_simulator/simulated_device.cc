@@ -0,0 +1,224 @@
+#include "simulated_device.h"
+#include "websocket_protocol.h"
+#include "mqtt_protocol.h"
+
+#include <settings.h>
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <cJSON.h>
+
+#include <chrono>
+#include <cstring>
+#include <random>
+
+#define TAG "SimulatedDevice"
+
+SimulatedDevice::SimulatedDevice(int index, const SimulatorOptions& options,
+    const std::vector<std::vector<uint8_t>>& uplink_packets)
+    : device_(index), options_(options), uplink_packets_(uplink_packets) {
+}
+
+SimulatedDevice::~SimulatedDevice() {
+    Join();
+}
+
+void SimulatedDevice::Start() {
+    thread_ = std::thread([this]() {
+        HostDevice::SetCurrent(&device_);
+        Run();
+        // Timers and sockets of the protocol belong to this device, release them here
+        protocol_.reset();
+    });
+}
+
+void SimulatedDevice::Join() {
+    if (thread_.joinable()) {
+        thread_.join();
+    }
+}
+
+template <typename Condition>
+bool SimulatedDevice::RunUntil(int64_t deadline_us, Condition condition) {
+    while (!condition()) {
+        int64_t now = esp_timer_get_time();
+        if (now >= deadline_us) {
+            return false;
+        }
+        // The clock timer of Application pings while the channel is open
+        if (now >= next_ping_time_us_) {
+            next_ping_time_us_ = now + PROTOCOL_PING_INTERVAL_SECONDS * 1000000LL;
+            if (protocol_->IsAudioChannelOpened()) {
+                protocol_->SendPing();
+            }
+        }
+        device_.application().RunPending(std::min(deadline_us, next_ping_time_us_));
+    }
+    return true;
+}
+
+void SimulatedDevice::InitializeProtocol() {
+    // What the OTA config writes to NVS on a real device
+    if (options_.transport == "mqtt") {
+        Settings settings("mqtt", true);
+        settings.SetString("endpoint", options_.mqtt_endpoint);
+        settings.SetString("client_id", "GID_test@@@" + device_.mac_address() + "@@@" + device_.board().GetUuid());
+        settings.SetString("username", device_.mac_address());
+        settings.SetString("password", options_.token);
+        settings.SetString("publish_topic", options_.mqtt_publish_topic);
+        protocol_ = std::make_unique<MqttProtocol>();
+    } else {
+        Settings settings("websocket", true);
+        settings.SetString("url", options_.url);
+        settings.SetString("token", options_.token);
+        settings.SetInt("version", options_.protocol_version);
+        protocol_ = std::make_unique<WebsocketProtocol>();
+    }
+
+    protocol_->OnNetworkError([this](const std::string& message) {
+        device_.application().Schedule([this, message]() {
+            error_message_ = message;
+        });
+    });
+    protocol_->OnIncomingAudio([this](std::unique_ptr<AudioStreamPacket> packet) {
+        int64_t expected = 0;
+        first_downlink_time_us_.compare_exchange_strong(expected, esp_timer_get_time());
+    });
+    protocol_->OnAudioChannelClosed([this]() {
+        device_.application().Schedule([this]() {
+            channel_closed_ = true;
+        });
+    });
+    protocol_->OnIncomingJson([this](const cJSON* root) {
+        auto type = cJSON_GetObjectItem(root, "type");
+        auto state = cJSON_GetObjectItem(root, "state");
+        if (cJSON_IsString(type) && strcmp(type->valuestring, "tts") == 0 &&
+            cJSON_IsString(state) && strcmp(state->valuestring, "stop") == 0) {
+            device_.application().Schedule([this]() {
+                tts_stopped_ = true;
+            });
+        }
+    });
+    protocol_->Start();
+}
+
+void SimulatedDevice::Run() {
+    InitializeProtocol();
+
+    std::mt19937 random(std::random_device{}() + device_.index());
+    auto never = []() { return false; };
+    std::uniform_real_distribution<double> ramp(0, options_.ramp_seconds);
+    RunUntil(esp_timer_get_time() + (int64_t)(ramp(random) * 1000000), never);
+
+    std::uniform_real_distribution<double> think(0.5 * options_.think_time, 1.5 * options_.think_time);
+    for (int i = 0; i < options_.sessions; i++) {
+        if (RunSession()) {
+            stats_.sessions++;
+        } else {
+            stats_.failures++;
+            ESP_LOGW(TAG, "Session failed: %s", error_message_.empty() ? "timeout" : error_message_.c_str());
+        }
+        for (int connect_ms : device_.TakeConnectTimes()) {
+            stats_.connect_ms.push_back(connect_ms);
+        }
+        RunUntil(esp_timer_get_time() + (int64_t)(think(random) * 1000000), never);
+    }
+
+    stats_.bytes_sent = device_.bytes_sent();
+    stats_.bytes_received = device_.bytes_received();
+}
+
+bool SimulatedDevice::RunSession() {
+    channel_closed_ = false;
+    tts_stopped_ = false;
+    uplink_done_ = false;
+    error_message_.clear();
+    first_downlink_time_us_ = 0;
+    int64_t start_time = esp_timer_get_time();
+    int64_t deadline = start_time + (int64_t)(options_.session_timeout * 1000000);
+    auto failed = [this]() {
+        return channel_closed_ || !error_message_.empty();
+    };
+
+    // Like Application::EnsureAudioChannel, the session sends its audio right behind the hello
+    if (!protocol_->OpenAudioChannelEarly()) {
+        device_.application().RunPending(0);
+        return false;
+    }
+    stats_.open_ms.push_back((esp_timer_get_time() - start_time) / 1000);
+    next_ping_time_us_ = esp_timer_get_time() + PROTOCOL_PING_INTERVAL_SECONDS * 1000000LL;
+
+    protocol_->SendWakeWordDetected(options_.wake_word);
+    protocol_->SendStartListening(kListeningModeManualStop);
+
+    // Like the audio uplink task of Application, the packets are sent from their own thread
+    // while the main loop keeps running
+    std::atomic<bool> stop_uplink = false;
+    int first_audio_ms = -1;
+    auto uplink = StartDeviceThread("uplink", [this, &stop_uplink, &first_audio_ms, start_time]() {
+        int64_t stream_start = esp_timer_get_time();
+        for (size_t i = 0; i < uplink_packets_.size() && !stop_uplink; i++) {
+            int64_t wait_us = stream_start + i * options_.frame_duration * 1000LL - esp_timer_get_time();
+            if (wait_us > 0) {
+                std::this_thread::sleep_for(std::chrono::microseconds(wait_us));
+            }
+            auto packet = std::make_unique<AudioStreamPacket>();
+            packet->sample_rate = 16000;
+            packet->frame_duration = options_.frame_duration;
+            packet->timestamp = i * options_.frame_duration;
+            packet->enqueue_time_us = esp_timer_get_time();
+            packet->payload = uplink_packets_[i];
+            bool sent = protocol_->SendAudio(std::move(packet));
+            if (i == 0 && sent) {
+                first_audio_ms = (esp_timer_get_time() - start_time) / 1000;
+            }
+        }
+        device_.application().Schedule([this]() {
+            uplink_done_ = true;
+        });
+    });
+    RunUntil(deadline, [this, &failed]() {
+        return uplink_done_ || failed();
+    });
+    stop_uplink = true;
+    uplink.join();
+    if (first_audio_ms >= 0) {
+        stats_.first_audio_ms.push_back(first_audio_ms);
+    }
+
+    bool success = false;
+    if (!failed()) {
+        protocol_->SendStopListening();
+        int64_t stop_time = esp_timer_get_time();
+        success = RunUntil(deadline, [this, &failed]() {
+            return tts_stopped_ || failed();
+        }) && tts_stopped_;
+        if (success && first_downlink_time_us_ > 0) {
+            stats_.response_ms.push_back((first_downlink_time_us_ - stop_time) / 1000);
+        }
+    }
+
+    if (!channel_closed_) {
+        protocol_->CloseAudioChannel();
+    }
+    CollectSessionStats();
+    // Let the close callbacks and the late messages of the session run
+    device_.application().RunPending(0);
+    return success;
+}
+
+void SimulatedDevice::CollectSessionStats() {
+    auto root = cJSON_Parse(protocol_->stats().GetStatsJson().c_str());
+    if (root == nullptr) {
+        return;
+    }
+    auto rtt_samples = cJSON_GetObjectItem(root, "rtt_samples");
+    auto rtt = cJSON_GetObjectItem(root, "rtt_ms");
+    if (cJSON_IsNumber(rtt_samples) && rtt_samples->valueint > 0 && cJSON_IsNumber(rtt)) {
+        stats_.rtt_ms.push_back(rtt->valueint);
+    }
+    auto lost = cJSON_GetObjectItem(root, "lost");
+    if (cJSON_IsNumber(lost)) {
+        stats_.lost += lost->valueint;
+    }
+    cJSON_Delete(root);
+}
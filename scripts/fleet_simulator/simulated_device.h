@@ -0,0 +1,95 @@
+#ifndef _SIMULATED_DEVICE_H_
+#define _SIMULATED_DEVICE_H_
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "host_device.h"
+#include "protocol.h"
+
+struct SimulatorOptions {
+    std::string transport = "websocket";
+    std::string url = "ws://127.0.0.1:8000/";
+    std::string token;
+    int protocol_version = 1;
+    std::string mqtt_endpoint = "127.0.0.1:1883";
+    std::string mqtt_publish_topic = "device-server";
+    int devices = 10;
+    int sessions = 3;
+    int frame_duration = OPUS_FRAME_DURATION_MS;
+    std::string wake_word = "你好小智";
+    double ramp_seconds = 5;
+    double think_time = 2;
+    double session_timeout = 60;
+};
+
+struct DeviceStats {
+    int sessions = 0;
+    int failures = 0;
+    // Transport connects: TCP and the websocket upgrade, or TCP and the MQTT CONNACK
+    std::vector<int> connect_ms;
+    // OpenAudioChannelEarly, including the hello round trip unless early data is used
+    std::vector<int> open_ms;
+    // Start of the session to the first uplink audio packet handed to the transport
+    std::vector<int> first_audio_ms;
+    // "listen stop" to the first downlink audio packet
+    std::vector<int> response_ms;
+    // Smoothed RTT of each session from the protocol stats
+    std::vector<int> rtt_ms;
+    int lost = 0;
+    uint64_t bytes_sent = 0;
+    uint64_t bytes_received = 0;
+};
+
+/*
+ * One device running the firmware protocol classes on its own main loop thread.
+ *
+ * The session follows Application: OpenAudioChannelEarly, wake word and
+ * "listen start", the recorded Opus packets through SendAudio in real time
+ * from a separate uplink thread like the audio uplink task,
+ * "listen stop", the reply until "tts stop", pings every
+ * PROTOCOL_PING_INTERVAL_SECONDS while the channel is open, and
+ * CloseAudioChannel, which sends the goodbye with the session stats.
+ */
+class SimulatedDevice {
+public:
+    SimulatedDevice(int index, const SimulatorOptions& options, const std::vector<std::vector<uint8_t>>& uplink_packets);
+    ~SimulatedDevice();
+
+    void Start();
+    void Join();
+    const DeviceStats& stats() const { return stats_; }
+    const std::string& device_id() const { return device_.mac_address(); }
+    int index() const { return device_.index(); }
+
+private:
+    HostDevice device_;
+    const SimulatorOptions& options_;
+    const std::vector<std::vector<uint8_t>>& uplink_packets_;
+    std::unique_ptr<Protocol> protocol_;
+    std::thread thread_;
+    DeviceStats stats_;
+    int64_t next_ping_time_us_ = 0;
+
+    // Main loop state, set by the protocol callbacks through Schedule
+    bool channel_closed_ = false;
+    bool tts_stopped_ = false;
+    bool uplink_done_ = false;
+    std::string error_message_;
+    // Set by the receive threads
+    std::atomic<int64_t> first_downlink_time_us_ = 0;
+
+    void Run();
+    void InitializeProtocol();
+    bool RunSession();
+    void CollectSessionStats();
+    // Run the main loop until the deadline or until the condition holds
+    template <typename Condition>
+    bool RunUntil(int64_t deadline_us, Condition condition);
+};
+
+#endif // _SIMULATED_DEVICE_H_
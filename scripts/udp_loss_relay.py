@@ -0,0 +1,142 @@
+import argparse
+import random
+import select
+import socket
+import time
+
+'''
+  Lossy UDP relay for testing the MQTT + UDP audio channel.
+
+  Point the device (or a test sender) at this relay instead of the UDP server
+  from the MQTT hello; it forwards both directions and drops uplink packets with
+  a Gilbert-Elliott model, so losses come in bursts like on a real cell link.
+
+  The 16 byte packet header is not encrypted, so the relay can follow the
+  sequence numbers and report how many lost frames came back:
+
+    repeat    a copy of the packet arrived later (uplink redundancy)
+    fec       no copy arrived but the next packet did, so the server can
+              rebuild the frame from its in-band FEC
+    lost      nothing to rebuild the frame from
+'''
+
+HEADER_SIZE = 16
+
+
+class LossModel:
+    '''Two state loss model, the bad state drops every packet'''
+
+    def __init__(self, loss_percent, mean_burst):
+        loss = loss_percent / 100
+        self.leave_bad = 1 / max(mean_burst, 1)
+        # Stationary loss = enter_bad / (enter_bad + leave_bad)
+        self.enter_bad = loss * self.leave_bad / (1 - loss) if loss < 1 else 1
+        self.bad = False
+
+    def drop(self):
+        if self.bad:
+            self.bad = random.random() >= self.leave_bad
+        else:
+            self.bad = random.random() < self.enter_bad
+        return self.bad
+
+
+class SequenceTracker:
+    def __init__(self):
+        self.first_seen = {}
+        self.delivered = {}
+        self.packets = 0
+        self.dropped = 0
+
+    def on_packet(self, sequence, delivered):
+        self.packets += 1
+        if not delivered:
+            self.dropped += 1
+        if sequence not in self.first_seen:
+            self.first_seen[sequence] = delivered
+            self.delivered[sequence] = 'original' if delivered else None
+        elif delivered and self.delivered[sequence] is None:
+            self.delivered[sequence] = 'repeat'
+
+    def report(self):
+        sequences = sorted(self.first_seen)
+        # The newest frames may still get a repeat or a successor, leave them out
+        sequences = sequences[:-3]
+        frames = len(sequences)
+        lost_originals = sum(1 for s in sequences if not self.first_seen[s])
+        repeat = sum(1 for s in sequences if self.delivered[s] == 'repeat')
+        fec = sum(1 for s in sequences if self.delivered[s] is None and self.delivered.get(s + 1) is not None)
+        lost = lost_originals - repeat - fec
+        return {
+            'frames': frames,
+            'packets': self.packets,
+            'dropped_packets': self.dropped,
+            'lost_originals': lost_originals,
+            'recovered_repeat': repeat,
+            'recovered_fec': fec,
+            'unrecovered': lost,
+        }
+
+
+def format_report(stats):
+    frames = max(stats['frames'], 1)
+    lost = max(stats['lost_originals'], 1)
+    return (f"{stats['frames']} frames, {stats['packets']} packets ({stats['dropped_packets']} dropped), "
+            f"original loss {100 * stats['lost_originals'] / frames:.1f}%, "
+            f"recovered by repeat {100 * stats['recovered_repeat'] / lost:.1f}%, "
+            f"by fec {100 * stats['recovered_fec'] / lost:.1f}%, "
+            f"residual loss {100 * stats['unrecovered'] / frames:.2f}%")
+
+
+def run(args):
+    listen = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    listen.bind((args.host, args.port))
+    upstream = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    server = (args.server_host, args.server_port)
+    uplink_loss = LossModel(args.loss, args.burst)
+    downlink_loss = LossModel(args.downlink_loss, args.burst)
+    tracker = SequenceTracker()
+    device = None
+    print(f'Relaying udp://{args.host}:{args.port} -> udp://{args.server_host}:{args.server_port}, '
+          f'uplink loss {args.loss}%, downlink loss {args.downlink_loss}%, mean burst {args.burst} packets')
+
+    last_report = time.monotonic()
+    try:
+        while True:
+            readable, _, _ = select.select([listen, upstream], [], [], 1)
+            for sock in readable:
+                data, address = sock.recvfrom(4096)
+                if sock is listen:
+                    device = address
+                    delivered = not uplink_loss.drop()
+                    if len(data) >= HEADER_SIZE and data[0] == 0x01:
+                        tracker.on_packet(int.from_bytes(data[12:16], 'big'), delivered)
+                    if delivered:
+                        upstream.sendto(data, server)
+                elif device is not None and not downlink_loss.drop():
+                    listen.sendto(data, device)
+            if time.monotonic() - last_report >= args.report_interval and tracker.packets > 0:
+                last_report = time.monotonic()
+                print(format_report(tracker.report()))
+    except KeyboardInterrupt:
+        pass
+    if tracker.packets > 0:
+        print(format_report(tracker.report()))
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Lossy UDP relay for the MQTT + UDP audio channel')
+    parser.add_argument('--host', default='0.0.0.0')
+    parser.add_argument('--port', type=int, default=8884, help='Port the device sends to')
+    parser.add_argument('--server-host', required=True, help='UDP server from the MQTT hello')
+    parser.add_argument('--server-port', type=int, required=True)
+    parser.add_argument('--loss', type=float, default=5, help='Uplink loss in percent')
+    parser.add_argument('--downlink-loss', type=float, default=0, help='Downlink loss in percent')
+    parser.add_argument('--burst', type=float, default=1.5, help='Mean number of packets lost in a row')
+    parser.add_argument('--report-interval', type=float, default=10)
+    args = parser.parse_args()
+    run(args)
+
+
+if __name__ == '__main__':
+    main()